@@ -4,8 +4,11 @@
 
 #include "bench.h"
 
+#include "chain.h"
+#include "chainparams.h"
 #include "crypto/sha256.h"
 #include "key.h"
+#include "pubkey.h"
 #include "validation.h"
 #include "util.h"
 #include "random.h"
@@ -16,10 +19,28 @@ main(int argc, char** argv)
     SHA256AutoDetect();
     RandomInit();
     ECC_Start();
+    ECCVerifyHandle verifyHandle;
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
 
+    // Block assembly needs chain parameters and a tip to build on; a bare
+    // regtest genesis index is enough as long as no template is checked with
+    // TestBlockValidity.
+    SelectParams(CBaseChainParams::REGTEST);
+    const CBlock& genesis = Params().GenesisBlock();
+    const uint256 hashGenesis = genesis.GetHash();
+    CBlockIndex indexGenesis(genesis);
+    indexGenesis.phashBlock = &hashGenesis;
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(&indexGenesis);
+    }
+
     benchmark::BenchRunner::RunAll();
 
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(nullptr);
+    }
     ECC_Stop();
 }
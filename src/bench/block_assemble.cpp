@@ -0,0 +1,170 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparams.h"
+#include "miner.h"
+#include "policy/policy.h"
+#include "random.h"
+#include "rpc/mining.h"
+#include "txmempool.h"
+#include "util.h"
+#include "validation.h"
+
+#include <memory>
+#include <vector>
+
+/**
+ * Synthetic mempool contents in topological order, in groups of 25 that
+ * stay within the default package limits: a long chain, a parent fanning out
+ * to 24 children, and 12 CPFP pairs of a cheap parent and a generous child.
+ */
+static void CreateTxs(size_t nTxs, std::vector<CTransactionRef>& vtx, std::vector<CAmount>& vFees)
+{
+    FastRandomContext rng(true);
+    // Roughly the size of a transaction spending a single P2PKH output
+    CScript scriptSig = CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2);
+    vtx.clear();
+    vFees.clear();
+    uint256 root;
+    for (size_t i = 0; vtx.size() < nTxs; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = scriptSig;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        tx.vout[0].nValue = COIN;
+
+        const int nPos = i % 25;
+        const int nGroup = (i / 25) % 3;
+        CAmount nFeeRate = 1 + rng.randrange(100);
+        if (nPos == 0) {
+            root = rng.rand256();
+            tx.vin[0].prevout = COutPoint(root, 0);
+            if (nGroup == 1)
+                tx.vout.resize(24, tx.vout[0]);
+        } else if (nGroup == 0) {
+            tx.vin[0].prevout = COutPoint(vtx.back()->GetHash(), 0);
+        } else if (nGroup == 1) {
+            tx.vin[0].prevout = COutPoint(vtx[vtx.size() - nPos]->GetHash(), nPos - 1);
+        } else if (nPos % 2) {
+            tx.vin[0].prevout = COutPoint(rng.rand256(), 0);
+            nFeeRate = 1;
+        } else {
+            tx.vin[0].prevout = COutPoint(vtx.back()->GetHash(), 0);
+            nFeeRate += 100;
+        }
+        vtx.push_back(MakeTransactionRef(std::move(tx)));
+        vFees.push_back(nFeeRate * GetVirtualTransactionSize(*vtx.back()));
+    }
+}
+
+/** Add the transactions that aren't in the pool yet, parents first, and return their txids */
+static std::vector<uint256> AddTxs(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, const std::vector<CAmount>& vFees)
+{
+    std::vector<uint256> vAdded;
+    LockPoints lp;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (pool.exists(vtx[i]->GetHash()))
+            continue;
+        pool.addUnchecked(vtx[i]->GetHash(), CTxMemPoolEntry(vtx[i], vFees[i], 0, 1, false, 4, lp));
+        vAdded.push_back(vtx[i]->GetHash());
+    }
+    return vAdded;
+}
+
+static void AssembleBlock(benchmark::State& state, size_t nTxs, bool fIncremental)
+{
+    gArgs.ForceSetArg("-incrementaltemplate", fIncremental ? "1" : "0");
+    std::vector<CTransactionRef> vtx;
+    std::vector<CAmount> vFees;
+    CreateTxs(nTxs, vtx, vFees);
+    AddTxs(mempool, vtx, vFees);
+
+    BlockAssembler::Options options = BlockAssembler::DefaultOptions(Params());
+    options.fTestBlockValidity = false;
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    while (state.KeepRunning()) {
+        BlockAssembler(Params(), options).CreateNewBlock(scriptPubKey);
+    }
+    mempool.clear();
+    gArgs.ForceSetArg("-incrementaltemplate", DEFAULT_INCREMENTAL_TEMPLATE ? "1" : "0");
+}
+
+// With -incrementaltemplate, every round after the first reuses the previous
+// selection as the mempool doesn't change
+static void AssembleBlock10k(benchmark::State& state) { AssembleBlock(state, 10000, true); }
+static void AssembleBlock300k(benchmark::State& state) { AssembleBlock(state, 300000, true); }
+static void AssembleBlockFromScratch10k(benchmark::State& state) { AssembleBlock(state, 10000, false); }
+static void AssembleBlockFromScratch300k(benchmark::State& state) { AssembleBlock(state, 300000, false); }
+
+// The transactions array of getblocktemplate for a full template
+static void BlockTemplateToJSON(benchmark::State& state)
+{
+    std::vector<CTransactionRef> vtx;
+    std::vector<CAmount> vFees;
+    CreateTxs(100000, vtx, vFees);
+    AddTxs(mempool, vtx, vFees);
+
+    BlockAssembler::Options options = BlockAssembler::DefaultOptions(Params());
+    options.fTestBlockValidity = false;
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params(), options).CreateNewBlock(CScript() << OP_TRUE);
+    mempool.clear();
+    while (state.KeepRunning()) {
+        BlockTemplateTxsToJSON(*pblocktemplate, false).write();
+    }
+}
+
+// Each round connects a full block's worth of the pool and then adds the
+// mined transactions back, as if the block was disconnected again
+static void MempoolRemoveForBlock(benchmark::State& state, size_t nTxs)
+{
+    std::vector<CTransactionRef> vtx;
+    std::vector<CAmount> vFees;
+    CreateTxs(nTxs, vtx, vFees);
+    AddTxs(mempool, vtx, vFees);
+
+    BlockAssembler::Options options = BlockAssembler::DefaultOptions(Params());
+    options.fTestBlockValidity = false;
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params(), options).CreateNewBlock(CScript() << OP_TRUE);
+    std::vector<CTransactionRef> vBlockTx(pblocktemplate->block.vtx.begin() + 1, pblocktemplate->block.vtx.end());
+    while (state.KeepRunning()) {
+        mempool.removeForBlock(vBlockTx, 2);
+        mempool.UpdateTransactionsFromBlock(AddTxs(mempool, vtx, vFees));
+    }
+    mempool.clear();
+}
+
+static void MempoolRemoveForBlock10k(benchmark::State& state) { MempoolRemoveForBlock(state, 10000); }
+static void MempoolRemoveForBlock300k(benchmark::State& state) { MempoolRemoveForBlock(state, 300000); }
+
+// Each round evicts a tenth of the pool by memory usage and then adds the
+// evicted transactions back
+static void MempoolTrimToSize(benchmark::State& state, size_t nTxs)
+{
+    std::vector<CTransactionRef> vtx;
+    std::vector<CAmount> vFees;
+    CreateTxs(nTxs, vtx, vFees);
+    CTxMemPool pool;
+    AddTxs(pool, vtx, vFees);
+
+    const size_t nLimit = pool.DynamicMemoryUsage() / 10 * 9;
+    while (state.KeepRunning()) {
+        pool.TrimToSize(nLimit);
+        AddTxs(pool, vtx, vFees);
+    }
+}
+
+static void MempoolTrimToSize10k(benchmark::State& state) { MempoolTrimToSize(state, 10000); }
+static void MempoolTrimToSize300k(benchmark::State& state) { MempoolTrimToSize(state, 300000); }
+
+BENCHMARK(AssembleBlock10k);
+BENCHMARK(AssembleBlock300k);
+BENCHMARK(AssembleBlockFromScratch10k);
+BENCHMARK(AssembleBlockFromScratch300k);
+BENCHMARK(BlockTemplateToJSON);
+BENCHMARK(MempoolRemoveForBlock10k);
+BENCHMARK(MempoolRemoveForBlock300k);
+BENCHMARK(MempoolTrimToSize10k);
+BENCHMARK(MempoolTrimToSize300k);
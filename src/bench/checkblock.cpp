@@ -15,13 +15,14 @@ namespace block_bench {
 
 // These are the two major time-sinks which happen after we have fully received
 // a block off the wire, but before we can relay the block on to peers using
-// compact block relay.
+// compact block relay. The block is a Bitcoin one from before the fork, which
+// comes in the legacy serialization.
 
 static void DeserializeBlockTest(benchmark::State& state)
 {
     CDataStream stream((const char*)block_bench::block413567,
             (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
-            SER_NETWORK, PROTOCOL_VERSION);
+            SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BLOCK_LEGACY);
     char a = '\0';
     stream.write(&a, 1); // Prevent compaction
 
@@ -36,7 +37,7 @@ static void DeserializeAndCheckBlockTest(benchmark::State& state)
 {
     CDataStream stream((const char*)block_bench::block413567,
             (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
-            SER_NETWORK, PROTOCOL_VERSION);
+            SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_BLOCK_LEGACY);
     char a = '\0';
     stream.write(&a, 1); // Prevent compaction
 
@@ -47,8 +48,10 @@ static void DeserializeAndCheckBlockTest(benchmark::State& state)
         stream >> block;
         assert(stream.Rewind(sizeof(block_bench::block413567)));
 
+        // A pre-fork block has no Equihash solution, so its proof of work
+        // can't pass; everything else is checked.
         CValidationState validationState;
-        assert(CheckBlock(block, validationState, chainParams->GetConsensus()));
+        assert(CheckBlock(block, validationState, chainParams->GetConsensus(), false));
     }
 }
 
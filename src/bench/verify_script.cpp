@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "bench.h"
+#include "arith_uint256.h"
 #include "key.h"
 #if defined(HAVE_CONSENSUS_LIB)
 #include "script/bitcoinconsensus.h"
@@ -106,3 +107,125 @@ static void VerifyScriptBench(benchmark::State& state)
 }
 
 BENCHMARK(VerifyScriptBench);
+
+// Stack manipulation with signature and public key sized elements, without
+// any signature checks: measures the interpreter's stack handling.
+static void EvalScriptStackOps(benchmark::State& state)
+{
+    const std::vector<unsigned char> sig(72, 0x30), pubkey(33, 0x02);
+    CScript script;
+    for (int i = 0; i < 20; i++) {
+        script << sig << pubkey << OP_2DUP << OP_SWAP << OP_HASH160 << OP_DROP << OP_OVER << OP_TOALTSTACK;
+        script << OP_2DROP << OP_FROMALTSTACK << OP_2DROP;
+    }
+    script << OP_1;
+
+    while (state.KeepRunning()) {
+        CScriptStack stack;
+        ScriptError err;
+        bool success = EvalScript(stack, script, SCRIPT_VERIFY_MINIMALDATA, BaseSignatureChecker(), SIGVERSION_BASE, &err);
+        assert(success);
+    }
+}
+
+BENCHMARK(EvalScriptStackOps);
+
+// A consolidation transaction spending many P2PKH outputs of one key with
+// SIGHASH_ALL|SIGHASH_FORKID, as found in blocks full of such transactions.
+static CMutableTransaction BuildConsolidation(const CKey& key, unsigned int nInputs, std::vector<CAmount>& amounts)
+{
+    CPubKey pubkey = key.GetPubKey();
+    CScript scriptPubKey = CScript() << OP_DUP << OP_HASH160 << ToByteVector(pubkey.GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(nInputs);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    amounts.assign(nInputs, 1000);
+    for (unsigned int i = 0; i < nInputs; i++) {
+        tx.vin[i].prevout.hash = ArithToUint256(arith_uint256(i + 1));
+        tx.vin[i].prevout.n = i % 3;
+        tx.vout[0].nValue += amounts[i];
+    }
+    const CTransaction txConst(tx);
+    const PrecomputedTransactionData txdata(txConst);
+    const int nHashType = SIGHASH_ALL | SIGHASH_FORKID;
+    for (unsigned int i = 0; i < nInputs; i++) {
+        std::vector<unsigned char> vchSig;
+        key.Sign(SignatureHash(scriptPubKey, txConst, i, nHashType, amounts[i], SIGVERSION_BASE, &txdata), vchSig);
+        vchSig.push_back((unsigned char)nHashType);
+        tx.vin[i].scriptSig = CScript() << vchSig << ToByteVector(pubkey);
+    }
+    return tx;
+}
+
+static void ConsolidationKey(CKey& key)
+{
+    static const std::array<unsigned char, 32> vchKey = {
+        {
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2
+        }
+    };
+    key.Set(vchKey.begin(), vchKey.end(), true);
+}
+
+// Verify every input of a 500-input FORKID transaction, sharing one
+// PrecomputedTransactionData as block validation does. Each signature hash
+// then only covers the input itself, so this scales linearly in the inputs.
+static void VerifyForkIdConsolidation(benchmark::State& state)
+{
+    const int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC;
+    CKey key;
+    ConsolidationKey(key);
+    std::vector<CAmount> amounts;
+    const CTransaction tx(BuildConsolidation(key, 500, amounts));
+    const CScript& scriptPubKey = tx.vout[0].scriptPubKey;
+
+    while (state.KeepRunning()) {
+        PrecomputedTransactionData txdata(tx);
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            ScriptError err;
+            bool success = VerifyScript(tx.vin[i].scriptSig, scriptPubKey, nullptr, flags,
+                                        TransactionSignatureChecker(&tx, i, amounts[i], txdata), &err);
+            assert(err == SCRIPT_ERR_OK);
+            assert(success);
+        }
+    }
+}
+
+// Only the signature hashes of the same transaction, with and without the
+// shared precomputed hashes: without them each digest rehashes all 500
+// prevouts and sequences, which is quadratic in the number of inputs.
+static void SignatureHashForkIdConsolidation(benchmark::State& state)
+{
+    CKey key;
+    ConsolidationKey(key);
+    std::vector<CAmount> amounts;
+    const CTransaction tx(BuildConsolidation(key, 500, amounts));
+    const CScript& scriptCode = tx.vout[0].scriptPubKey;
+
+    while (state.KeepRunning()) {
+        PrecomputedTransactionData txdata(tx);
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            SignatureHash(scriptCode, tx, i, SIGHASH_ALL | SIGHASH_FORKID, amounts[i], SIGVERSION_BASE, &txdata);
+    }
+}
+
+static void SignatureHashForkIdConsolidationNoCache(benchmark::State& state)
+{
+    CKey key;
+    ConsolidationKey(key);
+    std::vector<CAmount> amounts;
+    const CTransaction tx(BuildConsolidation(key, 500, amounts));
+    const CScript& scriptCode = tx.vout[0].scriptPubKey;
+
+    while (state.KeepRunning()) {
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            SignatureHash(scriptCode, tx, i, SIGHASH_ALL | SIGHASH_FORKID, amounts[i], SIGVERSION_BASE);
+    }
+}
+
+BENCHMARK(VerifyForkIdConsolidation);
+BENCHMARK(SignatureHashForkIdConsolidation);
+BENCHMARK(SignatureHashForkIdConsolidationNoCache);
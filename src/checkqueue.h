@@ -8,6 +8,9 @@
 #include "sync.h"
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -16,7 +19,7 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,12 +28,30 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Work is kept in one deque per worker rather than a single shared one.
+  * The master hands each added batch to the next worker's deque in turn;
+  * a worker takes work from the back of its own deque and, once that is
+  * empty, steals from the front of the others'. Each deque has its own
+  * lock, so workers only contend when they steal from the same victim.
+  * The shared mutex is only taken to sleep and to wake sleeping threads.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! A worker's deque of pending verifications.
+    struct WorkQueue {
+        boost::mutex mutex;
+        std::deque<T> items;
+        //! Number of items, readable without taking the mutex.
+        std::atomic<size_t> nSize{0};
+    };
+
+    //! The per-worker deques. Worker i owns queues[i % queues.size()].
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+
+    //! Mutex to protect sleeping and waking up
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,25 +60,21 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The number of worker threads (excluding the master) that have started.
+    std::atomic<unsigned int> nWorkers;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of verifications sitting in any of the deques.
+    std::atomic<size_t> nQueued;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<size_t> nTodo;
 
     //! Whether we're shutting down.
     bool fQuit;
@@ -65,73 +82,111 @@ private:
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! The deque the next added batch goes to (only used by the master).
+    unsigned int nNextQueue;
+
+    /**
+     * Move up to nBatchSize elements out of queue q into vChecks: from the
+     * back when q is our own deque, from the front when stealing. At most
+     * half of the deque (rounded up) is taken, so that other threads can
+     * still pick up the rest.
+     */
+    bool Take(WorkQueue& q, bool fSteal, std::vector<T>& vChecks)
+    {
+        if (q.nSize.load(std::memory_order_relaxed) == 0)
+            return false;
+        boost::unique_lock<boost::mutex> lock(q.mutex);
+        size_t nNow = std::min<size_t>(nBatchSize, (q.items.size() + 1) / 2);
+        if (nNow == 0)
+            return false;
+        vChecks.resize(nNow);
+        for (size_t i = 0; i < nNow; i++) {
+            // Swap jobs out of the deque instead of copying them.
+            if (fSteal) {
+                vChecks[i].swap(q.items.front());
+                q.items.pop_front();
+            } else {
+                vChecks[i].swap(q.items.back());
+                q.items.pop_back();
+            }
+        }
+        q.nSize.store(q.items.size(), std::memory_order_relaxed);
+        nQueued -= nNow;
+        return true;
+    }
+
+    //! Find work: first in our own deque (if any), then in everyone else's.
+    bool FindWork(int nOwn, std::vector<T>& vChecks)
+    {
+        if (nOwn >= 0 && Take(*queues[nOwn], false, vChecks))
+            return true;
+        const size_t nQueues = queues.size();
+        const size_t nStart = nOwn >= 0 ? nOwn + 1 : 0;
+        for (size_t i = 0; i < nQueues; i++) {
+            size_t nVictim = (nStart + i) % nQueues;
+            if ((int)nVictim != nOwn && Take(*queues[nVictim], true, vChecks))
+                return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        const int nOwn = fMaster ? -1 : (int)(nWorkers++ % queues.size());
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
+        while (true) {
+            if (FindWork(nOwn, vChecks)) {
+                // execute work, unless a previous check already failed
+                bool fOk = fAllOk.load(std::memory_order_relaxed);
+                for (T& check : vChecks)
+                    if (fOk)
+                        fOk = check();
+                if (!fOk)
+                    fAllOk = false;
+                // Destroy the checks before reporting them as done, so the
+                // master does not return while they are still being cleaned up.
+                size_t nNow = vChecks.size();
+                vChecks.clear();
+                if (nTodo.fetch_sub(nNow) == nNow) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                // Nothing left to take; wait for the last checks still being run by workers.
+                while (nTodo != 0 && nQueued == 0)
+                    condMaster.wait(lock);
+                if (nTodo == 0) {
+                    // reset the status for new work later
+                    return fAllOk.exchange(true);
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+            } else {
+                while (nQueued == 0) {
+                    if (fQuit)
+                        return fAllOk;
+                    condWorker.wait(lock); // wait
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+        }
     }
 
 public:
     //! Mutex to ensure only one concurrent CCheckQueueControl
     boost::mutex ControlMutex;
 
-    //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    //! Create a new check queue with room for up to nQueuesIn workers without sharing deques
+    CCheckQueue(unsigned int nBatchSizeIn, unsigned int nQueuesIn = 64) :
+        nWorkers(0), nQueued(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn), nNextQueue(0)
+    {
+        queues.resize(std::max(1U, nQueuesIn));
+        for (auto& q : queues)
+            q.reset(new WorkQueue());
+    }
 
     //! Worker thread
     void Thread()
@@ -148,15 +203,26 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
+        // Count the checks before they become visible, so neither counter
+        // can drop below the number of checks actually outstanding.
         nTodo += vChecks.size();
+        nQueued += vChecks.size();
+        const unsigned int nActive = std::max(1U, std::min<unsigned int>(nWorkers, queues.size()));
+        WorkQueue& q = *queues[nNextQueue++ % nActive];
+        {
+            boost::unique_lock<boost::mutex> lock(q.mutex);
+            for (T& check : vChecks) {
+                q.items.emplace_back();
+                check.swap(q.items.back());
+            }
+            q.nSize.store(q.items.size(), std::memory_order_relaxed);
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
@@ -166,7 +232,7 @@ public:
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
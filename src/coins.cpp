@@ -7,15 +7,32 @@
 #include "consensus/consensus.h"
 #include "memusage.h"
 #include "random.h"
+#include "streams.h"
+#include "version.h"
 
 #include <assert.h>
 
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CRollingCoinsStats &statsDelta, size_t &nDirty) { nDirty = 0; return false; }
+bool CCoinsView::GetRollingStats(CRollingCoinsStats &stats) const { return false; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return 0; }
 
+size_t CCoinsView::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins) const
+{
+    size_t nFound = 0;
+    coins.resize(outpoints.size());
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        if (GetCoin(outpoints[i], coins[i])) {
+            nFound++;
+        } else {
+            coins[i].Clear();
+        }
+    }
+    return nFound;
+}
+
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
 {
     Coin coin;
@@ -24,17 +41,79 @@ bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
+size_t CCoinsViewBacked::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins) const { return base->GetCoins(outpoints, coins); }
 bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CRollingCoinsStats &statsDelta, size_t &nDirty) { return base->BatchWrite(mapCoins, hashBlock, statsDelta, nDirty); }
+bool CCoinsViewBacked::GetRollingStats(CRollingCoinsStats &stats) const { return base->GetRollingStats(stats); }
+bool CCoinsViewBacked::TracksRollingStats() const { return base->TracksRollingStats(); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
+static void CoinToMuHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin, bool fAdd)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << static_cast<uint32_t>(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    if (fAdd) {
+        muhash.Insert((const unsigned char*)ss.data(), ss.size());
+    } else {
+        muhash.Remove((const unsigned char*)ss.data(), ss.size());
+    }
+}
+
+void CRollingCoinsStats::Add(const COutPoint& outpoint, const Coin& coin)
+{
+    CoinToMuHash(muhash, outpoint, coin, true);
+    nTransactionOutputs++;
+    nBogoSize += GetBogoSize(coin.out.scriptPubKey);
+    nTotalAmount += coin.out.nValue;
+}
+
+void CRollingCoinsStats::Remove(const COutPoint& outpoint, const Coin& coin)
+{
+    CoinToMuHash(muhash, outpoint, coin, false);
+    nTransactionOutputs--;
+    nBogoSize -= GetBogoSize(coin.out.scriptPubKey);
+    nTotalAmount -= coin.out.nValue;
+}
+
+CRollingCoinsStats& CRollingCoinsStats::operator+=(const CRollingCoinsStats& other)
+{
+    muhash *= other.muhash;
+    nTransactionOutputs += other.nTransactionOutputs;
+    nBogoSize += other.nBogoSize;
+    nTotalAmount += other.nTotalAmount;
+    return *this;
+}
+
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+void CCoinsCacheStats::Reset()
+{
+    for (std::atomic<uint64_t>* counter : {&nHits, &nMisses, &nMissesFound, &nAdded, &nAddedFresh, &nSpent,
+                                           &nSpentFresh, &nUncached, &nFlushes, &nFlushedEntries, &nFlushedDirty}) {
+        counter->store(0, std::memory_order_relaxed);
+    }
+}
+
+double CCoinsCacheStats::HitRate() const
+{
+    uint64_t hits = nHits.load(std::memory_order_relaxed);
+    uint64_t lookups = hits + nMisses.load(std::memory_order_relaxed);
+    return lookups ? (double)hits / lookups : 0.0;
+}
+
+static inline void Count(std::atomic<uint64_t>& counter, uint64_t n = 1)
+{
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn, CCoinsCacheStats *pstatsIn) :
+    CCoinsViewBacked(baseIn), cachedCoinsUsage(0), fTrackStats(baseIn->TracksRollingStats()), pstats(pstatsIn ? pstatsIn : &ownStats) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -42,11 +121,15 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
 
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        Count(pstats->nHits);
         return it;
+    }
+    Count(pstats->nMisses);
     Coin tmp;
     if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
+    Count(pstats->nMissesFound);
     CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
     if (ret->second.coin.IsSpent()) {
         // The parent only has an empty entry for this outpoint; we can consider our
@@ -66,6 +149,43 @@ bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return false;
 }
 
+void CCoinsViewCache::Prefetch(const std::vector<COutPoint> &outpoints) const {
+    std::vector<COutPoint> missing;
+    for (const COutPoint& outpoint : outpoints) {
+        if (!cacheCoins.count(outpoint)) missing.push_back(outpoint);
+    }
+    if (missing.empty()) return;
+    Count(pstats->nMisses, missing.size());
+    std::vector<Coin> coins;
+    base->GetCoins(missing, coins);
+    for (size_t i = 0; i < missing.size(); i++) {
+        if (coins[i].IsSpent()) continue;
+        CCoinsMap::iterator it;
+        bool inserted;
+        std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(missing[i]), std::forward_as_tuple(std::move(coins[i])));
+        if (inserted) {
+            Count(pstats->nMissesFound);
+            cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+        }
+    }
+}
+
+size_t CCoinsViewCache::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins) const {
+    Prefetch(outpoints);
+    size_t nFound = 0;
+    coins.resize(outpoints.size());
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        CCoinsMap::const_iterator it = cacheCoins.find(outpoints[i]);
+        if (it != cacheCoins.end() && !it->second.coin.IsSpent()) {
+            coins[i] = it->second.coin;
+            nFound++;
+        } else {
+            coins[i].Clear();
+        }
+    }
+    return nFound;
+}
+
 void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possible_overwrite) {
     assert(!coin.IsSpent());
     if (coin.out.scriptPubKey.IsUnspendable()) return;
@@ -76,12 +196,30 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     if (!inserted) {
         cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
     }
-    if (!possible_overwrite) {
+    if (possible_overwrite) {
+        // The rolling stats must account for the coin being replaced, which
+        // may only be known to the base view.
+        if (fTrackStats && !inserted) {
+            if (!it->second.coin.IsSpent()) {
+                statsDelta.Remove(outpoint, it->second.coin);
+            }
+        } else if (fTrackStats) {
+            Coin replaced;
+            if (base->GetCoin(outpoint, replaced) && !replaced.IsSpent()) {
+                statsDelta.Remove(outpoint, replaced);
+            }
+        }
+    } else {
         if (!it->second.coin.IsSpent()) {
             throw std::logic_error("Adding new coin that replaces non-pruned entry");
         }
         fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
     }
+    if (fTrackStats) {
+        statsDelta.Add(outpoint, coin);
+    }
+    Count(pstats->nAdded);
+    if (fresh) Count(pstats->nAddedFresh);
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
@@ -102,10 +240,15 @@ bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
     CCoinsMap::iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) return false;
     cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    if (fTrackStats && !it->second.coin.IsSpent()) {
+        statsDelta.Remove(outpoint, it->second.coin);
+    }
     if (moveout) {
         *moveout = std::move(it->second.coin);
     }
+    Count(pstats->nSpent);
     if (it->second.flags & CCoinsCacheEntry::FRESH) {
+        Count(pstats->nSpentFresh);
         cacheCoins.erase(it);
     } else {
         it->second.flags |= CCoinsCacheEntry::DIRTY;
@@ -145,9 +288,17 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+bool CCoinsViewCache::GetRollingStats(CRollingCoinsStats &stats) const {
+    if (!fTrackStats || !base->GetRollingStats(stats)) return false;
+    stats += statsDelta;
+    return true;
+}
+
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, const CRollingCoinsStats &statsDeltaIn, size_t &nDirty) {
+    nDirty = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
+            nDirty++;
             CCoinsMap::iterator itUs = cacheCoins.find(it->first);
             if (itUs == cacheCoins.end()) {
                 // The parent cache does not have an entry, while the child does
@@ -198,13 +349,21 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
         mapCoins.erase(itOld);
     }
     hashBlock = hashBlockIn;
+    if (fTrackStats) {
+        statsDelta += statsDeltaIn;
+    }
     return true;
 }
 
 bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, hashBlock);
+    size_t nDirty = 0;
+    Count(pstats->nFlushes);
+    Count(pstats->nFlushedEntries, cacheCoins.size());
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, statsDelta, nDirty);
+    Count(pstats->nFlushedDirty, nDirty);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    statsDelta = CRollingCoinsStats();
     return fOk;
 }
 
@@ -212,6 +371,7 @@ void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
     if (it != cacheCoins.end() && it->second.flags == 0) {
+        Count(pstats->nUncached);
         cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
         cacheCoins.erase(it);
     }
@@ -9,6 +9,7 @@
 #include "primitives/transaction.h"
 #include "compressor.h"
 #include "core_memusage.h"
+#include "crypto/muhash.h"
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
@@ -17,6 +18,7 @@
 #include <assert.h>
 #include <stdint.h>
 
+#include <atomic>
 #include <unordered_map>
 
 /**
@@ -121,6 +123,49 @@ struct CCoinsCacheEntry
 
 typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
 
+//! A meaningless metric for the size of an unspent output, as reported by gettxoutsetinfo.
+static inline uint64_t GetBogoSize(const CScript& scriptPubKey)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + scriptPubKey.size() /* scriptPubKey */;
+}
+
+/**
+ * Rolling summary of a set of unspent outputs: a MuHash3072 set hash plus
+ * output count, bogosize and total amount.
+ *
+ * Additions and removals commute, so the same structure is used both for
+ * the summary of a whole UTXO set and for the change a CCoinsViewCache has
+ * made on top of its base; applying a change is a simple merge.
+ */
+class CRollingCoinsStats
+{
+public:
+    MuHash3072 muhash;
+    int64_t nTransactionOutputs;
+    int64_t nBogoSize;
+    CAmount nTotalAmount;
+
+    CRollingCoinsStats() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    //! Account for an unspent output entering the set
+    void Add(const COutPoint& outpoint, const Coin& coin);
+    //! Account for an unspent output leaving the set
+    void Remove(const COutPoint& outpoint, const Coin& coin);
+    //! Apply the changes summarized by another instance
+    CRollingCoinsStats& operator+=(const CRollingCoinsStats& other);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(muhash);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+    }
+};
+
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
 {
@@ -151,6 +196,13 @@ public:
      */
     virtual bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
 
+    /** Retrieve the coins for several outpoints at once. coins is resized to
+     *  match outpoints; entries for which no unspent coin exists are left
+     *  spent. Returns the number of unspent coins found. Views backed by a
+     *  database override this to batch the lookups.
+     */
+    virtual size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins) const;
+
     //! Just check whether a given outpoint is unspent.
     virtual bool HaveCoin(const COutPoint &outpoint) const;
 
@@ -164,8 +216,19 @@ public:
     virtual std::vector<uint256> GetHeadBlocks() const;
 
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified. statsDelta summarizes the
+    //! additions and removals represented by mapCoins. nDirty is set to the
+    //! number of dirty entries in mapCoins.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CRollingCoinsStats &statsDelta, size_t &nDirty);
+
+    //! Retrieve the rolling hash and totals of the UTXO set this view represents.
+    //! Returns false if they are not known (e.g. for a chainstate written by an
+    //! older version that has not been rescanned yet).
+    virtual bool GetRollingStats(CRollingCoinsStats &stats) const;
+
+    //! Whether caches on top of this view should track changes to the rolling
+    //! stats. Only the chainstate does, and only with -rollingutxostats.
+    virtual bool TracksRollingStats() const { return false; }
 
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
@@ -187,16 +250,46 @@ protected:
 public:
     CCoinsViewBacked(CCoinsView *viewIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CRollingCoinsStats &statsDelta, size_t &nDirty) override;
+    bool GetRollingStats(CRollingCoinsStats &stats) const override;
+    bool TracksRollingStats() const override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
 };
 
 
+/**
+ * Usage counters for one or more CCoinsViewCache instances.
+ *
+ * The counters are relaxed atomics, so they can be updated by whoever holds
+ * the lock protecting the cache and read at any time without it. Short-lived
+ * caches (per-block views, mempool acceptance views) share one instance so
+ * their activity can be inspected in aggregate.
+ */
+struct CCoinsCacheStats
+{
+    std::atomic<uint64_t> nHits{0};          //!< Lookups answered from the cache
+    std::atomic<uint64_t> nMisses{0};        //!< Lookups forwarded to the base view
+    std::atomic<uint64_t> nMissesFound{0};   //!< Misses for which the base view had the coin
+    std::atomic<uint64_t> nAdded{0};         //!< Coins added with AddCoin
+    std::atomic<uint64_t> nAddedFresh{0};    //!< Coins added as FRESH (unknown to the base view)
+    std::atomic<uint64_t> nSpent{0};         //!< Coins spent with SpendCoin
+    std::atomic<uint64_t> nSpentFresh{0};    //!< Spends that dropped a FRESH entry without any write
+    std::atomic<uint64_t> nUncached{0};      //!< Clean entries evicted by Uncache
+    std::atomic<uint64_t> nFlushes{0};       //!< Calls to Flush
+    std::atomic<uint64_t> nFlushedEntries{0}; //!< Entries evicted by Flush
+    std::atomic<uint64_t> nFlushedDirty{0};  //!< Entries passed to the base view by Flush
+
+    void Reset();
+    //! Fraction of lookups answered from the cache (0 if there were none)
+    double HitRate() const;
+};
+
 /** CCoinsView that adds a memory cache for transactions to another CCoinsView */
 class CCoinsViewCache : public CCoinsViewBacked
 {
@@ -211,15 +304,31 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Changes to the rolling UTXO set stats made by this cache relative to its base. */
+    CRollingCoinsStats statsDelta;
+    /* Whether statsDelta is kept up to date; taken from the base on construction. */
+    const bool fTrackStats;
+
+    /* Usage counters; points to ownStats unless a shared instance was passed in. */
+    CCoinsCacheStats ownStats;
+    CCoinsCacheStats *pstats;
+
 public:
-    CCoinsViewCache(CCoinsView *baseIn);
+    /**
+     * Construct a cache on top of baseIn. Usage is counted in pstatsIn if
+     * given, otherwise in counters private to this cache.
+     */
+    CCoinsViewCache(CCoinsView *baseIn, CCoinsCacheStats *pstatsIn = nullptr);
 
     // Standard CCoinsView methods
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CRollingCoinsStats &statsDeltaIn, size_t &nDirty) override;
+    bool GetRollingStats(CRollingCoinsStats &stats) const override;
+    bool TracksRollingStats() const override { return fTrackStats; }
     CCoinsViewCursor* Cursor() const override {
         throw std::logic_error("CCoinsViewCache cursor iteration not supported.");
     }
@@ -231,6 +340,12 @@ public:
      */
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
+    /**
+     * Load the given outpoints into the cache, fetching all that are not
+     * cached yet from the backing view with a single GetCoins call.
+     */
+    void Prefetch(const std::vector<COutPoint> &outpoints) const;
+
     /**
      * Return a reference to Coin in the cache, or a pruned one if not found. This is
      * more efficient than GetCoin.
@@ -275,6 +390,9 @@ public:
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
+    //! Usage counters of this cache (possibly shared with other caches)
+    CCoinsCacheStats& GetStats() const { return *pstats; }
+
     /** 
      * Amount of bitcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -5,6 +5,9 @@
 #include "merkle.h"
 #include "hash.h"
 #include "utilstrencodings.h"
+#include "crypto/sha256.h"
+
+#include <string.h>
 
 /*     WARNING! If you're reading this because you're learning about crypto
        and/or designing a new system that will use merkle trees, keep in mind
@@ -130,10 +133,73 @@ static void MerkleComputation(const std::vector<uint256>& leaves, uint256* proot
     if (proot) *proot = h;
 }
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated) {
-    uint256 hash;
-    MerkleComputation(leaves, &hash, mutated, -1, nullptr);
-    return hash;
+/** Replace right by the double-SHA256 of left and right. */
+static void HashPair(const uint256& left, uint256& right)
+{
+    unsigned char buffer[64];
+    memcpy(buffer, left.begin(), 32);
+    memcpy(buffer + 32, right.begin(), 32);
+    SHA256D64(right.begin(), buffer, 1);
+}
+
+void CMerkleAccumulator::Add(const uint256& leaf)
+{
+    uint256 h = leaf;
+    count++;
+    // Combine with the complete subtrees that are now siblings of the new
+    // leaf's subtree, as in the first loop of MerkleComputation.
+    int level;
+    for (level = 0; !(count & (((uint32_t)1) << level)); level++) {
+        mutated |= (inner[level] == h);
+        HashPair(inner[level], h);
+    }
+    inner[level] = h;
+}
+
+uint256 CMerkleAccumulator::GetRoot(bool* pmutated) const
+{
+    if (pmutated) *pmutated = mutated;
+    if (count == 0) {
+        return uint256();
+    }
+    // The final sweep of MerkleComputation, on copies of the state.
+    uint32_t n = count;
+    int level = 0;
+    while (!(n & (((uint32_t)1) << level))) {
+        level++;
+    }
+    uint256 h = inner[level];
+    while (n != (((uint32_t)1) << level)) {
+        HashPair(h, h);
+        n += (((uint32_t)1) << level);
+        level++;
+        while (!(n & (((uint32_t)1) << level))) {
+            HashPair(inner[level], h);
+            level++;
+        }
+    }
+    return h;
+}
+
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated) {
+    // Hash one level of the tree at a time, in place, so that SHA256D64 can
+    // process many pairs per call.
+    bool mutation = false;
+    while (hashes.size() > 1) {
+        if (mutated) {
+            for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+                if (hashes[pos] == hashes[pos + 1]) mutation = true;
+            }
+        }
+        if (hashes.size() & 1) {
+            hashes.push_back(hashes.back());
+        }
+        SHA256D64(hashes[0].begin(), hashes[0].begin(), hashes.size() / 2);
+        hashes.resize(hashes.size() / 2);
+    }
+    if (mutated) *mutated = mutation;
+    if (hashes.size() == 0) return uint256();
+    return hashes[0];
 }
 
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position) {
@@ -162,7 +228,7 @@ uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
     for (size_t s = 0; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s]->GetHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeMerkleRoot(std::move(leaves), mutated);
 }
 
 uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
@@ -173,7 +239,7 @@ uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
     for (size_t s = 1; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s]->GetWitnessHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeMerkleRoot(std::move(leaves), mutated);
 }
 
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position)
@@ -5,14 +5,41 @@
 #ifndef BITCOIN_MERKLE
 #define BITCOIN_MERKLE
 
+#include <algorithm>
+#include <ios>
 #include <stdint.h>
 #include <vector>
 
+#include "consensus/consensus.h"
 #include "primitives/transaction.h"
 #include "primitives/block.h"
 #include "uint256.h"
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated = nullptr);
+/**
+ * Computes the merkle root of a sequence of leaves that are added one at a
+ * time, in constant space. Gives the same root and mutation flag as
+ * ComputeMerkleRoot on the vector of all leaves.
+ */
+class CMerkleAccumulator
+{
+private:
+    //! Number of leaves added so far.
+    uint32_t count;
+    //! inner[level] is the hash of the last complete subtree of 2^level
+    //! leaves, for every bit set in count.
+    uint256 inner[32];
+    //! Whether two identical hashes were combined (CVE-2012-2459).
+    bool mutated;
+
+public:
+    CMerkleAccumulator() : count(0), mutated(false) {}
+
+    void Add(const uint256& leaf);
+    uint256 GetRoot(bool* pmutated = nullptr) const;
+    uint32_t size() const { return count; }
+};
+
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated = nullptr);
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position);
 uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint256>& branch, uint32_t position);
 
@@ -35,4 +62,44 @@ uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated = nullptr);
  */
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position);
 
+/** The merkle roots of a block's transactions, as computed while decoding it. */
+struct BlockMerkleRoots
+{
+    uint256 hashMerkleRoot;
+    bool fMutated = false;
+    uint256 hashWitnessMerkleRoot;
+};
+
+/**
+ * Deserialize a block, feeding each transaction's txid and wtxid into merkle
+ * accumulators as soon as the transaction is decoded. The roots are returned
+ * in roots, to be passed on to CheckBlock and ContextualCheckBlock along with
+ * the block; they only hold for vtx as it was decoded.
+ * Throws std::ios_base::failure on malformed data, and before decoding any
+ * transaction if the block claims more than can fit in a block.
+ */
+template <typename Stream>
+void UnserializeBlockWithMerkleRoots(Stream& s, CBlock& block, BlockMerkleRoots& roots)
+{
+    block.SetNull();
+    s >> *(CBlockHeader*)&block;
+    uint64_t nTx = ReadCompactSize(s);
+    if (nTx > MAX_BLOCK_WEIGHT / MIN_SERIALIZABLE_TRANSACTION_WEIGHT)
+        throw std::ios_base::failure("UnserializeBlockWithMerkleRoots(): size too large");
+    // Grow vtx with the data actually received, not with the claimed count.
+    block.vtx.reserve(std::min<uint64_t>(nTx, 4096));
+    CMerkleAccumulator txids;
+    CMerkleAccumulator wtxids;
+    for (uint64_t i = 0; i < nTx; i++) {
+        CTransactionRef tx;
+        s >> tx;
+        txids.Add(tx->GetHash());
+        // The witness hash of the coinbase is 0.
+        wtxids.Add(i == 0 ? uint256() : tx->GetWitnessHash());
+        block.vtx.push_back(std::move(tx));
+    }
+    roots.hashMerkleRoot = txids.GetRoot(&roots.fMutated);
+    roots.hashWitnessMerkleRoot = wtxids.GetRoot();
+}
+
 #endif
@@ -0,0 +1,113 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+class uint256;
+
+/** A class representing a number modulo 2^3072 - 1103717, stored as little-endian limbs. */
+class Num3072
+{
+private:
+    void FullReduce();
+    bool IsOverflow() const;
+    Num3072 GetInverse() const;
+
+public:
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128 double_limb_t;
+    typedef uint64_t limb_t;
+    static constexpr int LIMBS = 48;
+    static constexpr int LIMB_SIZE = 64;
+#else
+    typedef uint64_t double_limb_t;
+    typedef uint32_t limb_t;
+    static constexpr int LIMBS = 96;
+    static constexpr int LIMB_SIZE = 32;
+#endif
+    static constexpr size_t BYTE_SIZE = 384;
+
+    limb_t limbs[LIMBS];
+
+    //! Sets this to 1
+    Num3072() { SetToOne(); }
+    //! Interpret 384 little-endian bytes as a number (not necessarily reduced)
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    //! Write the fully reduced number as 384 little-endian bytes
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]);
+};
+
+/** A class representing MuHash sets.
+ *
+ * MuHash is a hashing algorithm that supports adding set elements in any
+ * order and removing them again, which makes it usable as a rolling hash of
+ * a set such as the UTXO set. Each element is hashed with SHA256, expanded
+ * to 3072 bits with ChaCha20 and interpreted as a number modulo the prime
+ * 2^3072 - 1103717. The set hash is the product of all inserted elements
+ * divided by the product of all removed ones; the (expensive) division is
+ * deferred by tracking a separate numerator and denominator until Finalize.
+ *
+ * See https://cseweb.ucsd.edu/~mihir/papers/inchash.pdf for the security
+ * argument of the construction.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    //! Create an empty set
+    MuHash3072() {}
+
+    //! Create a set containing a single element
+    MuHash3072(const unsigned char* data, size_t len);
+
+    //! Add an element to the set
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+
+    //! Remove an element from the set
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Multiply (resulting in a hash for the union of the sets)
+    MuHash3072& operator*=(const MuHash3072& mul);
+
+    //! Divide (resulting in a hash for the difference of the sets)
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Finalize into a 32-byte hash. Does not change the represented set.
+    void Finalize(uint256& out);
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        unsigned char data[Num3072::BYTE_SIZE];
+        Num3072 tmp = numerator;
+        tmp.ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+        tmp = denominator;
+        tmp.ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        unsigned char data[Num3072::BYTE_SIZE];
+        s.read((char*)data, sizeof(data));
+        numerator = Num3072(data);
+        s.read((char*)data, sizeof(data));
+        denominator = Num3072(data);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -10,13 +10,30 @@
 #include <atomic>
 
 #if defined(__x86_64__) || defined(__amd64__)
-#if defined(EXPERIMENTAL_ASM)
+#if defined(ENABLE_SHANI) || defined(ENABLE_AVX2) || defined(EXPERIMENTAL_ASM)
 #include <cpuid.h>
+#endif
+#if defined(EXPERIMENTAL_ASM)
 namespace sha256_sse4
 {
 void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
 }
 #endif
+#if defined(ENABLE_SHANI)
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
+}
+#endif
+#if defined(ENABLE_AVX2)
+namespace sha256d64_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* in);
+}
+#endif
+#else
+#undef ENABLE_SHANI
+#undef ENABLE_AVX2
 #endif
 
 // Internal implementation code.
@@ -144,6 +161,33 @@ void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
 } // namespace sha256
 
 typedef void (*TransformType)(uint32_t*, const unsigned char*, size_t);
+typedef void (*TransformD64Type)(unsigned char*, const unsigned char*);
+
+TransformType Transform = sha256::Transform;
+TransformD64Type TransformD64_8way = nullptr;
+
+/** Double-SHA256 of a single 64-byte input, using the selected Transform. */
+void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    // Padding for a 64-byte message, and for the 32-byte intermediate hash.
+    static const unsigned char pad64[64] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0};
+    uint32_t s[8];
+    unsigned char buffer[64] = {0};
+    sha256::Initialize(s);
+    Transform(s, in, 1);
+    Transform(s, pad64, 1);
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(buffer + 4 * i, s[i]);
+    }
+    buffer[32] = 0x80;
+    buffer[62] = 1;
+    sha256::Initialize(s);
+    Transform(s, buffer, 1);
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(out + 4 * i, s[i]);
+    }
+}
 
 bool SelfTest(TransformType tr) {
     static const unsigned char in1[65] = {0, 0x80};
@@ -172,23 +216,103 @@ bool SelfTest(TransformType tr) {
     return true;
 }
 
-TransformType Transform = sha256::Transform;
+/** Check the selected double-SHA256 routines against the generic transform. */
+bool SelfTestD64()
+{
+    unsigned char in[64 * 8];
+    unsigned char out[32 * 8];
+    unsigned char expected[32 * 8];
+    for (size_t i = 0; i < sizeof(in); i++) {
+        in[i] = (unsigned char)(i * 7 + 3);
+    }
+    TransformType tr = Transform;
+    Transform = sha256::Transform;
+    for (int i = 0; i < 8; i++) {
+        TransformD64(expected + 32 * i, in + 64 * i);
+    }
+    Transform = tr;
+    for (int i = 0; i < 8; i++) {
+        TransformD64(out + 32 * i, in + 64 * i);
+    }
+    if (memcmp(out, expected, sizeof(out))) return false;
+    if (TransformD64_8way) {
+        TransformD64_8way(out, in);
+        if (memcmp(out, expected, sizeof(out))) return false;
+    }
+    return true;
+}
+
+#if defined(ENABLE_AVX2)
+/** Whether the OS saves the AVX (ymm) registers on context switches. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
 
 } // namespace
 
-std::string SHA256AutoDetect()
+std::string SHA256AutoDetect(bool fForce8Way)
 {
-#if defined(EXPERIMENTAL_ASM) && (defined(__x86_64__) || defined(__amd64__))
+    std::string ret = "standard";
+    Transform = sha256::Transform;
+    TransformD64_8way = nullptr;
+#if defined(ENABLE_SHANI) || defined(ENABLE_AVX2) || defined(EXPERIMENTAL_ASM)
     uint32_t eax, ebx, ecx, edx;
-    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx >> 19) & 1) {
+    bool have_sse4 = false, have_avx = false, have_avx2 = false, have_shani = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        have_sse4 = (ecx >> 19) & 1;
+        bool have_xsave = (ecx >> 27) & 1;
+        have_avx = have_xsave && ((ecx >> 28) & 1);
+    }
+#if defined(ENABLE_SHANI) || defined(ENABLE_AVX2)
+    if (__get_cpuid_max(0, nullptr) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+#if defined(ENABLE_AVX2)
+        have_avx2 = have_avx && AVXEnabled() && ((ebx >> 5) & 1);
+#endif
+#if defined(ENABLE_SHANI)
+        have_shani = have_sse4 && ((ebx >> 29) & 1);
+#endif
+    }
+#endif
+#if defined(ENABLE_SHANI)
+    if (have_shani) {
+        Transform = sha256_shani::Transform;
+        ret = "shani(1way)";
+    }
+#endif
+#if defined(ENABLE_AVX2)
+    if (have_avx2) {
+        // A single SHA-NI stream is about as fast as eight AVX2 lanes, so
+        // only batch when the SHA extensions are missing, unless asked to.
+        // The AVX2 code is still checked whenever the CPU could run it.
+        TransformD64_8way = sha256d64_avx2::Transform_8way;
+        assert(SelfTestD64());
+        if (have_shani && !fForce8Way) {
+            TransformD64_8way = nullptr;
+        } else {
+            ret += ",avx2(8way)";
+        }
+    }
+#endif
+#if defined(EXPERIMENTAL_ASM)
+    if (!have_shani && have_sse4) {
         Transform = sha256_sse4::Transform;
-        assert(SelfTest(Transform));
-        return "sse4";
+        ret = have_avx2 ? "sse4(1way),avx2(8way)" : "sse4";
     }
 #endif
+    (void)have_avx;
+    (void)have_avx2;
+    (void)have_shani;
+#endif
+    (void)fForce8Way;
 
     assert(SelfTest(Transform));
-    return "standard";
+    assert(SelfTestD64());
+    return ret;
 }
 
 ////// SHA-256
@@ -247,3 +371,21 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+    if (TransformD64_8way) {
+        while (blocks >= 8) {
+            TransformD64_8way(out, in);
+            out += 256;
+            in += 512;
+            blocks -= 8;
+        }
+    }
+    while (blocks) {
+        TransformD64(out, in);
+        out += 32;
+        in += 64;
+        --blocks;
+    }
+}
@@ -27,8 +27,19 @@ public:
 };
 
 /** Autodetect the best available SHA256 implementation.
- *  Returns the name of the implementation.
+ *  Returns the name of the implementation. With fForce8Way, the AVX2
+ *  8-way double-SHA256 is used whenever the CPU supports it, even if the
+ *  SHA extensions would be faster (for tests).
  */
-std::string SHA256AutoDetect();
+std::string SHA256AutoDetect(bool fForce8Way = false);
+
+/** Compute multiple double-SHA256's of 64-byte blobs.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  input:   pointer to a blocks*64 byte input buffer
+ *  blocks:  the number of hashes to compute.
+ *  The output may overlap the start of the input, so that a level of a
+ *  merkle tree can be hashed in place.
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
 
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -0,0 +1,150 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Double-SHA256 of eight independent 64-byte inputs at once, one per 32-bit
+// lane of the AVX2 registers. Only called after cpuid reported AVX2.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(ENABLE_AVX2) && (defined(__x86_64__) || defined(__amd64__))
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+AVX2_TARGET inline __m256i Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+AVX2_TARGET inline __m256i Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+AVX2_TARGET inline __m256i Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+AVX2_TARGET inline __m256i And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+AVX2_TARGET inline __m256i Ror(__m256i x, int n) { return Or(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n)); }
+AVX2_TARGET inline __m256i Shr(__m256i x, int n) { return _mm256_srli_epi32(x, n); }
+
+AVX2_TARGET inline __m256i Ch(__m256i x, __m256i y, __m256i z) { return Xor(z, And(x, Xor(y, z))); }
+AVX2_TARGET inline __m256i Maj(__m256i x, __m256i y, __m256i z) { return Or(And(x, y), And(z, Or(x, y))); }
+AVX2_TARGET inline __m256i Sigma0(__m256i x) { return Xor(Xor(Ror(x, 2), Ror(x, 13)), Ror(x, 22)); }
+AVX2_TARGET inline __m256i Sigma1(__m256i x) { return Xor(Xor(Ror(x, 6), Ror(x, 11)), Ror(x, 25)); }
+AVX2_TARGET inline __m256i sigma0(__m256i x) { return Xor(Xor(Ror(x, 7), Ror(x, 18)), Shr(x, 3)); }
+AVX2_TARGET inline __m256i sigma1(__m256i x) { return Xor(Xor(Ror(x, 17), Ror(x, 19)), Shr(x, 10)); }
+
+/**
+ * Round constants plus the expanded message schedule of the block that pads
+ * a 64-byte message. That block is the same for every input, so its
+ * schedule is precomputed.
+ */
+const uint32_t PADDING_WK[64] = {
+    0xc28a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf374,
+    0x649b69c1, 0xf0fe4786, 0x0fe1edc6, 0x240cf254, 0x4fe9346f, 0x6cc984be, 0x61b9411e, 0x16f988fa,
+    0xf2c65152, 0xa88e5a6d, 0xb019fc65, 0xb9d99ec7, 0x9a1231c3, 0xe70eeaa0, 0xfdb1232b, 0xc7353eb0,
+    0x3069bad5, 0xcb976d5f, 0x5a0f118f, 0xdc1eeefd, 0x0a35b689, 0xde0b7a04, 0x58f4ca9d, 0xe15d5b16,
+    0x007f3e86, 0x37088980, 0xa507ea32, 0x6fab9537, 0x17406110, 0x0d8cd6f1, 0xcdaa3b6d, 0xc0bbbe37,
+    0x83613bda, 0xdb48a363, 0x0b02e931, 0x6fd15ca7, 0x521afaca, 0x31338431, 0x6ed41a95, 0x6d437890,
+    0xc39c91f2, 0x9eccabbd, 0xb5c9a0e6, 0x532fb63c, 0xd2c741c6, 0x07237ea3, 0xa4954b68, 0x4c191d76};
+
+/**
+ * One SHA-256 compression into state s. The message words w get overwritten
+ * by the schedule; if w is null, the precomputed padding schedule is used.
+ */
+AVX2_TARGET inline void Compress(__m256i* s, __m256i* w)
+{
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    // Fully unrolled, the variable rotation below costs no moves.
+#pragma GCC unroll 64
+    for (int i = 0; i < 64; i++) {
+        __m256i wk;
+        if (w == nullptr) {
+            wk = _mm256_set1_epi32(PADDING_WK[i]);
+        } else {
+            if (i >= 16) {
+                w[i & 15] = Add(Add(w[i & 15], sigma1(w[(i - 2) & 15])), Add(w[(i - 7) & 15], sigma0(w[(i - 15) & 15])));
+            }
+            wk = Add(_mm256_set1_epi32(K[i]), w[i & 15]);
+        }
+        __m256i t1 = Add(Add(h, Sigma1(e)), Add(Ch(e, f, g), wk));
+        __m256i t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = Add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = Add(t1, t2);
+    }
+    s[0] = Add(s[0], a);
+    s[1] = Add(s[1], b);
+    s[2] = Add(s[2], c);
+    s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e);
+    s[5] = Add(s[5], f);
+    s[6] = Add(s[6], g);
+    s[7] = Add(s[7], h);
+}
+
+/** Word i of each of the eight 64-byte inputs. */
+AVX2_TARGET inline __m256i Read8(const unsigned char* in, int i)
+{
+    return _mm256_set_epi32(ReadBE32(in + 448 + 4 * i), ReadBE32(in + 384 + 4 * i), ReadBE32(in + 320 + 4 * i), ReadBE32(in + 256 + 4 * i),
+                            ReadBE32(in + 192 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 4 * i));
+}
+
+/** Store word i of each of the eight 32-byte outputs. */
+AVX2_TARGET inline void Write8(unsigned char* out, int i, __m256i v)
+{
+    alignas(32) uint32_t lanes[8];
+    _mm256_store_si256((__m256i*)lanes, v);
+    for (int j = 0; j < 8; j++) {
+        WriteBE32(out + 32 * j + 4 * i, lanes[j]);
+    }
+}
+
+} // namespace
+
+namespace sha256d64_avx2
+{
+AVX2_TARGET void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    __m256i s[8], t[8], w[16];
+
+    // First hash: the 64-byte input, followed by a padding block for 512 bits.
+    for (int i = 0; i < 8; i++) s[i] = _mm256_set1_epi32(INIT[i]);
+    for (int i = 0; i < 16; i++) w[i] = Read8(in, i);
+    Compress(s, w);
+    Compress(s, nullptr);
+
+    // Second hash: the 32-byte first hash, padded for 256 bits.
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+        t[i] = _mm256_set1_epi32(INIT[i]);
+    }
+    w[8] = _mm256_set1_epi32(0x80000000);
+    for (int i = 9; i < 15; i++) w[i] = _mm256_setzero_si256();
+    w[15] = _mm256_set1_epi32(256);
+    Compress(t, w);
+
+    for (int i = 0; i < 8; i++) Write8(out, i, t[i]);
+}
+} // namespace sha256d64_avx2
+
+#endif
@@ -13,6 +13,8 @@
 #include <memory>
 #include <vector>
 
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 /** namespace CuckooCache provides high performance cache primitives
  *
@@ -23,6 +25,9 @@
  * 2) cache is a cache which is performant in memory usage and lookup speed. It
  * is lockfree for erase operations. Elements are lazily erased on the next
  * insert.
+ *
+ * 3) sharded_cache splits a cache into independently locked shards, so that it
+ * can be read and written from many threads at once, and counts hits.
  */
 namespace CuckooCache
 {
@@ -476,6 +481,110 @@ public:
         return false;
     }
 };
+
+/** Hit/miss counters of a sharded_cache. */
+struct cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+};
+
+/** sharded_cache spreads elements over SHARDS independent caches, each behind
+ * its own reader/writer lock.
+ *
+ * A plain cache allows concurrent contains() calls but no reads concurrent
+ * with an insert(), so its users need one external lock around every access
+ * and writers stall all readers. Here an insert only excludes the lookups
+ * that fall into the same shard. The shard is picked from the low bits of
+ * the first hash, which are independent of the high bits each shard uses to
+ * pick a slot.
+ *
+ * @tparam SHARDS should be a power of two.
+ */
+template <typename Element, typename Hash, uint32_t SHARDS = 16>
+class sharded_cache
+{
+private:
+    struct shard {
+        mutable boost::shared_mutex mutex;
+        cache<Element, Hash> table;
+        // Counted per shard, so threads working on different shards do not
+        // contend for the same counter.
+        mutable std::atomic<uint64_t> hits{0};
+        mutable std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> inserts{0};
+    };
+    std::array<shard, SHARDS> shards;
+    const Hash hash_function;
+
+    inline shard& get_shard(const Element& e)
+    {
+        return shards[hash_function.template operator()<0>(e) % SHARDS];
+    }
+    inline const shard& get_shard(const Element& e) const
+    {
+        return shards[hash_function.template operator()<0>(e) % SHARDS];
+    }
+
+public:
+    sharded_cache() : shards(), hash_function() {}
+
+    /** setup_bytes splits the given number of bytes evenly over the shards.
+     * @returns the maximum number of elements storable in all shards together
+     */
+    uint32_t setup_bytes(size_t bytes)
+    {
+        uint32_t n = 0;
+        for (shard& s : shards) {
+            boost::unique_lock<boost::shared_mutex> lock(s.mutex);
+            n += s.table.setup_bytes(bytes / SHARDS);
+        }
+        return n;
+    }
+
+    /** insert e into its shard, see cache::insert. */
+    void insert(Element e)
+    {
+        shard& s = get_shard(e);
+        s.inserts.fetch_add(1, std::memory_order_relaxed);
+        boost::unique_lock<boost::shared_mutex> lock(s.mutex);
+        s.table.insert(std::move(e));
+    }
+
+    /** contains looks e up in its shard, see cache::contains. Safe to call
+     * concurrently with any other operation except setup_bytes. */
+    bool contains(const Element& e, const bool erase) const
+    {
+        const shard& s = get_shard(e);
+        bool found;
+        {
+            boost::shared_lock<boost::shared_mutex> lock(s.mutex);
+            found = s.table.contains(e, erase);
+        }
+        (found ? s.hits : s.misses).fetch_add(1, std::memory_order_relaxed);
+        return found;
+    }
+
+    cache_stats stats() const
+    {
+        cache_stats ret{0, 0, 0};
+        for (const shard& s : shards) {
+            ret.hits += s.hits.load(std::memory_order_relaxed);
+            ret.misses += s.misses.load(std::memory_order_relaxed);
+            ret.inserts += s.inserts.load(std::memory_order_relaxed);
+        }
+        return ret;
+    }
+
+    void reset_stats()
+    {
+        for (shard& s : shards) {
+            s.hits = 0;
+            s.misses = 0;
+            s.inserts = 0;
+        }
+    }
+};
 } // namespace CuckooCache
 
 #endif
@@ -14,6 +14,8 @@
 #include <memenv.h>
 #include <stdint.h>
 #include <algorithm>
+#include <numeric>
+#include <thread>
 
 class CBitcoinLevelDBLogger : public leveldb::Logger {
 public:
@@ -182,6 +184,62 @@ std::vector<unsigned char> CDBWrapper::CreateObfuscateKey() const
 
 }
 
+/** Below this many keys per thread, spawning threads costs more than it saves. */
+static const size_t READMANY_MIN_KEYS_PER_THREAD = 64;
+
+void CDBWrapper::ReadManyRaw(const std::vector<std::string>& keys, std::vector<std::string>& values, std::vector<bool>& found, int nThreads) const
+{
+    values.resize(keys.size());
+
+    // Visit keys in database order, so neighbouring lookups share table
+    // blocks, and give each thread a contiguous key range.
+    std::vector<size_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+    leveldb::ReadOptions options = readoptions;
+    options.snapshot = pdb->GetSnapshot();
+
+    // std::vector<bool> packs bits, so let every thread report into its own slots.
+    std::vector<char> vFound(keys.size(), 0);
+    std::vector<leveldb::Status> vErrors;
+
+    auto lookup = [&](size_t begin, size_t end, leveldb::Status* error) {
+        for (size_t j = begin; j < end; j++) {
+            size_t i = order[j];
+            leveldb::Status status = pdb->Get(options, keys[i], &values[i]);
+            if (status.ok()) {
+                vFound[i] = 1;
+            } else if (!status.IsNotFound()) {
+                *error = status;
+                return;
+            }
+        }
+    };
+
+    size_t nChunks = std::max<size_t>(1, std::min<size_t>(std::max(nThreads, 1), keys.size() / READMANY_MIN_KEYS_PER_THREAD));
+    vErrors.resize(nChunks);
+    std::vector<std::thread> threads;
+    for (size_t c = 1; c < nChunks; c++) {
+        threads.emplace_back(lookup, keys.size() * c / nChunks, keys.size() * (c + 1) / nChunks, &vErrors[c]);
+    }
+    lookup(0, keys.size() / nChunks, &vErrors[0]);
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    pdb->ReleaseSnapshot(options.snapshot);
+
+    for (const leveldb::Status& status : vErrors) {
+        if (!status.ok()) {
+            LogPrintf("LevelDB read failure: %s\n", status.ToString());
+            dbwrapper_private::HandleError(status);
+        }
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+        found[i] = vFound[i];
+    }
+}
+
 bool CDBWrapper::IsEmpty()
 {
     std::unique_ptr<CDBIterator> it(NewIterator());
@@ -209,6 +209,9 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
+    //! Look up serialized keys; backend of ReadMany
+    void ReadManyRaw(const std::vector<std::string>& keys, std::vector<std::string>& values, std::vector<bool>& found, int nThreads) const;
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
@@ -247,6 +250,45 @@ public:
         return true;
     }
 
+    /**
+     * Look up several keys at once. The keys are read in database order from
+     * a single snapshot, spread over up to nThreads threads, which keeps the
+     * block cache and the disk busy when many of them miss. values[i] is only
+     * assigned if found[i] is set. Returns the number of keys found.
+     */
+    template <typename K, typename V>
+    size_t ReadMany(const std::vector<K>& keys, std::vector<V>& values, std::vector<bool>& found, int nThreads = 1) const
+    {
+        std::vector<std::string> vKeys;
+        vKeys.reserve(keys.size());
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        for (const K& key : keys) {
+            ssKey << key;
+            vKeys.emplace_back(ssKey.data(), ssKey.size());
+            ssKey.clear();
+        }
+
+        std::vector<std::string> vValues;
+        found.assign(keys.size(), false);
+        ReadManyRaw(vKeys, vValues, found, nThreads);
+
+        values.resize(keys.size());
+        size_t nFound = 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (!found[i]) continue;
+            try {
+                CDataStream ssValue(vValues[i].data(), vValues[i].data() + vValues[i].size(), SER_DISK, CLIENT_VERSION);
+                ssValue.Xor(obfuscate_key);
+                ssValue >> values[i];
+                nFound++;
+            } catch (const std::exception&) {
+                found[i] = false;
+            }
+        }
+        return nFound;
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
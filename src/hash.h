@@ -195,6 +195,31 @@ public:
     }
 };
 
+/** Writes data to an underlying stream, while hashing the written data. */
+template<typename Sink>
+class CHashedWriter : public CHashWriter
+{
+private:
+    Sink* sink;
+
+public:
+    CHashedWriter(Sink* sink_) : CHashWriter(sink_->GetType(), sink_->GetVersion()), sink(sink_) {}
+
+    void write(const char* pch, size_t nSize)
+    {
+        sink->write(pch, nSize);
+        CHashWriter::write(pch, nSize);
+    }
+
+    template<typename T>
+    CHashedWriter<Sink>& operator<<(const T& obj)
+    {
+        // Serialize to this stream
+        ::Serialize(*this, obj);
+        return (*this);
+    }
+};
+
 /** Compute the 256-bit hash of an object's serialization. */
 template<typename T>
 uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL_VERSION)
@@ -185,7 +185,15 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
-            UniValue result = tableRPC.execute(jreq);
+            RPCResultWriter writeResult;
+            UniValue result = tableRPC.execute(jreq, &writeResult);
+            if (writeResult) {
+                // Large results go out while they are being encoded
+                WriteJSONReplyStreamed(req, [&](JSONWriter& writer) {
+                    JSONRPCReply(writer, writeResult, jreq.id);
+                });
+                return true;
+            }
 
             // Send reply
             strReply = JSONRPCReply(result, NullUniValue, jreq.id);
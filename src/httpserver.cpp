@@ -545,6 +545,11 @@ HTTPRequest::~HTTPRequest()
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
+    } else if (req) {
+        // A streamed reply that was never finished; end it so that the
+        // request is released, the client will see a truncated body
+        LogPrintf("%s: Unfinished reply\n", __func__);
+        WriteReplyEnd();
     }
     // evhttpd cleans up the request, as long as a reply was sent.
 }
@@ -606,6 +611,57 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+void HTTPRequest::WriteReplyStart(int nStatus)
+{
+    assert(!replySent && req);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        std::bind(evhttp_send_reply_start, req, nStatus, (const char*)nullptr));
+    ev->trigger(0);
+    replySent = true;
+}
+
+void HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(replySent && req);
+    // Events are handled in the order they were triggered, so the pieces
+    // go out in order. An empty chunk would end a chunked body early.
+    if (strChunk.empty())
+        return;
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    struct evhttp_request* _req = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [_req, evb]() {
+        evhttp_send_reply_chunk(_req, evb);
+        evbuffer_free(evb);
+    });
+    ev->trigger(0);
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(replySent && req);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        std::bind(evhttp_send_reply_end, req));
+    ev->trigger(0);
+    req = 0; // transferred back to main thread
+}
+
+void WriteJSONReplyStreamed(HTTPRequest* req, const std::function<void(JSONWriter&)>& writeJSON)
+{
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReplyStart(HTTP_OK);
+    try {
+        JSONWriter writer([req](const std::string& chunk) { req->WriteReplyChunk(chunk); });
+        writeJSON(writer);
+        writer.Finish();
+    } catch (const std::exception& e) {
+        // Too late for an error status, the client is left with a truncated body
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    req->WriteReplyEnd();
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -17,6 +17,7 @@ struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+class JSONWriter;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -114,6 +115,25 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply whose body follows in pieces through WriteReplyChunk, for
+     * replies too large to build in memory first. HTTP/1.1 clients receive
+     * it with chunked transfer encoding.
+     *
+     * @note Write all headers before calling this. Call WriteReplyEnd once
+     * the body is complete; the destructor does so if it was cut short.
+     */
+    void WriteReplyStart(int nStatus);
+
+    /** Send the next piece of the body of a reply begun with WriteReplyStart */
+    void WriteReplyChunk(const std::string& strChunk);
+
+    /**
+     * Finish a reply begun with WriteReplyStart. As with WriteReply, do not
+     * call any other HTTPRequest methods after calling this.
+     */
+    void WriteReplyEnd();
 };
 
 /** Event handler closure.
@@ -148,6 +168,12 @@ private:
     struct event* ev;
 };
 
+/**
+ * Reply with a JSON document that writeJSON produces piece by piece, sending
+ * every piece as soon as it is ready instead of building the whole body first.
+ */
+void WriteJSONReplyStreamed(HTTPRequest* req, const std::function<void(JSONWriter&)>& writeJSON);
+
 std::string urlDecode(const std::string &urlEncoded);
 
 #endif // BITCOIN_HTTPSERVER_H
@@ -28,9 +28,12 @@
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <deque>
 #include <queue>
 #include <utility>
 
+#include <boost/bind.hpp>
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // BitcoinMiner
@@ -61,15 +64,127 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     return nNewTime - nOldTime;
 }
 
+CTemplateSelection templateSelection;
+
+bool CTemplateSelection::Key::operator==(const Key& other) const
+{
+    return pindexPrev == other.pindexPrev &&
+           nHeight == other.nHeight &&
+           nLockTimeCutoff == other.nLockTimeCutoff &&
+           nBlockMaxWeight == other.nBlockMaxWeight &&
+           nBlockMaxSize == other.nBlockMaxSize &&
+           blockMinFeeRate == other.blockMinFeeRate &&
+           fIncludeWitness == other.fIncludeWitness;
+}
+
+CTemplateSelection::CTemplateSelection() : fValid(false), nTransactionsUpdated(0), nReused(0), nRebuilt(0)
+{
+    key.pindexPrev = nullptr;
+    key.nHeight = 0;
+    key.nLockTimeCutoff = 0;
+}
+
+void CTemplateSelection::Connect(CTxMemPool& pool)
+{
+    LOCK(cs);
+    if (connAdded.connected())
+        return;
+    connAdded = pool.NotifyEntryAdded.connect(boost::bind(&CTemplateSelection::TransactionAdded, this, _1));
+    connRemoved = pool.NotifyEntryRemoved.connect(boost::bind(&CTemplateSelection::TransactionRemoved, this, _1, _2));
+}
+
+void CTemplateSelection::TransactionAdded(CTransactionRef tx)
+{
+    LOCK(cs);
+    if (!fValid)
+        return;
+    vAdded.push_back(tx->GetHash());
+    nTransactionsUpdated++;
+}
+
+void CTemplateSelection::TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    LOCK(cs);
+    if (!fValid)
+        return;
+    if (reason == MemPoolRemovalReason::BLOCK) {
+        // A new tip is coming; the selection is keyed on the old one.
+        Invalidate();
+        return;
+    }
+    if (setSelected.count(tx->GetHash())) {
+        if (stored.fBlockFull) {
+            // The space it frees could go to packages we left out.
+            Invalidate();
+            return;
+        }
+        setRemoved.insert(tx->GetHash());
+    }
+    nTransactionsUpdated++;
+}
+
+void CTemplateSelection::Invalidate()
+{
+    LOCK(cs);
+    fValid = false;
+    stored = Selection();
+    setSelected.clear();
+    setRemoved.clear();
+    vAdded.clear();
+}
+
+bool CTemplateSelection::Fetch(const CTxMemPool& pool, const Key& keyIn, Selection& selection, std::vector<uint256>& vAddedOut)
+{
+    AssertLockHeld(pool.cs);
+    LOCK(cs);
+    // Every addition and removal bumps the mempool's update counter once, so
+    // any other difference means a change we were not told about, such as a
+    // fee delta.
+    bool fReuse = fValid && keyIn == key && pool.GetTransactionsUpdated() == nTransactionsUpdated;
+    if (fReuse) {
+        selection.nMarginalFees = stored.nMarginalFees;
+        selection.nMarginalSize = stored.nMarginalSize;
+        selection.fBlockFull = stored.fBlockFull;
+        selection.vTxids.clear();
+        selection.vTxids.reserve(stored.vTxids.size());
+        for (const uint256& hash : stored.vTxids) {
+            if (!setRemoved.count(hash))
+                selection.vTxids.push_back(hash);
+        }
+        vAddedOut.swap(vAdded);
+    }
+    Invalidate();
+    return fReuse;
+}
+
+void CTemplateSelection::Store(const CTxMemPool& pool, const Key& keyIn, Selection selection, bool fReused)
+{
+    AssertLockHeld(pool.cs);
+    LOCK(cs);
+    if (fReused)
+        nReused++;
+    else
+        nRebuilt++;
+    Invalidate();
+    key = keyIn;
+    stored = std::move(selection);
+    setSelected.reserve(stored.vTxids.size());
+    setSelected.insert(stored.vTxids.begin(), stored.vTxids.end());
+    nTransactionsUpdated = pool.GetTransactionsUpdated();
+    fValid = true;
+}
+
 BlockAssembler::Options::Options() {
     blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     nBlockMaxWeight = DEFAULT_BLOCK_MAX_WEIGHT;
     nBlockMaxSize = DEFAULT_BLOCK_MAX_SIZE;
+    fTestBlockValidity = true;
 }
 
 BlockAssembler::BlockAssembler(const CChainParams& params, const Options& options) : chainparams(params)
 {
     blockMinFeeRate = options.blockMinFeeRate;
+    fTestBlockValidity = options.fTestBlockValidity;
     // Limit weight to between 4K and MAX_BLOCK_WEIGHT-4K for sanity:
     nBlockMaxWeight = std::max<size_t>(4000, std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, options.nBlockMaxWeight));
     // Limit size to between 1K and MAX_BLOCK_SERIALIZED_SIZE-1K for sanity:
@@ -78,7 +193,7 @@ BlockAssembler::BlockAssembler(const CChainParams& params, const Options& option
     fNeedSizeAccounting = (nBlockMaxSize < MAX_BLOCK_SERIALIZED_SIZE - 1000);
 }
 
-static BlockAssembler::Options DefaultOptions(const CChainParams& params)
+BlockAssembler::Options BlockAssembler::DefaultOptions(const CChainParams& params)
 {
     // Block resource limits
     // If neither -blockmaxsize or -blockmaxweight is given, limit to DEFAULT_BLOCK_MAX_*
@@ -124,6 +239,10 @@ void BlockAssembler::resetBlock()
     // These counters do not include coinbase tx
     nBlockTx = 0;
     nFees = 0;
+
+    nMarginalFees = 0;
+    nMarginalSize = 0;
+    fBlockFull = false;
 }
 
 std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx)
@@ -170,7 +289,39 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    bool fClusterOrder = mempool.GetClusterOrder();
+    bool fIncremental = !fClusterOrder && gArgs.GetBoolArg("-incrementaltemplate", DEFAULT_INCREMENTAL_TEMPLATE);
+    bool fReused = false;
+    CTemplateSelection::Key key;
+    key.pindexPrev = pindexPrev;
+    key.nHeight = nHeight;
+    key.nLockTimeCutoff = nLockTimeCutoff;
+    key.nBlockMaxWeight = nBlockMaxWeight;
+    key.nBlockMaxSize = nBlockMaxSize;
+    key.blockMinFeeRate = blockMinFeeRate;
+    key.fIncludeWitness = fIncludeWitness;
+    if (fIncremental) {
+        templateSelection.Connect(mempool);
+        fReused = addIncrementalTxs(key, nPackagesSelected);
+    } else {
+        templateSelection.Invalidate();
+    }
+    if (fClusterOrder) {
+        addChunkTxs(nPackagesSelected);
+    } else if (!fReused) {
+        addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    }
+    if (fIncremental) {
+        CTemplateSelection::Selection selection;
+        selection.vTxids.reserve(pblock->vtx.size() - 1);
+        for (size_t i = 1; i < pblock->vtx.size(); i++) {
+            selection.vTxids.push_back(pblock->vtx[i]->GetHash());
+        }
+        selection.nMarginalFees = nMarginalFees;
+        selection.nMarginalSize = nMarginalSize;
+        selection.fBlockFull = fBlockFull;
+        templateSelection.Store(mempool, key, std::move(selection), fReused);
+    }
 
     int64_t nTime1 = GetTimeMicros();
 
@@ -226,12 +377,12 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
 
     CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+    if (fTestBlockValidity && !TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
         throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
     }
     int64_t nTime2 = GetTimeMicros();
 
-    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%s, %d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), fReused ? "incremental" : "full", nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
 
     return std::move(pblocktemplate);
 }
@@ -443,6 +594,7 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
         }
 
         if (!TestPackage(packageSize, packageSigOpsCost)) {
+            fBlockFull = true;
             if (fUsingModified) {
                 // Since we always look at the best entry in mapModifiedTx,
                 // we must erase failed entries so that we can consider the
@@ -471,6 +623,10 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
 
         // Test if all tx's are Final
         if (!TestPackageTransactions(ancestors)) {
+            // Non-final transactions stay that way for this key, but the
+            // size limit is a full block
+            if (fNeedSizeAccounting)
+                fBlockFull = true;
             if (fUsingModified) {
                 mapModifiedTx.get<ancestor_score>().erase(modit);
                 failedTx.insert(iter);
@@ -492,12 +648,278 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
         }
 
         ++nPackagesSelected;
+        UpdateMarginalPackage(packageFees, packageSize);
 
         // Update transactions that depend on each of these
         nDescendantsUpdated += UpdatePackagesForAdded(ancestors, mapModifiedTx);
     }
 }
 
+void BlockAssembler::UpdateMarginalPackage(CAmount packageFees, uint64_t packageSize)
+{
+    if (nMarginalSize == 0 || (double)packageFees * nMarginalSize < (double)nMarginalFees * packageSize) {
+        nMarginalFees = packageFees;
+        nMarginalSize = packageSize;
+    }
+}
+
+// Packages are added as their transactions arrive rather than in feerate
+// order. That gives the same block as full selection as long as everything
+// fits, so anything that would have to displace a selected package, or
+// that could have been picked over one, sends us back to addPackageTxs.
+bool BlockAssembler::addIncrementalTxs(const CTemplateSelection::Key& key, int &nPackagesSelected)
+{
+    CTemplateSelection::Selection selection;
+    std::vector<uint256> vAdded;
+    if (!templateSelection.Fetch(mempool, key, selection, vAdded))
+        return false;
+
+    bool fIncludeWitnessIn = fIncludeWitness;
+    bool fSuccess = true;
+    for (const uint256& hash : selection.vTxids) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end()) {
+            fSuccess = false;
+            break;
+        }
+        AddToBlock(it);
+    }
+    nMarginalFees = selection.nMarginalFees;
+    nMarginalSize = selection.nMarginalSize;
+    fBlockFull = selection.fBlockFull;
+
+    // New transactions, then the descendants of each package we add, whose
+    // packages just got cheaper
+    std::deque<CTxMemPool::txiter> candidates;
+    for (const uint256& hash : vAdded) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it != mempool.mapTx.end())
+            candidates.push_back(it);
+    }
+
+    while (fSuccess && !candidates.empty()) {
+        CTxMemPool::txiter iter = candidates.front();
+        candidates.pop_front();
+        if (inBlock.count(iter))
+            continue;
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        onlyUnconfirmed(ancestors);
+        ancestors.insert(iter);
+
+        uint64_t packageSize = 0;
+        CAmount packageFees = 0;
+        int64_t packageSigOpsCost = 0;
+        for (CTxMemPool::txiter it : ancestors) {
+            packageSize += it->GetTxSize();
+            packageFees += it->GetModifiedFee();
+            packageSigOpsCost += it->GetSigOpCost();
+        }
+
+        if (packageFees < blockMinFeeRate.GetFee(packageSize))
+            continue;
+
+        bool fBetter = nMarginalSize == 0 || (double)packageFees * nMarginalSize > (double)nMarginalFees * packageSize;
+        if (!TestPackageTransactions(ancestors)) {
+            if (fNeedSizeAccounting) {
+                if (fBetter) {
+                    fSuccess = false;
+                    break;
+                }
+                fBlockFull = true;
+            }
+            continue;
+        }
+        if (!TestPackage(packageSize, packageSigOpsCost)) {
+            if (fBetter) {
+                fSuccess = false;
+                break;
+            }
+            fBlockFull = true;
+            continue;
+        }
+        if (fBlockFull && fBetter) {
+            fSuccess = false;
+            break;
+        }
+
+        std::vector<CTxMemPool::txiter> sortedEntries;
+        SortForBlock(ancestors, iter, sortedEntries);
+        for (size_t i=0; i<sortedEntries.size(); ++i) {
+            AddToBlock(sortedEntries[i]);
+        }
+        ++nPackagesSelected;
+        UpdateMarginalPackage(packageFees, packageSize);
+
+        for (CTxMemPool::txiter it : ancestors) {
+            for (const CTxMemPoolEntry* child : mempool.GetMemPoolChildren(it)) {
+                CTxMemPool::txiter childit = mempool.mapTx.iterator_to(*child);
+                if (!inBlock.count(childit))
+                    candidates.push_back(childit);
+            }
+        }
+    }
+
+    if (!fSuccess) {
+        pblock->vtx.resize(1);
+        pblocktemplate->vTxFees.resize(1);
+        pblocktemplate->vTxSigOpsCost.resize(1);
+        resetBlock();
+        fIncludeWitness = fIncludeWitnessIn;
+    }
+    return fSuccess;
+}
+
+// With the mempool in cluster order each cluster is already a list of
+// chunks by nonincreasing feerate, so selection is a merge of those lists
+// and nothing has to be updated as transactions are added.
+void BlockAssembler::addChunkTxs(int &nPackagesSelected)
+{
+    std::vector<CTxMemPool::Cluster> clusters;
+    mempool.GetClusters(clusters);
+
+    // Index of the next chunk of each cluster
+    std::vector<size_t> vNextChunk(clusters.size(), 0);
+    auto worse = [&](size_t a, size_t b) {
+        const CTxMemPool::Chunk& ca = clusters[a][vNextChunk[a]];
+        const CTxMemPool::Chunk& cb = clusters[b][vNextChunk[b]];
+        return (double)ca.nModFees * cb.nSize < (double)cb.nModFees * ca.nSize;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(worse)> bestChunks(worse);
+    for (size_t i = 0; i < clusters.size(); i++) {
+        bestChunks.push(i);
+    }
+
+    // Same heuristic as in addPackageTxs
+    const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
+    int64_t nConsecutiveFailed = 0;
+
+    while (!bestChunks.empty()) {
+        size_t nCluster = bestChunks.top();
+        bestChunks.pop();
+        const CTxMemPool::Chunk& chunk = clusters[nCluster][vNextChunk[nCluster]];
+
+        if (chunk.nModFees < blockMinFeeRate.GetFee(chunk.nSize)) {
+            // Everything else we might consider has a lower fee rate
+            return;
+        }
+
+        // Later chunks of a cluster may spend from this one, so a chunk that
+        // cannot be added ends its cluster.
+        if (!TestPackage(chunk.nSize, chunk.nSigOpCost)) {
+            fBlockFull = true;
+            ++nConsecutiveFailed;
+            if (nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockWeight >
+                    nBlockMaxWeight - 4000) {
+                break;
+            }
+            continue;
+        }
+
+        CTxMemPool::setEntries package(chunk.vTx.begin(), chunk.vTx.end());
+        if (!TestPackageTransactions(package)) {
+            if (fNeedSizeAccounting)
+                fBlockFull = true;
+            continue;
+        }
+
+        nConsecutiveFailed = 0;
+        for (CTxMemPool::txiter it : chunk.vTx) {
+            AddToBlock(it);
+        }
+        ++nPackagesSelected;
+        UpdateMarginalPackage(chunk.nModFees, chunk.nSize);
+
+        if (++vNextChunk[nCluster] < clusters[nCluster].size())
+            bestChunks.push(nCluster);
+    }
+}
+
+CTemplateValidator templateValidator;
+
+void CTemplateValidator::Submit(const CChainParams& chainparams, CBlockTemplate& blocktemplate, CBlockIndex* pindexPrev)
+{
+    std::unique_ptr<Job> job(new Job());
+    job->chainparams = &chainparams;
+    // getblocktemplate keeps updating the header of its copy
+    job->block = std::make_shared<const CBlock>(blocktemplate.block);
+    job->pindexPrev = pindexPrev;
+    job->check = std::make_shared<CTemplateCheck>();
+    blocktemplate.check = job->check;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        pending = std::move(job);
+    }
+    cond.notify_one();
+}
+
+void CTemplateValidator::Check(const Job& job)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    CValidationState state;
+    bool fValid;
+    {
+        LOCK(cs_main);
+        if (chainActive.Tip() != job.pindexPrev) {
+            job.check->nStatus = CTemplateCheck::STALE;
+            return;
+        }
+        fValid = TestBlockValidity(state, *job.chainparams, *job.block, job.pindexPrev, false, false);
+    }
+    LogPrint(BCLog::BENCH, "%s: %.2fms\n", __func__, 0.001 * (GetTimeMicros() - nTimeStart));
+    if (fValid) {
+        job.check->nStatus = CTemplateCheck::VALID;
+        return;
+    }
+
+    LogPrintf("%s: template on %s failed TestBlockValidity: %s\n", __func__, job.pindexPrev->GetBlockHash().ToString(), FormatStateMessage(state));
+    job.check->strRejectReason = FormatStateMessage(state);
+    job.check->nStatus = CTemplateCheck::INVALID;
+    // The selection would likely come out the same
+    templateSelection.Invalidate();
+    {
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        cvBlockChange.notify_all();
+    }
+}
+
+bool CTemplateValidator::CheckPending()
+{
+    std::unique_ptr<Job> job;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        job = std::move(pending);
+    }
+    if (!job)
+        return false;
+    Check(*job);
+    return true;
+}
+
+void CTemplateValidator::Thread()
+{
+    while (true) {
+        std::unique_ptr<Job> job;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!pending) {
+                cond.wait(lock); // interruption point
+            }
+            job = std::move(pending);
+        }
+        Check(*job);
+    }
+}
+
+void ThreadTemplateValidation()
+{
+    RenameThread("bitcoin-tmplchk");
+    templateValidator.Thread();
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -10,9 +10,15 @@
 #include "txmempool.h"
 
 #include <stdint.h>
+#include <atomic>
 #include <memory>
+#include <string>
+#include <unordered_set>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
+#include <boost/signals2/connection.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 
 class CBlockIndex;
 class CChainParams;
@@ -21,6 +27,34 @@ class CScript;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -incrementaltemplate */
+static const bool DEFAULT_INCREMENTAL_TEMPLATE = true;
+/** Default for -asynctemplatevalidation */
+static const bool DEFAULT_ASYNC_TEMPLATE_VALIDATION = false;
+
+/** Outcome of a TestBlockValidity run left to the template validator */
+class CTemplateCheck
+{
+public:
+    enum Status {
+        PENDING,
+        VALID,
+        INVALID,
+        STALE,     //!< the tip moved before the check ran
+    };
+
+    CTemplateCheck() : nStatus(PENDING) {}
+
+    Status GetStatus() const { return (Status)nStatus.load(); }
+    bool IsInvalid() const { return GetStatus() == INVALID; }
+    //! Only meaningful once the status is INVALID
+    const std::string& GetRejectReason() const { return strRejectReason; }
+
+private:
+    friend class CTemplateValidator;
+    std::atomic<int> nStatus;
+    std::string strRejectReason;
+};
 
 struct CBlockTemplate
 {
@@ -28,6 +62,8 @@ struct CBlockTemplate
     std::vector<CAmount> vTxFees;
     std::vector<int64_t> vTxSigOpsCost;
     std::vector<unsigned char> vchCoinbaseCommitment;
+    //! Set if the template was handed out before TestBlockValidity ran
+    std::shared_ptr<CTemplateCheck> check;
 };
 
 // Container for tracking updates to ancestor feerate as we include (parent)
@@ -71,7 +107,7 @@ struct modifiedentry_iter {
 // except operating on CTxMemPoolModifiedEntry.
 // TODO: refactor to avoid duplication of this logic.
 struct CompareModifiedEntry {
-    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b)
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const /*COMPAT*/
     {
         double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
         double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
@@ -86,7 +122,7 @@ struct CompareModifiedEntry {
 // This is sufficient to sort an ancestor package in an order that is valid
 // to appear in a block.
 struct CompareTxIterByAncestorCount {
-    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b)
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const /*COMPAT*/
     {
         if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
             return a->GetCountWithAncestors() < b->GetCountWithAncestors();
@@ -128,6 +164,97 @@ struct update_for_parent_inclusion
     CTxMemPool::txiter iter;
 };
 
+/**
+ * The transactions BlockAssembler last selected for a block, kept up to date
+ * with the mempool between templates. Transactions entering and leaving the
+ * mempool are only recorded as they happen; the next template applies them
+ * to the previous selection instead of running package selection over the
+ * whole mempool, so its cost follows the mempool churn since the previous
+ * template rather than the size of the mempool.
+ *
+ * Changes that could make other packages win fall back to full selection:
+ * a new tip or different assembler settings, a fee delta or any other
+ * mempool change that is not an addition or removal, a selected transaction
+ * leaving a full block, or a new package paying a higher feerate than the
+ * cheapest package selected for a full block.
+ */
+class CTemplateSelection
+{
+public:
+    /** What a selection depends on, apart from the mempool. */
+    struct Key {
+        const CBlockIndex* pindexPrev;
+        int nHeight;
+        int64_t nLockTimeCutoff;
+        uint64_t nBlockMaxWeight;
+        uint64_t nBlockMaxSize;
+        CFeeRate blockMinFeeRate;
+        bool fIncludeWitness;
+
+        bool operator==(const Key& other) const;
+    };
+
+    /** Transactions selected for a block and what is needed to extend them. */
+    struct Selection {
+        //! Selected transactions, in block order
+        std::vector<uint256> vTxids;
+        //! Fees and size of the selected package with the lowest feerate
+        CAmount nMarginalFees;
+        uint64_t nMarginalSize;
+        //! Whether some package was left out because it did not fit
+        bool fBlockFull;
+
+        Selection() : nMarginalFees(0), nMarginalSize(0), fBlockFull(false) {}
+    };
+
+    CTemplateSelection();
+
+    /** Start recording the changes of pool (once). */
+    void Connect(CTxMemPool& pool);
+
+    /**
+     * Take the stored selection for key, minus the transactions that left
+     * the mempool since, and the transactions that entered it since, in
+     * order. Returns false if the selection has to be rebuilt from scratch.
+     * The stored selection is consumed either way. Requires pool.cs.
+     */
+    bool Fetch(const CTxMemPool& pool, const Key& key, Selection& selection, std::vector<uint256>& vAdded);
+
+    /**
+     * Remember a selection made for key, and whether it was built from the
+     * previous one. Requires pool.cs.
+     */
+    void Store(const CTxMemPool& pool, const Key& key, Selection selection, bool fReused);
+
+    /** Forget the stored selection. */
+    void Invalidate();
+
+    /** Number of templates that reused or rebuilt the selection. */
+    uint64_t GetReuseCount() const { return nReused; }
+    uint64_t GetRebuildCount() const { return nRebuilt; }
+
+private:
+    void TransactionAdded(CTransactionRef tx);
+    void TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
+
+    mutable CCriticalSection cs;
+    bool fValid;
+    Key key;
+    Selection stored;
+    std::unordered_set<uint256, SaltedTxidHasher> setSelected;
+    //! Selected transactions that left the mempool since Store
+    std::unordered_set<uint256, SaltedTxidHasher> setRemoved;
+    //! Transactions that entered the mempool since Store, in order
+    std::vector<uint256> vAdded;
+    //! Mempool update counter at Store, plus one for each recorded change
+    unsigned int nTransactionsUpdated;
+    std::atomic<uint64_t> nReused;
+    std::atomic<uint64_t> nRebuilt;
+
+    boost::signals2::scoped_connection connAdded;
+    boost::signals2::scoped_connection connRemoved;
+};
+
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
 {
@@ -150,6 +277,12 @@ private:
     uint64_t nBlockSigOpsCost;
     CAmount nFees;
     CTxMemPool::setEntries inBlock;
+    // The selected package with the lowest feerate, and whether a package
+    // did not fit, for extending the selection later
+    CAmount nMarginalFees;
+    uint64_t nMarginalSize;
+    bool fBlockFull;
+    bool fTestBlockValidity;
 
     // Chain context for the block
     int nHeight;
@@ -162,11 +295,16 @@ public:
         size_t nBlockMaxWeight;
         size_t nBlockMaxSize;
         CFeeRate blockMinFeeRate;
+        //! Check the template with TestBlockValidity before returning it
+        bool fTestBlockValidity;
     };
 
     BlockAssembler(const CChainParams& params);
     BlockAssembler(const CChainParams& params, const Options& options);
 
+    /** The options set by -blockmaxweight, -blockmaxsize and -blockmintxfee */
+    static Options DefaultOptions(const CChainParams& params);
+
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
 
@@ -182,6 +320,12 @@ private:
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
       * statistics from the package selection (for logging statistics). */
     void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated);
+    /** Rebuild the previous template's selection from templateSelection and
+      * add the packages that entered the mempool since. Returns false, with
+      * the block's transactions cleared, if full selection is needed. */
+    bool addIncrementalTxs(const CTemplateSelection::Key& key, int &nPackagesSelected);
+    /** Add the mempool's cluster chunks, best feerate first. */
+    void addChunkTxs(int &nPackagesSelected);
 
     // helper functions for addPackageTxs()
     /** Remove confirmed (inBlock) entries from given set */
@@ -202,8 +346,51 @@ private:
       * state updated assuming given transactions are inBlock. Returns number
       * of updated descendants. */
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
+    /** Record a package added to the block as a candidate marginal package */
+    void UpdateMarginalPackage(CAmount packageFees, uint64_t packageSize);
 };
 
+/** The selection kept up to date for the next template (-incrementaltemplate) */
+extern CTemplateSelection templateSelection;
+
+/**
+ * Runs TestBlockValidity on templates that were handed out without it
+ * (-asynctemplatevalidation), on a thread of its own. Only the newest
+ * template waits to be checked; an older one still queued is dropped along
+ * with its check. A template that fails is marked invalid and longpolling
+ * getblocktemplate calls are woken up to replace it.
+ */
+class CTemplateValidator
+{
+public:
+    /** Queue a check of blocktemplate, built on pindexPrev, and set its check. */
+    void Submit(const CChainParams& chainparams, CBlockTemplate& blocktemplate, CBlockIndex* pindexPrev);
+
+    /** Run the queued check, if any, in the calling thread. Returns whether there was one. */
+    bool CheckPending();
+
+    /** Worker thread loop, until interrupted. */
+    void Thread();
+
+private:
+    struct Job {
+        const CChainParams* chainparams;
+        std::shared_ptr<const CBlock> block;
+        CBlockIndex* pindexPrev;
+        std::shared_ptr<CTemplateCheck> check;
+    };
+
+    void Check(const Job& job);
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::unique_ptr<Job> pending;
+};
+
+extern CTemplateValidator templateValidator;
+
+void ThreadTemplateValidation();
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
@@ -2005,6 +2005,17 @@ void CConnman::ThreadMessageHandler()
             fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
             if (flagInterruptMsgProc)
                 return;
+        }
+
+        // Admit the transactions received from all peers above as one batch
+        GetNodeSignals().ProcessTransactions(*this, flagInterruptMsgProc);
+        if (flagInterruptMsgProc)
+            return;
+
+        for (CNode* pnode : vNodesCopy)
+        {
+            if (pnode->fDisconnect)
+                continue;
 
             // Send messages
             {
@@ -22,6 +22,9 @@ static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
 static constexpr int64_t HEADERS_DOWNLOAD_TIMEOUT_BASE = 15 * 60 * 1000000; // 15 minutes
 static constexpr int64_t HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER = 1000; // 1ms/header
 
+/** Maximum number of consecutive tx messages of a peer that ProcessMessages takes in one go */
+static const unsigned int MAX_TX_MESSAGES_PER_PASS = 100;
+
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
 /** Unregister a network node */
@@ -54,6 +57,15 @@ void Misbehaving(NodeId nodeid, int howmuch);
 
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interrupt);
+/**
+ * Admit the transactions ProcessMessages received since the last call to the
+ * mempool, verifying their scripts as one batch, together with the orphans
+ * they resolve.
+ *
+ * @param[in]   connman         The connection manager for the nodes they came from.
+ * @param[in]   interrupt       Interrupt condition for processing threads
+ */
+void ProcessPendingTransactions(CConnman& connman, const std::atomic<bool>& interrupt);
 /**
  * Send queued protocol messages to be sent to a give node.
  *
@@ -78,6 +78,11 @@ private:
     const std::vector<double>& buckets;              // The upper-bound of the range for the bucket (inclusive)
     const std::map<double, unsigned int>& bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
 
+    // The moving averages below are stored divided by decayFactor, the
+    // product of the decays applied since they were last normalized. Decaying
+    // every average then only takes a multiplication of decayFactor, and
+    // recording a data point adds 1 / decayFactor.
+
     // For each bucket X:
     // Count the total # of txs in each bucket
     // Track the historical moving average of this total over blocks
@@ -85,11 +90,11 @@ private:
 
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
-    std::vector<std::vector<double>> confAvg; // confAvg[Y][X]
+    std::vector<double> confAvg; // confAvg[Y * buckets + X]
 
     // Track moving avg of txs which have been evicted from the mempool
     // after failing to be confirmed within Y blocks
-    std::vector<std::vector<double>> failAvg; // failAvg[Y][X]
+    std::vector<double> failAvg; // failAvg[Y * buckets + X]
 
     // Sum the total feerate of all tx's in each bucket
     // Track the historical moving average of this total over blocks
@@ -99,6 +104,11 @@ private:
     // Combine the total value with the tx counts to calculate the avg feerate per bucket
 
     double decay;
+    double decayFactor;
+
+    // Number of buckets and of periods covered by the flat arrays
+    size_t nBuckets;
+    unsigned int nPeriods;
 
     // Resolution (# of blocks) with which confirmations are tracked
     unsigned int scale;
@@ -106,12 +116,15 @@ private:
     // Mempool counts of outstanding transactions
     // For each bucket X, track the number of transactions in the mempool
     // that are unconfirmed for each possible confirmation value Y
-    std::vector<std::vector<int> > unconfTxs;  //unconfTxs[Y][X]
+    std::vector<int> unconfTxs;  //unconfTxs[Y * buckets + X]
     // transactions still unconfirmed after GetMaxConfirms for each bucket
     std::vector<int> oldUnconfTxs;
 
     void resizeInMemoryCounters(size_t newbuckets);
 
+    /** Fold decayFactor back into the stored averages */
+    void Normalize();
+
 public:
     /**
      * Create new TxConfirmStats. This is called by BlockPolicyEstimator's
@@ -161,7 +174,7 @@ public:
                              EstimationResult *result = nullptr) const;
 
     /** Return the max number of confirms we're tracking */
-    unsigned int GetMaxConfirms() const { return scale * confAvg.size(); }
+    unsigned int GetMaxConfirms() const { return scale * nPeriods; }
 
     /** Write state of estimation data to a file*/
     void Write(CAutoFile& fileout) const;
@@ -180,37 +193,32 @@ TxConfirmStats::TxConfirmStats(const std::vector<double>& defaultBuckets,
     : buckets(defaultBuckets), bucketMap(defaultBucketMap)
 {
     decay = _decay;
+    decayFactor = 1;
     scale = _scale;
-    confAvg.resize(maxPeriods);
-    for (unsigned int i = 0; i < maxPeriods; i++) {
-        confAvg[i].resize(buckets.size());
-    }
-    failAvg.resize(maxPeriods);
-    for (unsigned int i = 0; i < maxPeriods; i++) {
-        failAvg[i].resize(buckets.size());
-    }
+    nBuckets = buckets.size();
+    nPeriods = maxPeriods;
+    confAvg.resize(maxPeriods * nBuckets);
+    failAvg.resize(maxPeriods * nBuckets);
 
-    txCtAvg.resize(buckets.size());
-    avg.resize(buckets.size());
+    txCtAvg.resize(nBuckets);
+    avg.resize(nBuckets);
 
-    resizeInMemoryCounters(buckets.size());
+    resizeInMemoryCounters(nBuckets);
 }
 
 void TxConfirmStats::resizeInMemoryCounters(size_t newbuckets) {
     // newbuckets must be passed in because the buckets referred to during Read have not been updated yet.
-    unconfTxs.resize(GetMaxConfirms());
-    for (unsigned int i = 0; i < unconfTxs.size(); i++) {
-        unconfTxs[i].resize(newbuckets);
-    }
-    oldUnconfTxs.resize(newbuckets);
+    unconfTxs.assign(GetMaxConfirms() * newbuckets, 0);
+    oldUnconfTxs.assign(newbuckets, 0);
 }
 
 // Roll the unconfirmed txs circular buffer
 void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
+    int* row = &unconfTxs[(nBlockHeight % GetMaxConfirms()) * nBuckets];
+    for (unsigned int j = 0; j < nBuckets; j++) {
+        oldUnconfTxs[j] += row[j];
+        row[j] = 0;
     }
 }
 
@@ -222,23 +230,34 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
         return;
     int periodsToConfirm = (blocksToConfirm + scale - 1)/scale;
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    for (size_t i = periodsToConfirm; i <= confAvg.size(); i++) {
-        confAvg[i - 1][bucketindex]++;
+    const double weight = 1 / decayFactor;
+    for (size_t i = periodsToConfirm; i <= nPeriods; i++) {
+        confAvg[(i - 1) * nBuckets + bucketindex] += weight;
     }
-    txCtAvg[bucketindex]++;
-    avg[bucketindex] += val;
+    txCtAvg[bucketindex] += weight;
+    avg[bucketindex] += val * weight;
 }
 
 void TxConfirmStats::UpdateMovingAverages()
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay;
-        for (unsigned int i = 0; i < failAvg.size(); i++)
-            failAvg[i][j] = failAvg[i][j] * decay;
-        avg[j] = avg[j] * decay;
-        txCtAvg[j] = txCtAvg[j] * decay;
+    decayFactor *= decay;
+    // Keep 1 / decayFactor far from overflowing; with the default decays
+    // this happens once every few thousand blocks.
+    if (decayFactor < 1e-100)
+        Normalize();
+}
+
+void TxConfirmStats::Normalize()
+{
+    for (double& val : confAvg)
+        val *= decayFactor;
+    for (double& val : failAvg)
+        val *= decayFactor;
+    for (unsigned int j = 0; j < nBuckets; j++) {
+        avg[j] *= decayFactor;
+        txCtAvg[j] *= decayFactor;
     }
+    decayFactor = 1;
 }
 
 // returns -1 on error conditions
@@ -273,7 +292,7 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int bestFarBucket = startbucket;
 
     bool foundAnswer = false;
-    unsigned int bins = unconfTxs.size();
+    unsigned int bins = GetMaxConfirms();
     bool newBucketRange = true;
     bool passing = true;
     EstimatorBucket passBucket;
@@ -286,11 +305,11 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
             newBucketRange = false;
         }
         curFarBucket = bucket;
-        nConf += confAvg[periodTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
-        failNum += failAvg[periodTarget - 1][bucket];
+        nConf += confAvg[(periodTarget - 1) * nBuckets + bucket] * decayFactor;
+        totalNum += txCtAvg[bucket] * decayFactor;
+        failNum += failAvg[(periodTarget - 1) * nBuckets + bucket] * decayFactor;
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
-            extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
+            extraNum += unconfTxs[((nBlockHeight - confct) % bins) * nBuckets + bucket];
         extraNum += oldUnconfTxs[bucket];
         // If we have enough transaction data points in this range of buckets,
         // we can test for success
@@ -346,13 +365,13 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int minBucket = std::min(bestNearBucket, bestFarBucket);
     unsigned int maxBucket = std::max(bestNearBucket, bestFarBucket);
     for (unsigned int j = minBucket; j <= maxBucket; j++) {
-        txSum += txCtAvg[j];
+        txSum += txCtAvg[j] * decayFactor;
     }
     if (foundAnswer && txSum != 0) {
         txSum = txSum / 2;
         for (unsigned int j = minBucket; j <= maxBucket; j++) {
-            if (txCtAvg[j] < txSum)
-                txSum -= txCtAvg[j];
+            if (txCtAvg[j] * decayFactor < txSum)
+                txSum -= txCtAvg[j] * decayFactor;
             else { // we're in the right bucket
                 median = avg[j] / txCtAvg[j];
                 break;
@@ -394,14 +413,32 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     return median;
 }
 
+/** Apply the decay that is still pending on stored averages */
+static std::vector<double> Decayed(std::vector<double> vals, double factor)
+{
+    for (double& val : vals)
+        val *= factor;
+    return vals;
+}
+
+/** Split a flat [period][bucket] array into rows of nBuckets, as stored on disk */
+static std::vector<std::vector<double>> ToRows(const std::vector<double>& flat, size_t nBuckets)
+{
+    std::vector<std::vector<double>> rows;
+    for (size_t i = 0; i + nBuckets <= flat.size() && nBuckets; i += nBuckets) {
+        rows.emplace_back(flat.begin() + i, flat.begin() + i + nBuckets);
+    }
+    return rows;
+}
+
 void TxConfirmStats::Write(CAutoFile& fileout) const
 {
     fileout << decay;
     fileout << scale;
-    fileout << avg;
-    fileout << txCtAvg;
-    fileout << confAvg;
-    fileout << failAvg;
+    fileout << Decayed(avg, decayFactor);
+    fileout << Decayed(txCtAvg, decayFactor);
+    fileout << ToRows(Decayed(confAvg, decayFactor), nBuckets);
+    fileout << ToRows(Decayed(failAvg, decayFactor), nBuckets);
 }
 
 void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets)
@@ -410,6 +447,7 @@ void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets
     // buckets and bucketMap are not updated yet, so don't access them
     // If there is a read failure, we'll just discard this entire object anyway
     size_t maxConfirms, maxPeriods;
+    std::vector<std::vector<double>> confRows, failRows;
 
     // The current version will store the decay with each individual TxConfirmStats and also keep a scale factor
     if (nFileVersion >= 149900) {
@@ -428,34 +466,41 @@ void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets
     if (txCtAvg.size() != numBuckets) {
         throw std::runtime_error("Corrupt estimates file. Mismatch in tx count bucket count");
     }
-    filein >> confAvg;
-    maxPeriods = confAvg.size();
+    filein >> confRows;
+    maxPeriods = confRows.size();
     maxConfirms = scale * maxPeriods;
 
     if (maxConfirms <= 0 || maxConfirms > 6 * 24 * 7) { // one week
         throw std::runtime_error("Corrupt estimates file.  Must maintain estimates for between 1 and 1008 (one week) confirms");
     }
     for (unsigned int i = 0; i < maxPeriods; i++) {
-        if (confAvg[i].size() != numBuckets) {
+        if (confRows[i].size() != numBuckets) {
             throw std::runtime_error("Corrupt estimates file. Mismatch in feerate conf average bucket count");
         }
     }
 
     if (nFileVersion >= 149900) {
-        filein >> failAvg;
-        if (maxPeriods != failAvg.size()) {
+        filein >> failRows;
+        if (maxPeriods != failRows.size()) {
             throw std::runtime_error("Corrupt estimates file. Mismatch in confirms tracked for failures");
         }
         for (unsigned int i = 0; i < maxPeriods; i++) {
-            if (failAvg[i].size() != numBuckets) {
+            if (failRows[i].size() != numBuckets) {
                 throw std::runtime_error("Corrupt estimates file. Mismatch in one of failure average bucket counts");
             }
         }
     } else {
-        failAvg.resize(confAvg.size());
-        for (unsigned int i = 0; i < failAvg.size(); i++) {
-            failAvg[i].resize(numBuckets);
-        }
+        failRows.assign(maxPeriods, std::vector<double>(numBuckets));
+    }
+
+    nBuckets = numBuckets;
+    nPeriods = maxPeriods;
+    decayFactor = 1;
+    confAvg.clear();
+    failAvg.clear();
+    for (unsigned int i = 0; i < maxPeriods; i++) {
+        confAvg.insert(confAvg.end(), confRows[i].begin(), confRows[i].end());
+        failAvg.insert(failAvg.end(), failRows[i].begin(), failRows[i].end());
     }
 
     // Resize the current block variables which aren't stored in the data file
@@ -469,8 +514,8 @@ void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    unsigned int blockIndex = nBlockHeight % unconfTxs.size();
-    unconfTxs[blockIndex][bucketindex]++;
+    unsigned int blockIndex = nBlockHeight % GetMaxConfirms();
+    unconfTxs[blockIndex * nBuckets + bucketindex]++;
     return bucketindex;
 }
 
@@ -485,7 +530,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         return;  //This can't happen because we call this with our best seen height, no entries can have higher
     }
 
-    if (blocksAgo >= (int)unconfTxs.size()) {
+    if (blocksAgo >= (int)GetMaxConfirms()) {
         if (oldUnconfTxs[bucketindex] > 0) {
             oldUnconfTxs[bucketindex]--;
         } else {
@@ -494,9 +539,9 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         }
     }
     else {
-        unsigned int blockIndex = entryHeight % unconfTxs.size();
-        if (unconfTxs[blockIndex][bucketindex] > 0) {
-            unconfTxs[blockIndex][bucketindex]--;
+        unsigned int blockIndex = entryHeight % GetMaxConfirms();
+        if (unconfTxs[blockIndex * nBuckets + bucketindex] > 0) {
+            unconfTxs[blockIndex * nBuckets + bucketindex]--;
         } else {
             LogPrint(BCLog::ESTIMATEFEE, "Blockpolicy error, mempool tx removed from blockIndex=%u,bucketIndex=%u already\n",
                      blockIndex, bucketindex);
@@ -504,8 +549,8 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
     }
     if (!inBlock && (unsigned int)blocksAgo >= scale) { // Only counts as a failure if not confirmed for entire period
         unsigned int periodsAgo = blocksAgo / scale;
-        for (size_t i = 0; i < periodsAgo && i < failAvg.size(); i++) {
-            failAvg[i][bucketindex]++;
+        for (size_t i = 0; i < periodsAgo && i < nPeriods; i++) {
+            failAvg[i * nBuckets + bucketindex] += 1 / decayFactor;
         }
     }
 }
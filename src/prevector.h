@@ -11,7 +11,9 @@
 #include <string.h>
 
 #include <iterator>
+#include <stdexcept>
 #include <type_traits>
+#include <vector>
 
 #pragma pack(push, 1)
 /** Implements a drop-in replacement for std::vector<T> which stores up to N
@@ -29,11 +31,29 @@
  *    - T* indirect: a pointer to an array of capacity elements of type T
  *      (only the first _size are initialized).
  *
- *  The data type T must be movable by memmove/realloc(). Once we switch to C++,
- *  move constructors can be used instead.
+ *  The data type T must be movable by memmove/realloc(): elements are
+ *  relocated by copying their bytes, and the originals are not destroyed.
+ *  That is checked with is_trivially_relocatable below.
  */
 template<unsigned int N, typename T, typename Size = uint32_t, typename Diff = int32_t>
+class prevector;
+
+/** Whether a T may be moved to another address by copying its bytes, without
+ *  destroying the original. That holds for trivially copyable types, and for
+ *  types that only own their heap memory and hold no pointers into
+ *  themselves, which have to specialize this. */
+template<typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+/** A prevector holds its elements either inline or behind a pointer to the
+ *  heap, so it is relocatable if they are. */
+template<unsigned int N, typename T, typename Size, typename Diff>
+struct is_trivially_relocatable<prevector<N, T, Size, Diff>> : is_trivially_relocatable<T> {};
+
+template<unsigned int N, typename T, typename Size, typename Diff>
 class prevector {
+    static_assert(is_trivially_relocatable<T>::value, "prevector relocates its elements with memmove/realloc()");
+
 public:
     typedef Size size_type;
     typedef Diff difference_type;
@@ -166,7 +186,7 @@ private:
                 T* indirect = indirect_ptr(0);
                 T* src = indirect;
                 T* dst = direct_ptr(0);
-                memcpy(dst, src, size() * sizeof(T));
+                memcpy(static_cast<void*>(dst), src, size() * sizeof(T));
                 free(indirect);
                 _size -= N + 1;
             }
@@ -183,7 +203,7 @@ private:
                 assert(new_indirect);
                 T* src = direct_ptr(0);
                 T* dst = reinterpret_cast<T*>(new_indirect);
-                memcpy(dst, src, size() * sizeof(T));
+                memcpy(static_cast<void*>(dst), src, size() * sizeof(T));
                 _union.indirect = new_indirect;
                 _union.capacity = new_capacity;
                 _size += N + 1;
@@ -194,16 +214,61 @@ private:
     T* item_ptr(difference_type pos) { return is_direct() ? direct_ptr(pos) : indirect_ptr(pos); }
     const T* item_ptr(difference_type pos) const { return is_direct() ? direct_ptr(pos) : indirect_ptr(pos); }
 
+    /* Construct count copies of value, or copies of [first, last), in the
+     * uninitialized memory at dst. Contiguous ranges of trivially copyable
+     * types (such as bytes) are copied with memcpy/memset rather than one
+     * element at a time. The caller updates _size. */
+    void fill_n(T* dst, difference_type count, const T& value) {
+        if (std::is_trivially_copyable<T>::value && sizeof(T) == 1) {
+            memset(static_cast<void*>(dst), *reinterpret_cast<const unsigned char*>(&value), count);
+        } else {
+            for (difference_type i = 0; i < count; i++) {
+                new(static_cast<void*>(dst + i)) T(value);
+            }
+        }
+    }
+
+    template<typename InputIterator>
+    void fill(T* dst, InputIterator first, InputIterator last) {
+        while (first != last) {
+            new(static_cast<void*>(dst)) T(*first);
+            ++dst;
+            ++first;
+        }
+    }
+
+    void fill(T* dst, const T* first, const T* last) {
+        if (std::is_trivially_copyable<T>::value) {
+            if (first != last) {
+                memcpy(static_cast<void*>(dst), first, (last - first) * sizeof(T));
+            }
+        } else {
+            fill<const T*>(dst, first, last);
+        }
+    }
+
+    void fill(T* dst, T* first, T* last) { fill(dst, (const T*)first, (const T*)last); }
+    void fill(T* dst, const_iterator first, const_iterator last) { fill(dst, &*first, &*first + (last - first)); }
+    void fill(T* dst, iterator first, iterator last) { fill(dst, &*first, &*first + (last - first)); }
+    void fill(T* dst, typename std::vector<T>::const_iterator first, typename std::vector<T>::const_iterator last) {
+        if (first != last) {
+            fill(dst, &*first, &*first + (last - first));
+        }
+    }
+    void fill(T* dst, typename std::vector<T>::iterator first, typename std::vector<T>::iterator last) {
+        if (first != last) {
+            fill(dst, &*first, &*first + (last - first));
+        }
+    }
+
 public:
     void assign(size_type n, const T& val) {
         clear();
         if (capacity() < n) {
             change_capacity(n);
         }
-        while (size() < n) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(val);
-        }
+        fill_n(item_ptr(0), n, val);
+        _size += n;
     }
 
     template<typename InputIterator>
@@ -213,11 +278,8 @@ public:
         if (capacity() < n) {
             change_capacity(n);
         }
-        while (first != last) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(*first);
-            ++first;
-        }
+        fill(item_ptr(0), first, last);
+        _size += n;
     }
 
     prevector() : _size(0), _union{{}} {}
@@ -228,31 +290,23 @@ public:
 
     explicit prevector(size_type n, const T& val = T()) : _size(0) {
         change_capacity(n);
-        while (size() < n) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(val);
-        }
+        fill_n(item_ptr(0), n, val);
+        _size += n;
     }
 
     template<typename InputIterator>
     prevector(InputIterator first, InputIterator last) : _size(0) {
         size_type n = last - first;
         change_capacity(n);
-        while (first != last) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(*first);
-            ++first;
-        }
+        fill(item_ptr(0), first, last);
+        _size += n;
     }
 
     prevector(const prevector<N, T, Size, Diff>& other) : _size(0) {
-        change_capacity(other.size());
-        const_iterator it = other.begin();
-        while (it != other.end()) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(*it);
-            ++it;
-        }
+        size_type n = other.size();
+        change_capacity(n);
+        fill(item_ptr(0), other.begin(), other.end());
+        _size += n;
     }
 
     prevector(prevector<N, T, Size, Diff>&& other) : _size(0) {
@@ -264,13 +318,10 @@ public:
             return *this;
         }
         resize(0);
-        change_capacity(other.size());
-        const_iterator it = other.begin();
-        while (it != other.end()) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(*it);
-            ++it;
-        }
+        size_type n = other.size();
+        change_capacity(n);
+        fill(item_ptr(0), other.begin(), other.end());
+        _size += n;
         return *this;
     }
 
@@ -313,6 +364,20 @@ public:
         return *item_ptr(pos);
     }
 
+    T& at(size_type pos) {
+        if (pos >= size()) {
+            throw std::out_of_range("prevector::at");
+        }
+        return *item_ptr(pos);
+    }
+
+    const T& at(size_type pos) const {
+        if (pos >= size()) {
+            throw std::out_of_range("prevector::at");
+        }
+        return *item_ptr(pos);
+    }
+
     void resize(size_type new_size) {
         if (size() > new_size) {
             erase(item_ptr(new_size), end());
@@ -320,9 +385,10 @@ public:
         if (new_size > capacity()) {
             change_capacity(new_size);
         }
-        while (size() < new_size) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T();
+        if (size() < new_size) {
+            size_type count = new_size - size();
+            fill_n(item_ptr(size()), count, T());
+            _size += count;
         }
     }
 
@@ -346,7 +412,7 @@ public:
         if (capacity() < new_size) {
             change_capacity(new_size + (new_size >> 1));
         }
-        memmove(item_ptr(p + 1), item_ptr(p), (size() - p) * sizeof(T));
+        memmove(static_cast<void*>(item_ptr(p + 1)), item_ptr(p), (size() - p) * sizeof(T));
         _size++;
         new(static_cast<void*>(item_ptr(p))) T(value);
         return iterator(item_ptr(p));
@@ -358,7 +424,7 @@ public:
         if (capacity() < new_size) {
             change_capacity(new_size + (new_size >> 1));
         }
-        memmove(item_ptr(p + count), item_ptr(p), (size() - p) * sizeof(T));
+        memmove(static_cast<void*>(item_ptr(p + count)), item_ptr(p), (size() - p) * sizeof(T));
         _size += count;
         for (size_type i = 0; i < count; i++) {
             new(static_cast<void*>(item_ptr(p + i))) T(value);
@@ -373,13 +439,9 @@ public:
         if (capacity() < new_size) {
             change_capacity(new_size + (new_size >> 1));
         }
-        memmove(item_ptr(p + count), item_ptr(p), (size() - p) * sizeof(T));
+        memmove(static_cast<void*>(item_ptr(p + count)), item_ptr(p), (size() - p) * sizeof(T));
         _size += count;
-        while (first != last) {
-            new(static_cast<void*>(item_ptr(p))) T(*first);
-            ++p;
-            ++first;
-        }
+        fill(item_ptr(p), first, last);
     }
 
     iterator erase(iterator pos) {
@@ -404,7 +466,7 @@ public:
         } else {
             _size -= last - p;
         }
-        memmove(&(*first), &(*last), endp - ((char*)(&(*last))));
+        memmove(static_cast<void*>(&(*first)), &(*last), endp - ((char*)(&(*last))));
         return first;
     }
 
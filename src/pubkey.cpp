@@ -7,10 +7,56 @@
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
 
+#include <string.h>
+
+#include <boost/thread/tss.hpp>
+
 namespace
 {
 /* Global secp256k1_context object used for verification. */
 secp256k1_context* secp256k1_context_verify = nullptr;
+
+/** Small per-thread cache of parsed compressed public keys.
+ *
+ * Parsing a compressed key costs a field square root, and signature-heavy
+ * blocks (consolidations, multisig) tend to verify many signatures against
+ * the same few keys. Slots are direct-mapped on a byte of the x coordinate
+ * and keep the full encoding, so a collision only costs a re-parse.
+ */
+class ParsedPubKeyCache
+{
+private:
+    static const size_t SLOTS = 256;
+
+    struct Slot {
+        bool fUsed;
+        unsigned char vch[33];
+        secp256k1_pubkey parsed;
+    };
+    Slot slots[SLOTS];
+
+public:
+    ParsedPubKeyCache() { memset(slots, 0, sizeof(slots)); }
+
+    bool Parse(const unsigned char* data, size_t len, secp256k1_pubkey& pubkey)
+    {
+        if (len != sizeof(Slot::vch))
+            return secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, data, len);
+        Slot& slot = slots[data[1] % SLOTS];
+        if (slot.fUsed && memcmp(slot.vch, data, len) == 0) {
+            pubkey = slot.parsed;
+            return true;
+        }
+        if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, data, len))
+            return false;
+        slot.fUsed = true;
+        memcpy(slot.vch, data, len);
+        slot.parsed = pubkey;
+        return true;
+    }
+};
+
+boost::thread_specific_ptr<ParsedPubKeyCache> parsed_pubkey_cache;
 } // namespace
 
 /** This function is taken from the libsecp256k1 distribution and implements
@@ -169,10 +215,12 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
         return false;
     secp256k1_pubkey pubkey;
     secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
+    if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, vchSig.data(), vchSig.size())) {
         return false;
     }
-    if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, vchSig.data(), vchSig.size())) {
+    if (parsed_pubkey_cache.get() == nullptr)
+        parsed_pubkey_cache.reset(new ParsedPubKeyCache());
+    if (!parsed_pubkey_cache->Parse(&(*this)[0], size(), pubkey)) {
         return false;
     }
     /* libsecp256k1's ECDSA verification requires lower-S signatures, which have
@@ -263,10 +263,9 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        std::string strJSON = objBlock.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        WriteJSONReplyStreamed(req, [&](JSONWriter& writer) {
+            blockToJSON(writer, block, pblockindex, showTxDetails);
+        });
         return true;
     }
 
@@ -352,11 +351,7 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RF_JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        std::string strJSON = mempoolObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        WriteJSONReplyStreamed(req, [](JSONWriter& writer) { mempoolToJSON(writer); });
         return true;
     }
     default: {
@@ -532,12 +527,13 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         if (fCheckMemPool)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
+        std::vector<Coin> coins;
+        view.GetCoins(vOutPoints, coins);
         for (size_t i = 0; i < vOutPoints.size(); i++) {
             bool hit = false;
-            Coin coin;
-            if (view.GetCoin(vOutPoints[i], coin) && !mempool.isSpent(vOutPoints[i])) {
+            if (!coins[i].IsSpent() && !mempool.isSpent(vOutPoints[i])) {
                 hit = true;
-                outs.emplace_back(std::move(coin));
+                outs.emplace_back(std::move(coins[i]));
             }
 
             hits.push_back(hit);
@@ -18,6 +18,7 @@
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
 #include "streams.h"
 #include "sync.h"
 #include "txdb.h"
@@ -32,9 +33,14 @@
 
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 
+/** Maximum number of threads used to scan the chainstate in gettxoutsetinfo */
+static const int MAX_UTXO_SCAN_THREADS = 16;
+
 struct CUpdatedBlock
 {
     uint256 hash;
@@ -148,7 +154,17 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+static UniValue blockTxToJSON(const CTransaction& tx, bool txDetails)
+{
+    if (!txDetails)
+        return tx.GetHash().GetHex();
+    UniValue objTx(UniValue::VOBJ);
+    TxToUniv(tx, uint256(), objTx, true, RPCSerializationFlags());
+    return objTx;
+}
+
+/** All of blockToJSON, with txs as the "tx" member */
+static UniValue blockFieldsToJSON(const CBlock& block, const CBlockIndex* blockindex, const UniValue& txs)
 {
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
@@ -169,18 +185,6 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    UniValue txs(UniValue::VARR);
-    for(const auto& tx : block.vtx)
-    {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToUniv(*tx, uint256(), objTx, true, RPCSerializationFlags());
-            txs.push_back(objTx);
-        }
-        else
-            txs.push_back(tx->GetHash().GetHex());
-    }
     result.push_back(Pair("tx", txs));
     result.push_back(Pair("time", block.GetBlockTime()));
     result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
@@ -198,6 +202,36 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     return result;
 }
 
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+{
+    UniValue txs(UniValue::VARR);
+    for (const auto& tx : block.vtx)
+        txs.push_back(blockTxToJSON(*tx, txDetails));
+    return blockFieldsToJSON(block, blockindex, txs);
+}
+
+void blockToJSON(JSONWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+{
+    // Only the transactions are written one by one, in place of the empty
+    // array that stands in for them
+    const UniValue fields = blockFieldsToJSON(block, blockindex, UniValue(UniValue::VARR));
+    const std::vector<std::string>& keys = fields.getKeys();
+    const std::vector<UniValue>& values = fields.getValues();
+    writer.BeginObject();
+    for (size_t i = 0; i < keys.size(); i++) {
+        writer.Key(keys[i]);
+        if (keys[i] == "tx") {
+            writer.BeginArray();
+            for (const auto& tx : block.vtx)
+                writer.Value(blockTxToJSON(*tx, txDetails));
+            writer.EndArray();
+        } else {
+            writer.Value(values[i]);
+        }
+    }
+    writer.EndObject();
+}
+
 UniValue getblockcount(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -459,6 +493,20 @@ UniValue mempoolToJSON(bool fVerbose)
     }
 }
 
+void mempoolToJSON(JSONWriter& writer)
+{
+    LOCK(mempool.cs);
+    writer.BeginObject();
+    for (const CTxMemPoolEntry& e : mempool.mapTx)
+    {
+        UniValue info(UniValue::VOBJ);
+        entryToJSON(info, e);
+        writer.Key(e.GetTx().GetHash().ToString());
+        writer.Value(info);
+    }
+    writer.EndObject();
+}
+
 UniValue getrawmempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
@@ -491,6 +539,15 @@ UniValue getrawmempool(const JSONRPCRequest& request)
     return mempoolToJSON(fVerbose);
 }
 
+static RPCResultWriter getrawmempool_streamed(const JSONRPCRequest& request)
+{
+    // Only the verbose form is large enough to be worth it
+    if (request.fHelp || request.params.size() != 1 || !request.params[0].isBool() || !request.params[0].get_bool())
+        return nullptr;
+
+    return [](JSONWriter& writer) { mempoolToJSON(writer); };
+}
+
 UniValue getmempoolancestors(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2) {
@@ -743,6 +800,41 @@ UniValue getblockheader(const JSONRPCRequest& request)
     return blockheaderToJSON(pblockindex);
 }
 
+static int GetBlockVerbosity(const JSONRPCRequest& request)
+{
+    int verbosity = 1;
+    if (!request.params[1].isNull()) {
+        if(request.params[1].isNum())
+            verbosity = request.params[1].get_int();
+        else
+            verbosity = request.params[1].get_bool() ? 1 : 0;
+    }
+    return verbosity;
+}
+
+static CBlockIndex* ReadBlockForRPC(const uint256& hash, CBlock& block)
+{
+    AssertLockHeld(cs_main);
+
+    if (mapBlockIndex.count(hash) == 0)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    CBlockIndex* pblockindex = mapBlockIndex[hash];
+
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
+
+    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        // Block not found on disk. This could be because we have the block
+        // header in our index but don't have the block (for example if a
+        // non-whitelisted node sends us an unrequested long chain of valid
+        // blocks, we add the headers to our index, but don't accept the
+        // block).
+        throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
+
+    return pblockindex;
+}
+
 UniValue getblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
@@ -799,34 +891,14 @@ UniValue getblock(const JSONRPCRequest& request)
     std::string strHash = request.params[0].get_str();
     uint256 hash(uint256S(strHash));
 
-    int verbosity = 1;
-    if (!request.params[1].isNull()) {
-        if(request.params[1].isNum())
-            verbosity = request.params[1].get_int();
-        else
-            verbosity = request.params[1].get_bool() ? 1 : 0;
-    }
+    int verbosity = GetBlockVerbosity(request);
     bool legacy_format = false;
     if (request.params.size() == 3 && request.params[2].get_bool() == true) {
         legacy_format = true;
     }
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
-
-    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        // Block not found on disk. This could be because we have the block
-        // header in our index but don't have the block (for example if a
-        // non-whitelisted node sends us an unrequested long chain of valid
-        // blocks, we add the headers to our index, but don't accept the
-        // block).
-        throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
+    CBlockIndex* pblockindex = ReadBlockForRPC(hash, block);
 
     if (verbosity <= 0)
     {
@@ -840,6 +912,27 @@ UniValue getblock(const JSONRPCRequest& request)
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
+static RPCResultWriter getblock_streamed(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        return nullptr;
+    // Leave the hex encoding, and any malformed legacy flag, to getblock
+    const int verbosity = GetBlockVerbosity(request);
+    if (verbosity <= 0 || (request.params.size() == 3 && !request.params[2].isBool()))
+        return nullptr;
+
+    LOCK(cs_main);
+
+    uint256 hash(uint256S(request.params[0].get_str()));
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    const CBlockIndex* pblockindex = ReadBlockForRPC(hash, *pblock);
+
+    return [pblock, pblockindex, verbosity](JSONWriter& writer) {
+        LOCK(cs_main);
+        blockToJSON(writer, *pblock, pblockindex, verbosity >= 2);
+    };
+}
+
 struct CCoinsStats
 {
     int nHeight;
@@ -866,8 +959,7 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash,
         ss << VARINT(output.second.out.nValue);
         stats.nTransactionOutputs++;
         stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
+        stats.nBogoSize += GetBogoSize(output.second.out.scriptPubKey);
     }
     ss << VARINT(0);
 }
@@ -910,6 +1002,47 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
     return true;
 }
 
+//! Recompute the rolling UTXO set stats from the chainstate database. The
+//! keyspace is split by the first byte of the txid and scanned on several
+//! threads; the results are merged at the end as MuHash is order-independent.
+//! The caller must make sure the database is not written to meanwhile.
+static bool ScanRollingStats(const CCoinsViewDB *view, CRollingCoinsStats &stats)
+{
+    const int nShards = std::max(1, std::min(GetNumCores(), MAX_UTXO_SCAN_THREADS));
+    std::vector<CRollingCoinsStats> vShardStats(nShards);
+    std::atomic<bool> fFailed(false);
+
+    boost::thread_group workers;
+    for (int i = 0; i < nShards; i++) {
+        workers.create_thread([&, i] {
+            uint256 hashStart;
+            *hashStart.begin() = 256 * i / nShards;
+            const unsigned int nEnd = 256 * (i + 1) / nShards;
+            std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor(hashStart));
+            for (; pcursor->Valid() && !fFailed; pcursor->Next()) {
+                COutPoint key;
+                Coin coin;
+                if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+                    fFailed = true;
+                    break;
+                }
+                if (*key.hash.begin() >= nEnd) break;
+                vShardStats[i].Add(key, coin);
+            }
+        });
+    }
+    workers.join_all();
+    if (fFailed) {
+        return error("%s: unable to read value", __func__);
+    }
+
+    stats = CRollingCoinsStats();
+    for (const CRollingCoinsStats& shard : vShardStats) {
+        stats += shard;
+    }
+    return true;
+}
+
 UniValue pruneblockchain(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -961,43 +1094,107 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
 
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" full_scan )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time with hash_type 'hash_serialized_2' or full_scan.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"    (string, optional, default=hash_serialized_2) Which UTXO set hash to return.\n"
+            "                  'hash_serialized_2' hashes the whole set in order with a full scan, 'muhash'\n"
+            "                  returns the rolling set hash maintained while connecting blocks with -rollingutxostats,\n"
+            "                  or computes it with a parallel scan of the chainstate without it.\n"
+            "2. full_scan      (boolean, optional, default=false) With 'muhash', recompute the hash and totals with a\n"
+            "                  parallel scan of the chainstate and check them against the rolling values.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions (only with hash_serialized_2)\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (only with hash_serialized_2)\n"
+            "  \"muhash\": \"hash\",       (string) The rolling MuHash3072 set hash (only with muhash)\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
+            + HelpExampleRpc("gettxoutsetinfo", "\"muhash\"")
         );
 
+    std::string hash_type = "hash_serialized_2";
+    if (!request.params[0].isNull()) {
+        hash_type = request.params[0].get_str();
+    }
+    bool fFullScan = !request.params[1].isNull() && request.params[1].get_bool();
+
     UniValue ret(UniValue::VOBJ);
 
-    CCoinsStats stats;
-    FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview, stats)) {
-        ret.push_back(Pair("height", (int64_t)stats.nHeight));
-        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
-        ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
-        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
-        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
-        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
-        ret.push_back(Pair("disk_size", stats.nDiskSize));
-        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
-    } else {
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+    if (hash_type == "hash_serialized_2") {
+        if (fFullScan) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "full_scan is only supported with hash_type muhash");
+        }
+        CCoinsStats stats;
+        FlushStateToDisk();
+        if (GetUTXOStats(pcoinsdbview, stats)) {
+            ret.push_back(Pair("height", (int64_t)stats.nHeight));
+            ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+            ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+            ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+            ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
+            ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+            ret.push_back(Pair("disk_size", stats.nDiskSize));
+            ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        } else {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        }
+        return ret;
+    }
+    if (hash_type != "muhash") {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + hash_type);
     }
+
+    CRollingCoinsStats stats;
+    uint256 hashBlock;
+    int nHeight;
+    {
+        LOCK(cs_main);
+        if (fFullScan || !pcoinsTip->GetRollingStats(stats)) {
+            // Scan the flushed chainstate; holding cs_main keeps it unchanged.
+            FlushStateToDisk();
+            if (!ScanRollingStats(pcoinsdbview, stats)) {
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+            }
+            CRollingCoinsStats rolling;
+            if (pcoinsdbview->GetRollingStats(rolling)) {
+                uint256 hashRolling, hashScanned;
+                CRollingCoinsStats scanned = stats;
+                rolling.muhash.Finalize(hashRolling);
+                scanned.muhash.Finalize(hashScanned);
+                if (hashRolling != hashScanned || rolling.nTransactionOutputs != stats.nTransactionOutputs ||
+                    rolling.nBogoSize != stats.nBogoSize || rolling.nTotalAmount != stats.nTotalAmount) {
+                    throw JSONRPCError(RPC_DATABASE_ERROR, "Rolling UTXO set stats do not match the chainstate");
+                }
+            } else if (pcoinsdbview->TracksRollingStats() && !pcoinsdbview->WriteRollingStats(stats)) {
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to store rolling UTXO set stats");
+            }
+        }
+        hashBlock = pcoinsTip->GetBestBlock();
+        nHeight = mapBlockIndex.find(hashBlock)->second->nHeight;
+    }
+
+    uint256 muhash;
+    stats.muhash.Finalize(muhash);
+    ret.push_back(Pair("height", (int64_t)nHeight));
+    ret.push_back(Pair("bestblock", hashBlock.GetHex()));
+    ret.push_back(Pair("txouts", stats.nTransactionOutputs));
+    ret.push_back(Pair("bogosize", stats.nBogoSize));
+    ret.push_back(Pair("muhash", muhash.GetHex()));
+    ret.push_back(Pair("disk_size", (uint64_t)pcoinsdbview->EstimateSize()));
+    ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     return ret;
 }
 
@@ -1419,6 +1616,284 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+static UniValue CoinsCacheStatsToJSON(const CCoinsCacheStats& stats)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("hits", (uint64_t)stats.nHits.load(std::memory_order_relaxed)));
+    ret.push_back(Pair("misses", (uint64_t)stats.nMisses.load(std::memory_order_relaxed)));
+    ret.push_back(Pair("misses_found", (uint64_t)stats.nMissesFound.load(std::memory_order_relaxed)));
+    ret.push_back(Pair("hitrate", stats.HitRate()));
+    ret.push_back(Pair("added", (uint64_t)stats.nAdded.load(std::memory_order_relaxed)));
+    ret.push_back(Pair("added_fresh", (uint64_t)stats.nAddedFresh.load(std::memory_order_relaxed)));
+    ret.push_back(Pair("spent", (uint64_t)stats.nSpent.load(std::memory_order_relaxed)));
+    ret.push_back(Pair("spent_fresh", (uint64_t)stats.nSpentFresh.load(std::memory_order_relaxed)));
+    ret.push_back(Pair("uncached", (uint64_t)stats.nUncached.load(std::memory_order_relaxed)));
+    ret.push_back(Pair("flushes", (uint64_t)stats.nFlushes.load(std::memory_order_relaxed)));
+    ret.push_back(Pair("flushed_entries", (uint64_t)stats.nFlushedEntries.load(std::memory_order_relaxed)));
+    ret.push_back(Pair("flushed_dirty", (uint64_t)stats.nFlushedDirty.load(std::memory_order_relaxed)));
+    return ret;
+}
+
+UniValue getcoinscacheinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw std::runtime_error(
+            "getcoinscacheinfo ( reset )\n"
+            "\nReturns usage statistics of the UTXO caches.\n"
+            "\"tip\" is the in-memory cache in front of the chainstate database, \"blockviews\" aggregates the\n"
+            "temporary caches used to connect and disconnect blocks, \"mempoolviews\" those used to validate\n"
+            "transactions for the mempool. Counters accumulate since startup or the last reset.\n"
+            "\nArguments:\n"
+            "1. reset      (boolean, optional, default=false) Reset all counters after reporting them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"tip\": {\n"
+            "    \"entries\": xxxxx,          (numeric) Number of outputs currently cached\n"
+            "    \"usage\": xxxxx,            (numeric) Memory used by the cache in bytes\n"
+            "    \"maxusage\": xxxxx,         (numeric) Usage above which the cache is flushed to disk (-dbcache)\n"
+            "    \"hits\": xxxxx,             (numeric) Lookups answered from the cache\n"
+            "    \"misses\": xxxxx,           (numeric) Lookups forwarded to the backing view\n"
+            "    \"misses_found\": xxxxx,     (numeric) Misses for which the backing view had the output\n"
+            "    \"hitrate\": x.xxx,          (numeric) hits / (hits + misses)\n"
+            "    \"added\": xxxxx,            (numeric) Outputs added\n"
+            "    \"added_fresh\": xxxxx,      (numeric) Outputs added that the backing view did not have\n"
+            "    \"spent\": xxxxx,            (numeric) Outputs spent\n"
+            "    \"spent_fresh\": xxxxx,      (numeric) Spends of fresh outputs, dropped without a write\n"
+            "    \"uncached\": xxxxx,         (numeric) Unmodified outputs evicted after a rejected transaction\n"
+            "    \"flushes\": xxxxx,          (numeric) Number of flushes to the backing view\n"
+            "    \"flushed_entries\": xxxxx,  (numeric) Entries evicted by flushes\n"
+            "    \"flushed_dirty\": xxxxx     (numeric) Modified entries written by flushes\n"
+            "  },\n"
+            "  \"blockviews\": { ... },     (json object) The same counters, without entries/usage/maxusage\n"
+            "  \"mempoolviews\": { ... }    (json object) The same counters, without entries/usage/maxusage\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcoinscacheinfo", "")
+            + HelpExampleRpc("getcoinscacheinfo", "true")
+        );
+
+    bool fReset = !request.params[0].isNull() && request.params[0].get_bool();
+
+    UniValue ret(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        UniValue tip(UniValue::VOBJ);
+        tip.push_back(Pair("entries", (uint64_t)pcoinsTip->GetCacheSize()));
+        tip.push_back(Pair("usage", (uint64_t)pcoinsTip->DynamicMemoryUsage()));
+        tip.push_back(Pair("maxusage", (uint64_t)nCoinCacheUsage));
+        tip.pushKVs(CoinsCacheStatsToJSON(pcoinsTip->GetStats()));
+        ret.push_back(Pair("tip", tip));
+        if (fReset) pcoinsTip->GetStats().Reset();
+    }
+    ret.push_back(Pair("blockviews", CoinsCacheStatsToJSON(g_block_view_stats)));
+    ret.push_back(Pair("mempoolviews", CoinsCacheStatsToJSON(g_mempool_view_stats)));
+    if (fReset) {
+        g_block_view_stats.Reset();
+        g_mempool_view_stats.Reset();
+    }
+    return ret;
+}
+
+static UniValue SigCacheStatsToJSON(const CuckooCache::cache_stats& stats)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("hits", stats.hits));
+    ret.push_back(Pair("misses", stats.misses));
+    ret.push_back(Pair("hitrate", stats.hits + stats.misses == 0 ? 0.0 : (double)stats.hits / (stats.hits + stats.misses)));
+    ret.push_back(Pair("inserts", stats.inserts));
+    return ret;
+}
+
+UniValue getsigcacheinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw std::runtime_error(
+            "getsigcacheinfo ( reset )\n"
+            "\nReturns usage statistics of the signature and script execution caches.\n"
+            "Counters accumulate since startup or the last reset.\n"
+            "\nArguments:\n"
+            "1. reset      (boolean, optional, default=false) Reset all counters after reporting them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"signatures\": {\n"
+            "    \"hits\": xxxxx,       (numeric) Signature checks answered from the cache\n"
+            "    \"misses\": xxxxx,     (numeric) Signature checks that had to be verified\n"
+            "    \"hitrate\": x.xxx,    (numeric) hits / (hits + misses)\n"
+            "    \"inserts\": xxxxx     (numeric) Valid signatures added to the cache\n"
+            "  },\n"
+            "  \"scripts\": { ... }   (json object) The same counters for whole-transaction script executions\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "true")
+        );
+
+    bool fReset = !request.params[0].isNull() && request.params[0].get_bool();
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("signatures", SigCacheStatsToJSON(GetSignatureCacheStats(fReset))));
+    ret.push_back(Pair("scripts", SigCacheStatsToJSON(GetScriptExecutionCacheStats(fReset))));
+    return ret;
+}
+
+/** Name of an opcode in the profileblock result. Direct pushes share one entry. */
+static std::string ProfiledOpName(int op)
+{
+    if (op > OP_0 && op < OP_PUSHDATA1)
+        return "push";
+    if (op == OP_0)
+        return "OP_0";
+    if (op == OP_1NEGATE)
+        return "OP_1NEGATE";
+    if (op >= OP_1 && op <= OP_16)
+        return strprintf("OP_%d", op - OP_1 + 1);
+    return GetOpName((opcodetype)op);
+}
+
+UniValue profileblock(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "profileblock \"blockhash\" ( verbose )\n"
+            "\nValidates a block again while measuring its script verification, one input at a time.\n"
+            "The block must be in the active chain, at most " + std::to_string(MIN_BLOCKS_TO_KEEP) + " blocks deep, or be a child of its tip.\n"
+            "Blocks in the active chain are checked against the UTXO set with the blocks above them disconnected.\n"
+            "Block processing is paused meanwhile, which can take a while for deep blocks.\n"
+            "The signature and script caches are only read, never updated.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"     (string, required) The block hash\n"
+            "2. verbose         (boolean, optional, default=false) Include the measurements of every input\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"hash\" : \"hash\",          (string) The block hash\n"
+            "  \"height\" : n,             (numeric) The block height\n"
+            "  \"txs\" : n,                (numeric) The number of transactions\n"
+            "  \"inputs\" : n,             (numeric) The number of inputs whose scripts were verified\n"
+            "  \"sigopscost\" : n,         (numeric) The block's sigop cost\n"
+            "  \"connect_us\" : n,         (numeric) Time spent connecting the block, in microseconds\n"
+            "  \"verify_us\" : n,          (numeric) Time spent verifying scripts, in microseconds\n"
+            "  \"scriptcachehits\" : n,    (numeric) Transactions found in the script execution cache, whose scripts are verified anyway\n"
+            "  \"sigchecks\" : n,          (numeric) Signature checks performed\n"
+            "  \"sigcachehits\" : n,       (numeric) Signature checks answered from the signature cache\n"
+            "  \"sighashbytes\" : n,       (numeric) Bytes hashed to compute signature hashes\n"
+            "  \"fastpath\" : n,           (numeric) Inputs verified without running the script interpreter\n"
+            "  \"types\" : {               (json object) Totals per type of the spent output\n"
+            "    \"type\" : {\n"
+            "      \"inputs\" : n,         (numeric) The number of inputs\n"
+            "      \"verify_us\" : n,      (numeric) Time spent verifying them, in microseconds\n"
+            "      \"sigchecks\" : n       (numeric) Signature checks performed\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"opcodes\" : {             (json object) Opcodes executed by the script interpreter\n"
+            "    \"opcode\" : n, ...       (numeric) Times the opcode was executed. Direct pushes are counted as \"push\"\n"
+            "  },\n"
+            "  \"vin\" : [                 (array of json objects, only if verbose) Every verified input, in block order\n"
+            "    {\n"
+            "      \"txid\" : \"id\",        (string) The transaction id\n"
+            "      \"vin\" : n,            (numeric) The input index\n"
+            "      \"type\" : \"type\",      (string) The type of the spent output\n"
+            "      \"verify_us\" : n,      (numeric) Time spent verifying the input, in microseconds\n"
+            "      \"sigchecks\" : n,      (numeric) Signature checks performed\n"
+            "      \"sigcachehits\" : n,   (numeric) Signature checks answered from the signature cache\n"
+            "      \"sighashbytes\" : n,   (numeric) Bytes hashed to compute signature hashes\n"
+            "      \"fastpath\" : true|false (boolean) Whether the input was verified without the script interpreter\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("profileblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+            + HelpExampleRpc("profileblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", true")
+        );
+
+    LOCK(cs_main);
+
+    uint256 hash(uint256S(request.params[0].get_str()));
+    bool fVerbose = !request.params[1].isNull() && request.params[1].get_bool();
+
+    if (mapBlockIndex.count(hash) == 0)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    CBlockIndex* pblockindex = mapBlockIndex[hash];
+
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        throw JSONRPCError(RPC_MISC_ERROR, "Can't read block from disk");
+
+    CBlockProfile profile;
+    CValidationState state;
+    if (!ProfileBlock(state, Params(), block, pblockindex, profile))
+        throw JSONRPCError(RPC_VERIFY_ERROR, strprintf("Block validation failed: %s", FormatStateMessage(state)));
+
+    struct TypeTotals {
+        int nInputs = 0;
+        int64_t nTimeMicros = 0;
+        int64_t nSigChecks = 0;
+    };
+    std::map<std::string, TypeTotals> mapTypes;
+    int64_t nTimeVerify = 0;
+    int nFastPath = 0;
+    UniValue vin(UniValue::VARR);
+    for (const CInputProfile& input : profile.vInputs) {
+        TypeTotals& totals = mapTypes[GetTxnOutputType(input.type)];
+        totals.nInputs++;
+        totals.nTimeMicros += input.nTimeMicros;
+        totals.nSigChecks += input.nSigChecks;
+        nTimeVerify += input.nTimeMicros;
+        nFastPath += input.fFastPath;
+        if (fVerbose) {
+            UniValue entry(UniValue::VOBJ);
+            entry.push_back(Pair("txid", input.txid.GetHex()));
+            entry.push_back(Pair("vin", (int64_t)input.nIn));
+            entry.push_back(Pair("type", GetTxnOutputType(input.type)));
+            entry.push_back(Pair("verify_us", input.nTimeMicros));
+            entry.push_back(Pair("sigchecks", (int64_t)input.nSigChecks));
+            entry.push_back(Pair("sigcachehits", (int64_t)input.nSigCacheHits));
+            entry.push_back(Pair("sighashbytes", (uint64_t)input.nSighashBytes));
+            entry.push_back(Pair("fastpath", input.fFastPath));
+            vin.push_back(entry);
+        }
+    }
+
+    UniValue types(UniValue::VOBJ);
+    for (const auto& entry : mapTypes) {
+        UniValue type(UniValue::VOBJ);
+        type.push_back(Pair("inputs", entry.second.nInputs));
+        type.push_back(Pair("verify_us", entry.second.nTimeMicros));
+        type.push_back(Pair("sigchecks", entry.second.nSigChecks));
+        types.pushKV(entry.first, type);
+    }
+
+    std::map<std::string, uint64_t> mapOpcodes;
+    for (int op = 0; op < 256; op++) {
+        if (profile.total.nOpcodes[op])
+            mapOpcodes[ProfiledOpName(op)] += profile.total.nOpcodes[op];
+    }
+    UniValue opcodes(UniValue::VOBJ);
+    for (const auto& entry : mapOpcodes)
+        opcodes.pushKV(entry.first, entry.second);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("hash", block.GetHash().GetHex()));
+    ret.push_back(Pair("height", pblockindex->nHeight));
+    ret.push_back(Pair("txs", (int64_t)block.vtx.size()));
+    ret.push_back(Pair("inputs", (int64_t)profile.vInputs.size()));
+    ret.push_back(Pair("sigopscost", profile.nSigOpsCost));
+    ret.push_back(Pair("connect_us", profile.nTimeConnect));
+    ret.push_back(Pair("verify_us", nTimeVerify));
+    ret.push_back(Pair("scriptcachehits", (int64_t)profile.nScriptCacheHits));
+    ret.push_back(Pair("sigchecks", (int64_t)profile.total.nSigChecks));
+    ret.push_back(Pair("sigcachehits", (int64_t)profile.total.nSigCacheHits));
+    ret.push_back(Pair("sighashbytes", profile.total.nSighashBytes));
+    ret.push_back(Pair("fastpath", nFastPath));
+    ret.push_back(Pair("types", types));
+    ret.push_back(Pair("opcodes", opcodes));
+    if (fVerbose)
+        ret.push_back(Pair("vin", vin));
+    return ret;
+}
+
 UniValue preciousblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1622,6 +2097,8 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockhash",           &getblockhash,           true,  {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         true,  {"blockhash","verbose","legacy"} },
     { "blockchain",         "getchaintips",           &getchaintips,           true,  {} },
+    { "blockchain",         "getcoinscacheinfo",      &getcoinscacheinfo,      true,  {"reset"} },
+    { "blockchain",         "getsigcacheinfo",        &getsigcacheinfo,        true,  {"reset"} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true,  {} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true,  {"txid","verbose"} },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true,  {"txid","verbose"} },
@@ -1629,7 +2106,8 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {"hash_type","full_scan"} },
+    { "blockchain",         "profileblock",           &profileblock,           true,  {"blockhash","verbose"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height"} },
     { "blockchain",         "verifychain",            &verifychain,            true,  {"checklevel","nblocks"} },
 
@@ -1647,4 +2125,7 @@ void RegisterBlockchainRPCCommands(CRPCTable &t)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         t.appendCommand(commands[vcidx].name, &commands[vcidx]);
+
+    t.appendStreamingCommand("getblock", &getblock_streamed);
+    t.appendStreamingCommand("getrawmempool", &getrawmempool_streamed);
 }
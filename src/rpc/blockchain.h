@@ -7,6 +7,7 @@
 
 class CBlock;
 class CBlockIndex;
+class JSONWriter;
 class UniValue;
 
 /**
@@ -24,12 +25,18 @@ void RPCNotifyBlockChange(bool ibd, const CBlockIndex *);
 /** Block description to JSON */
 UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 
+/** Block description to JSON, handing the transactions to writer one at a time */
+void blockToJSON(JSONWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+
 /** Mempool information to JSON */
 UniValue mempoolInfoToJSON();
 
 /** Mempool to JSON */
 UniValue mempoolToJSON(bool fVerbose = false);
 
+/** Verbose mempool to JSON, handing the entries to writer one at a time */
+void mempoolToJSON(JSONWriter& writer);
+
 /** Block header to JSON */
 UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
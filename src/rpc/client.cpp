@@ -101,6 +101,10 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "sendrawtransaction", 1, "allowhighfees" },
     { "combinerawtransaction", 0, "txs" },
     { "fundrawtransaction", 1, "options" },
+    { "gettxoutsetinfo", 1, "full_scan" },
+    { "getcoinscacheinfo", 0, "reset" },
+    { "getsigcacheinfo", 0, "reset" },
+    { "profileblock", 1, "verbose" },
     { "gettxout", 1, "n" },
     { "gettxout", 2, "include_mempool" },
     { "gettxoutproof", 0, "txids" },
@@ -9,9 +9,14 @@
 
 #include <univalue.h>
 
+struct CBlockTemplate;
+
 /** Generate blocks (mine) */
 UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGenerate, uint64_t nMaxTries, bool keepScript);
 
+/** The "transactions" array of a getblocktemplate result */
+UniValue BlockTemplateTxsToJSON(const CBlockTemplate& blocktemplate, bool fPreSegWit);
+
 /** Check bounds on a command line confirm target */
 unsigned int ParseConfirmTarget(const UniValue& value);
 
@@ -12,6 +12,7 @@
 #include "utiltime.h"
 #include "version.h"
 
+#include <assert.h>
 #include <stdint.h>
 #include <fstream>
 
@@ -59,6 +60,96 @@ UniValue JSONRPCError(int code, const std::string& message)
     return error;
 }
 
+JSONWriter::JSONWriter(const Sink& sinkIn, size_t nChunkSizeIn) :
+    sink(sinkIn), nChunkSize(nChunkSizeIn), fAfterKey(false)
+{
+    buf.reserve(nChunkSize);
+}
+
+void JSONWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+    } else if (!vHasElements.empty()) {
+        if (vHasElements.back())
+            buf += ',';
+        vHasElements.back() = true;
+    }
+}
+
+void JSONWriter::MaybeFlush()
+{
+    if (buf.size() > nChunkSize) {
+        sink(buf);
+        buf.clear();
+    }
+}
+
+void JSONWriter::BeginObject()
+{
+    Separate();
+    buf += '{';
+    vHasElements.push_back(false);
+}
+
+void JSONWriter::EndObject()
+{
+    assert(!vHasElements.empty() && !fAfterKey);
+    vHasElements.pop_back();
+    buf += '}';
+    MaybeFlush();
+}
+
+void JSONWriter::BeginArray()
+{
+    Separate();
+    buf += '[';
+    vHasElements.push_back(false);
+}
+
+void JSONWriter::EndArray()
+{
+    assert(!vHasElements.empty() && !fAfterKey);
+    vHasElements.pop_back();
+    buf += ']';
+    MaybeFlush();
+}
+
+void JSONWriter::Key(const std::string& key)
+{
+    Separate();
+    buf += UniValue(key).write();
+    buf += ':';
+    fAfterKey = true;
+}
+
+void JSONWriter::Value(const UniValue& val)
+{
+    Separate();
+    buf += val.write();
+    MaybeFlush();
+}
+
+void JSONWriter::Finish()
+{
+    assert(vHasElements.empty());
+    buf += '\n';
+    sink(buf);
+    buf.clear();
+}
+
+void JSONRPCReply(JSONWriter& writer, const std::function<void(JSONWriter&)>& writeResult, const UniValue& id)
+{
+    writer.BeginObject();
+    writer.Key("result");
+    writeResult(writer);
+    writer.Key("error");
+    writer.Value(NullUniValue);
+    writer.Key("id");
+    writer.Value(id);
+    writer.EndObject();
+}
+
 /** Username used when cookie authentication is in use (arbitrary, only for
  * recognizability in debugging/logging purposes)
  */
@@ -8,10 +8,12 @@
 
 #include "fs.h"
 
+#include <functional>
 #include <list>
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include <univalue.h>
 
@@ -91,6 +93,46 @@ UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const Un
 std::string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id);
 UniValue JSONRPCError(int code, const std::string& message);
 
+/**
+ * Compact JSON encoder that hands its output to a sink in pieces while it is
+ * being produced. Used for replies that are too big to build as a single
+ * UniValue tree first, such as blocks with full transaction details; the
+ * elements can still be small UniValues. The text is exactly what
+ * UniValue::write() would produce for the same document.
+ */
+class JSONWriter
+{
+public:
+    typedef std::function<void(const std::string& chunk)> Sink;
+
+    /** The sink is called whenever more than nChunkSize bytes are buffered */
+    explicit JSONWriter(const Sink& sinkIn, size_t nChunkSizeIn = 64 * 1024);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    /** Start a member of the current object; its value follows */
+    void Key(const std::string& key);
+    void Value(const UniValue& val);
+    /** End the document with a newline, like replies written in one go, and pass on everything buffered */
+    void Finish();
+
+private:
+    void Separate();
+    void MaybeFlush();
+
+    Sink sink;
+    size_t nChunkSize;
+    std::string buf;
+    //! For every open object or array, whether it has an element yet
+    std::vector<bool> vHasElements;
+    bool fAfterKey;
+};
+
+/** Write a JSON-RPC reply as JSONRPCReply would, with writeResult writing the result */
+void JSONRPCReply(JSONWriter& writer, const std::function<void(JSONWriter&)>& writeResult, const UniValue& id);
+
 /** Get name of RPC authentication cookie file */
 fs::path GetAuthCookieFile();
 /** Generate a new RPC authentication cookie and write it to disk */
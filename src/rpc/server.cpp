@@ -309,6 +309,14 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
     return true;
 }
 
+bool CRPCTable::appendStreamingCommand(const std::string& name, rpcstreamfn_type fn)
+{
+    if (IsRPCRunning() || !mapCommands.count(name))
+        return false;
+
+    return mapStreamingCommands.emplace(name, fn).second;
+}
+
 bool StartRPC()
 {
     LogPrint(BCLog::RPC, "Starting RPC\n");
@@ -470,7 +478,20 @@ static inline JSONRPCRequest transformNamedArguments(const JSONRPCRequest& in, c
     return out;
 }
 
-UniValue CRPCTable::execute(const JSONRPCRequest &request) const
+UniValue CRPCTable::executeCommand(const CRPCCommand& cmd, const JSONRPCRequest& request, RPCResultWriter* pwriter) const
+{
+    if (pwriter) {
+        std::map<std::string, rpcstreamfn_type>::const_iterator it = mapStreamingCommands.find(cmd.name);
+        if (it != mapStreamingCommands.end()) {
+            *pwriter = it->second(request);
+            if (*pwriter)
+                return NullUniValue;
+        }
+    }
+    return cmd.actor(request);
+}
+
+UniValue CRPCTable::execute(const JSONRPCRequest &request, RPCResultWriter* pwriter) const
 {
     // Return immediately if in warmup
     {
@@ -490,9 +511,9 @@ UniValue CRPCTable::execute(const JSONRPCRequest &request) const
     {
         // Execute, convert arguments to array if necessary
         if (request.params.isObject()) {
-            return pcmd->actor(transformNamedArguments(request, pcmd->argNames));
+            return executeCommand(*pcmd, transformNamedArguments(request, pcmd->argNames), pwriter);
         } else {
-            return pcmd->actor(request);
+            return executeCommand(*pcmd, request, pwriter);
         }
     }
     catch (const std::exception& e)
@@ -10,6 +10,7 @@
 #include "rpc/protocol.h"
 #include "uint256.h"
 
+#include <functional>
 #include <list>
 #include <map>
 #include <stdint.h>
@@ -128,6 +129,15 @@ void RPCRunLater(const std::string& name, std::function<void(void)> func, int64_
 
 typedef UniValue(*rpcfn_type)(const JSONRPCRequest& jsonRequest);
 
+/** Writes the result of a call straight to the reply */
+typedef std::function<void(JSONWriter& writer)> RPCResultWriter;
+/**
+ * Streaming variant of a method with potentially huge results. It checks the
+ * request and throws like the regular actor would, then returns a writer for
+ * the result, or an empty function to leave the call to the regular actor.
+ */
+typedef RPCResultWriter(*rpcstreamfn_type)(const JSONRPCRequest& jsonRequest);
+
 class CRPCCommand
 {
 public:
@@ -145,6 +155,9 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamingCommands;
+
+    UniValue executeCommand(const CRPCCommand& cmd, const JSONRPCRequest& request, RPCResultWriter* pwriter) const;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -153,10 +166,12 @@ public:
     /**
      * Execute a method.
      * @param request The JSONRPCRequest to execute
+     * @param pwriter If given and the method has a streaming variant, may be
+     *                set to a writer for the result instead of returning it.
      * @returns Result of the call.
      * @throws an exception (UniValue) when an error happens.
      */
-    UniValue execute(const JSONRPCRequest &request) const;
+    UniValue execute(const JSONRPCRequest &request, RPCResultWriter* pwriter = nullptr) const;
 
     /**
     * Returns a list of registered commands
@@ -171,6 +186,12 @@ public:
      * Commands cannot be overwritten (returns false).
      */
     bool appendCommand(const std::string& name, const CRPCCommand* pcmd);
+
+    /**
+     * Registers a streaming variant for an appended command. Same restrictions
+     * as appendCommand.
+     */
+    bool appendStreamingCommand(const std::string& name, rpcstreamfn_type fn);
 };
 
 extern CRPCTable tableRPC;
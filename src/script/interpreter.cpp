@@ -6,6 +6,7 @@
 #include "interpreter.h"
 
 #include "primitives/transaction.h"
+#include "crypto/common.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
@@ -33,7 +34,7 @@ inline bool set_error(ScriptError* ret, const ScriptError serror)
 
 } // namespace
 
-bool CastToBool(const valtype& vch)
+bool CastToBool(const CScriptStackElement& vch)
 {
     for (unsigned int i = 0; i < vch.size(); i++)
     {
@@ -54,14 +55,20 @@ bool CastToBool(const valtype& vch)
  */
 #define stacktop(i)  (stack.at(stack.size()+(i)))
 #define altstacktop(i)  (altstack.at(altstack.size()+(i)))
-static inline void popstack(std::vector<valtype>& stack)
+static inline void popstack(CScriptStack& stack)
 {
     if (stack.empty())
         throw std::runtime_error("popstack(): stack empty");
     stack.pop_back();
 }
 
-bool static IsCompressedOrUncompressedPubKey(const valtype &vchPubKey) {
+static inline void pushnum(CScriptStack& stack, const CScriptNum& bn)
+{
+    stack.push_back(CScriptStackElement());
+    bn.getvch(stack.back());
+}
+
+bool static IsCompressedOrUncompressedPubKey(Span<const unsigned char> vchPubKey) {
     if (vchPubKey.size() < 33) {
         //  Non-canonical public key: too short
         return false;
@@ -83,7 +90,7 @@ bool static IsCompressedOrUncompressedPubKey(const valtype &vchPubKey) {
     return true;
 }
 
-bool static IsCompressedPubKey(const valtype &vchPubKey) {
+bool static IsCompressedPubKey(Span<const unsigned char> vchPubKey) {
     if (vchPubKey.size() != 33) {
         //  Non-canonical public key: invalid length for compressed key
         return false;
@@ -105,7 +112,7 @@ bool static IsCompressedPubKey(const valtype &vchPubKey) {
  *
  * This function is consensus-critical since BIP66.
  */
-bool static IsValidSignatureEncoding(const std::vector<unsigned char> &sig) {
+bool static IsValidSignatureEncoding(Span<const unsigned char> sig) {
     // Format: 0x30 [total-length] 0x02 [R-length] [R] 0x02 [S-length] [S] [sighash]
     // * total-length: 1-byte length descriptor of everything that follows,
     //   excluding the sighash byte.
@@ -170,14 +177,14 @@ bool static IsValidSignatureEncoding(const std::vector<unsigned char> &sig) {
     return true;
 }
 
-uint32_t static GetHashType(const valtype &vchSig) {
+uint32_t static GetHashType(Span<const unsigned char> vchSig) {
     if (vchSig.size() == 0)
         return 0;
     // check IsValidSignatureEncoding()'s comment for vchSig format
     return vchSig.back();
 }
 
-bool static IsLowDERSignature(const valtype &vchSig, ScriptError* serror) {
+bool static IsLowDERSignature(Span<const unsigned char> vchSig, ScriptError* serror) {
     if (!IsValidSignatureEncoding(vchSig)) {
         return set_error(serror, SCRIPT_ERR_SIG_DER);
     }
@@ -188,7 +195,7 @@ bool static IsLowDERSignature(const valtype &vchSig, ScriptError* serror) {
     return true;
 }
 
-bool static IsDefinedHashtypeSignature(const valtype &vchSig) {
+bool static IsDefinedHashtypeSignature(Span<const unsigned char> vchSig) {
     if (vchSig.size() == 0) {
         return false;
     }
@@ -203,7 +210,7 @@ bool static UsesForkId(uint32_t nHashType) {
     return nHashType & SIGHASH_FORKID;
 }
 
-bool static UsesForkId(const valtype &vchSig) {
+bool static UsesForkId(Span<const unsigned char> vchSig) {
     uint32_t nHashType = GetHashType(vchSig);
     return UsesForkId(nHashType);
 }
@@ -212,7 +219,7 @@ bool static AllowsNonForkId(unsigned int flags) {
     return flags & SCRIPT_ALLOW_NON_FORKID;
 }
 
-bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror) {
+bool CheckSignatureEncoding(Span<const unsigned char> vchSig, unsigned int flags, ScriptError* serror) {
     // Empty signature. Not strictly DER encoded, but allowed to provide a
     // compact way to provide an invalid signature for use with CHECK(MULTI)SIG
     if (vchSig.size() == 0) {
@@ -235,7 +242,7 @@ bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned i
     return true;
 }
 
-bool static CheckPubKeyEncoding(const valtype &vchPubKey, unsigned int flags, const SigVersion &sigversion, ScriptError* serror) {
+bool static CheckPubKeyEncoding(Span<const unsigned char> vchPubKey, unsigned int flags, const SigVersion &sigversion, ScriptError* serror) {
     if ((flags & SCRIPT_VERIFY_STRICTENC) != 0 && !IsCompressedOrUncompressedPubKey(vchPubKey)) {
         return set_error(serror, SCRIPT_ERR_PUBKEYTYPE);
     }
@@ -246,7 +253,7 @@ bool static CheckPubKeyEncoding(const valtype &vchPubKey, unsigned int flags, co
     return true;
 }
 
-bool static CheckMinimalPush(const valtype& data, opcodetype opcode) {
+bool static CheckMinimalPush(const CScriptStackElement& data, opcodetype opcode) {
     if (data.size() == 0) {
         // Could have used OP_0.
         return opcode == OP_0;
@@ -269,28 +276,29 @@ bool static CheckMinimalPush(const valtype& data, opcodetype opcode) {
     return true;
 }
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
+bool EvalScript(CScriptStack& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
 {
     static const CScriptNum bnZero(0);
     static const CScriptNum bnOne(1);
     // static const CScriptNum bnFalse(0);
     // static const CScriptNum bnTrue(1);
-    static const valtype vchFalse(0);
-    // static const valtype vchZero(0);
-    static const valtype vchTrue(1, 1);
+    static const CScriptStackElement vchFalse;
+    // static const CScriptStackElement vchZero;
+    static const CScriptStackElement vchTrue(1, (unsigned char)1);
 
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
-    valtype vchPushValue;
+    CScriptStackElement vchPushValue;
     std::vector<bool> vfExec;
-    std::vector<valtype> altstack;
+    CScriptStack altstack;
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
     if (script.size() > MAX_SCRIPT_SIZE)
         return set_error(serror, SCRIPT_ERR_SCRIPT_SIZE);
     int nOpCount = 0;
     bool fRequireMinimal = (flags & SCRIPT_VERIFY_MINIMALDATA) != 0;
+    ScriptProfile* profile = checker.GetProfile();
 
     try
     {
@@ -305,6 +313,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                 return set_error(serror, SCRIPT_ERR_BAD_OPCODE);
             if (vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE)
                 return set_error(serror, SCRIPT_ERR_PUSH_SIZE);
+            if (profile && fExec)
+                profile->nOpcodes[opcode]++;
 
             // Note how OP_RESERVED does not count towards the opcode limit.
             if (opcode > OP_16 && ++nOpCount > MAX_OPS_PER_SCRIPT)
@@ -358,7 +368,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                 {
                     // ( -- value)
                     CScriptNum bn((int)opcode - (int)(OP_1 - 1));
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                     // The result of these opcodes should always be the minimal way to push the data
                     // they push, so no need for a CheckMinimalPush here.
                 }
@@ -467,7 +477,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     {
                         if (stack.size() < 1)
                             return set_error(serror, SCRIPT_ERR_UNBALANCED_CONDITIONAL);
-                        valtype& vch = stacktop(-1);
+                        CScriptStackElement& vch = stacktop(-1);
                         if (sigversion == SIGVERSION_WITNESS_V0 && (flags & SCRIPT_VERIFY_MINIMALIF)) {
                             if (vch.size() > 1)
                                 return set_error(serror, SCRIPT_ERR_MINIMALIF);
@@ -556,8 +566,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 -- x1 x2 x1 x2)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
+                    CScriptStackElement vch1 = stacktop(-2);
+                    CScriptStackElement vch2 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -568,9 +578,9 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 x3 -- x1 x2 x3 x1 x2 x3)
                     if (stack.size() < 3)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-3);
-                    valtype vch2 = stacktop(-2);
-                    valtype vch3 = stacktop(-1);
+                    CScriptStackElement vch1 = stacktop(-3);
+                    CScriptStackElement vch2 = stacktop(-2);
+                    CScriptStackElement vch3 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                     stack.push_back(vch3);
@@ -582,8 +592,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 x3 x4 -- x1 x2 x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-4);
-                    valtype vch2 = stacktop(-3);
+                    CScriptStackElement vch1 = stacktop(-4);
+                    CScriptStackElement vch2 = stacktop(-3);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -594,8 +604,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
                     if (stack.size() < 6)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
+                    CScriptStackElement vch1 = stacktop(-6);
+                    CScriptStackElement vch2 = stacktop(-5);
                     stack.erase(stack.end()-6, stack.end()-4);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
@@ -607,8 +617,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 x3 x4 -- x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    swap(stacktop(-4), stacktop(-2));
-                    swap(stacktop(-3), stacktop(-1));
+                    stacktop(-4).swap(stacktop(-2));
+                    stacktop(-3).swap(stacktop(-1));
                 }
                 break;
 
@@ -617,7 +627,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x - 0 | x x)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
+                    CScriptStackElement vch = stacktop(-1);
                     if (CastToBool(vch))
                         stack.push_back(vch);
                 }
@@ -627,7 +637,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                 {
                     // -- stacksize
                     CScriptNum bn(stack.size());
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                 }
                 break;
 
@@ -645,7 +655,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x -- x x)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
+                    CScriptStackElement vch = stacktop(-1);
                     stack.push_back(vch);
                 }
                 break;
@@ -664,7 +674,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 -- x1 x2 x1)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-2);
+                    CScriptStackElement vch = stacktop(-2);
                     stack.push_back(vch);
                 }
                 break;
@@ -680,7 +690,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     popstack(stack);
                     if (n < 0 || n >= (int)stack.size())
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-n-1);
+                    CScriptStackElement vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
                         stack.erase(stack.end()-n-1);
                     stack.push_back(vch);
@@ -694,8 +704,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     //  x2 x3 x1  after second swap
                     if (stack.size() < 3)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    swap(stacktop(-3), stacktop(-2));
-                    swap(stacktop(-2), stacktop(-1));
+                    stacktop(-3).swap(stacktop(-2));
+                    stacktop(-2).swap(stacktop(-1));
                 }
                 break;
 
@@ -704,7 +714,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 -- x2 x1)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    swap(stacktop(-2), stacktop(-1));
+                    stacktop(-2).swap(stacktop(-1));
                 }
                 break;
 
@@ -713,7 +723,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 -- x2 x1 x2)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
+                    CScriptStackElement vch = stacktop(-1);
                     stack.insert(stack.end()-2, vch);
                 }
                 break;
@@ -725,7 +735,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     CScriptNum bn(stacktop(-1).size());
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                 }
                 break;
 
@@ -740,8 +750,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 - bool)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    CScriptStackElement& vch1 = stacktop(-2);
+                    CScriptStackElement& vch2 = stacktop(-1);
                     bool fEqual = (vch1 == vch2);
                     // OP_NOTEQUAL is disabled because it would be too easy to say
                     // something like n != 1 and have some wiseguy pass in 1 with extra
@@ -787,7 +797,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     default:            assert(!"invalid opcode"); break;
                     }
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                 }
                 break;
 
@@ -836,7 +846,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     }
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
 
                     if (opcode == OP_NUMEQUALVERIFY)
                     {
@@ -877,8 +887,9 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (in -- hash)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    CScriptStackElement& vch = stacktop(-1);
+                    CScriptStackElement vchHash;
+                    vchHash.resize((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
                     if (opcode == OP_RIPEMD160)
                         CRIPEMD160().Write(vch.data(), vch.size()).Finalize(vchHash.data());
                     else if (opcode == OP_SHA1)
@@ -908,15 +919,15 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
 
-                    valtype& vchSig    = stacktop(-2);
-                    valtype& vchPubKey = stacktop(-1);
+                    const CScriptStackElement& vchSig = stacktop(-2);
+                    const CScriptStackElement& vchPubKey = stacktop(-1);
 
                     // Subset of script starting at the most recent codeseparator
                     CScript scriptCode(pbegincodehash, pend);
 
                     // Drop the signature in pre-segwit scripts but not segwit scripts
                     if (sigversion == SIGVERSION_BASE) {
-                        scriptCode.FindAndDelete(CScript(vchSig));
+                        scriptCode.FindAndDelete(CScript() << vchSig);
                     }
 
                     if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, sigversion, serror)) {
@@ -978,17 +989,17 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // Drop the signature in pre-segwit scripts but not segwit scripts
                     for (int k = 0; k < nSigsCount; k++)
                     {
-                        valtype& vchSig = stacktop(-isig-k);
+                        const CScriptStackElement& vchSig = stacktop(-isig-k);
                         if (sigversion == SIGVERSION_BASE) {
-                            scriptCode.FindAndDelete(CScript(vchSig));
+                            scriptCode.FindAndDelete(CScript() << vchSig);
                         }
                     }
 
                     bool fSuccess = true;
                     while (fSuccess && nSigsCount > 0)
                     {
-                        valtype& vchSig    = stacktop(-isig);
-                        valtype& vchPubKey = stacktop(-ikey);
+                        const CScriptStackElement& vchSig = stacktop(-isig);
+                        const CScriptStackElement& vchPubKey = stacktop(-ikey);
 
                         // Note how this makes the exact order of pubkey/signature evaluation
                         // distinguishable by CHECKMULTISIG NOT if the STRICTENC flag is set.
@@ -1069,6 +1080,18 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
     return set_success(serror);
 }
 
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
+{
+    CScriptStack scriptStack;
+    for (const valtype& vch : stack)
+        scriptStack.push_back(CScriptStackElement(vch.begin(), vch.end()));
+    bool ret = EvalScript(scriptStack, script, flags, checker, sigversion, serror);
+    stack.clear();
+    for (const CScriptStackElement& vch : scriptStack)
+        stack.emplace_back(vch.begin(), vch.end());
+    return ret;
+}
+
 namespace {
 
 /**
@@ -1277,25 +1300,47 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     return ss.GetHash();
 }
 
+/**
+ * Number of bytes SignatureHash serializes into its final double-SHA256,
+ * mirroring its two digest algorithms.
+ */
+static uint64_t SignatureHashSize(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, SigVersion sigversion)
+{
+    CSizeComputer s(SER_GETHASH, 0);
+    if (sigversion == SIGVERSION_WITNESS_V0 || UsesForkId(nHashType)) {
+        // version, hashPrevouts, hashSequence, outpoint, scriptCode, amount,
+        // nSequence, hashOutputs, nLockTime and sighash type
+        s << txTo.nVersion << uint256() << uint256() << txTo.vin[nIn].prevout << scriptCode << CAmount(0) << txTo.vin[nIn].nSequence << uint256() << txTo.nLockTime << nHashType;
+        return s.size();
+    }
+    if (nIn >= txTo.vin.size() || ((nHashType & 0x1f) == SIGHASH_SINGLE && nIn >= txTo.vout.size()))
+        return 0;
+    s << CTransactionSignatureSerializer(txTo, scriptCode, nIn, nHashType) << nHashType;
+    return s.size();
+}
+
 bool TransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     return pubkey.Verify(sighash, vchSig);
 }
 
-bool TransactionSignatureChecker::CheckSig(const std::vector<unsigned char>& vchSigIn, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const
+bool TransactionSignatureChecker::CheckSig(Span<const unsigned char> vchSigIn, Span<const unsigned char> vchPubKey, const CScript& scriptCode, SigVersion sigversion) const
 {
-    CPubKey pubkey(vchPubKey);
+    CPubKey pubkey(vchPubKey.begin(), vchPubKey.end());
     if (!pubkey.IsValid())
         return false;
 
     // Hash type is one byte tacked on to the end of the signature
-    std::vector<unsigned char> vchSig(vchSigIn);
-    if (vchSig.empty())
+    if (vchSigIn.empty())
         return false;
-    int nHashType = GetHashType(vchSig);
-    vchSig.pop_back();
+    int nHashType = GetHashType(vchSigIn);
+    std::vector<unsigned char> vchSig(vchSigIn.begin(), vchSigIn.end() - 1);
 
     uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, sigversion, this->txdata);
+    if (profile) {
+        profile->nSigChecks++;
+        profile->nSighashBytes += SignatureHashSize(scriptCode, *txTo, nIn, nHashType, sigversion);
+    }
 
     if (!VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -1387,7 +1432,7 @@ bool TransactionSignatureChecker::CheckSequence(const CScriptNum& nSequence) con
 
 static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion, const std::vector<unsigned char>& program, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
 {
-    std::vector<std::vector<unsigned char> > stack;
+    CScriptStack stack;
     CScript scriptPubKey;
 
     if (witversion == 0) {
@@ -1397,7 +1442,8 @@ static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion,
                 return set_error(serror, SCRIPT_ERR_WITNESS_PROGRAM_WITNESS_EMPTY);
             }
             scriptPubKey = CScript(witness.stack.back().begin(), witness.stack.back().end());
-            stack = std::vector<std::vector<unsigned char> >(witness.stack.begin(), witness.stack.end() - 1);
+            for (auto it = witness.stack.begin(); it != witness.stack.end() - 1; ++it)
+                stack.push_back(CScriptStackElement(it->begin(), it->end()));
             uint256 hashScriptPubKey;
             CSHA256().Write(&scriptPubKey[0], scriptPubKey.size()).Finalize(hashScriptPubKey.begin());
             if (memcmp(hashScriptPubKey.begin(), &program[0], 32)) {
@@ -1409,7 +1455,8 @@ static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion,
                 return set_error(serror, SCRIPT_ERR_WITNESS_PROGRAM_MISMATCH); // 2 items in witness
             }
             scriptPubKey << OP_DUP << OP_HASH160 << program << OP_EQUALVERIFY << OP_CHECKSIG;
-            stack = witness.stack;
+            for (const valtype& item : witness.stack)
+                stack.push_back(CScriptStackElement(item.begin(), item.end()));
         } else {
             return set_error(serror, SCRIPT_ERR_WITNESS_PROGRAM_WRONG_LENGTH);
         }
@@ -1438,7 +1485,7 @@ static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion,
     return true;
 }
 
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
 {
     static const CScriptWitness emptyWitness;
     if (witness == nullptr) {
@@ -1452,7 +1499,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY);
     }
 
-    std::vector<std::vector<unsigned char> > stack, stackCopy;
+    CScriptStack stack, stackCopy;
     if (!EvalScript(stack, scriptSig, flags, checker, SIGVERSION_BASE, serror))
         // serror is set
         return false;
@@ -1493,15 +1540,15 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
             return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY);
 
         // Restore stack.
-        swap(stack, stackCopy);
+        stack.swap(stackCopy);
 
         // stack cannot be empty here, because if it was the
         // P2SH  HASH <> EQUAL  scriptPubKey would be evaluated with
         // an empty stack and the EvalScript above would return false.
         assert(!stack.empty());
 
-        const valtype& pubKeySerialized = stack.back();
-        CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
+        const CScriptStackElement& pubKeySerialized = stack.back();
+        CScript pubKey2(pubKeySerialized.data(), pubKeySerialized.data() + pubKeySerialized.size());
         popstack(stack);
 
         if (!EvalScript(stack, pubKey2, flags, checker, SIGVERSION_BASE, serror))
@@ -1557,6 +1604,274 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
     return set_success(serror);
 }
 
+namespace {
+
+/** A data push found by the template matchers below. Points into the script it was read from. */
+struct PushData
+{
+    const unsigned char* data;
+    size_t size;
+
+    Span<const unsigned char> ToSpan() const { return Span<const unsigned char>(data, size); }
+    bool operator==(const PushData& other) const { return size == other.size && memcmp(data, other.data, size) == 0; }
+};
+
+/**
+ * Read a push of 2 to MAX_SCRIPT_ELEMENT_SIZE bytes at p. Only the shortest
+ * encoding is accepted, so a match is a push that EvalScript would perform
+ * unchanged whether or not SCRIPT_VERIFY_MINIMALDATA is set.
+ */
+bool ReadMinimalPush(const unsigned char*& p, const unsigned char* end, PushData& push)
+{
+    if (p >= end)
+        return false;
+    const unsigned char opcode = *p++;
+    size_t size;
+    if (opcode >= 2 && opcode < OP_PUSHDATA1) {
+        size = opcode;
+    } else if (opcode == OP_PUSHDATA1) {
+        if (end - p < 1)
+            return false;
+        size = *p++;
+        if (size < OP_PUSHDATA1)
+            return false;
+    } else if (opcode == OP_PUSHDATA2) {
+        if (end - p < 2)
+            return false;
+        size = ReadLE16(p);
+        p += 2;
+        if (size <= 0xff)
+            return false;
+    } else {
+        return false;
+    }
+    if (size > MAX_SCRIPT_ELEMENT_SIZE || (size_t)(end - p) < size)
+        return false;
+    push.data = p;
+    push.size = size;
+    p += size;
+    return true;
+}
+
+/** CastToBool without copying the element. */
+bool IsTrue(const unsigned char* data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != 0)
+            return i != size - 1 || data[i] != 0x80;
+    }
+    return false;
+}
+
+bool MatchesHash160(const PushData& pubkey, const unsigned char* hash)
+{
+    unsigned char result[CHash160::OUTPUT_SIZE];
+    CHash160().Write(pubkey.data, pubkey.size).Finalize(result);
+    return memcmp(result, hash, sizeof(result)) == 0;
+}
+
+/**
+ * The CHECKSIG at the end of the single key templates and the final
+ * truth test of the script, with the errors EvalScript would report.
+ */
+bool CheckSingleSig(Span<const unsigned char> vchSig, Span<const unsigned char> vchPubKey, const CScript& scriptCode, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
+{
+    if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, sigversion, serror))
+        return false;
+    if (checker.CheckSig(vchSig, vchPubKey, scriptCode, sigversion))
+        return set_success(serror);
+    if ((flags & SCRIPT_VERIFY_NULLFAIL) && vchSig.size())
+        return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
+    return set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+}
+
+/** <sig> <pubkey> spending OP_DUP OP_HASH160 <hash> OP_EQUALVERIFY OP_CHECKSIG. */
+bool VerifyP2PKH(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, bool& fSuccess, ScriptError* serror)
+{
+    const unsigned char* p = scriptSig.data();
+    const unsigned char* end = p + scriptSig.size();
+    PushData sig, pubkey;
+    if (!ReadMinimalPush(p, end, sig) || !ReadMinimalPush(p, end, pubkey) || p != end)
+        return false;
+    const unsigned char* hash = scriptPubKey.data() + 3;
+    // FindAndDelete would remove a signature that equals the hash push from the script code.
+    if (sig.size == 20 && memcmp(sig.data, hash, 20) == 0)
+        return false;
+    if (!MatchesHash160(pubkey, hash)) {
+        fSuccess = set_error(serror, SCRIPT_ERR_EQUALVERIFY);
+        return true;
+    }
+    fSuccess = CheckSingleSig(sig.ToSpan(), pubkey.ToSpan(), scriptPubKey, flags, checker, SIGVERSION_BASE, serror);
+    return true;
+}
+
+/** <sig> spending <pubkey> OP_CHECKSIG. */
+bool VerifyP2PK(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, bool& fSuccess, ScriptError* serror)
+{
+    const unsigned char* p = scriptPubKey.data();
+    const unsigned char* end = p + scriptPubKey.size();
+    PushData sig, pubkey;
+    if (!ReadMinimalPush(p, end, pubkey) || end - p != 1 || *p != OP_CHECKSIG)
+        return false;
+    p = scriptSig.data();
+    end = p + scriptSig.size();
+    if (!ReadMinimalPush(p, end, sig) || p != end || sig == pubkey)
+        return false;
+    fSuccess = CheckSingleSig(sig.ToSpan(), pubkey.ToSpan(), scriptPubKey, flags, checker, SIGVERSION_BASE, serror);
+    return true;
+}
+
+/** OP_0 <sig>... <redeemScript> spending a P2SH scriptPubKey whose redeemScript is m-of-n OP_CHECKMULTISIG. */
+bool VerifyP2SHMultisig(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, bool& fSuccess, ScriptError* serror)
+{
+    // Without P2SH the redeemScript is never run, and the interpreter's answer is cheap anyway.
+    if (!(flags & SCRIPT_VERIFY_P2SH))
+        return false;
+
+    const unsigned char* p = scriptSig.data();
+    const unsigned char* end = p + scriptSig.size();
+    if (p == end || *p++ != OP_0)
+        return false;
+    PushData pushes[17];
+    int nPushes = 0;
+    while (p != end) {
+        if (nPushes == 17 || !ReadMinimalPush(p, end, pushes[nPushes]))
+            return false;
+        nPushes++;
+    }
+    if (nPushes < 2)
+        return false;
+    const PushData& redeem = pushes[nPushes - 1];
+    const PushData* sigs = pushes;
+    const int nSigs = nPushes - 1;
+
+    if (!MatchesHash160(redeem, scriptPubKey.data() + 2)) {
+        fSuccess = set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+        return true;
+    }
+
+    // OP_m <pubkey>... OP_n OP_CHECKMULTISIG, with exactly m signatures supplied.
+    p = redeem.data;
+    end = p + redeem.size;
+    if (*p < OP_1 || *p > OP_16)
+        return false;
+    const int nRequired = CScript::DecodeOP_N((opcodetype)*p++);
+    PushData keys[16];
+    int nKeys = 0;
+    while (end - p > 2) {
+        if (nKeys == 16 || !ReadMinimalPush(p, end, keys[nKeys]))
+            return false;
+        nKeys++;
+    }
+    if (end - p != 2 || p[1] != OP_CHECKMULTISIG || *p != OP_1 + nKeys - 1 || nKeys < nRequired || nSigs != nRequired)
+        return false;
+    // FindAndDelete would remove a signature that equals a key push from the script code.
+    for (int i = 0; i < nSigs; i++) {
+        for (int k = 0; k < nKeys; k++) {
+            if (sigs[i] == keys[k])
+                return false;
+        }
+    }
+
+    // Same order as the OP_CHECKMULTISIG loop in EvalScript: from the last
+    // signature and key backwards.
+    const CScript scriptCode(redeem.data, redeem.data + redeem.size);
+    int isig = nSigs - 1, ikey = nKeys - 1;
+    int nSigsLeft = nSigs, nKeysLeft = nKeys;
+    bool fOk = true;
+    while (fOk && nSigsLeft > 0) {
+        const Span<const unsigned char> vchSig = sigs[isig].ToSpan();
+        const Span<const unsigned char> vchPubKey = keys[ikey].ToSpan();
+        if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, SIGVERSION_BASE, serror)) {
+            fSuccess = false;
+            return true;
+        }
+        if (checker.CheckSig(vchSig, vchPubKey, scriptCode, SIGVERSION_BASE)) {
+            isig--;
+            nSigsLeft--;
+        }
+        ikey--;
+        nKeysLeft--;
+        if (nSigsLeft > nKeysLeft)
+            fOk = false;
+    }
+    if (fOk)
+        fSuccess = set_success(serror);
+    else if (flags & SCRIPT_VERIFY_NULLFAIL)
+        fSuccess = set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
+    else
+        fSuccess = set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+    return true;
+}
+
+/** Empty scriptSig and a <sig> <pubkey> witness spending OP_0 <hash>. */
+bool VerifyP2WPKH(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, bool& fSuccess, ScriptError* serror)
+{
+    if (!(flags & SCRIPT_VERIFY_WITNESS) || scriptSig.size() != 0 || witness == nullptr || witness->stack.size() != 2)
+        return false;
+    const unsigned char* hash = scriptPubKey.data() + 2;
+    if (!IsTrue(hash, 20))
+        return false;
+    const valtype& vchSig = witness->stack[0];
+    const valtype& vchPubKey = witness->stack[1];
+    if (vchSig.size() > MAX_SCRIPT_ELEMENT_SIZE || vchPubKey.size() > MAX_SCRIPT_ELEMENT_SIZE)
+        return false;
+    if (!MatchesHash160(PushData{vchPubKey.data(), vchPubKey.size()}, hash)) {
+        fSuccess = set_error(serror, SCRIPT_ERR_EQUALVERIFY);
+        return true;
+    }
+    unsigned char code[25] = {OP_DUP, OP_HASH160, 20};
+    memcpy(code + 3, hash, 20);
+    code[23] = OP_EQUALVERIFY;
+    code[24] = OP_CHECKSIG;
+    fSuccess = CheckSingleSig(vchSig, vchPubKey, CScript(code, code + sizeof(code)), flags, checker, SIGVERSION_WITNESS_V0, serror);
+    return true;
+}
+
+} // namespace
+
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, bool& fSuccess, ScriptError* serror)
+{
+    // Leave the flag combinations VerifyScriptInterpreted asserts on to it.
+    if ((flags & SCRIPT_VERIFY_WITNESS) && !(flags & SCRIPT_VERIFY_P2SH))
+        return false;
+    if ((flags & SCRIPT_VERIFY_CLEANSTACK) && (~flags & (SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS)))
+        return false;
+
+    const size_t size = scriptPubKey.size();
+    const unsigned char* spk = scriptPubKey.data();
+    try {
+        if (size == 22 && spk[0] == OP_0 && spk[1] == 20)
+            return VerifyP2WPKH(scriptSig, scriptPubKey, witness, flags, checker, fSuccess, serror);
+
+        // Any unexpected witness is only reported once the scripts themselves passed.
+        if ((flags & SCRIPT_VERIFY_WITNESS) && witness != nullptr && !witness->IsNull())
+            return false;
+        if (size == 25 && spk[0] == OP_DUP && spk[1] == OP_HASH160 && spk[2] == 20 && spk[23] == OP_EQUALVERIFY && spk[24] == OP_CHECKSIG)
+            return VerifyP2PKH(scriptSig, scriptPubKey, flags, checker, fSuccess, serror);
+        if (scriptPubKey.IsPayToScriptHash())
+            return VerifyP2SHMultisig(scriptSig, scriptPubKey, flags, checker, fSuccess, serror);
+        if (size >= 2 && spk[size - 1] == OP_CHECKSIG)
+            return VerifyP2PK(scriptSig, scriptPubKey, flags, checker, fSuccess, serror);
+    } catch (...) {
+        // Match EvalScript, which reports anything thrown by the checker this way.
+        fSuccess = set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
+        return true;
+    }
+    return false;
+}
+
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    bool fSuccess;
+    if (VerifyStandardScript(scriptSig, scriptPubKey, witness, flags, checker, fSuccess, serror)) {
+        if (ScriptProfile* profile = checker.GetProfile())
+            profile->fFastPath = true;
+        return fSuccess;
+    }
+    return VerifyScriptInterpreted(scriptSig, scriptPubKey, witness, flags, checker, serror);
+}
+
 size_t static WitnessSigOps(int witversion, const std::vector<unsigned char>& witprogram, const CScriptWitness& witness, int flags)
 {
     if (witversion == 0) {
@@ -7,10 +7,13 @@
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
 #include "script_error.h"
+#include "prevector.h"
 #include "primitives/transaction.h"
+#include "span.h"
 
 #include <vector>
 #include <stdint.h>
+#include <string.h>
 #include <string>
 
 class CPubKey;
@@ -126,7 +129,7 @@ enum
     SCRIPT_ALLOW_NON_FORKID = (1U << 17),
 };
 
-bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror);
+bool CheckSignatureEncoding(Span<const unsigned char> vchSig, unsigned int flags, ScriptError* serror);
 
 struct PrecomputedTransactionData
 {
@@ -143,10 +146,35 @@ enum SigVersion
 
 uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache = nullptr, const int forkid=FORKID_IN_USE);
 
+/**
+ * Counters collected while verifying one input under a profiler. They are
+ * only filled in when the signature checker returns one from GetProfile().
+ */
+struct ScriptProfile
+{
+    //! Times each opcode was executed by EvalScript (pushes included).
+    uint64_t nOpcodes[256];
+    //! Signature checks performed, including failed ones in multisig.
+    unsigned int nSigChecks;
+    //! Signature checks answered from the signature cache.
+    unsigned int nSigCacheHits;
+    //! Bytes serialized into signature hashes. The per-transaction
+    //! midstate hashes of PrecomputedTransactionData are not counted.
+    uint64_t nSighashBytes;
+    //! Whether VerifyStandardScript verified the input without EvalScript.
+    bool fFastPath;
+
+    ScriptProfile() : nSigChecks(0), nSigCacheHits(0), nSighashBytes(0), fFastPath(false)
+    {
+        memset(nOpcodes, 0, sizeof(nOpcodes));
+    }
+};
+
 class BaseSignatureChecker
 {
 public:
-    virtual bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const
+    /** The signature and key are read in place from the interpreter's stack. */
+    virtual bool CheckSig(Span<const unsigned char> scriptSig, Span<const unsigned char> vchPubKey, const CScript& scriptCode, SigVersion sigversion) const
     {
         return false;
     }
@@ -161,6 +189,11 @@ public:
          return false;
     }
 
+    virtual ScriptProfile* GetProfile() const
+    {
+        return nullptr;
+    }
+
     virtual ~BaseSignatureChecker() {}
 };
 
@@ -171,16 +204,21 @@ private:
     unsigned int nIn;
     const CAmount amount;
     const PrecomputedTransactionData* txdata;
+    ScriptProfile* profile;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn) : txTo(txToIn), nIn(nInIn), amount(amountIn), txdata(nullptr) {}
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, const PrecomputedTransactionData& txdataIn) : txTo(txToIn), nIn(nInIn), amount(amountIn), txdata(&txdataIn) {}
-    bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const override;
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn) : txTo(txToIn), nIn(nInIn), amount(amountIn), txdata(nullptr), profile(nullptr) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, const PrecomputedTransactionData& txdataIn) : txTo(txToIn), nIn(nInIn), amount(amountIn), txdata(&txdataIn), profile(nullptr) {}
+    bool CheckSig(Span<const unsigned char> scriptSig, Span<const unsigned char> vchPubKey, const CScript& scriptCode, SigVersion sigversion) const override;
     bool CheckLockTime(const CScriptNum& nLockTime) const override;
     bool CheckSequence(const CScriptNum& nSequence) const override;
+    ScriptProfile* GetProfile() const override { return profile; }
+
+    //! Record the work done by this checker and the interpreter into profileIn.
+    void SetProfile(ScriptProfile* profileIn) { profile = profileIn; }
 };
 
 class MutableTransactionSignatureChecker : public TransactionSignatureChecker
@@ -192,9 +230,30 @@ public:
     MutableTransactionSignatureChecker(const CMutableTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn) : TransactionSignatureChecker(&txTo, nInIn, amountIn), txTo(*txToIn) {}
 };
 
+/**
+ * Element of the interpreter's stack. Signatures, public keys, hashes and
+ * numbers fit in the inline buffer, so pushing them does not allocate.
+ */
+typedef prevector<76, unsigned char> CScriptStackElement;
+/** The interpreter's stack. Holds the stacks of standard scripts without allocating; its elements are relocated bytewise (see is_trivially_relocatable). */
+typedef prevector<16, CScriptStackElement> CScriptStack;
+
+bool EvalScript(CScriptStack& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* error = nullptr);
+/** EvalScript on a std::vector stack, for callers outside of script verification. */
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* error = nullptr);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror = nullptr);
 
+/**
+ * Verify the standard P2PKH, P2PK, P2SH multisig and P2WPKH spends directly,
+ * without running them through EvalScript. Returns false if the scripts are
+ * not of one of these forms, or use an encoding the fast paths leave to the
+ * interpreter. Otherwise returns true and sets fSuccess and serror to what
+ * VerifyScriptInterpreted would have returned. VerifyScript tries this first.
+ */
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, bool& fSuccess, ScriptError* serror = nullptr);
+/** VerifyScript without the fast paths: every script is run through EvalScript. */
+bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror = nullptr);
+
 size_t CountWitnessSigOps(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags);
 
 #endif // BITCOIN_SCRIPT_INTERPRETER_H
@@ -9,6 +9,7 @@
 #include "crypto/common.h"
 #include "prevector.h"
 #include "serialize.h"
+#include "span.h"
 
 #include <assert.h>
 #include <climits>
@@ -221,7 +222,8 @@ public:
 
     static const size_t nDefaultMaxNumSize = 4;
 
-    explicit CScriptNum(const std::vector<unsigned char>& vch, bool fRequireMinimal,
+    template <typename Vch>
+    explicit CScriptNum(const Vch& vch, bool fRequireMinimal,
                         const size_t nMaxNumSize = nDefaultMaxNumSize)
     {
         if (vch.size() > nMaxNumSize) {
@@ -323,12 +325,27 @@ public:
         return serialize(m_value);
     }
 
+    /** Serialize into any byte container, e.g. a script stack element. */
+    template <typename Vch>
+    void getvch(Vch& result) const
+    {
+        serialize(m_value, result);
+    }
+
     static std::vector<unsigned char> serialize(const int64_t& value)
     {
+        std::vector<unsigned char> result;
+        serialize(value, result);
+        return result;
+    }
+
+    template <typename Vch>
+    static void serialize(const int64_t& value, Vch& result)
+    {
+        result.clear();
         if(value == 0)
-            return std::vector<unsigned char>();
+            return;
 
-        std::vector<unsigned char> result;
         const bool neg = value < 0;
         uint64_t absvalue = neg ? -value : value;
 
@@ -352,12 +369,11 @@ public:
             result.push_back(neg ? 0x80 : 0);
         else if (neg)
             result.back() |= 0x80;
-
-        return result;
     }
 
 private:
-    static int64_t set_vch(const std::vector<unsigned char>& vch)
+    template <typename Vch>
+    static int64_t set_vch(const Vch& vch)
     {
       if (vch.empty())
           return 0;
@@ -449,6 +465,11 @@ public:
     }
 
     CScript& operator<<(const std::vector<unsigned char>& b)
+    {
+        return *this << Span<const unsigned char>(b.data(), b.size());
+    }
+
+    CScript& operator<<(Span<const unsigned char> b)
     {
         if (b.size() < OP_PUSHDATA1)
         {
@@ -498,7 +519,7 @@ public:
     bool GetOp(iterator& pc, opcodetype& opcodeRet)
     {
          const_iterator pc2 = pc;
-         bool fRet = GetOp2(pc2, opcodeRet, nullptr);
+         bool fRet = GetOp2(pc2, opcodeRet, (std::vector<unsigned char>*)nullptr);
          pc = begin() + (pc2 - begin());
          return fRet;
     }
@@ -510,10 +531,18 @@ public:
 
     bool GetOp(const_iterator& pc, opcodetype& opcodeRet) const
     {
-        return GetOp2(pc, opcodeRet, nullptr);
+        return GetOp2(pc, opcodeRet, (std::vector<unsigned char>*)nullptr);
+    }
+
+    /** GetOp into any byte container, such as an interpreter stack element. */
+    template <typename Vch>
+    bool GetOp(const_iterator& pc, opcodetype& opcodeRet, Vch& vchRet) const
+    {
+        return GetOp2(pc, opcodeRet, &vchRet);
     }
 
-    bool GetOp2(const_iterator& pc, opcodetype& opcodeRet, std::vector<unsigned char>* pvchRet) const
+    template <typename Vch>
+    bool GetOp2(const_iterator& pc, opcodetype& opcodeRet, Vch* pvchRet) const
     {
         opcodeRet = OP_INVALIDOPCODE;
         if (pvchRet)
@@ -556,8 +585,8 @@ public:
             }
             if (end() - pc < 0 || (unsigned int)(end() - pc) < nSize)
                 return false;
-            if (pvchRet)
-                pvchRet->assign(pc, pc + nSize);
+            if (pvchRet && nSize > 0)
+                pvchRet->assign(&*pc, &*pc + nSize);
             pc += nSize;
         }
 
@@ -12,7 +12,6 @@
 #include "util.h"
 
 #include "cuckoocache.h"
-#include <boost/thread.hpp>
 
 namespace {
 /**
@@ -25,9 +24,8 @@ class CSignatureCache
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    typedef CuckooCache::sharded_cache<uint256, SignatureCacheHasher> map_type;
     map_type setValid;
-    boost::shared_mutex cs_sigcache;
 
 public:
     CSignatureCache()
@@ -44,19 +42,25 @@ public:
     bool
     Get(const uint256& entry, const bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
         return setValid.contains(entry, erase);
     }
 
     void Set(uint256& entry)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
         setValid.insert(entry);
     }
     uint32_t setup_bytes(size_t n)
     {
         return setValid.setup_bytes(n);
     }
+    CuckooCache::cache_stats stats() const
+    {
+        return setValid.stats();
+    }
+    void reset_stats()
+    {
+        setValid.reset_stats();
+    }
 };
 
 /* In previous versions of this code, signatureCache was a local static variable
@@ -80,12 +84,23 @@ void InitSignatureCache()
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+CuckooCache::cache_stats GetSignatureCacheStats(bool fReset)
+{
+    CuckooCache::cache_stats stats = signatureCache.stats();
+    if (fReset)
+        signatureCache.reset_stats();
+    return stats;
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
-    if (signatureCache.Get(entry, !store))
+    if (signatureCache.Get(entry, !store && erase)) {
+        if (ScriptProfile* profile = GetProfile())
+            profile->nSigCacheHits++;
         return true;
+    }
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
     if (store)
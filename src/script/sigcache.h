@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include "cuckoocache.h"
 #include "script/interpreter.h"
 
 #include <vector>
@@ -44,13 +45,22 @@ class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
+    bool erase;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, bool storeIn, PrecomputedTransactionData& txdataIn) : TransactionSignatureChecker(txToIn, nInIn, amountIn, txdataIn), store(storeIn) {}
+    /**
+     * With storeIn, verified signatures are added to the cache. Otherwise the
+     * signatures found in it are removed, unless eraseIn is false, which makes
+     * the lookup read-only.
+     */
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, bool storeIn, PrecomputedTransactionData& txdataIn, bool eraseIn = true) : TransactionSignatureChecker(txToIn, nInIn, amountIn, txdataIn), store(storeIn), erase(eraseIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
 };
 
 void InitSignatureCache();
 
+/** Return the signature cache hit counters, and zero them if fReset is set. */
+CuckooCache::cache_stats GetSignatureCacheStats(bool fReset = false);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,42 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SPAN_H
+#define BITCOIN_SPAN_H
+
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+
+/** A Span is an object that can refer to a contiguous sequence of objects.
+ *
+ * It implements a subset of C++20's std::span. It does not own the objects,
+ * so it must not outlive the container it was made from.
+ */
+template<typename C>
+class Span
+{
+    C* m_data;
+    size_t m_size;
+
+public:
+    constexpr Span() noexcept : m_data(nullptr), m_size(0) {}
+    constexpr Span(C* data, size_t size) noexcept : m_data(data), m_size(size) {}
+    constexpr Span(C* data, C* end) noexcept : m_data(data), m_size(end - data) {}
+
+    /** Refer to the contents of a container with contiguous storage, such
+     *  as std::vector or prevector. */
+    template<typename V, typename = typename std::enable_if<std::is_convertible<decltype(std::declval<V&>().data()), C*>::value>::type>
+    constexpr Span(V& other) noexcept : m_data(other.data()), m_size(other.size()) {}
+
+    constexpr C* data() const noexcept { return m_data; }
+    constexpr C* begin() const noexcept { return m_data; }
+    constexpr C* end() const noexcept { return m_data + m_size; }
+    constexpr C& back() const noexcept { return m_data[m_size - 1]; }
+    constexpr size_t size() const noexcept { return m_size; }
+    constexpr bool empty() const noexcept { return m_size == 0; }
+    constexpr C& operator[](size_t pos) const noexcept { return m_data[pos]; }
+};
+
+#endif // BITCOIN_SPAN_H
@@ -16,6 +16,7 @@
 #include <mutex>
 #include <condition_variable>
 
+#include <set>
 #include <unordered_set>
 #include <memory>
 #include "random.h"
@@ -125,7 +126,27 @@ struct FrozenCleanupCheck {
     void swap(FrozenCleanupCheck& x){std::swap(should_freeze, x.should_freeze);};
 };
 
+/** Blocks until checks have run on nThreads different threads at once, or a timeout. */
+struct StealCheck {
+    static std::mutex m;
+    static std::condition_variable cv;
+    static std::set<std::thread::id> threads;
+    static size_t nThreads;
+    bool operator()()
+    {
+        std::unique_lock<std::mutex> l(m);
+        threads.insert(std::this_thread::get_id());
+        cv.notify_all();
+        return cv.wait_for(l, std::chrono::seconds(10), []{ return threads.size() >= nThreads; });
+    }
+    void swap(StealCheck& x){};
+};
+
 // Static Allocations
+std::mutex StealCheck::m;
+std::condition_variable StealCheck::cv;
+std::set<std::thread::id> StealCheck::threads;
+size_t StealCheck::nThreads{0};
 std::mutex FrozenCleanupCheck::m{};
 std::atomic<uint64_t> FrozenCleanupCheck::nFrozen{0};
 std::condition_variable FrozenCleanupCheck::cv{};
@@ -141,6 +162,7 @@ typedef CCheckQueue<FailingCheck> Failing_Queue;
 typedef CCheckQueue<UniqueCheck> Unique_Queue;
 typedef CCheckQueue<MemoryCheck> Memory_Queue;
 typedef CCheckQueue<FrozenCleanupCheck> FrozenCleanup_Queue;
+typedef CCheckQueue<StealCheck> Steal_Queue;
 
 
 /** This test case checks that the CCheckQueue works properly
@@ -302,6 +324,61 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
     tg.join_all();
 }
 
+// Test that checks added as one batch, which all land in a single worker's
+// deque, are taken up by the other workers and the master as well
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Stealing)
+{
+    auto queue = std::unique_ptr<Steal_Queue>(new Steal_Queue {1});
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+       tg.create_thread([&]{queue->Thread();});
+    }
+    // Each check only returns once the checks are running on every worker
+    // and the master at the same time.
+    StealCheck::threads.clear();
+    StealCheck::nThreads = nScriptCheckThreads + 1;
+    {
+        CCheckQueueControl<StealCheck> control(queue.get());
+        std::vector<StealCheck> vChecks(nScriptCheckThreads + 1);
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+    }
+    BOOST_CHECK_EQUAL(StealCheck::threads.size(), (size_t)nScriptCheckThreads + 1);
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+// Test that batches of very different sizes, from single checks to many times
+// the batch size, are all run exactly once
+BOOST_AUTO_TEST_CASE(test_CheckQueue_UnevenBatches)
+{
+    auto queue = std::unique_ptr<Unique_Queue>(new Unique_Queue {QUEUE_BATCH_SIZE});
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+       tg.create_thread([&]{queue->Thread();});
+    }
+    UniqueCheck::results.clear();
+    size_t COUNT = 0;
+    for (int i = 0; i < 100; i++) {
+        {
+            CCheckQueueControl<UniqueCheck> control(queue.get());
+            for (size_t nBatch : {(size_t)1, (size_t)QUEUE_BATCH_SIZE * 40, (size_t)0, (size_t)2, (size_t)InsecureRandRange(QUEUE_BATCH_SIZE * 8), (size_t)1}) {
+                std::vector<UniqueCheck> vChecks;
+                for (size_t k = 0; k < nBatch; k++)
+                    vChecks.emplace_back(COUNT++);
+                control.Add(vChecks);
+            }
+            BOOST_REQUIRE(control.Wait());
+        }
+        BOOST_REQUIRE_EQUAL(UniqueCheck::results.size(), COUNT);
+    }
+    bool r = true;
+    for (size_t i = 0; i < COUNT; ++i)
+        r = r && UniqueCheck::results.count(i) == 1;
+    BOOST_REQUIRE(r);
+    tg.interrupt_all();
+    tg.join_all();
+}
 
 // Test that blocks which might allocate lots of memory free their memory aggressively.
 //
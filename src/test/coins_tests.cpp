@@ -8,6 +8,7 @@
 #include "undo.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
+#include "txdb.h"
 #include "validation.h"
 #include "consensus/validation.h"
 
@@ -34,6 +35,7 @@ class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
     std::map<COutPoint, Coin> map_;
+    CRollingCoinsStats stats_;
 
 public:
     bool GetCoin(const COutPoint& outpoint, Coin& coin) const override
@@ -52,10 +54,20 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    bool GetRollingStats(CRollingCoinsStats& stats) const override
     {
+        stats = stats_;
+        return true;
+    }
+
+    bool TracksRollingStats() const override { return true; }
+
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CRollingCoinsStats& statsDelta, size_t& nDirty) override
+    {
+        nDirty = 0;
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                nDirty++;
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
                 map_[it->first] = it->second.coin;
                 if (it->second.coin.IsSpent() && InsecureRandRange(3) == 0) {
@@ -67,6 +79,7 @@ public:
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
+        stats_ += statsDelta;
         return true;
     }
 };
@@ -74,7 +87,7 @@ public:
 class CCoinsViewCacheTest : public CCoinsViewCache
 {
 public:
-    CCoinsViewCacheTest(CCoinsView* _base) : CCoinsViewCache(_base) {}
+    CCoinsViewCacheTest(CCoinsView* _base, CCoinsCacheStats* _stats = nullptr) : CCoinsViewCache(_base, _stats) {}
 
     void SelfTest() const
     {
@@ -93,6 +106,25 @@ public:
     size_t& usage() { return cachedCoinsUsage; }
 };
 
+//! Compare the rolling stats of a view with the ones recomputed from the expected coins
+void CheckRollingStats(const CCoinsView& view, const std::map<COutPoint, Coin>& coins)
+{
+    CRollingCoinsStats expected, actual;
+    for (const auto& entry : coins) {
+        if (!entry.second.IsSpent() && !entry.second.out.scriptPubKey.IsUnspendable()) {
+            expected.Add(entry.first, entry.second);
+        }
+    }
+    BOOST_CHECK(view.GetRollingStats(actual));
+    uint256 expected_hash, actual_hash;
+    expected.muhash.Finalize(expected_hash);
+    actual.muhash.Finalize(actual_hash);
+    BOOST_CHECK(expected_hash == actual_hash);
+    BOOST_CHECK_EQUAL(expected.nTransactionOutputs, actual.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(expected.nBogoSize, actual.nBogoSize);
+    BOOST_CHECK_EQUAL(expected.nTotalAmount, actual.nTotalAmount);
+}
+
 } // namespace
 
 BOOST_FIXTURE_TEST_SUITE(coins_tests, BasicTestingSetup)
@@ -204,6 +236,9 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             for (const CCoinsViewCacheTest *test : stack) {
                 test->SelfTest();
             }
+            if (i == NUM_SIMULATION_ITERATIONS - 1) {
+                CheckRollingStats(*stack.back(), result);
+            }
         }
 
         if (InsecureRandRange(100) == 0) {
@@ -426,6 +461,9 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
                 BOOST_CHECK(have == !coin.IsSpent());
                 BOOST_CHECK(coin == it->second);
             }
+            if (i == NUM_SIMULATION_ITERATIONS - 1) {
+                CheckRollingStats(*stack.back(), result);
+            }
         }
 
         // One every 10 iterations, remove a random entry from the cache
@@ -473,6 +511,31 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
+BOOST_AUTO_TEST_CASE(rolling_stats_opt_in)
+{
+    // Caches only keep the rolling stats if the view at the bottom of the
+    // stack asks for them.
+    const COutPoint outpoint(InsecureRand256(), 0);
+    const Coin coin(CTxOut(COIN, CScript() << OP_TRUE), 1, true);
+    CRollingCoinsStats stats;
+
+    CCoinsView dummy;
+    CCoinsViewCacheTest plain1(&dummy);
+    CCoinsViewCacheTest plain2(&plain1);
+    BOOST_CHECK(!plain2.TracksRollingStats());
+    plain2.AddCoin(outpoint, Coin(coin), true);
+    BOOST_CHECK(!plain2.GetRollingStats(stats));
+
+    CCoinsViewTest base;
+    CCoinsViewCacheTest tracking1(&base);
+    CCoinsViewCacheTest tracking2(&tracking1);
+    BOOST_CHECK(tracking2.TracksRollingStats());
+    tracking2.AddCoin(outpoint, Coin(coin), true);
+    CheckRollingStats(tracking2, {{outpoint, coin}});
+    tracking2.Flush();
+    CheckRollingStats(tracking1, {{outpoint, coin}});
+}
+
 BOOST_AUTO_TEST_CASE(ccoins_serialization)
 {
     // Good example
@@ -588,7 +651,8 @@ void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
     CCoinsMap map;
     InsertCoinsMapEntry(map, value, flags);
-    view.BatchWrite(map, {});
+    size_t nDirty;
+    view.BatchWrite(map, {}, CRollingCoinsStats(), nDirty);
 }
 
 class SingleEntryCacheTest
@@ -855,4 +919,142 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_db_bulk_write)
+{
+    // Flush the same random set through a CCoinsViewDB with and without
+    // bulk (sorted) writes, using a tiny batch size so the flush is split
+    // into many partial batches, and check both databases agree.
+    gArgs.ForceSetArg("-dbbatchsize", "1024");
+    CCoinsViewDB dbPlain(1 << 20, true);
+    CCoinsViewDB dbBulk(1 << 20, true);
+    dbBulk.SetBulkWriteMode(true);
+
+    std::map<COutPoint, Coin> result;
+    for (int round = 0; round < 3; ++round) {
+        CCoinsViewCache cachePlain(&dbPlain);
+        CCoinsViewCache cacheBulk(&dbBulk);
+        for (int i = 0; i < 500; ++i) {
+            if (!result.empty() && InsecureRandBits(2) == 0) {
+                // Spend a coin written in an earlier round.
+                auto it = result.begin();
+                std::advance(it, InsecureRandRange(result.size()));
+                cachePlain.SpendCoin(it->first);
+                cacheBulk.SpendCoin(it->first);
+                result.erase(it);
+                continue;
+            }
+            COutPoint outpoint(InsecureRand256(), InsecureRandRange(300));
+            Coin coin;
+            coin.out.nValue = InsecureRand32();
+            coin.nHeight = round + 1;
+            coin.out.scriptPubKey.assign(InsecureRandBits(4), 0);
+            cachePlain.AddCoin(outpoint, Coin(coin), false);
+            cacheBulk.AddCoin(outpoint, Coin(coin), false);
+            result[outpoint] = coin;
+        }
+        uint256 hashBlock = InsecureRand256();
+        cachePlain.SetBestBlock(hashBlock);
+        cacheBulk.SetBestBlock(hashBlock);
+        BOOST_CHECK(cachePlain.Flush());
+        BOOST_CHECK(cacheBulk.Flush());
+        BOOST_CHECK(dbBulk.GetBestBlock() == hashBlock);
+    }
+    gArgs.ForceSetArg("-dbbatchsize", std::to_string(nDefaultDbBatchSize));
+
+    for (CCoinsView* view : std::vector<CCoinsView*>{&dbPlain, &dbBulk}) {
+        std::unique_ptr<CCoinsViewCursor> cursor(view->Cursor());
+        size_t found = 0;
+        for (; cursor->Valid(); cursor->Next()) {
+            COutPoint key;
+            Coin coin;
+            BOOST_CHECK(cursor->GetKey(key));
+            BOOST_CHECK(cursor->GetValue(coin));
+            auto it = result.find(key);
+            BOOST_CHECK(it != result.end() && it->second == coin);
+            ++found;
+        }
+        BOOST_CHECK_EQUAL(found, result.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_cache_stats)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest parent(&base);
+    CCoinsCacheStats shared;
+    COutPoint op1(InsecureRand256(), 0), op2(InsecureRand256(), 1), op3(InsecureRand256(), 2);
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.out.scriptPubKey.assign(1, OP_TRUE);
+
+    parent.AddCoin(op1, Coin(coin), false);
+    BOOST_CHECK(parent.Flush());
+    BOOST_CHECK_EQUAL(parent.GetStats().nFlushes.load(), 1U);
+    BOOST_CHECK_EQUAL(parent.GetStats().nFlushedDirty.load(), 1U);
+
+    for (int round = 0; round < 2; ++round) {
+        CCoinsViewCacheTest child(&parent, &shared);
+        BOOST_CHECK(&child.GetStats() == &shared);
+        BOOST_CHECK(child.HaveCoin(op1));    // miss in child and parent, found in base
+        BOOST_CHECK(child.HaveCoin(op1));    // hit
+        BOOST_CHECK(!child.HaveCoin(op2));   // miss, not found
+        child.AddCoin(op3, Coin(coin), false);
+        BOOST_CHECK(child.SpendCoin(op3));   // hit; fresh, so dropped without a write
+        child.Uncache(op1);
+    }
+    BOOST_CHECK_EQUAL(shared.nHits.load(), 4U);
+    BOOST_CHECK_EQUAL(shared.nMisses.load(), 4U);
+    BOOST_CHECK_EQUAL(shared.nMissesFound.load(), 2U);
+    BOOST_CHECK_EQUAL(shared.nAdded.load(), 2U);
+    BOOST_CHECK_EQUAL(shared.nAddedFresh.load(), 2U);
+    BOOST_CHECK_EQUAL(shared.nSpent.load(), 2U);
+    BOOST_CHECK_EQUAL(shared.nSpentFresh.load(), 2U);
+    BOOST_CHECK_EQUAL(shared.nUncached.load(), 2U);
+    BOOST_CHECK_EQUAL(shared.HitRate(), 0.5);
+    // The parent served the child's first lookup of op1 from the base once
+    // and from its own cache the second time.
+    BOOST_CHECK_EQUAL(parent.GetStats().nHits.load(), 1U);
+
+    shared.Reset();
+    BOOST_CHECK_EQUAL(shared.nHits.load(), 0U);
+    BOOST_CHECK_EQUAL(shared.HitRate(), 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_getcoins)
+{
+    // A batched lookup through a cache on top of a database agrees with
+    // individual lookups, and leaves the found coins cached.
+    CCoinsViewDB db(1 << 20, true);
+    std::vector<COutPoint> outpoints;
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 300; i++) {
+            outpoints.emplace_back(InsecureRand256(), InsecureRandRange(4));
+            if (i % 3 == 0) continue; // not in the set
+            Coin coin;
+            coin.out.nValue = InsecureRand32();
+            coin.out.scriptPubKey.assign(InsecureRandBits(4) + 1, 0);
+            cache.AddCoin(outpoints.back(), std::move(coin), false);
+        }
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CCoinsViewCacheTest cache(&db);
+    // One outpoint is already cached and spent, which must not be fetched again.
+    BOOST_CHECK(cache.SpendCoin(outpoints[1]));
+    std::vector<Coin> coins;
+    size_t found = cache.GetCoins(outpoints, coins);
+    BOOST_CHECK_EQUAL(coins.size(), outpoints.size());
+    BOOST_CHECK_EQUAL(found, 199U);
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        Coin coin;
+        bool have = i != 1 && db.GetCoin(outpoints[i], coin);
+        BOOST_CHECK_EQUAL(have, !coins[i].IsSpent());
+        BOOST_CHECK_EQUAL(have, cache.HaveCoinInCache(outpoints[i]));
+        if (have) BOOST_CHECK(coin == coins[i]);
+    }
+    cache.SelfTest();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
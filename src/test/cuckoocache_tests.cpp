@@ -125,6 +125,8 @@ BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate_ok)
     for (double load = 0.1; load < 2; load *= 2) {
         double hits = test_cache<CuckooCache::cache<uint256, SignatureCacheHasher>>(megabytes, load);
         BOOST_CHECK(normalize_hit_rate(hits, load) > HitRateThresh);
+        double sharded_hits = test_cache<CuckooCache::sharded_cache<uint256, SignatureCacheHasher>>(megabytes, load);
+        BOOST_CHECK(normalize_hit_rate(sharded_hits, load) > HitRateThresh);
     }
 }
 
@@ -192,6 +194,7 @@ BOOST_AUTO_TEST_CASE(cuckoocache_erase_ok)
 {
     size_t megabytes = 4;
     test_cache_erase<CuckooCache::cache<uint256, SignatureCacheHasher>>(megabytes);
+    test_cache_erase<CuckooCache::sharded_cache<uint256, SignatureCacheHasher>>(megabytes);
 }
 
 template <typename Cache>
@@ -375,6 +378,50 @@ void test_cache_generations()
 BOOST_AUTO_TEST_CASE(cuckoocache_generations)
 {
     test_cache_generations<CuckooCache::cache<uint256, SignatureCacheHasher>>();
+    test_cache_generations<CuckooCache::sharded_cache<uint256, SignatureCacheHasher>>();
+}
+
+/* Check that a sharded cache can be written and read from several threads
+ * without any external locking, and that it counts every access.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_sharded_concurrent)
+{
+    local_rand_ctx = FastRandomContext(true);
+    CuckooCache::sharded_cache<uint256, SignatureCacheHasher> set{};
+    size_t bytes = 4 * (1 << 20);
+    set.setup_bytes(bytes);
+    const uint32_t n_threads = 4;
+    const uint32_t n_per_thread = (bytes / sizeof(uint256)) / 2 / n_threads;
+    std::vector<uint256> hashes(n_threads * n_per_thread);
+    for (uint256& h : hashes)
+        insecure_GetRandHash(h);
+
+    // Every thread inserts its own slice while looking up the previous
+    // thread's slice, which is being inserted at the same time.
+    std::vector<std::thread> threads;
+    for (uint32_t x = 0; x < n_threads; ++x)
+        threads.emplace_back([&, x] {
+            uint32_t other = (x + n_threads - 1) % n_threads;
+            for (uint32_t i = 0; i < n_per_thread; ++i) {
+                set.insert(hashes[x * n_per_thread + i]);
+                set.contains(hashes[other * n_per_thread + i], false);
+            }
+        });
+    for (std::thread& t : threads)
+        t.join();
+
+    CuckooCache::cache_stats stats = set.stats();
+    BOOST_CHECK_EQUAL(stats.inserts, hashes.size());
+    BOOST_CHECK_EQUAL(stats.hits + stats.misses, hashes.size());
+
+    // At half load, (nearly) everything inserted must be found afterwards.
+    set.reset_stats();
+    for (const uint256& h : hashes)
+        set.contains(h, false);
+    stats = set.stats();
+    BOOST_CHECK_EQUAL(stats.hits + stats.misses, hashes.size());
+    BOOST_CHECK(stats.hits > 0.98 * hashes.size());
+    BOOST_CHECK_EQUAL(stats.inserts, 0U);
 }
 
 BOOST_AUTO_TEST_SUITE_END();
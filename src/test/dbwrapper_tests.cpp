@@ -77,6 +77,44 @@ BOOST_AUTO_TEST_CASE(dbwrapper_batch)
     }
 }
 
+// Test batched reads, single- and multi-threaded
+BOOST_AUTO_TEST_CASE(dbwrapper_readmany)
+{
+    for (bool obfuscate : {false, true}) {
+        fs::path ph = fs::temp_directory_path() / fs::unique_path();
+        CDBWrapper dbw(ph, (1 << 20), true, false, obfuscate);
+
+        // Store every even key; look up all of them in shuffled order.
+        std::vector<std::pair<char, uint32_t>> keys;
+        std::map<uint32_t, uint256> stored;
+        CDBBatch batch(dbw);
+        for (uint32_t i = 0; i < 1000; i++) {
+            keys.emplace_back('m', i);
+            if (i % 2 == 0) {
+                stored[i] = InsecureRand256();
+                batch.Write(keys.back(), stored[i]);
+            }
+        }
+        dbw.WriteBatch(batch);
+        for (size_t i = keys.size() - 1; i > 0; i--) {
+            std::swap(keys[i], keys[InsecureRandRange(i + 1)]);
+        }
+
+        for (int nThreads : {1, 4}) {
+            std::vector<uint256> values;
+            std::vector<bool> found;
+            BOOST_CHECK_EQUAL(dbw.ReadMany(keys, values, found, nThreads), stored.size());
+            BOOST_CHECK_EQUAL(values.size(), keys.size());
+            for (size_t i = 0; i < keys.size(); i++) {
+                BOOST_CHECK_EQUAL(bool(found[i]), keys[i].second % 2 == 0);
+                if (found[i]) {
+                    BOOST_CHECK(values[i] == stored[keys[i].second]);
+                }
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
 {
     // Perform tests both obfuscated and non-obfuscated.
@@ -158,4 +158,43 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("2052d8a32079c11e79db95af63bb9600c5b04f21a9ca33dc129c2bfa8ac9dc1cd561d8ae5e0f6c1a16bde3719c64c2fd70e404b6428ab9a69566962e8771b5944d"));
 }
 
+BOOST_AUTO_TEST_CASE(pubkey_parse_cache)
+{
+    // Repeated verifications reuse the per-thread parsed key; make sure a
+    // key sharing a cache slot with another one is never confused with it.
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    do {
+        key2.MakeNewKey(true);
+    } while (key2.GetPubKey()[1] != key1.GetPubKey()[1]);
+    CPubKey pubkey1 = key1.GetPubKey(), pubkey2 = key2.GetPubKey();
+    BOOST_CHECK(pubkey1 != pubkey2);
+
+    std::string strMsg = "Very cached message";
+    uint256 hash = Hash(strMsg.begin(), strMsg.end());
+    std::vector<unsigned char> sig1, sig2;
+    BOOST_CHECK(key1.Sign(hash, sig1));
+    BOOST_CHECK(key2.Sign(hash, sig2));
+
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK(pubkey1.Verify(hash, sig1));
+        BOOST_CHECK(!pubkey2.Verify(hash, sig1));
+        BOOST_CHECK(pubkey2.Verify(hash, sig2));
+        BOOST_CHECK(!pubkey1.Verify(hash, sig2));
+    }
+
+    // A key that is not on the curve must keep failing, even in a slot that
+    // already holds a valid key.
+    std::vector<unsigned char> vchBad(pubkey1.begin(), pubkey1.end());
+    CPubKey pubkeyBad;
+    do {
+        vchBad[32]++;
+        pubkeyBad.Set(vchBad.begin(), vchBad.end());
+    } while (pubkeyBad.IsFullyValid());
+    for (int i = 0; i < 2; i++) {
+        BOOST_CHECK(!pubkeyBad.Verify(hash, sig1));
+        BOOST_CHECK(pubkey1.Verify(hash, sig1));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,13 +2,19 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "consensus/validation.h"
 #include "policy/policy.h"
+#include "policy/rbf.h"
+#include "script/standard.h"
 #include "txmempool.h"
 #include "util.h"
+#include "utilmoneystr.h"
+#include "validation.h"
 
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
+#include <algorithm>
 #include <list>
 #include <vector>
 
@@ -314,7 +320,13 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
         sortedOrder.push_back(tx3.GetHash().ToString());
         sortedOrder.push_back(tx6.GetHash().ToString());
     }
-    CheckSort<mining_score>(pool, sortedOrder);
+    // There is no mapTx index for the mining score; check the comparator directly.
+    std::vector<CTxMemPoolEntry> vEntries(pool.mapTx.begin(), pool.mapTx.end());
+    std::sort(vEntries.begin(), vEntries.end(), CompareTxMemPoolEntryByScore());
+    BOOST_REQUIRE_EQUAL(vEntries.size(), sortedOrder.size());
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        BOOST_CHECK_EQUAL(vEntries[i].GetTx().GetHash().ToString(), sortedOrder[i]);
+    }
 }
 
 BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
@@ -581,4 +593,445 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolChainReorgTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // A chain of 100 transactions, and one more spending from the 11th and
+    // the 61st
+    const int nChain = 100;
+    std::vector<CMutableTransaction> chain(nChain);
+    for (int i = 0; i < nChain; i++) {
+        chain[i].vin.resize(1);
+        chain[i].vin[0].scriptSig = CScript() << OP_1;
+        if (i > 0)
+            chain[i].vin[0].prevout = COutPoint(chain[i - 1].GetHash(), 0);
+        chain[i].vout.resize(2);
+        chain[i].vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        chain[i].vout[0].nValue = 10 * COIN;
+        chain[i].vout[1].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+        chain[i].vout[1].nValue = COIN;
+    }
+    CMutableTransaction txMerge;
+    txMerge.vin.resize(2);
+    txMerge.vin[0].prevout = COutPoint(chain[10].GetHash(), 1);
+    txMerge.vin[1].prevout = COutPoint(chain[60].GetHash(), 1);
+    txMerge.vout.resize(1);
+    txMerge.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    txMerge.vout[0].nValue = 2 * COIN;
+
+    // The first half was in a disconnected block, so it is added back after
+    // the transactions spending from it
+    for (int i = nChain / 2; i < nChain; i++) {
+        pool.addUnchecked(chain[i].GetHash(), entry.Fee(1000LL).FromTx(chain[i]));
+    }
+    pool.addUnchecked(txMerge.GetHash(), entry.Fee(1000LL).FromTx(txMerge));
+    std::vector<uint256> vHashesToUpdate;
+    for (int i = 0; i < nChain / 2; i++) {
+        pool.addUnchecked(chain[i].GetHash(), entry.Fee(1000LL).FromTx(chain[i]));
+        vHashesToUpdate.push_back(chain[i].GetHash());
+    }
+    pool.UpdateTransactionsFromBlock(vHashesToUpdate);
+
+    LOCK(pool.cs);
+    for (int i = 0; i < nChain; i++) {
+        CTxMemPool::txiter it = pool.mapTx.find(chain[i].GetHash());
+        BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), i + 1);
+        BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), nChain - i + (i <= 60 ? 1 : 0));
+        BOOST_CHECK_EQUAL(pool.GetMemPoolParents(it).size(), i > 0 ? 1 : 0);
+        BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(it).size(), (i == 10 || i == 60 ? 1 : 0) + (i < nChain - 1 ? 1 : 0));
+    }
+    CTxMemPool::txiter itMerge = pool.mapTx.find(txMerge.GetHash());
+    BOOST_CHECK_EQUAL(itMerge->GetCountWithAncestors(), 62);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(itMerge).size(), 2);
+
+    CTxMemPool::setEntries setAncestors;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*itMerge, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 61);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(*itMerge, setAncestors, 25, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+
+    CTxMemPool::setEntries setDescendants;
+    pool.CalculateDescendants(pool.mapTx.find(chain[10].GetHash()), setDescendants);
+    BOOST_CHECK_EQUAL(setDescendants.size(), nChain - 10 + 1);
+
+    // Removing from the middle takes the rest of the chain and the merge
+    pool.removeRecursive(chain[nChain / 2]);
+    BOOST_CHECK_EQUAL(pool.size(), nChain / 2);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(chain[0].GetHash())->GetCountWithDescendants(), nChain / 2);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(pool.mapTx.find(chain[10].GetHash())).size(), 1);
+    BOOST_CHECK(pool.GetMemPoolChildren(pool.mapTx.find(chain[nChain / 2 - 1].GetHash())).empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolRemoveForBlockTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // txs[0] <- txs[1] <- txs[2] is a chain, txs[3] <- txs[4] spends an
+    // output that a block transaction spends as well
+    const COutPoint outDoubleSpent(InsecureRand256(), 0);
+    std::vector<CMutableTransaction> txs(5);
+    for (size_t i = 0; i < txs.size(); i++) {
+        txs[i].vin.resize(1);
+        txs[i].vin[0].scriptSig = CScript() << OP_1;
+        if (i == 0)
+            txs[i].vin[0].prevout = COutPoint(InsecureRand256(), 0);
+        else if (i == 3)
+            txs[i].vin[0].prevout = outDoubleSpent;
+        else
+            txs[i].vin[0].prevout = COutPoint(txs[i - 1].GetHash(), 0);
+        txs[i].vout.resize(1);
+        txs[i].vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        txs[i].vout[0].nValue = 10 * COIN;
+    }
+    for (size_t i = 0; i < txs.size(); i++) {
+        pool.addUnchecked(txs[i].GetHash(), entry.Fee(1000LL * (i + 1)).FromTx(txs[i]));
+    }
+    pool.PrioritiseTransaction(txs[3].GetHash(), 5000);
+
+    CMutableTransaction txConflict;
+    txConflict.vin.resize(1);
+    txConflict.vin[0].prevout = outDoubleSpent;
+    txConflict.vout.resize(1);
+    txConflict.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    txConflict.vout[0].nValue = 10 * COIN;
+
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(txs[0]));
+    vtx.push_back(MakeTransactionRef(txConflict));
+    pool.removeForBlock(vtx, 1);
+
+    // The rest of the chain stays, with the mined parent no longer counted
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    LOCK(pool.cs);
+    CTxMemPool::txiter it1 = pool.mapTx.find(txs[1].GetHash());
+    CTxMemPool::txiter it2 = pool.mapTx.find(txs[2].GetHash());
+    BOOST_REQUIRE(it1 != pool.mapTx.end() && it2 != pool.mapTx.end());
+    BOOST_CHECK_EQUAL(it1->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it1->GetSizeWithAncestors(), it1->GetTxSize());
+    BOOST_CHECK_EQUAL(it1->GetModFeesWithAncestors(), 2000);
+    BOOST_CHECK_EQUAL(it1->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(it1->GetModFeesWithDescendants(), 5000);
+    BOOST_CHECK_EQUAL(it2->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(it2->GetSizeWithAncestors(), it1->GetTxSize() + it2->GetTxSize());
+    BOOST_CHECK_EQUAL(it2->GetSigOpCostWithAncestors(), it1->GetSigOpCost() + it2->GetSigOpCost());
+    BOOST_CHECK(pool.GetMemPoolParents(it1).empty());
+
+    // The conflict and its child are gone, and so is the conflict's delta
+    BOOST_CHECK(!pool.exists(txs[3].GetHash()));
+    BOOST_CHECK(!pool.exists(txs[4].GetHash()));
+    BOOST_CHECK(!pool.isSpent(outDoubleSpent));
+    CAmount nDelta = 0;
+    pool.ApplyDelta(txs[3].GetHash(), nDelta);
+    BOOST_CHECK_EQUAL(nDelta, 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // Three clusters: a parent paid for by its child, a lone transaction,
+    // and a parent whose child pays less than it does
+    std::vector<CMutableTransaction> txs(6);
+    for (size_t i = 0; i < txs.size(); i++) {
+        txs[i].vin.resize(1);
+        txs[i].vin[0].scriptSig = CScript() << OP_1;
+        if (i % 2)
+            txs[i].vin[0].prevout = COutPoint(txs[i - 1].GetHash(), 0);
+        else
+            txs[i].vin[0].prevout = COutPoint(InsecureRand256(), 0);
+        txs[i].vout.resize(1);
+        txs[i].vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        txs[i].vout[0].nValue = 10 * COIN;
+    }
+    const CAmount fees[] = {1000, 20000, 5000, 0, 30000, 100};
+    for (size_t i = 0; i < txs.size(); i++) {
+        // Leave out the child of the lone transaction
+        if (i != 3)
+            pool.addUnchecked(txs[i].GetHash(), entry.Fee(fees[i]).FromTx(txs[i]));
+    }
+
+    std::vector<CTxMemPool::Cluster> clusters;
+    pool.GetClusters(clusters);
+    BOOST_CHECK_EQUAL(clusters.size(), 3);
+    std::map<uint256, CTxMemPool::Cluster> byFirstTx;
+    for (const CTxMemPool::Cluster& cluster : clusters) {
+        byFirstTx[cluster.front().vTx.front()->GetTx().GetHash()] = cluster;
+    }
+
+    const CTxMemPool::Cluster& cpfp = byFirstTx[txs[0].GetHash()];
+    BOOST_CHECK_EQUAL(cpfp.size(), 1);
+    BOOST_CHECK_EQUAL(cpfp[0].vTx.size(), 2);
+    BOOST_CHECK(cpfp[0].vTx[1]->GetTx().GetHash() == txs[1].GetHash());
+    BOOST_CHECK_EQUAL(cpfp[0].nModFees, 21000);
+    BOOST_CHECK_EQUAL(cpfp[0].nSize, cpfp[0].vTx[0]->GetTxSize() + cpfp[0].vTx[1]->GetTxSize());
+
+    BOOST_CHECK_EQUAL(byFirstTx[txs[2].GetHash()].size(), 1);
+
+    const CTxMemPool::Cluster& split = byFirstTx[txs[4].GetHash()];
+    BOOST_CHECK_EQUAL(split.size(), 2);
+    BOOST_CHECK_EQUAL(split[0].nModFees, 30000);
+    BOOST_CHECK(split[1].vTx[0]->GetTx().GetHash() == txs[5].GetHash());
+
+    // Eviction goes by chunk feerate: the cheap child first, then the lone
+    // transaction, which pays less than the CPFP pair. The clusters are
+    // built first, as the memory they take counts towards the limit.
+    pool.setClusterOrder(true);
+    pool.GetClusters(clusters);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(pool.exists(txs[4].GetHash()));
+    BOOST_CHECK(!pool.exists(txs[5].GetHash()));
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(txs[2].GetHash()));
+    BOOST_CHECK(pool.exists(txs[0].GetHash()) && pool.exists(txs[1].GetHash()));
+
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+
+    // Nothing of a cleared pool is left for the next walk over it
+    for (size_t i = 0; i < 3; i++)
+        pool.addUnchecked(txs[i].GetHash(), entry.Fee(fees[i]).FromTx(txs[i]));
+    pool.clear();
+    BOOST_CHECK(pool.vTxHashes.empty());
+    pool.addUnchecked(txs[4].GetHash(), entry.Fee(fees[4]).FromTx(txs[4]));
+    pool.GetClusters(clusters);
+    BOOST_CHECK_EQUAL(clusters.size(), 1);
+    BOOST_CHECK_EQUAL(clusters[0][0].vTx.size(), 1);
+}
+
+// The chunks of each cluster by transaction ids, with their fees
+static std::map<std::set<uint256>, CAmount> ClusterChunks(CTxMemPool& pool)
+{
+    std::vector<CTxMemPool::Cluster> clusters;
+    pool.GetClusters(clusters);
+    std::map<std::set<uint256>, CAmount> chunks;
+    for (const CTxMemPool::Cluster& cluster : clusters) {
+        for (const CTxMemPool::Chunk& chunk : cluster) {
+            std::set<uint256> txids;
+            for (CTxMemPool::txiter it : chunk.vTx)
+                txids.insert(it->GetTx().GetHash());
+            chunks[txids] = chunk.nModFees;
+        }
+    }
+    return chunks;
+}
+
+// Clusters kept up to date as the pool changes match ones built from scratch
+static void CheckClusterCache(CTxMemPool& pool)
+{
+    std::map<std::set<uint256>, CAmount> cached = ClusterChunks(pool);
+    pool.setClusterOrder(false);
+    BOOST_CHECK(cached == ClusterChunks(pool));
+    pool.setClusterOrder(true);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterCacheTest)
+{
+    CTxMemPool pool;
+    pool.setClusterOrder(true);
+    TestMemPoolEntryHelper entry;
+
+    // Ten chains of three, all with different feerates
+    std::vector<CMutableTransaction> txs;
+    for (int i = 0; i < 30; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vin[0].prevout = i % 3 ? COutPoint(txs.back().GetHash(), 0) : COutPoint(InsecureRand256(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        txs.push_back(tx);
+        pool.addUnchecked(tx.GetHash(), entry.Fee(1000 + 997 * i).FromTx(tx));
+    }
+    CheckClusterCache(pool);
+
+    pool.PrioritiseTransaction(txs[4].GetHash(), 50000);
+    CheckClusterCache(pool);
+
+    pool.removeRecursive(txs[7]);
+    CheckClusterCache(pool);
+
+    // Join the first two chains
+    CMutableTransaction join;
+    join.vin.resize(2);
+    join.vin[0].prevout = COutPoint(txs[2].GetHash(), 0);
+    join.vin[1].prevout = COutPoint(txs[5].GetHash(), 0);
+    join.vout.resize(2);
+    join.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    join.vout[0].nValue = 10 * COIN;
+    join.vout[1] = join.vout[0];
+    pool.addUnchecked(join.GetHash(), entry.Fee(40001).FromTx(join));
+    CheckClusterCache(pool);
+
+    // Split the joined cluster again by mining the transaction joining it
+    // and everything it spends
+    std::vector<CMutableTransaction> children(2);
+    for (int i = 0; i < 2; i++) {
+        children[i].vin.resize(1);
+        children[i].vin[0].prevout = COutPoint(join.GetHash(), i);
+        children[i].vout.resize(1);
+        children[i].vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        children[i].vout[0].nValue = 5 * COIN;
+        pool.addUnchecked(children[i].GetHash(), entry.Fee(3001 + i).FromTx(children[i]));
+    }
+    CheckClusterCache(pool);
+    std::vector<CTransactionRef> block;
+    for (int i = 0; i < 6; i++)
+        block.push_back(MakeTransactionRef(txs[i]));
+    block.push_back(MakeTransactionRef(join));
+    pool.removeForBlock(block, 1);
+    CheckClusterCache(pool);
+    BOOST_CHECK_EQUAL(pool.size(), 30 - 2 - 6 + 2);
+
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    CheckClusterCache(pool);
+
+    pool.clear();
+    BOOST_CHECK(ClusterChunks(pool).empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterLimitTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // Two chains of three
+    std::vector<CMutableTransaction> txs;
+    for (int i = 0; i < 6; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vin[0].prevout = i % 3 ? COutPoint(txs.back().GetHash(), 0) : COutPoint(InsecureRand256(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        txs.push_back(tx);
+        pool.addUnchecked(tx.GetHash(), entry.Fee(1000).FromTx(tx));
+    }
+    const size_t nUsageUnordered = pool.DynamicMemoryUsage();
+
+    // A transaction joining both chains would make a cluster of seven
+    CMutableTransaction join;
+    join.vin.resize(2);
+    join.vin[0].prevout = COutPoint(txs[0].GetHash(), 0);
+    join.vin[1].prevout = COutPoint(txs[5].GetHash(), 0);
+    join.vout.resize(1);
+    join.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    join.vout[0].nValue = 10 * COIN;
+    CTxMemPoolEntry joinEntry = entry.Fee(1000).FromTx(join);
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(joinEntry, setAncestors, 100, 1000000, 100, 1000000, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 4);
+
+    // Only a mempool in cluster order has its clusters bounded
+    const CTxMemPool::setEntries setNoConflicts;
+    BOOST_CHECK(pool.CheckClusterLimit(setAncestors, setNoConflicts, 6, errString));
+    pool.setClusterOrder(true);
+    BOOST_CHECK(!pool.CheckClusterLimit(setAncestors, setNoConflicts, 6, errString));
+    BOOST_CHECK(pool.CheckClusterLimit(setAncestors, setNoConflicts, 7, errString));
+
+    // Unless it replaces the middle of the first chain, which evicts its
+    // last transaction as well
+    CTxMemPool::setEntries setConflicting;
+    setConflicting.insert(pool.mapTx.find(txs[1].GetHash()));
+    BOOST_CHECK(pool.CheckClusterLimit(setAncestors, setConflicting, 5, errString));
+    BOOST_CHECK(!pool.CheckClusterLimit(setAncestors, setConflicting, 4, errString));
+
+    // The cached clusters count towards the memory usage
+    std::vector<CTxMemPool::Cluster> clusters;
+    pool.GetClusters(clusters);
+    BOOST_CHECK_EQUAL(clusters.size(), 2);
+    BOOST_CHECK(pool.DynamicMemoryUsage() > nUsageUnordered);
+
+    // and are not rebuilt by trimming a mempool that is within its limit
+    pool.addUnchecked(join.GetHash(), joinEntry);
+    const size_t nUsage = pool.DynamicMemoryUsage();
+    pool.TrimToSize(nUsage);
+    BOOST_CHECK_EQUAL(pool.size(), 7);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), nUsage);
+    pool.GetClusters(clusters);
+    BOOST_CHECK_EQUAL(clusters.size(), 1);
+    BOOST_CHECK(pool.DynamicMemoryUsage() != nUsage);
+}
+
+
+BOOST_AUTO_TEST_CASE(MempoolReplaceWithDescendantsTest)
+{
+    // A transaction conflicting with a single mempool transaction that has
+    // descendants has to pay for all of them, and evicts all of them.
+    CScript redeemScript = CScript() << OP_TRUE;
+    CScript scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+    COutPoint prevout(InsecureRand256(), 0);
+    {
+        LOCK(cs_main);
+        pcoinsTip->AddCoin(prevout, Coin(CTxOut(10 * COIN, scriptPubKey), 1, false), false);
+    }
+
+    // A parent signalling replaceability, with two children paying well
+    CMutableTransaction parent;
+    parent.vin.resize(1);
+    parent.vin[0].prevout = prevout;
+    parent.vin[0].scriptSig = CScript() << ToByteVector(redeemScript);
+    parent.vin[0].nSequence = MAX_BIP125_RBF_SEQUENCE;
+    parent.vout.resize(2);
+    for (CTxOut& txout : parent.vout) {
+        txout.nValue = 5 * COIN - 500;
+        txout.scriptPubKey = scriptPubKey;
+    }
+    std::vector<CMutableTransaction> txs(1, parent);
+    for (int i = 0; i < 2; i++) {
+        CMutableTransaction child;
+        child.vin.resize(1);
+        child.vin[0].prevout = COutPoint(parent.GetHash(), i);
+        child.vin[0].scriptSig = CScript() << ToByteVector(redeemScript);
+        child.vout.resize(1);
+        child.vout[0].nValue = parent.vout[i].nValue - 20000;
+        child.vout[0].scriptPubKey = scriptPubKey;
+        txs.push_back(child);
+    }
+    const CAmount nPackageFees = 1000 + 2 * 20000;
+
+    LOCK(cs_main);
+    for (const CMutableTransaction& tx : txs) {
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(tx), true, nullptr));
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+
+    // Paying more than the parent alone at a far higher feerate is not enough
+    CMutableTransaction replacement;
+    replacement.vin.resize(1);
+    replacement.vin[0].prevout = prevout;
+    replacement.vin[0].scriptSig = CScript() << ToByteVector(redeemScript);
+    replacement.vout.resize(1);
+    replacement.vout[0].nValue = 10 * COIN - 30000;
+    replacement.vout[0].scriptPubKey = scriptPubKey;
+    CValidationState state;
+    BOOST_CHECK(!AcceptToMemoryPool(mempool, state, MakeTransactionRef(replacement), true, nullptr));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "insufficient fee");
+    const std::string strTotal = FormatMoney(30000) + " < " + FormatMoney(nPackageFees);
+    BOOST_CHECK(state.GetDebugMessage().find(strTotal) != std::string::npos);
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+
+    // Paying for the whole package replaces it
+    replacement.vout[0].nValue = 10 * COIN - 50000;
+    std::list<CTransactionRef> lReplaced;
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(replacement), true, nullptr, &lReplaced));
+    BOOST_CHECK_EQUAL(lReplaced.size(), 3);
+    BOOST_CHECK_EQUAL(mempool.size(), 1);
+    BOOST_CHECK(mempool.exists(replacement.GetHash()));
+    for (const CMutableTransaction& tx : txs)
+        BOOST_CHECK(!mempool.exists(tx.GetHash()));
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
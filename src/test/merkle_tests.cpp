@@ -2,8 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
 #include "consensus/merkle.h"
+#include "consensus/validation.h"
+#include "streams.h"
 #include "test/test_bitcoin.h"
+#include "validation.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -132,4 +136,69 @@ BOOST_AUTO_TEST_CASE(merkle_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(merkle_unserialize_block)
+{
+    for (int ntx = 1; ntx <= 9; ntx++) {
+        CBlock block;
+        block.nVersion = 42;
+        for (int j = 0; j < ntx; j++) {
+            CMutableTransaction mtx;
+            mtx.vin.resize(1);
+            mtx.vout.resize(1);
+            mtx.nLockTime = j;
+            if (j % 2) {
+                mtx.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(j, 0x01));
+            }
+            block.vtx.push_back(MakeTransactionRef(std::move(mtx)));
+        }
+        // Duplicate the last transaction in every other block.
+        bool fDuplicate = ntx % 2 && ntx > 1;
+        if (fDuplicate) {
+            block.vtx.push_back(block.vtx.back());
+        }
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << block;
+        CBlock decoded;
+        BlockMerkleRoots roots;
+        UnserializeBlockWithMerkleRoots(stream, decoded, roots);
+        BOOST_CHECK(stream.empty());
+        BOOST_CHECK(decoded.GetHash() == block.GetHash());
+        BOOST_REQUIRE_EQUAL(decoded.vtx.size(), block.vtx.size());
+        BOOST_CHECK(decoded.vtx.back()->GetWitnessHash() == block.vtx.back()->GetWitnessHash());
+
+        bool mutated;
+        BOOST_CHECK(roots.hashMerkleRoot == BlockMerkleRoot(block, &mutated));
+        BOOST_CHECK_EQUAL(roots.fMutated, mutated);
+        BOOST_CHECK_EQUAL(roots.fMutated, fDuplicate);
+        BOOST_CHECK(roots.hashWitnessMerkleRoot == BlockWitnessMerkleRoot(block));
+
+        // CheckBlock uses the roots it is given in place of computing them.
+        const Consensus::Params& consensusParams = Params().GetConsensus();
+        BlockMerkleRoots badRoots = roots;
+        badRoots.hashMerkleRoot = uint256();
+        CValidationState state;
+        BOOST_CHECK(!CheckBlock(decoded, state, consensusParams, false, true, &badRoots));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txnmrklroot");
+
+        // Without them, the roots are computed from vtx as it is now, so a
+        // modified copy of a decoded block is not checked against stale roots.
+        CBlock modified(decoded);
+        modified.vtx.push_back(MakeTransactionRef(CMutableTransaction()));
+        CValidationState state2;
+        BOOST_CHECK(!CheckBlock(modified, state2, consensusParams, false, true));
+        BOOST_CHECK_EQUAL(state2.GetRejectReason(), "bad-txnmrklroot");
+    }
+
+    // A transaction count that cannot fit in a block is rejected before
+    // any transaction is decoded.
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CBlockHeader();
+    WriteCompactSize(stream, MAX_BLOCK_WEIGHT / MIN_SERIALIZABLE_TRANSACTION_WEIGHT + 1);
+    CBlock decoded;
+    BlockMerkleRoots roots;
+    BOOST_CHECK_THROW(UnserializeBlockWithMerkleRoots(stream, decoded, roots), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
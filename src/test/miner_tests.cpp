@@ -21,6 +21,7 @@
 #include "test/test_bitcoin.h"
 
 #include <memory>
+#include <set>
 
 #include <boost/test/unit_test.hpp>
 
@@ -502,4 +503,192 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+static std::set<uint256> TemplateTxids(const CBlockTemplate& pblocktemplate)
+{
+    std::set<uint256> txids;
+    for (size_t i = 1; i < pblocktemplate.block.vtx.size(); i++) {
+        txids.insert(pblocktemplate.block.vtx[i]->GetHash());
+    }
+    return txids;
+}
+
+static CTransactionRef AddToMempool(const uint256& prevout, CAmount fee)
+{
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout.hash = prevout;
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    tx.vout[0].nValue = 100000000LL - fee;
+    LOCK(mempool.cs);
+    mempool.addUnchecked(tx.GetHash(), entry.Fee(fee).FromTx(tx));
+    return MakeTransactionRef(tx);
+}
+
+BOOST_AUTO_TEST_CASE(CreateNewBlock_incremental)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << OP_TRUE;
+
+    BlockAssembler::Options options;
+    options.nBlockMaxWeight = MAX_BLOCK_WEIGHT;
+    options.nBlockMaxSize = MAX_BLOCK_SERIALIZED_SIZE;
+    options.blockMinFeeRate = blockMinFeeRate;
+    options.fTestBlockValidity = false;
+
+    // Rebuilds the template from scratch and checks that the incremental
+    // one selected the same transactions
+    auto CheckFullSelection = [&](const BlockAssembler::Options& opts, const std::set<uint256>& txids) {
+        gArgs.ForceSetArg("-incrementaltemplate", "0");
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams, opts).CreateNewBlock(scriptPubKey);
+        gArgs.ForceSetArg("-incrementaltemplate", "1");
+        BOOST_CHECK(TemplateTxids(*pblocktemplate) == txids);
+    };
+
+    gArgs.ForceSetArg("-incrementaltemplate", "1");
+    std::vector<CTransactionRef> txs;
+    for (int i = 0; i < 10; i++) {
+        txs.push_back(AddToMempool(InsecureRand256(), 10000 + 1000 * i));
+    }
+    BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    uint64_t nReused = templateSelection.GetReuseCount();
+    uint64_t nRebuilt = templateSelection.GetRebuildCount();
+
+    // Additions, a child paying for a parent below the minimum feerate, and
+    // removals are applied to the previous selection
+    txs.push_back(AddToMempool(InsecureRand256(), 50000));
+    CTransactionRef parent = AddToMempool(InsecureRand256(), 0);
+    CTransactionRef child = AddToMempool(parent->GetHash(), 20000);
+    CTransactionRef orphan = AddToMempool(txs[3]->GetHash(), 5000);
+    mempool.removeRecursive(*txs[3]);
+    mempool.removeRecursive(*txs[5]);
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(templateSelection.GetReuseCount(), nReused + 1);
+    std::set<uint256> txids = TemplateTxids(*pblocktemplate);
+    BOOST_CHECK_EQUAL(txids.size(), 11);
+    BOOST_CHECK(txids.count(parent->GetHash()) && txids.count(child->GetHash()));
+    BOOST_CHECK(!txids.count(txs[3]->GetHash()) && !txids.count(orphan->GetHash()));
+    CheckFullSelection(options, txids);
+
+    // A fee delta is not an addition or removal, so it forces a rebuild
+    BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    nRebuilt = templateSelection.GetRebuildCount();
+    mempool.PrioritiseTransaction(txs[0]->GetHash(), 1000);
+    BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(templateSelection.GetRebuildCount(), nRebuilt + 1);
+    mempool.clear();
+
+    // Room for three of these transactions
+    txs.clear();
+    for (int i = 0; i < 5; i++) {
+        txs.push_back(AddToMempool(InsecureRand256(), 10000 + 1000 * i));
+    }
+    options.nBlockMaxWeight = 4000 + 3 * ::GetTransactionWeight(*txs[0]) + 1;
+    pblocktemplate = BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+
+    // Cheaper than everything selected: nothing changes, without a rebuild
+    nReused = templateSelection.GetReuseCount();
+    AddToMempool(InsecureRand256(), 11500);
+    pblocktemplate = BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(templateSelection.GetReuseCount(), nReused + 1);
+    CheckFullSelection(options, TemplateTxids(*pblocktemplate));
+
+    // Better than the cheapest selected package, which it has to displace
+    BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    nRebuilt = templateSelection.GetRebuildCount();
+    CTransactionRef best = AddToMempool(InsecureRand256(), 100000);
+    pblocktemplate = BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(templateSelection.GetRebuildCount(), nRebuilt + 1);
+    BOOST_CHECK(TemplateTxids(*pblocktemplate).count(best->GetHash()));
+
+    // Removing a selected transaction from a full block makes room for
+    // one that was left out
+    mempool.removeRecursive(*best);
+    pblocktemplate = BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(TemplateTxids(*pblocktemplate).count(txs[2]->GetHash()));
+    CheckFullSelection(options, TemplateTxids(*pblocktemplate));
+
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(CreateNewBlock_cluster_order)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << OP_TRUE;
+
+    BlockAssembler::Options options;
+    options.nBlockMaxWeight = MAX_BLOCK_WEIGHT;
+    options.nBlockMaxSize = MAX_BLOCK_SERIALIZED_SIZE;
+    options.blockMinFeeRate = blockMinFeeRate;
+    options.fTestBlockValidity = false;
+
+    std::vector<CTransactionRef> txs;
+    for (int i = 0; i < 10; i++) {
+        txs.push_back(AddToMempool(InsecureRand256(), 10000 + 1000 * i));
+    }
+    CTransactionRef parent = AddToMempool(InsecureRand256(), 0);
+    CTransactionRef child = AddToMempool(parent->GetHash(), 40000);
+    CTransactionRef cheap = AddToMempool(child->GetHash(), 0);
+
+    // Everything that pays the minimum feerate fits, in either order
+    std::set<uint256> txids = TemplateTxids(*BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey));
+    mempool.setClusterOrder(true);
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(TemplateTxids(*pblocktemplate) == txids);
+    BOOST_REQUIRE_EQUAL(txids.size(), 12);
+    BOOST_CHECK(!txids.count(cheap->GetHash()));
+    // The first chunk is the parent and the child paying for it
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == parent->GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == child->GetHash());
+
+    // Room for three of these transactions
+    options.nBlockMaxWeight = 4000 + 3 * ::GetTransactionWeight(*txs[0]) + 1;
+    txids = TemplateTxids(*BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(txids.size(), 3);
+    BOOST_CHECK(txids.count(parent->GetHash()) && txids.count(child->GetHash()) && txids.count(txs[9]->GetHash()));
+
+    mempool.setClusterOrder(false);
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(CreateNewBlock_async_validation)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << OP_TRUE;
+
+    BlockAssembler::Options options = BlockAssembler::DefaultOptions(chainparams);
+    options.fTestBlockValidity = false;
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(!pblocktemplate->check);
+    BOOST_CHECK(!templateValidator.CheckPending());
+
+    // A template that cannot be valid: its coinbase is spent twice
+    pblocktemplate->block.vtx.push_back(pblocktemplate->block.vtx[0]);
+    templateValidator.Submit(chainparams, *pblocktemplate, chainActive.Tip());
+    BOOST_CHECK_EQUAL(pblocktemplate->check->GetStatus(), CTemplateCheck::PENDING);
+    BOOST_CHECK(templateValidator.CheckPending());
+    BOOST_CHECK(pblocktemplate->check->IsInvalid());
+    BOOST_CHECK(!pblocktemplate->check->GetRejectReason().empty());
+    BOOST_CHECK(!templateValidator.CheckPending());
+
+    // Only the newest template is checked
+    templateValidator.Submit(chainparams, *pblocktemplate, chainActive.Tip());
+    std::shared_ptr<CTemplateCheck> superseded = pblocktemplate->check;
+    templateValidator.Submit(chainparams, *pblocktemplate, chainActive.Tip());
+    BOOST_CHECK(templateValidator.CheckPending());
+    BOOST_CHECK(!templateValidator.CheckPending());
+    BOOST_CHECK_EQUAL(superseded->GetStatus(), CTemplateCheck::PENDING);
+    BOOST_CHECK(pblocktemplate->check->IsInvalid());
+
+    // Templates on an old tip are not checked at all
+    CBlockIndex index;
+    templateValidator.Submit(chainparams, *pblocktemplate, &index);
+    BOOST_CHECK(templateValidator.CheckPending());
+    BOOST_CHECK_EQUAL(pblocktemplate->check->GetStatus(), CTemplateCheck::STALE);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
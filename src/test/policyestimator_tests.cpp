@@ -179,4 +179,52 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatesLongRun)
+{
+    CBlockPolicyEstimator feeEst;
+    CTxMemPool mpool(&feeEst);
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 0LL;
+
+    // Enough blocks for the short horizon's pending decay to be folded back
+    // into its averages a few times; higher fees take longer to confirm so
+    // the estimates don't all sit in one bucket
+    std::vector<CTransactionRef> block;
+    std::vector<CTransactionRef> pending[3];
+    for (int blocknum = 0; blocknum < 20000; blocknum++) {
+        for (int j = 0; j < 3; j++) {
+            tx.vin[0].prevout.n = 10 * blocknum + j;
+            mpool.addUnchecked(tx.GetHash(), entry.Fee(10000LL * (3 - j)).Height(blocknum).FromTx(tx));
+            pending[j].push_back(MakeTransactionRef(tx));
+        }
+        for (int j = 0; j < 3; j++) {
+            if (blocknum % (j + 1) == 0) {
+                block.insert(block.end(), pending[j].begin(), pending[j].end());
+                pending[j].clear();
+            }
+        }
+        mpool.removeForBlock(block, blocknum + 1);
+        block.clear();
+    }
+    CFeeRate feeRate = feeEst.estimateFee(2);
+    BOOST_CHECK(feeRate > CFeeRate(0));
+
+    // The estimates come back unchanged from the fee_estimates file
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!file.IsNull());
+    BOOST_CHECK(feeEst.Write(file));
+    rewind(file.Get());
+    CBlockPolicyEstimator feeEstRead;
+    BOOST_CHECK(feeEstRead.Read(file));
+    for (int i = 1; i < 12; i++) {
+        BOOST_CHECK_EQUAL(feeEstRead.estimateFee(i).GetFeePerK(), feeEst.estimateFee(i).GetFeePerK());
+        BOOST_CHECK_EQUAL(feeEstRead.estimateSmartFee(i, nullptr, true).GetFeePerK(), feeEst.estimateSmartFee(i, nullptr, true).GetFeePerK());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -49,6 +49,12 @@ class prevector_tester {
              local_check(&(pre_vector[s]) == &(pre_vector.begin()[s]));
              local_check(&(pre_vector[s]) == &*(pre_vector.begin() + s));
              local_check(&(pre_vector[s]) == &*((pre_vector.end() + s) - real_vector.size()));
+             local_check(&(const_pre_vector.at(s)) == &(pre_vector[s]));
+        }
+        try {
+            const_pre_vector.at(real_vector.size());
+            local_check(false);
+        } catch (const std::out_of_range&) {
         }
         // local_check(realtype(pre_vector) == real_vector);
         local_check(pretype(real_vector.begin(), real_vector.end()) == pre_vector);
@@ -194,13 +200,15 @@ public:
     }
 };
 
-BOOST_AUTO_TEST_CASE(PrevectorTestInt)
+/** Run random operations on a prevector<N, T> and a std::vector<T> side by side. */
+template<unsigned int N, typename T>
+static void PrevectorRandomTest(T (*random_value)())
 {
     for (int j = 0; j < 64; j++) {
-        prevector_tester<8, int> test;
+        prevector_tester<N, T> test;
         for (int i = 0; i < 2048; i++) {
             if (InsecureRandBits(2) == 0) {
-                test.insert(InsecureRandRange(test.size() + 1), InsecureRand32());
+                test.insert(InsecureRandRange(test.size() + 1), random_value());
             }
             if (test.size() > 0 && InsecureRandBits(2) == 1) {
                 test.erase(InsecureRandRange(test.size()));
@@ -210,7 +218,7 @@ BOOST_AUTO_TEST_CASE(PrevectorTestInt)
                 test.resize(new_size);
             }
             if (InsecureRandBits(3) == 3) {
-                test.insert(InsecureRandRange(test.size() + 1), 1 + InsecureRandBool(), InsecureRand32());
+                test.insert(InsecureRandRange(test.size() + 1), 1 + InsecureRandBool(), random_value());
             }
             if (InsecureRandBits(3) == 4) {
                 int del = std::min<int>(test.size(), 1 + (InsecureRandBool()));
@@ -218,16 +226,16 @@ BOOST_AUTO_TEST_CASE(PrevectorTestInt)
                 test.erase(beg, beg + del);
             }
             if (InsecureRandBits(4) == 5) {
-                test.push_back(InsecureRand32());
+                test.push_back(random_value());
             }
             if (test.size() > 0 && InsecureRandBits(4) == 6) {
                 test.pop_back();
             }
             if (InsecureRandBits(5) == 7) {
-                int values[4];
+                T values[4];
                 int num = 1 + (InsecureRandBits(2));
                 for (int k = 0; k < num; k++) {
-                    values[k] = InsecureRand32();
+                    values[k] = random_value();
                 }
                 test.insert_range(InsecureRandRange(test.size() + 1), values, values + num);
             }
@@ -243,13 +251,13 @@ BOOST_AUTO_TEST_CASE(PrevectorTestInt)
                 test.shrink_to_fit();
             }
             if (test.size() > 0) {
-                test.update(InsecureRandRange(test.size()), InsecureRand32());
+                test.update(InsecureRandRange(test.size()), random_value());
             }
             if (InsecureRandBits(10) == 11) {
                 test.clear();
             }
             if (InsecureRandBits(9) == 12) {
-                test.assign(InsecureRandBits(5), InsecureRand32());
+                test.assign(InsecureRandBits(5), random_value());
             }
             if (InsecureRandBits(3) == 3) {
                 test.swap();
@@ -264,4 +272,34 @@ BOOST_AUTO_TEST_CASE(PrevectorTestInt)
     }
 }
 
+static int RandomInt()
+{
+    return InsecureRand32();
+}
+
+/** Up to twice as many bytes as fit inline, so that both representations
+ *  get relocated by the outer prevector. */
+static prevector<4, unsigned char> RandomBytes()
+{
+    prevector<4, unsigned char> v;
+    v.resize(InsecureRandRange(9));
+    for (unsigned char& c : v) {
+        c = InsecureRandBits(8);
+    }
+    return v;
+}
+
+BOOST_AUTO_TEST_CASE(PrevectorTestInt)
+{
+    PrevectorRandomTest<8, int>(RandomInt);
+}
+
+BOOST_AUTO_TEST_CASE(PrevectorTestNested)
+{
+    // Elements that are not trivially copyable, as on the script interpreter's stack.
+    static_assert(!std::is_trivially_copyable<prevector<4, unsigned char>>::value, "");
+    static_assert(is_trivially_relocatable<prevector<4, unsigned char>>::value, "");
+    PrevectorRandomTest<8, prevector<4, unsigned char>>(RandomBytes);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -6,8 +6,12 @@
 #include "rpc/client.h"
 
 #include "base58.h"
+#include "chainparams.h"
 #include "core_io.h"
 #include "netbase.h"
+#include "rpc/blockchain.h"
+#include "txmempool.h"
+#include "validation.h"
 
 #include "test/test_bitcoin.h"
 
@@ -369,4 +373,73 @@ BOOST_AUTO_TEST_CASE(rpc_getblocksubsidy)
     BOOST_CHECK_EQUAL(founders.get_int64(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_jsonwriter)
+{
+    std::string strOut;
+    size_t nChunks = 0;
+    JSONWriter::Sink sink = [&](const std::string& chunk) { strOut += chunk; nChunks++; };
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("a \"quoted\"\nkey", 1.5));
+    obj.push_back(Pair("empty", UniValue(UniValue::VARR)));
+    UniValue arr(UniValue::VARR);
+    arr.push_back(NullUniValue);
+    arr.push_back(true);
+    arr.push_back("\x01\\");
+    arr.push_back(UniValue(UniValue::VOBJ));
+    obj.push_back(Pair("arr", arr));
+
+    // A chunk size of one hands every element on by itself
+    JSONWriter writer(sink, 1);
+    writer.BeginObject();
+    writer.Key("a \"quoted\"\nkey");
+    writer.Value(1.5);
+    writer.Key("empty");
+    writer.BeginArray();
+    writer.EndArray();
+    writer.Key("arr");
+    writer.BeginArray();
+    writer.Value(NullUniValue);
+    writer.Value(true);
+    writer.Value("\x01\\");
+    writer.BeginObject();
+    writer.EndObject();
+    writer.EndArray();
+    writer.EndObject();
+    writer.Finish();
+    BOOST_CHECK_EQUAL(strOut, obj.write() + "\n");
+    BOOST_CHECK(nChunks > 5);
+
+    // Streamed blocks and mempool contents match their UniValue forms
+    {
+        LOCK(cs_main);
+        const CBlock& genesis = Params().GenesisBlock();
+        for (bool txDetails : {false, true}) {
+            strOut.clear();
+            JSONWriter blockWriter(sink);
+            blockToJSON(blockWriter, genesis, chainActive.Tip(), txDetails);
+            blockWriter.Finish();
+            BOOST_CHECK_EQUAL(strOut, blockToJSON(genesis, chainActive.Tip(), txDetails).write() + "\n");
+        }
+    }
+
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx.vout[0].nValue = COIN;
+    mempool.addUnchecked(tx.GetHash(), entry.Fee(1000).FromTx(tx));
+    tx.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+    mempool.addUnchecked(tx.GetHash(), entry.Fee(2000).FromTx(tx));
+
+    strOut.clear();
+    JSONWriter mempoolWriter(sink);
+    mempoolToJSON(mempoolWriter);
+    mempoolWriter.Finish();
+    BOOST_CHECK_EQUAL(strOut, mempoolToJSON(true).write() + "\n");
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
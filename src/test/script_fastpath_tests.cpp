@@ -0,0 +1,311 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "primitives/transaction.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+#include "script/script_error.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "utilstrencodings.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+typedef std::vector<unsigned char> valtype;
+
+namespace {
+
+enum Template {
+    TEMPLATE_P2PKH,
+    TEMPLATE_P2PK,
+    TEMPLATE_P2SH_MULTISIG,
+    TEMPLATE_P2WPKH,
+    TEMPLATE_COUNT
+};
+
+/** A spend under construction: the pushes of the scriptSig are kept apart so they can be mutated. */
+struct Spend
+{
+    std::vector<valtype> pushes;
+    CScript scriptPubKey;
+    CScriptWitness witness;
+};
+
+valtype RandomBytes(size_t size)
+{
+    valtype ret(size);
+    for (unsigned char& c : ret)
+        c = InsecureRandBits(8);
+    return ret;
+}
+
+int RandomHashType()
+{
+    static const int base[] = {SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE};
+    int nHashType = base[InsecureRandRange(3)];
+    if (InsecureRandRange(8) != 0)
+        nHashType |= SIGHASH_FORKID;
+    if (InsecureRandBool())
+        nHashType |= SIGHASH_ANYONECANPAY;
+    return nHashType;
+}
+
+valtype Sign(const CKey& key, const CScript& scriptCode, const CTransaction& tx, CAmount amount, SigVersion sigversion)
+{
+    const int nHashType = RandomHashType();
+    valtype vchSig;
+    BOOST_CHECK(key.Sign(SignatureHash(scriptCode, tx, 0, nHashType, amount, sigversion), vchSig));
+    vchSig.push_back((unsigned char)nHashType);
+    return vchSig;
+}
+
+CScript MultisigScript(int nRequired, const std::vector<CPubKey>& keys)
+{
+    CScript script;
+    script << CScript::EncodeOP_N(nRequired);
+    for (const CPubKey& key : keys)
+        script << ToByteVector(key);
+    script << CScript::EncodeOP_N(keys.size()) << OP_CHECKMULTISIG;
+    return script;
+}
+
+/** Build a correctly signed spend of the given template. */
+Spend BuildSpend(Template type, const std::vector<CKey>& keys, const CTransaction& tx, CAmount amount)
+{
+    Spend spend;
+    const CKey& key = keys[InsecureRandRange(keys.size())];
+    const CPubKey pubkey = key.GetPubKey();
+    switch (type) {
+    case TEMPLATE_P2PKH:
+        spend.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << ToByteVector(pubkey.GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+        spend.pushes.push_back(Sign(key, spend.scriptPubKey, tx, amount, SIGVERSION_BASE));
+        spend.pushes.push_back(ToByteVector(pubkey));
+        break;
+    case TEMPLATE_P2PK:
+        spend.scriptPubKey = CScript() << ToByteVector(pubkey) << OP_CHECKSIG;
+        spend.pushes.push_back(Sign(key, spend.scriptPubKey, tx, amount, SIGVERSION_BASE));
+        break;
+    case TEMPLATE_P2SH_MULTISIG: {
+        const int nKeys = 1 + InsecureRandRange(keys.size());
+        const int nRequired = 1 + InsecureRandRange(nKeys);
+        std::vector<CKey> chosen;
+        std::vector<CPubKey> pubkeys;
+        for (int i = 0; i < nKeys; i++) {
+            chosen.push_back(keys[InsecureRandRange(keys.size())]);
+            pubkeys.push_back(chosen.back().GetPubKey());
+        }
+        const CScript redeem = MultisigScript(nRequired, pubkeys);
+        spend.scriptPubKey = CScript() << OP_HASH160 << ToByteVector(CScriptID(redeem)) << OP_EQUAL;
+        // The dummy element, then signatures by an ordered subset of the keys.
+        spend.pushes.push_back(valtype());
+        int nSkip = nKeys - nRequired;
+        for (int i = 0; i < nKeys; i++) {
+            if (nSkip > 0 && InsecureRandBool()) {
+                nSkip--;
+                continue;
+            }
+            if ((int)spend.pushes.size() <= nRequired)
+                spend.pushes.push_back(Sign(chosen[i], redeem, tx, amount, SIGVERSION_BASE));
+        }
+        spend.pushes.push_back(valtype(redeem.begin(), redeem.end()));
+        break;
+    }
+    case TEMPLATE_P2WPKH: {
+        spend.scriptPubKey = CScript() << OP_0 << ToByteVector(pubkey.GetID());
+        const CScript scriptCode = CScript() << OP_DUP << OP_HASH160 << ToByteVector(pubkey.GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+        spend.witness.stack.push_back(Sign(key, scriptCode, tx, amount, SIGVERSION_WITNESS_V0));
+        spend.witness.stack.push_back(ToByteVector(pubkey));
+        break;
+    }
+    default:
+        assert(false);
+    }
+    return spend;
+}
+
+/** Pick one of the signature-carrying elements of a spend. */
+valtype* PickElement(Spend& spend)
+{
+    std::vector<valtype>& items = spend.witness.stack.empty() ? spend.pushes : spend.witness.stack;
+    if (items.empty())
+        return nullptr;
+    return &items[InsecureRandRange(items.size())];
+}
+
+/** Damage a spend in one of the ways the fast paths must either reject exactly like the interpreter, or hand back to it. */
+void Mutate(Spend& spend, const std::vector<CKey>& keys)
+{
+    valtype* item = PickElement(spend);
+    switch (InsecureRandRange(10)) {
+    case 0: // Flip a byte of an element, possibly breaking its DER encoding.
+        if (item && !item->empty())
+            (*item)[InsecureRandRange(item->size())] ^= 1 << InsecureRandRange(8);
+        break;
+    case 1: // Change the hash type.
+        if (item && !item->empty())
+            item->back() = InsecureRandBits(8);
+        break;
+    case 2: // Replace an element with an empty one.
+        if (item)
+            item->clear();
+        break;
+    case 3: // Replace an element with another public key.
+        if (item)
+            *item = ToByteVector(keys[InsecureRandRange(keys.size())].GetPubKey());
+        break;
+    case 4: // Replace an element with a short or oversized random one.
+        if (item)
+            *item = RandomBytes(InsecureRandBool() ? InsecureRandRange(3) : 515 + InsecureRandRange(10));
+        break;
+    case 5: // Drop an element.
+        if (!spend.witness.stack.empty())
+            spend.witness.stack.pop_back();
+        else if (!spend.pushes.empty())
+            spend.pushes.erase(spend.pushes.begin() + InsecureRandRange(spend.pushes.size()));
+        break;
+    case 6: // Add an element.
+        spend.pushes.insert(spend.pushes.begin() + InsecureRandRange(spend.pushes.size() + 1), RandomBytes(InsecureRandRange(80)));
+        break;
+    case 7: // Damage the scriptPubKey.
+        if (!spend.scriptPubKey.empty())
+            spend.scriptPubKey[InsecureRandRange(spend.scriptPubKey.size())] ^= 1 << InsecureRandRange(8);
+        break;
+    case 8: // Add or remove witness data.
+        if (!spend.witness.stack.empty() && InsecureRandBool())
+            spend.witness.stack.clear();
+        else
+            spend.witness.stack.push_back(RandomBytes(InsecureRandRange(3)));
+        break;
+    case 9: // Use the same element twice, e.g. a signature also used as a key.
+        if (item && spend.pushes.size() > 1)
+            spend.pushes[InsecureRandRange(spend.pushes.size())] = *item;
+        break;
+    }
+}
+
+/** Serialize the pushes, occasionally with a non-minimal encoding. */
+CScript BuildScriptSig(const Spend& spend)
+{
+    CScript script;
+    for (const valtype& push : spend.pushes) {
+        if (push.size() <= 0xff && InsecureRandRange(20) == 0) {
+            script.insert(script.end(), OP_PUSHDATA1);
+            script.insert(script.end(), (unsigned char)push.size());
+            script.insert(script.end(), push.begin(), push.end());
+        } else {
+            script << push;
+        }
+    }
+    return script;
+}
+
+unsigned int RandomFlags()
+{
+    unsigned int flags = InsecureRandBits(18) & ~(1U << 16);
+    // VerifyScript asserts on these combinations.
+    if (flags & SCRIPT_VERIFY_CLEANSTACK)
+        flags |= SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS;
+    if (flags & SCRIPT_VERIFY_WITNESS)
+        flags |= SCRIPT_VERIFY_P2SH;
+    return flags;
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(script_fastpath_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(script_fastpath_differential)
+{
+    std::vector<CKey> keys;
+    for (int i = 0; i < 4; i++) {
+        keys.emplace_back();
+        keys.back().MakeNewKey(i % 2 == 0);
+    }
+
+    int nHandled[TEMPLATE_COUNT] = {};
+    int nValidHandled = 0;
+    for (int i = 0; i < 4000; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(InsecureRand256(), InsecureRandRange(4));
+        mtx.vout.resize(1 + InsecureRandRange(2));
+        for (CTxOut& out : mtx.vout)
+            out.nValue = InsecureRandRange(100000);
+        const CTransaction tx(mtx);
+        const CAmount amount = InsecureRandRange(1000000);
+        const TransactionSignatureChecker checker(&tx, 0, amount);
+
+        const Template type = (Template)InsecureRandRange(TEMPLATE_COUNT);
+        Spend spend = BuildSpend(type, keys, tx, amount);
+        const int nMutations = InsecureRandRange(4) == 0 ? 0 : 1 + InsecureRandRange(2);
+        for (int j = 0; j < nMutations; j++)
+            Mutate(spend, keys);
+        const CScript scriptSig = BuildScriptSig(spend);
+        const unsigned int flags = RandomFlags();
+
+        ScriptError errInterpreted, errFast, errVerify;
+        const bool fInterpreted = VerifyScriptInterpreted(scriptSig, spend.scriptPubKey, &spend.witness, flags, checker, &errInterpreted);
+        const bool fVerify = VerifyScript(scriptSig, spend.scriptPubKey, &spend.witness, flags, checker, &errVerify);
+        BOOST_CHECK_EQUAL(fVerify, fInterpreted);
+        BOOST_CHECK_EQUAL(errVerify, errInterpreted);
+
+        bool fFast = false;
+        if (VerifyStandardScript(scriptSig, spend.scriptPubKey, &spend.witness, flags, checker, fFast, &errFast)) {
+            nHandled[type]++;
+            if (fFast)
+                nValidHandled++;
+            BOOST_CHECK_MESSAGE(fFast == fInterpreted && errFast == errInterpreted,
+                "template " << type << " flags " << flags << ": " << ScriptErrorString(errFast) << " vs " << ScriptErrorString(errInterpreted)
+                << " for " << HexStr(scriptSig) << " / " << HexStr(spend.scriptPubKey));
+        }
+    }
+
+    // Make sure the fast paths were actually exercised, both accepting and rejecting.
+    for (int type = 0; type < TEMPLATE_COUNT; type++)
+        BOOST_CHECK(nHandled[type] > 100);
+    BOOST_CHECK(nValidHandled > 200);
+}
+
+BOOST_AUTO_TEST_CASE(script_fastpath_fallback)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CPubKey pubkey = key.GetPubKey();
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vout.resize(1);
+    const CTransaction tx(mtx);
+    const TransactionSignatureChecker checker(&tx, 0, 0);
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_MINIMALDATA;
+    bool fSuccess;
+
+    // Anything that isn't one of the standard forms goes to the interpreter.
+    const CScript p2pkh = CScript() << OP_DUP << OP_HASH160 << ToByteVector(pubkey.GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+    BOOST_CHECK(!VerifyStandardScript(CScript() << OP_1 << OP_2, CScript() << OP_ADD << OP_3 << OP_EQUAL, nullptr, flags, checker, fSuccess));
+    BOOST_CHECK(!VerifyStandardScript(CScript() << OP_1 << ToByteVector(pubkey), p2pkh, nullptr, flags, checker, fSuccess));
+    BOOST_CHECK(!VerifyStandardScript(CScript() << valtype(72, 0x30) << ToByteVector(pubkey) << OP_NOP, p2pkh, nullptr, flags, checker, fSuccess));
+
+    // A well-formed but wrong key is rejected by the fast path with the interpreter's error.
+    ScriptError err;
+    CKey other;
+    other.MakeNewKey(true);
+    BOOST_CHECK(VerifyStandardScript(CScript() << valtype(72, 0x30) << ToByteVector(other.GetPubKey()), p2pkh, nullptr, flags, checker, fSuccess, &err));
+    BOOST_CHECK(!fSuccess);
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_EQUALVERIFY);
+
+    // Without P2SH the redeemScript isn't run, so that case is left to the interpreter.
+    const CScript redeem = MultisigScript(1, {pubkey});
+    const CScript p2sh = CScript() << OP_HASH160 << ToByteVector(CScriptID(redeem)) << OP_EQUAL;
+    const CScript scriptSig = CScript() << OP_0 << valtype(72, 0x30) << valtype(redeem.begin(), redeem.end());
+    BOOST_CHECK(!VerifyStandardScript(scriptSig, p2sh, nullptr, SCRIPT_VERIFY_NONE, checker, fSuccess));
+    BOOST_CHECK(VerifyScript(scriptSig, p2sh, nullptr, SCRIPT_VERIFY_NONE, checker));
+    BOOST_CHECK(VerifyStandardScript(scriptSig, p2sh, nullptr, flags, checker, fSuccess, &err));
+    BOOST_CHECK(!fSuccess);
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_SIG_DER);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
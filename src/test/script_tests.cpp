@@ -1191,6 +1191,28 @@ BOOST_AUTO_TEST_CASE(script_PushData)
     BOOST_CHECK_MESSAGE(err == SCRIPT_ERR_OK, ScriptErrorString(err));
 }
 
+BOOST_AUTO_TEST_CASE(script_stack_spill)
+{
+    // Elements and stacks larger than the inline buffers of CScriptStack
+    // move to the heap and must behave exactly as before.
+    const std::vector<unsigned char> big(200, 0x42), small(3, 0x17);
+    CScript script;
+    for (int i = 0; i < 20; i++)
+        script << (i % 2 ? big : small);
+    script << OP_16 << OP_ROLL << OP_2SWAP << OP_ROT << OP_TUCK << OP_DUP << OP_TOALTSTACK << OP_SIZE << OP_FROMALTSTACK << OP_SHA256;
+
+    ScriptError err;
+    CScriptStack stack;
+    BOOST_CHECK(EvalScript(stack, script, SCRIPT_VERIFY_MINIMALDATA, BaseSignatureChecker(), SIGVERSION_BASE, &err));
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_OK);
+    std::vector<std::vector<unsigned char> > vectorStack;
+    BOOST_CHECK(EvalScript(vectorStack, script, SCRIPT_VERIFY_MINIMALDATA, BaseSignatureChecker(), SIGVERSION_BASE, &err));
+    BOOST_CHECK_EQUAL(stack.size(), 23U);
+    BOOST_REQUIRE_EQUAL(vectorStack.size(), stack.size());
+    for (size_t i = 0; i < stack.size(); i++)
+        BOOST_CHECK(std::vector<unsigned char>(stack[i].begin(), stack[i].end()) == vectorStack[i]);
+}
+
 CScript
 sign_multisig(CScript scriptPubKey, std::vector<CKey> keys, CTransaction transaction)
 {
@@ -1322,6 +1344,57 @@ BOOST_AUTO_TEST_CASE(script_CHECKMULTISIG23)
     BOOST_CHECK_MESSAGE(err == SCRIPT_ERR_INVALID_STACK_OPERATION, ScriptErrorString(err));
 }
 
+BOOST_AUTO_TEST_CASE(script_profile)
+{
+    ScriptError err;
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(false);
+
+    // A bare 1-of-2 multisig runs through the interpreter. Keys are tried
+    // from the top of the stack, so a signature by key1 is checked twice.
+    CScript scriptPubKey;
+    scriptPubKey << OP_1 << ToByteVector(key1.GetPubKey()) << ToByteVector(key2.GetPubKey()) << OP_2 << OP_CHECKMULTISIG;
+    CMutableTransaction txFrom = BuildCreditingTransaction(scriptPubKey);
+    CMutableTransaction txTo = BuildSpendingTransaction(CScript(), CScriptWitness(), txFrom);
+    CScript scriptSig = sign_multisig(scriptPubKey, key1, txTo);
+
+    ScriptProfile profile;
+    MutableTransactionSignatureChecker checker(&txTo, 0, txFrom.vout[0].nValue);
+    checker.SetProfile(&profile);
+    BOOST_CHECK(VerifyScript(scriptSig, scriptPubKey, nullptr, gFlags, checker, &err));
+    BOOST_CHECK_MESSAGE(err == SCRIPT_ERR_OK, ScriptErrorString(err));
+    BOOST_CHECK(!profile.fFastPath);
+    BOOST_CHECK_EQUAL(profile.nOpcodes[OP_0], 1U);
+    BOOST_CHECK_EQUAL(profile.nOpcodes[OP_1], 1U);
+    BOOST_CHECK_EQUAL(profile.nOpcodes[OP_2], 1U);
+    BOOST_CHECK_EQUAL(profile.nOpcodes[OP_CHECKMULTISIG], 1U);
+    BOOST_CHECK_EQUAL(profile.nSigChecks, 2U);
+    BOOST_CHECK_EQUAL(profile.nSigCacheHits, 0U);
+    // The FORKID digest hashes 156 bytes besides the serialized scriptCode.
+    const uint64_t nSighashBytes = 156 + ::GetSerializeSize(scriptPubKey, SER_GETHASH, 0);
+    BOOST_CHECK_EQUAL(profile.nSighashBytes, 2 * nSighashBytes);
+
+    // Standard templates are verified by the fast path, which still counts
+    // its signature checks but no opcodes.
+    CScript scriptP2PKH = GetScriptForDestination(key1.GetPubKey().GetID());
+    txFrom = BuildCreditingTransaction(scriptP2PKH);
+    txTo = BuildSpendingTransaction(CScript(), CScriptWitness(), txFrom);
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key1.Sign(SignatureHash(scriptP2PKH, txTo, 0, SIGHASH_ALL | SIGHASH_FORKID, 0, SIGVERSION_BASE), vchSig));
+    vchSig.push_back((unsigned char)(SIGHASH_ALL | SIGHASH_FORKID));
+    scriptSig = CScript() << vchSig << ToByteVector(key1.GetPubKey());
+
+    ScriptProfile profileP2PKH;
+    MutableTransactionSignatureChecker checkerP2PKH(&txTo, 0, txFrom.vout[0].nValue);
+    checkerP2PKH.SetProfile(&profileP2PKH);
+    BOOST_CHECK(VerifyScript(scriptSig, scriptP2PKH, nullptr, gFlags, checkerP2PKH, &err));
+    BOOST_CHECK(profileP2PKH.fFastPath);
+    BOOST_CHECK_EQUAL(profileP2PKH.nSigChecks, 1U);
+    BOOST_CHECK_EQUAL(profileP2PKH.nSighashBytes, 156 + ::GetSerializeSize(scriptP2PKH, SER_GETHASH, 0));
+    BOOST_CHECK_EQUAL(profileP2PKH.nOpcodes[OP_CHECKSIG], 0U);
+}
+
 BOOST_AUTO_TEST_CASE(script_combineSigs)
 {
     // Test the CombineSignatures function
@@ -164,6 +164,30 @@ BOOST_AUTO_TEST_CASE(sighash_test)
     #endif
 }
 
+// Goal: check that FORKID digests are the same with and without precomputed hashes
+BOOST_AUTO_TEST_CASE(sighash_forkid_precomputed)
+{
+    SeedInsecureRand(false);
+
+    for (int i=0; i<5000; i++) {
+        int nHashType = (InsecureRand32() & ~0xff) | (InsecureRandBits(2) + 1) | SIGHASH_FORKID;
+        if (InsecureRandBool())
+            nHashType |= SIGHASH_ANYONECANPAY;
+        CMutableTransaction mtx;
+        RandomTransaction(mtx, (nHashType & 0x1f) == SIGHASH_SINGLE);
+        const CTransaction txTo(mtx);
+        const PrecomputedTransactionData txdata(txTo);
+        CScript scriptCode;
+        RandomScript(scriptCode);
+        CAmount amount = InsecureRandRange(100000000);
+
+        for (unsigned int nIn = 0; nIn < txTo.vin.size(); nIn++) {
+            uint256 sh = SignatureHash(scriptCode, txTo, nIn, nHashType, amount, SIGVERSION_BASE);
+            BOOST_CHECK(sh == SignatureHash(scriptCode, txTo, nIn, nHashType, amount, SIGVERSION_BASE, &txdata));
+        }
+    }
+}
+
 // Goal: check that SignatureHash generates correct hash
 BOOST_AUTO_TEST_CASE(sighash_from_data)
 {
@@ -2,16 +2,23 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
 #include "consensus/validation.h"
+#include "hash.h"
 #include "key.h"
+#include "net.h"
+#include "net_processing.h"
+#include "netmessagemaker.h"
 #include "validation.h"
 #include "miner.h"
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
 #include "script/standard.h"
+#include "script/sigcache.h"
 #include "script/sign.h"
 #include "test/test_bitcoin.h"
+#include "util.h"
 #include "utiltime.h"
 #include "core_io.h"
 #include "keystore.h"
@@ -368,4 +375,322 @@ BOOST_FIXTURE_TEST_CASE(checkinputs_test, TestChain100Setup)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(preverify_scripts_test, TestingSetup)
+{
+    // PreVerifyTransactionScripts should only add signatures that are valid
+    // to the signature cache, skip transactions with unknown inputs or that
+    // fail the policy checks, and leave AcceptToMemoryPool no scripts to
+    // check.
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+
+    std::vector<CMutableTransaction> spends(5);
+    for (int i = 0; i < 5; i++) {
+        COutPoint prevout(InsecureRand256(), 0);
+        if (i != 2) {
+            LOCK(cs_main);
+            pcoinsTip->AddCoin(prevout, Coin(CTxOut(COIN, scriptPubKey), 1, false), false);
+        }
+        spends[i].nVersion = 1;
+        spends[i].vin.resize(1);
+        spends[i].vin[0].prevout = prevout;
+        spends[i].vout.resize(1);
+        // The fourth spend pays no fee at all
+        spends[i].vout[0].nValue = i != 3 ? COIN - 1000 : COIN;
+        spends[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, spends[i], 0, SIGHASH_ALL | SIGHASH_FORKID, COIN, SIGVERSION_BASE);
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)(SIGHASH_ALL | SIGHASH_FORKID));
+        spends[i].vin[0].scriptSig << vchSig;
+    }
+    // The last spend spends the output of the fifth one.
+    CMutableTransaction child;
+    child.nVersion = 1;
+    child.vin.resize(1);
+    child.vin[0].prevout = COutPoint(spends[4].GetHash(), 0);
+    child.vout.resize(1);
+    child.vout[0].nValue = COIN - 2000;
+    child.vout[0].scriptPubKey = scriptPubKey;
+    {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, child, 0, SIGHASH_ALL | SIGHASH_FORKID, COIN - 1000, SIGVERSION_BASE);
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)(SIGHASH_ALL | SIGHASH_FORKID));
+        child.vin[0].scriptSig << vchSig;
+    }
+    spends.push_back(child);
+    // Corrupt the signature of the second spend.
+    std::vector<unsigned char> vchBad(spends[1].vin[0].scriptSig.begin() + 1, spends[1].vin[0].scriptSig.end());
+    vchBad[10] ^= 1;
+    spends[1].vin[0].scriptSig = CScript() << vchBad;
+    {
+        // Write the coins out, so that they have to be pulled into the cache
+        LOCK(cs_main);
+        pcoinsTip->Flush();
+    }
+
+    std::vector<MemPoolAcceptRef> vAccept;
+    uint64_t nInsertsBefore = GetSignatureCacheStats().inserts;
+    PreVerifyTransactionScripts({MakeTransactionRef(spends[0]), MakeTransactionRef(spends[1]), MakeTransactionRef(spends[2]),
+                                 MakeTransactionRef(spends[3]), MakeTransactionRef(spends[4]), MakeTransactionRef(spends[5])}, vAccept);
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().inserts, nInsertsBefore + 3);
+    BOOST_CHECK_EQUAL(vAccept.size(), 6);
+    BOOST_CHECK(vAccept[0] && vAccept[1] && vAccept[4] && vAccept[5]);
+    BOOST_CHECK(!vAccept[2] && !vAccept[3]);
+
+    // Count every signature looked up from here on.
+    CuckooCache::cache_stats stats = GetSignatureCacheStats();
+    {
+        // The coin of the spend that failed the policy checks was uncached
+        // right away, the one of the invalid spend is left to
+        // AcceptToMemoryPool, which rejects it without checking its
+        // signature again.
+        LOCK(cs_main);
+        BOOST_CHECK(pcoinsTip->HaveCoinInCache(spends[1].vin[0].prevout));
+        BOOST_CHECK(!pcoinsTip->HaveCoinInCache(spends[3].vin[0].prevout));
+
+        CValidationState state;
+        int nDoS = 0;
+        BOOST_CHECK(!AcceptToMemoryPool(mempool, state, MakeTransactionRef(spends[1]), true, nullptr, nullptr, false, 0, vAccept[1]));
+        BOOST_CHECK(state.IsInvalid(nDoS) && nDoS == 100);
+        BOOST_CHECK(!pcoinsTip->HaveCoinInCache(spends[1].vin[0].prevout));
+
+        // A fee delta given after the pre-verification still counts.
+        mempool.PrioritiseTransaction(spends[0].GetHash(), -1000);
+        BOOST_CHECK(!AcceptToMemoryPool(mempool, state, MakeTransactionRef(spends[0]), true, nullptr, nullptr, false, 0, vAccept[0]));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "min relay fee not met");
+        mempool.ClearPrioritisation(spends[0].GetHash());
+
+        // The valid spends are accepted as they are, the second one after
+        // re-checking the mempool the first one changed, and the child of
+        // the second one once its parent is in the mempool.
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(spends[0]), true, nullptr, nullptr, false, 0, vAccept[0]));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(spends[4]), true, nullptr, nullptr, false, 0, vAccept[4]));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(spends[5]), true, nullptr, nullptr, false, 0, vAccept[5]));
+        BOOST_CHECK(mempool.exists(spends[0].GetHash()) && mempool.exists(spends[4].GetHash()) && mempool.exists(spends[5].GetHash()));
+    }
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().hits, stats.hits);
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().misses, stats.misses);
+
+    // The verified signature is now found in the cache.
+    const CTransaction tx(spends[0]);
+    PrecomputedTransactionData txdata(tx);
+    uint64_t nHitsBefore = GetSignatureCacheStats().hits;
+    CScriptCheck check(scriptPubKey, COIN, tx, 0, STANDARD_SCRIPT_VERIFY_FLAGS, false, &txdata);
+    BOOST_CHECK(check());
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().hits, nHitsBefore + 1);
+    mempool.clear();
+}
+
+
+/** Queue tx on node as if it had just been received. */
+static void ReceiveTransaction(CNode& node, const CTransaction& tx)
+{
+    CSerializedNetMsg msg = CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::TX, tx);
+    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), msg.data.size());
+    uint256 hash = Hash(msg.data.begin(), msg.data.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream header(SER_NETWORK, PROTOCOL_VERSION);
+    header << hdr;
+
+    CNetMessage netmsg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    BOOST_CHECK_EQUAL(netmsg.readHeader(header.data(), header.size()), (int)header.size());
+    BOOST_CHECK_EQUAL(netmsg.readData((const char*)msg.data.data(), msg.data.size()), (int)msg.data.size());
+    BOOST_CHECK(netmsg.complete());
+    LOCK(node.cs_vProcessMsg);
+    node.nProcessQueueSize += netmsg.vRecv.size() + CMessageHeader::HEADER_SIZE;
+    node.vProcessMsg.push_back(netmsg);
+}
+
+BOOST_FIXTURE_TEST_CASE(relay_batch_preverify_test, TestingSetup)
+{
+    // The transactions received from all peers in one pass of the message
+    // handler are only admitted to the mempool by ProcessPendingTransactions,
+    // which checks the inputs of all of them on the mempool script check
+    // queue at once. An invalid transaction among them is rejected on its
+    // own.
+    PeerLogicValidation peerLogic(connman);
+    std::atomic<bool> interruptDummy(false);
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+
+    CKey keyWrong;
+    keyWrong.MakeNewKey(true);
+
+    // The last input of the last transaction is signed with the wrong key.
+    const int nPeers = 4, nTxPerPeer = 2, nInputs = 20;
+    std::vector<CMutableTransaction> txs(nPeers * nTxPerPeer);
+    for (CMutableTransaction& tx : txs) {
+        const bool fInvalid = &tx == &txs.back();
+        tx.nVersion = 1;
+        tx.vin.resize(nInputs);
+        for (CTxIn& txin : tx.vin) {
+            txin.prevout = COutPoint(InsecureRand256(), 0);
+            LOCK(cs_main);
+            pcoinsTip->AddCoin(txin.prevout, Coin(CTxOut(COIN, scriptPubKey), 1, false), false);
+        }
+        tx.vout.resize(1);
+        tx.vout[0].nValue = nInputs * COIN - 10000;
+        tx.vout[0].scriptPubKey = scriptPubKey;
+        for (int i = 0; i < nInputs; i++) {
+            std::vector<unsigned char> vchSig;
+            uint256 hash = SignatureHash(scriptPubKey, tx, i, SIGHASH_ALL | SIGHASH_FORKID, COIN, SIGVERSION_BASE);
+            BOOST_CHECK((fInvalid && i == nInputs - 1 ? keyWrong : key).Sign(hash, vchSig));
+            vchSig.push_back((unsigned char)(SIGHASH_ALL | SIGHASH_FORKID));
+            tx.vin[i].scriptSig = CScript() << vchSig;
+        }
+    }
+
+    std::vector<std::unique_ptr<CNode>> nodes;
+    for (int i = 0; i < nPeers; i++) {
+        CAddress addr(CService(CNetAddr(), Params().GetDefaultPort()), NODE_NONE);
+        nodes.emplace_back(new CNode(1000 + i, NODE_NETWORK, 0, INVALID_SOCKET, addr, i, i, CAddress(), "", true));
+        CNode& node = *nodes.back();
+        node.SetSendVersion(PROTOCOL_VERSION);
+        node.SetRecvVersion(PROTOCOL_VERSION);
+        node.fUsesGoldMagic = true;
+        GetNodeSignals().InitializeNode(&node, *connman);
+        node.nVersion = PROTOCOL_VERSION;
+        node.fSuccessfullyConnected = true;
+        for (int j = 0; j < nTxPerPeer; j++)
+            ReceiveTransaction(node, txs[i * nTxPerPeer + j]);
+    }
+
+    // A run of transactions is taken from a peer at once, and nothing is
+    // admitted yet.
+    for (const std::unique_ptr<CNode>& node : nodes) {
+        BOOST_CHECK(!ProcessMessages(node.get(), *connman, interruptDummy));
+        BOOST_CHECK(node->vProcessMsg.empty());
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+
+    uint64_t nSigInsertsBefore = GetSignatureCacheStats().inserts;
+    uint64_t nExecInsertsBefore = GetScriptExecutionCacheStats().inserts;
+    ProcessPendingTransactions(*connman, interruptDummy);
+    BOOST_CHECK_EQUAL(mempool.size(), txs.size() - 1);
+    for (const CMutableTransaction& tx : txs)
+        BOOST_CHECK_EQUAL(mempool.exists(tx.GetHash()), &tx != &txs.back());
+    // Every valid signature was verified and cached once, whether the other
+    // inputs of its transaction passed or not, and every valid transaction
+    // got its script execution cache entry.
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().inserts, nSigInsertsBefore + txs.size() * nInputs - 1);
+    BOOST_CHECK_EQUAL(GetScriptExecutionCacheStats().inserts, nExecInsertsBefore + txs.size() - 1);
+
+    for (const std::unique_ptr<CNode>& node : nodes) {
+        bool fUpdateConnectionTime;
+        GetNodeSignals().FinalizeNode(node->GetId(), fUpdateConnectionTime);
+    }
+    mempool.clear();
+}
+
+static std::vector<char> ReadMempoolDump()
+{
+    std::vector<char> data;
+    FILE* file = fsbridge::fopen(GetDataDir() / "mempool.dat", "rb");
+    BOOST_REQUIRE(file);
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(file);
+    return data;
+}
+
+static void WriteMempoolDump(const std::vector<char>& data)
+{
+    FILE* file = fsbridge::fopen(GetDataDir() / "mempool.dat", "wb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(data.data(), 1, data.size(), file), data.size());
+    fclose(file);
+}
+
+BOOST_FIXTURE_TEST_CASE(mempool_dump_test, TestingSetup)
+{
+    // A dump should be loaded back with its fee deltas, and rejected as a
+    // whole if its hash does not match. Dumps without a hash, as written by
+    // older versions, should still be loaded.
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+
+    std::vector<CMutableTransaction> txs(3);
+    for (size_t i = 0; i < txs.size(); i++) {
+        // The last transaction spends the output of the first one.
+        COutPoint prevout(i + 1 < txs.size() ? COutPoint(InsecureRand256(), 0) : COutPoint(txs[0].GetHash(), 0));
+        CAmount nValue = i + 1 < txs.size() ? COIN : COIN - 1000;
+        if (i + 1 < txs.size()) {
+            LOCK(cs_main);
+            pcoinsTip->AddCoin(prevout, Coin(CTxOut(nValue, scriptPubKey), 1, false), false);
+        }
+        txs[i].nVersion = 1;
+        txs[i].vin.resize(1);
+        txs[i].vin[0].prevout = prevout;
+        txs[i].vout.resize(1);
+        txs[i].vout[0].nValue = nValue - 1000;
+        txs[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, txs[i], 0, SIGHASH_ALL | SIGHASH_FORKID, nValue, SIGVERSION_BASE);
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)(SIGHASH_ALL | SIGHASH_FORKID));
+        txs[i].vin[0].scriptSig << vchSig;
+        BOOST_CHECK(ToMemPool(txs[i]));
+    }
+    const uint256 hashUnknown = InsecureRand256();
+    mempool.PrioritiseTransaction(txs[1].GetHash(), 500);
+    mempool.PrioritiseTransaction(hashUnknown, 700);
+    BOOST_CHECK_EQUAL(mempool.size(), txs.size());
+
+    DumpMempool();
+    const std::vector<char> dump = ReadMempoolDump();
+    BOOST_REQUIRE_GT(dump.size(), sizeof(uint256));
+
+    auto Reload = [&](const std::vector<char>& data) {
+        mempool.clear();
+        mempool.ClearPrioritisation(txs[1].GetHash());
+        mempool.ClearPrioritisation(hashUnknown);
+        WriteMempoolDump(data);
+        return LoadMempool();
+    };
+    auto CheckLoaded = [&]() {
+        BOOST_CHECK_EQUAL(mempool.size(), txs.size());
+        for (const CMutableTransaction& tx : txs)
+            BOOST_CHECK(mempool.exists(tx.GetHash()));
+        CAmount nDelta = 0;
+        mempool.ApplyDelta(txs[1].GetHash(), nDelta);
+        BOOST_CHECK_EQUAL(nDelta, 500);
+        nDelta = 0;
+        mempool.ApplyDelta(hashUnknown, nDelta);
+        BOOST_CHECK_EQUAL(nDelta, 700);
+    };
+
+    BOOST_CHECK(Reload(dump));
+    CheckLoaded();
+
+    // A corrupted hash rejects the whole dump.
+    std::vector<char> corrupt(dump);
+    corrupt.back() ^= 1;
+    BOOST_CHECK(!Reload(corrupt));
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+    CAmount nDelta = 0;
+    mempool.ApplyDelta(txs[1].GetHash(), nDelta);
+    BOOST_CHECK_EQUAL(nDelta, 0);
+
+    // So does a truncated one.
+    BOOST_CHECK(!Reload(std::vector<char>(dump.begin(), dump.end() - 1)));
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+
+    // A dump without the hash is loaded unverified.
+    BOOST_CHECK(Reload(std::vector<char>(dump.begin(), dump.end() - sizeof(uint256))));
+    CheckLoaded();
+
+    mempool.clear();
+    mempool.ClearPrioritisation(txs[1].GetHash());
+    mempool.ClearPrioritisation(hashUnknown);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
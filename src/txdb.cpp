@@ -17,6 +17,8 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include <boost/thread.hpp>
 
 static const char DB_COIN = 'C';
@@ -27,6 +29,7 @@ static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_HEAD_BLOCKS = 'H';
+static const char DB_ROLLING_STATS = 'S';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
@@ -53,9 +56,23 @@ struct CoinEntry {
     }
 };
 
+/**
+ * Orders cache entries the way their CoinEntry keys sort in LevelDB: by the
+ * raw txid bytes, then by output index. The index is a VARINT on disk, which
+ * only differs from numeric order between outputs of the same transaction,
+ * so a sorted flush still produces a single ascending run of keys.
+ */
+struct CoinEntryKeyOrder {
+    bool operator()(const CCoinsMap::iterator& a, const CCoinsMap::iterator& b) const {
+        int cmp = memcmp(a->first.hash.begin(), b->first.hash.begin(), a->first.hash.size());
+        return cmp < 0 || (cmp == 0 && a->first.n < b->first.n);
+    }
+};
+
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true), fBulkWrite(false),
+    fRollingStats(gArgs.GetBoolArg("-rollingutxostats", DEFAULT_ROLLING_UTXO_STATS))
 {
 }
 
@@ -63,6 +80,21 @@ bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
+size_t CCoinsViewDB::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins) const {
+    std::vector<CoinEntry> keys;
+    keys.reserve(outpoints.size());
+    for (const COutPoint& outpoint : outpoints) {
+        keys.emplace_back(&outpoint);
+    }
+    std::vector<bool> found;
+    int nThreads = (int)gArgs.GetArg("-dbreadthreads", nDefaultDbReadThreads);
+    size_t nFound = db.ReadMany(keys, coins, found, nThreads);
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        if (!found[i]) coins[i].Clear();
+    }
+    return nFound;
+}
+
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
     return db.Exists(CoinEntry(&outpoint));
 }
@@ -82,7 +114,25 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::GetRollingStats(CRollingCoinsStats &stats) const {
+    // Without -rollingutxostats any stored stats may be out of date.
+    if (!fRollingStats)
+        return false;
+    if (db.Read(DB_ROLLING_STATS, stats))
+        return true;
+    // A database that has never been written to holds the empty set.
+    if (GetBestBlock().IsNull() && GetHeadBlocks().empty()) {
+        stats = CRollingCoinsStats();
+        return true;
+    }
+    return false;
+}
+
+bool CCoinsViewDB::WriteRollingStats(const CRollingCoinsStats &stats) {
+    return db.Write(DB_ROLLING_STATS, stats, true);
+}
+
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CRollingCoinsStats &statsDelta, size_t &nDirty) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -90,6 +140,12 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
 
+    CRollingCoinsStats stats;
+    bool fStatsKnown = GetRollingStats(stats);
+    if (fStatsKnown) {
+        stats += statsDelta;
+    }
+
     uint256 old_tip = GetBestBlock();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
@@ -106,19 +162,11 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     // interrupting after partial writes from multiple independent reorgs.
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
+    // The rolling stats cannot be reconstructed after an interrupted
+    // multi-batch write, so only keep them if the final batch lands.
+    batch.Erase(DB_ROLLING_STATS);
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
-        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            CoinEntry entry(&it->first);
-            if (it->second.coin.IsSpent())
-                batch.Erase(entry);
-            else
-                batch.Write(entry, it->second.coin);
-            changed++;
-        }
-        count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+    auto write_partial = [&]() {
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -131,15 +179,60 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
                 }
             }
         }
+    };
+
+    if (fBulkWrite) {
+        // Bulk mode: drop the clean entries, then emit the dirty ones in
+        // database key order so consecutive batches cover disjoint, ascending
+        // key ranges instead of being spread over the whole keyspace.
+        std::vector<CCoinsMap::iterator> dirty;
+        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+            count++;
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                dirty.push_back(it++);
+            } else {
+                mapCoins.erase(it++);
+            }
+        }
+        std::sort(dirty.begin(), dirty.end(), CoinEntryKeyOrder());
+        for (CCoinsMap::iterator it : dirty) {
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
+            else
+                batch.Write(entry, it->second.coin);
+            changed++;
+            mapCoins.erase(it);
+            write_partial();
+        }
+    } else {
+        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                CoinEntry entry(&it->first);
+                if (it->second.coin.IsSpent())
+                    batch.Erase(entry);
+                else
+                    batch.Write(entry, it->second.coin);
+                changed++;
+            }
+            count++;
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+            write_partial();
+        }
     }
 
     // In the last batch, mark the database as consistent with hashBlock again.
     batch.Erase(DB_HEAD_BLOCKS);
     batch.Write(DB_BEST_BLOCK, hashBlock);
+    if (fStatsKnown) {
+        batch.Write(DB_ROLLING_STATS, stats);
+    }
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
     LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    nDirty = changed;
     return ret;
 }
 
@@ -172,12 +265,17 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 }
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
+{
+    return Cursor(uint256());
+}
+
+CCoinsViewCursor *CCoinsViewDB::Cursor(const uint256 &hashStart) const
 {
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COIN);
+    i->pcursor->Seek(std::make_pair(DB_COIN, hashStart));
     // Cache key of first record
     if (i->pcursor->Valid()) {
         CoinEntry entry(&i->keyTmp.second);
@@ -25,6 +25,10 @@ static constexpr int MAX_BLOCK_COINSDB_USAGE = 10;
 static const int64_t nDefaultDbCache = 450;
 //! -dbbatchsize default (bytes)
 static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -dbreadthreads default
+static const int64_t nDefaultDbReadThreads = 4;
+//! -rollingutxostats default
+static const bool DEFAULT_ROLLING_UTXO_STATS = false;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
@@ -68,16 +72,34 @@ class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    //! Write flushed coins in key order (see SetBulkWriteMode)
+    bool fBulkWrite;
+    //! Maintain the rolling stats with every flush (-rollingutxostats)
+    const bool fRollingStats;
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CRollingCoinsStats &statsDelta, size_t &nDirty) override;
+    bool GetRollingStats(CRollingCoinsStats &stats) const override;
+    bool TracksRollingStats() const override { return fRollingStats; }
     CCoinsViewCursor *Cursor() const override;
-
+    //! Get a cursor positioned at the first coin whose txid sorts at or after hashStart in the database
+    CCoinsViewCursor *Cursor(const uint256 &hashStart) const;
+
+    //! Store rolling stats recomputed from a full scan of the current state.
+    bool WriteRollingStats(const CRollingCoinsStats &stats);
+    /**
+     * Enable or disable bulk write mode. In bulk mode BatchWrite sorts the
+     * dirty coins by database key before writing them, so large flushes (as
+     * during initial block download) reach LevelDB as ascending runs rather
+     * than in hash map order, which keeps compaction work down.
+     */
+    void SetBulkWriteMode(bool fBulk) { fBulkWrite = fBulk; }
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
@@ -18,11 +18,14 @@
 #include "utilmoneystr.h"
 #include "utiltime.h"
 
+#include <algorithm>
+#include <queue>
+
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, unsigned int _entryHeight,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp):
     tx(_tx), nFee(_nFee), nTime(_nTime), entryHeight(_entryHeight),
-    spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp)
+    sigOpCost(_sigOpsCost), lockPoints(lp), spendsCoinbase(_spendsCoinbase)
 {
     nTxWeight = GetTransactionWeight(*tx);
     nUsageSize = RecursiveDynamicUsage(tx);
@@ -37,6 +40,8 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
     nSizeWithAncestors = GetTxSize();
     nModFeesWithAncestors = nFee;
     nSigOpCostWithAncestors = sigOpCost;
+
+    nVisitedEpoch = 0;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -61,44 +66,66 @@ size_t CTxMemPoolEntry::GetTxSize() const
     return GetVirtualTransactionSize(nTxWeight, sigOpCost);
 }
 
+CTxMemPool::EpochGuard::EpochGuard(const CTxMemPool& poolIn) : pool(poolIn)
+{
+    assert(!pool.fEpochInUse);
+    pool.fEpochInUse = true;
+    ++pool.nEpoch;
+}
+
+CTxMemPool::EpochGuard::~EpochGuard()
+{
+    pool.fEpochInUse = false;
+}
+
 // Update the given tx for any in-mempool descendants.
 // Assumes that setMemPoolChildren is correct for the given tx and all
 // descendants.
-void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
+void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::unordered_set<uint256, SaltedTxidHasher> &setExclude)
 {
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
-
-    while (!stageEntries.empty()) {
-        const txiter cit = *stageEntries.begin();
-        setAllDescendants.insert(cit);
-        stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
-        for (const txiter childEntry : setChildren) {
-            cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
-            if (cacheIt != cachedDescendants.end()) {
-                // We've already calculated this one, just add the entries for this set
-                // but don't traverse again.
-                for (const txiter cacheEntry : cacheIt->second) {
-                    setAllDescendants.insert(cacheEntry);
+    vecEntries stageEntries, vAllDescendants;
+    {
+        EpochGuard guard(*this);
+        for (const CTxMemPoolEntry* child : GetMemPoolChildren(updateIt)) {
+            if (!Visited(*child))
+                stageEntries.push_back(mapTx.iterator_to(*child));
+        }
+
+        while (!stageEntries.empty()) {
+            const txiter cit = stageEntries.back();
+            stageEntries.pop_back();
+            vAllDescendants.push_back(cit);
+            for (const CTxMemPoolEntry* child : GetMemPoolChildren(cit)) {
+                if (Visited(*child))
+                    continue;
+                const txiter childEntry = mapTx.iterator_to(*child);
+                cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
+                if (cacheIt != cachedDescendants.end()) {
+                    // We've already calculated this one, just add the entries for this set
+                    // but don't traverse again.
+                    for (const txiter cacheEntry : cacheIt->second) {
+                        if (!Visited(*cacheEntry))
+                            vAllDescendants.push_back(cacheEntry);
+                    }
+                } else {
+                    // Schedule for later processing
+                    stageEntries.push_back(childEntry);
                 }
-            } else if (!setAllDescendants.count(childEntry)) {
-                // Schedule for later processing
-                stageEntries.insert(childEntry);
             }
         }
     }
-    // setAllDescendants now contains all in-mempool descendants of updateIt.
+    // vAllDescendants now contains all in-mempool descendants of updateIt.
     // Update and add to cached descendant map
     int64_t modifySize = 0;
     CAmount modifyFee = 0;
     int64_t modifyCount = 0;
-    for (txiter cit : setAllDescendants) {
+    vecEntries& cached = cachedDescendants[updateIt];
+    for (txiter cit : vAllDescendants) {
         if (!setExclude.count(cit->GetTx().GetHash())) {
             modifySize += cit->GetTxSize();
             modifyFee += cit->GetModifiedFee();
             modifyCount++;
-            cachedDescendants[updateIt].insert(cit);
+            cached.push_back(cit);
             // Update ancestor state for each descendant
             mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCost()));
         }
@@ -121,7 +148,7 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
 
     // Use a set for lookups into vHashesToUpdate (these entries are already
     // accounted for in the state of their ancestors)
-    std::set<uint256> setAlreadyIncluded(vHashesToUpdate.begin(), vHashesToUpdate.end());
+    std::unordered_set<uint256, SaltedTxidHasher> setAlreadyIncluded(vHashesToUpdate.begin(), vHashesToUpdate.end());
 
     // Iterate in reverse, so that whenever we are looking at a transaction
     // we are sure that all in-mempool descendants have already been processed.
@@ -129,8 +156,6 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
     // setMemPoolChildren will be updated, an assumption made in
     // UpdateForDescendants.
     for (const uint256 &hash : reverse_iterate(vHashesToUpdate)) {
-        // we cache the in-mempool children to avoid duplicate updates
-        setEntries setChildren;
         // calculate children from mapNextTx
         txiter it = mapTx.find(hash);
         if (it == mapTx.end()) {
@@ -139,13 +164,14 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
         auto iter = mapNextTx.lower_bound(COutPoint(hash, 0));
         // First calculate the children, and update setMemPoolChildren to
         // include them, and update their setMemPoolParents to include this tx.
+        // UpdateChild and UpdateParent ignore links that already exist.
         for (; iter != mapNextTx.end() && iter->first->hash == hash; ++iter) {
             const uint256 &childHash = iter->second->GetHash();
             txiter childIter = mapTx.find(childHash);
             assert(childIter != mapTx.end());
-            // We can skip updating entries we've encountered before or that
-            // are in the block (which are already accounted for).
-            if (setChildren.insert(childIter).second && !setAlreadyIncluded.count(childHash)) {
+            // We can skip updating entries that are in the block (which are
+            // already accounted for).
+            if (!setAlreadyIncluded.count(childHash)) {
                 UpdateChild(it, childIter, true);
                 UpdateParent(childIter, it, true);
             }
@@ -157,8 +183,11 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
 {
     LOCK(cs);
+    EpochGuard guard(*this);
 
-    setEntries parentHashes;
+    // Ancestors found but not looked at yet; with setAncestors, these are
+    // the entries this walk visited
+    vecEntries parentHashes;
     const CTransaction &tx = entry.GetTx();
 
     if (fSearchForParents) {
@@ -167,8 +196,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // iterate mapTx to find parents.
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             txiter piter = mapTx.find(tx.vin[i].prevout.hash);
-            if (piter != mapTx.end()) {
-                parentHashes.insert(piter);
+            if (piter != mapTx.end() && !Visited(*piter)) {
+                parentHashes.push_back(piter);
                 if (parentHashes.size() + 1 > limitAncestorCount) {
                     errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
                     return false;
@@ -179,16 +208,19 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        for (const CTxMemPoolEntry* parent : GetMemPoolParents(it)) {
+            if (!Visited(*parent))
+                parentHashes.push_back(mapTx.iterator_to(*parent));
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
 
     while (!parentHashes.empty()) {
-        txiter stageit = *parentHashes.begin();
+        txiter stageit = parentHashes.back();
 
         setAncestors.insert(stageit);
-        parentHashes.erase(stageit);
+        parentHashes.pop_back();
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
@@ -202,11 +234,10 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
             return false;
         }
 
-        const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
-        for (const txiter &phash : setMemPoolParents) {
+        for (const CTxMemPoolEntry* parent : GetMemPoolParents(stageit)) {
             // If this is a new ancestor, add it.
-            if (setAncestors.count(phash) == 0) {
-                parentHashes.insert(phash);
+            if (!Visited(*parent)) {
+                parentHashes.push_back(mapTx.iterator_to(*parent));
             }
             if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
                 errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
@@ -218,12 +249,67 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
     return true;
 }
 
+bool CTxMemPool::CheckClusterLimit(const setEntries &setAncestors, const setEntries &setConflicting, uint64_t limitClusterCount, std::string &errString) const
+{
+    LOCK(cs);
+    if (!fClusterOrder)
+        return true;
+
+    // Mark the entries the transaction replaces, so that the walk below
+    // neither counts them nor passes through them
+    EpochGuard guard(*this);
+    std::vector<const CTxMemPoolEntry*> vReplaced;
+    for (txiter it : setConflicting) {
+        if (!Visited(*it))
+            vReplaced.push_back(&*it);
+    }
+    for (size_t i = 0; i < vReplaced.size(); i++) {
+        for (const CTxMemPoolEntry* child : vReplaced[i]->vMemPoolChildren) {
+            if (!Visited(*child))
+                vReplaced.push_back(child);
+        }
+    }
+
+    // Walk the clusters the transaction would join, until they are found to
+    // hold too many transactions to add it
+    std::vector<const CTxMemPoolEntry*> vCluster;
+    for (txiter it : setAncestors) {
+        if (!Visited(*it))
+            vCluster.push_back(&*it);
+    }
+    for (size_t i = 0; i < vCluster.size() && vCluster.size() < limitClusterCount; i++) {
+        for (const CTxMemPoolEntry* parent : vCluster[i]->vMemPoolParents) {
+            if (!Visited(*parent))
+                vCluster.push_back(parent);
+        }
+        for (const CTxMemPoolEntry* child : vCluster[i]->vMemPoolChildren) {
+            if (!Visited(*child))
+                vCluster.push_back(child);
+        }
+    }
+    if (vCluster.size() + 1 > limitClusterCount) {
+        errString = strprintf("too many transactions in cluster [limit: %u]", limitClusterCount);
+        return false;
+    }
+    return true;
+}
+
+namespace {
+/** Change to the ancestor or descendant state of one entry, summed over a batch of removals */
+struct StateDelta
+{
+    int64_t nSize = 0;
+    CAmount nFee = 0;
+    int64_t nCount = 0;
+    int64_t nSigOpCost = 0;
+};
+} // namespace
+
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
-    for (txiter piter : parentIters) {
-        UpdateChild(piter, it, add);
+    for (const CTxMemPoolEntry* parent : GetMemPoolParents(it)) {
+        UpdateChild(mapTx.iterator_to(*parent), it, add);
     }
     const int64_t updateCount = (add ? 1 : -1);
     const int64_t updateSize = updateCount * it->GetTxSize();
@@ -249,33 +335,36 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
-    for (txiter updateIt : setMemPoolChildren) {
-        UpdateParent(updateIt, it, false);
+    for (const CTxMemPoolEntry* child : GetMemPoolChildren(it)) {
+        UpdateParent(mapTx.iterator_to(*child), it, false);
     }
 }
 
 void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants)
 {
-    // For each entry, walk back all ancestors and decrement size associated with this
-    // transaction
+    // Every entry that stays in the mempool collects the changes from all
+    // transactions being removed first, so that it is modified (and re-sorted
+    // in mapTx) only once. Entries that are being removed aren't updated.
+    std::map<txiter, StateDelta, CompareIteratorByHash> mapAncestorDeltas, mapDescendantDeltas;
     const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
     if (updateDescendants) {
         // updateDescendants should be true whenever we're not recursively
         // removing a tx and all its descendants, eg when a transaction is
         // confirmed in a block.
-        // Here we only update statistics and not data in mapLinks (which
+        // Here we only update statistics and not the parent and child links (which
         // we need to preserve until we're finished with all operations that
         // need to traverse the mempool).
         for (txiter removeIt : entriesToRemove) {
             setEntries setDescendants;
             CalculateDescendants(removeIt, setDescendants);
-            setDescendants.erase(removeIt); // don't update state for self
-            int64_t modifySize = -((int64_t)removeIt->GetTxSize());
-            CAmount modifyFee = -removeIt->GetModifiedFee();
-            int modifySigOps = -removeIt->GetSigOpCost();
             for (txiter dit : setDescendants) {
-                mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+                if (entriesToRemove.count(dit))
+                    continue;
+                StateDelta& delta = mapAncestorDeltas[dit];
+                delta.nSize -= removeIt->GetTxSize();
+                delta.nFee -= removeIt->GetModifiedFee();
+                delta.nCount -= 1;
+                delta.nSigOpCost -= removeIt->GetSigOpCost();
             }
         }
     }
@@ -289,21 +378,39 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // should be a bit faster.
         // However, if we happen to be in the middle of processing a reorg, then
         // the mempool can be in an inconsistent state.  In this case, the set
-        // of ancestors reachable via mapLinks will be the same as the set of 
+        // of ancestors reachable via the links will be the same as the set of
         // ancestors whose packages include this transaction, because when we
         // add a new transaction to the mempool in addUnchecked(), we assume it
         // has no children, and in the case of a reorg where that assumption is
         // false, the in-mempool children aren't linked to the in-block tx's
         // until UpdateTransactionsFromBlock() is called.
         // So if we're being called during a reorg, ie before
-        // UpdateTransactionsFromBlock() has been called, then mapLinks[] will
+        // UpdateTransactionsFromBlock() has been called, then the links will
         // differ from the set of mempool parents we'd calculate by searching,
-        // and it's important that we use the mapLinks[] notion of ancestor
+        // and it's important that we use the links' notion of ancestor
         // transactions as the set of things to update for removal.
         CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
-        // Note that UpdateAncestorsOf severs the child links that point to
-        // removeIt in the entries for the parents of removeIt.
-        UpdateAncestorsOf(false, removeIt, setAncestors);
+        // Sever the child links that point to removeIt in the entries for the
+        // parents of removeIt.
+        for (const CTxMemPoolEntry* parent : GetMemPoolParents(removeIt)) {
+            UpdateChild(mapTx.iterator_to(*parent), removeIt, false);
+        }
+        for (txiter ancestorIt : setAncestors) {
+            if (entriesToRemove.count(ancestorIt))
+                continue;
+            StateDelta& delta = mapDescendantDeltas[ancestorIt];
+            delta.nSize -= removeIt->GetTxSize();
+            delta.nFee -= removeIt->GetModifiedFee();
+            delta.nCount -= 1;
+        }
+    }
+    for (const auto& item : mapAncestorDeltas) {
+        const StateDelta& delta = item.second;
+        mapTx.modify(item.first, update_ancestor_state(delta.nSize, delta.nFee, delta.nCount, delta.nSigOpCost));
+    }
+    for (const auto& item : mapDescendantDeltas) {
+        const StateDelta& delta = item.second;
+        mapTx.modify(item.first, update_descendant_state(delta.nSize, delta.nFee, delta.nCount));
     }
     // After updating all the ancestor sizes, we can now sever the link between each
     // transaction being removed and any mempool children (ie, update setMemPoolParents
@@ -319,7 +426,7 @@ void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFe
     assert(int64_t(nSizeWithDescendants) > 0);
     nModFeesWithDescendants += modifyFee;
     nCountWithDescendants += modifyCount;
-    assert(int64_t(nCountWithDescendants) > 0);
+    assert(int32_t(nCountWithDescendants) > 0);
 }
 
 void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int modifySigOps)
@@ -328,13 +435,13 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
     assert(int64_t(nSizeWithAncestors) > 0);
     nModFeesWithAncestors += modifyFee;
     nCountWithAncestors += modifyCount;
-    assert(int64_t(nCountWithAncestors) > 0);
+    assert(int32_t(nCountWithAncestors) > 0);
     nSigOpCostWithAncestors += modifySigOps;
     assert(int(nSigOpCostWithAncestors) >= 0);
 }
 
 CTxMemPool::CTxMemPool(CBlockPolicyEstimator* estimator) :
-    nTransactionsUpdated(0), minerPolicyEstimator(estimator)
+    nTransactionsUpdated(0), minerPolicyEstimator(estimator), nEpoch(0), fEpochInUse(false), nNextClusterId(0), cachedClusterUsage(0)
 {
     _clear(); //lock free clear
 
@@ -342,6 +449,18 @@ CTxMemPool::CTxMemPool(CBlockPolicyEstimator* estimator) :
     // accepting transactions becomes O(N^2) where N is the number
     // of transactions in the pool
     nCheckFrequency = 0;
+    fClusterOrder = false;
+}
+
+void CTxMemPool::setClusterOrder(bool fClusterOrderIn)
+{
+    LOCK(cs);
+    fClusterOrder = fClusterOrderIn;
+    ResetClusters();
+    if (fClusterOrder) {
+        for (const CTxMemPoolEntry& entry : mapTx)
+            vClusterDirty.push_back(entry.GetTx().GetHash());
+    }
 }
 
 bool CTxMemPool::isSpent(const COutPoint& outpoint)
@@ -370,7 +489,6 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
-    mapLinks.insert(make_pair(newit, TxLinks()));
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
@@ -418,6 +536,8 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     vTxHashes.emplace_back(tx.GetWitnessHash(), newit);
     newit->vTxHashesIdx = vTxHashes.size() - 1;
 
+    MarkClusterDirty(hash);
+
     return true;
 }
 
@@ -437,10 +557,11 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     } else
         vTxHashes.clear();
 
+    MarkClusterDirty(hash);
+
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
-    mapLinks.erase(it);
+    cachedInnerUsage -= memusage::DynamicUsage(it->vMemPoolParents) + memusage::DynamicUsage(it->vMemPoolChildren);
     mapTx.erase(it);
     nTransactionsUpdated++;
     if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash, false);}
@@ -454,22 +575,25 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 // can save time by not iterating over those entries.
 void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants)
 {
-    setEntries stage;
-    if (setDescendants.count(entryit) == 0) {
-        stage.insert(entryit);
-    }
+    if (setDescendants.count(entryit))
+        return;
+    EpochGuard guard(*this);
+    vecEntries stage(1, entryit);
+    Visited(*entryit);
     // Traverse down the children of entry, only adding children that are not
     // accounted for in setDescendants already (because those children have either
     // already been walked, or will be walked in this iteration).
     while (!stage.empty()) {
-        txiter it = *stage.begin();
+        txiter it = stage.back();
+        stage.pop_back();
         setDescendants.insert(it);
-        stage.erase(it);
 
-        const setEntries &setChildren = GetMemPoolChildren(it);
-        for (const txiter &childiter : setChildren) {
+        for (const CTxMemPoolEntry* child : GetMemPoolChildren(it)) {
+            if (Visited(*child))
+                continue;
+            const txiter childiter = mapTx.iterator_to(*child);
             if (!setDescendants.count(childiter)) {
-                stage.insert(childiter);
+                stage.push_back(childiter);
             }
         }
     }
@@ -568,26 +692,53 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
 {
     LOCK(cs);
     std::vector<const CTxMemPoolEntry*> entries;
+    std::unordered_set<uint256, SaltedTxidHasher> setBlockTxids;
+    setEntries setBlockEntries;
+    setBlockTxids.reserve(vtx.size());
     for (const auto& tx : vtx)
     {
-        uint256 hash = tx->GetHash();
+        const uint256& hash = tx->GetHash();
+        setBlockTxids.insert(hash);
 
         indexed_transaction_set::iterator i = mapTx.find(hash);
-        if (i != mapTx.end())
+        if (i != mapTx.end()) {
             entries.push_back(&*i);
+            setBlockEntries.insert(i);
+        }
     }
     // Before the txs in the new block have been removed from the mempool, update policy estimates
     if (minerPolicyEstimator) {minerPolicyEstimator->processBlock(nBlockHeight, entries);}
+
+    // Mempool transactions spending the same outputs as a block transaction
+    // conflict with it, and are removed together with their descendants.
+    setEntries setConflicts;
     for (const auto& tx : vtx)
     {
-        txiter it = mapTx.find(tx->GetHash());
-        if (it != mapTx.end()) {
-            setEntries stage;
-            stage.insert(it);
-            RemoveStaged(stage, true, MemPoolRemovalReason::BLOCK);
+        for (const CTxIn &txin : tx->vin) {
+            auto it = mapNextTx.find(txin.prevout);
+            if (it == mapNextTx.end() || setBlockTxids.count(it->second->GetHash()))
+                continue;
+            txiter conflictit = mapTx.find(it->second->GetHash());
+            assert(conflictit != mapTx.end());
+            if (setConflicts.insert(conflictit).second) {
+                ClearPrioritisation(conflictit->GetTx().GetHash());
+            }
         }
-        removeConflicts(*tx);
-        ClearPrioritisation(tx->GetHash());
+    }
+    setEntries setConflictRemoves;
+    for (txiter it : setConflicts) {
+        CalculateDescendants(it, setConflictRemoves);
+    }
+    for (txiter it : setBlockEntries) {
+        setConflictRemoves.erase(it);
+    }
+
+    // All the block's transactions leave in one pass, so descendants that stay
+    // behind get their ancestor state updated once.
+    RemoveStaged(setBlockEntries, true, MemPoolRemovalReason::BLOCK);
+    RemoveStaged(setConflictRemoves, false, MemPoolRemovalReason::CONFLICT);
+    for (const uint256& hash : setBlockTxids) {
+        ClearPrioritisation(hash);
     }
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = true;
@@ -595,9 +746,10 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
 
 void CTxMemPool::_clear()
 {
-    mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    vTxHashes.clear();
+    ResetClusters();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     lastRollingFeeUpdate = GetTime();
@@ -635,10 +787,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         checkTotal += it->GetTxSize();
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
-        txlinksMap::const_iterator linksiter = mapLinks.find(it);
-        assert(linksiter != mapLinks.end());
-        const TxLinks &links = linksiter->second;
-        innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
+        innerUsage += memusage::DynamicUsage(it->vMemPoolParents) + memusage::DynamicUsage(it->vMemPoolChildren);
         bool fDependsWait = false;
         setEntries setParentCheck;
         int64_t parentSizes = 0;
@@ -664,7 +813,9 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        assert(setParentCheck.size() == it->vMemPoolParents.size());
+        for (const CTxMemPoolEntry* parent : it->vMemPoolParents)
+            assert(setParentCheck.count(mapTx.iterator_to(*parent)));
         // Verify ancestor state is correct.
         setEntries setAncestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -697,7 +848,9 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 childSizes += childit->GetTxSize();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        assert(setChildrenCheck.size() == it->vMemPoolChildren.size());
+        for (const CTxMemPoolEntry* child : it->vMemPoolChildren)
+            assert(setChildrenCheck.count(mapTx.iterator_to(*child)));
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= childSizes + it->GetTxSize());
@@ -844,6 +997,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
             mapTx.modify(it, update_fee_delta(delta));
+            MarkClusterDirty(hash);
             // Now update all ancestors' modified fees with descendants
             setEntries setAncestors;
             uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -907,10 +1061,45 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return base->GetCoin(outpoint, coin);
 }
 
+size_t CCoinsViewMemPool::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins) const {
+    // Answer what the mempool knows directly (see GetCoin) and batch the
+    // remaining lookups to the base view.
+    size_t nFound = 0;
+    std::vector<COutPoint> vBaseOutpoints;
+    std::vector<size_t> vBaseIndex;
+    coins.resize(outpoints.size());
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        CTransactionRef ptx = mempool.get(outpoints[i].hash);
+        if (ptx) {
+            if (outpoints[i].n < ptx->vout.size()) {
+                coins[i] = Coin(ptx->vout[outpoints[i].n], MEMPOOL_HEIGHT, false);
+                nFound++;
+            } else {
+                coins[i].Clear();
+            }
+        } else {
+            vBaseOutpoints.push_back(outpoints[i]);
+            vBaseIndex.push_back(i);
+        }
+    }
+    if (!vBaseOutpoints.empty()) {
+        std::vector<Coin> vBaseCoins;
+        nFound += base->GetCoins(vBaseOutpoints, vBaseCoins);
+        for (size_t j = 0; j < vBaseIndex.size(); j++) {
+            coins[vBaseIndex[j]] = std::move(vBaseCoins[j]);
+        }
+    }
+    return nFound;
+}
+
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
+    size_t nUsage = memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    // The clusters are only kept with cluster order
+    if (fClusterOrder)
+        nUsage += memusage::DynamicUsage(mapClusters) + memusage::DynamicUsage(mapClusterIds) + memusage::DynamicUsage(setClusterTails) + memusage::DynamicUsage(vClusterDirty) + cachedClusterUsage;
+    return nUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -947,40 +1136,43 @@ bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
     return addUnchecked(hash, entry, setAncestors, validFeeEstimate);
 }
 
-void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+// Parents and children are few for all but pathological transactions, so a
+// linear search of the adjacency array is cheaper than any set.
+static void UpdateLink(CTxMemPoolEntry::Links& links, const CTxMemPoolEntry* other, bool add, uint64_t& cachedInnerUsage)
 {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    CTxMemPoolEntry::Links::iterator it = std::find(links.begin(), links.end(), other);
+    if (add == (it != links.end()))
+        return;
+    cachedInnerUsage -= memusage::DynamicUsage(links);
+    if (add) {
+        links.push_back(other);
+    } else {
+        *it = links.back();
+        links.pop_back();
     }
+    cachedInnerUsage += memusage::DynamicUsage(links);
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+{
+    UpdateLink(entry->vMemPoolChildren, &*child, add, cachedInnerUsage);
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
-    }
+    UpdateLink(entry->vMemPoolParents, &*parent, add, cachedInnerUsage);
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+const CTxMemPoolEntry::Links & CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.parents;
+    return entry->vMemPoolParents;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+const CTxMemPoolEntry::Links & CTxMemPool::GetMemPoolChildren(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.children;
+    return entry->vMemPoolChildren;
 }
 
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
@@ -1015,25 +1207,291 @@ void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
     }
 }
 
+static bool HigherFeeRate(CAmount aFees, uint64_t aSize, CAmount bFees, uint64_t bSize)
+{
+    return (double)aFees * bSize > (double)bFees * aSize;
+}
+
+// The same ancestor feerate selection that the block assembler runs over the
+// whole mempool, then merging of groups into chunks.
+void CTxMemPool::LinearizeCluster(const vecEntries& vCluster, std::vector<size_t>& vLocalIdx, Cluster& cluster) const
+{
+    const size_t n = vCluster.size();
+    for (size_t i = 0; i < n; i++)
+        vLocalIdx[vCluster[i]->vTxHashesIdx] = i;
+
+    // Fees and size of each transaction with its ancestors that are not
+    // ordered yet
+    std::vector<CAmount> vFees(n);
+    std::vector<uint64_t> vSize(n);
+    std::vector<bool> vDone(n, false);
+    // Marks for the walks below, which may not use the pool's epoch while
+    // GetClusters holds it
+    std::vector<uint64_t> vMark(n, 0);
+    uint64_t nMark = 0;
+
+    struct Candidate {
+        CAmount nFees;
+        uint64_t nSize;
+        size_t nIdx;
+    };
+    auto worse = [](const Candidate& a, const Candidate& b) {
+        if (HigherFeeRate(b.nFees, b.nSize, a.nFees, a.nSize))
+            return true;
+        if (HigherFeeRate(a.nFees, a.nSize, b.nFees, b.nSize))
+            return false;
+        return a.nIdx > b.nIdx;
+    };
+    // Stale entries are skipped when they come up
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(worse)> candidates(worse);
+    for (size_t i = 0; i < n; i++) {
+        vFees[i] = vCluster[i]->GetModFeesWithAncestors();
+        vSize[i] = vCluster[i]->GetSizeWithAncestors();
+        candidates.push(Candidate{vFees[i], vSize[i], i});
+    }
+
+    std::vector<size_t> vGroup, vStage;
+    while (!candidates.empty()) {
+        const Candidate best = candidates.top();
+        candidates.pop();
+        if (vDone[best.nIdx] || vFees[best.nIdx] != best.nFees || vSize[best.nIdx] != best.nSize)
+            continue;
+
+        vGroup.clear();
+        vStage.assign(1, best.nIdx);
+        vMark[best.nIdx] = ++nMark;
+        while (!vStage.empty()) {
+            size_t i = vStage.back();
+            vStage.pop_back();
+            vGroup.push_back(i);
+            for (const CTxMemPoolEntry* parent : vCluster[i]->vMemPoolParents) {
+                size_t j = vLocalIdx[parent->vTxHashesIdx];
+                if (!vDone[j] && vMark[j] != nMark) {
+                    vMark[j] = nMark;
+                    vStage.push_back(j);
+                }
+            }
+        }
+        // Parents have fewer ancestors than their children
+        std::sort(vGroup.begin(), vGroup.end(), [&](size_t a, size_t b) {
+            return vCluster[a]->GetCountWithAncestors() < vCluster[b]->GetCountWithAncestors();
+        });
+
+        Chunk chunk;
+        for (size_t i : vGroup) {
+            vDone[i] = true;
+            chunk.vTx.push_back(vCluster[i]);
+            chunk.nModFees += vCluster[i]->GetModifiedFee();
+            chunk.nSize += vCluster[i]->GetTxSize();
+            chunk.nSigOpCost += vCluster[i]->GetSigOpCost();
+        }
+        // The descendants of the group no longer count it as an ancestor
+        for (size_t i : vGroup) {
+            vStage.assign(1, i);
+            ++nMark;
+            while (!vStage.empty()) {
+                size_t k = vStage.back();
+                vStage.pop_back();
+                for (const CTxMemPoolEntry* child : vCluster[k]->vMemPoolChildren) {
+                    size_t j = vLocalIdx[child->vTxHashesIdx];
+                    if (vMark[j] == nMark)
+                        continue;
+                    vMark[j] = nMark;
+                    vStage.push_back(j);
+                    // Walk through descendants ordered in this group to reach the rest
+                    if (vDone[j])
+                        continue;
+                    vFees[j] -= vCluster[i]->GetModifiedFee();
+                    vSize[j] -= vCluster[i]->GetTxSize();
+                    candidates.push(Candidate{vFees[j], vSize[j], j});
+                }
+            }
+        }
+
+        // A group that pays better than the chunk before it is mined with
+        // it, or that chunk would be paying for nothing
+        while (!cluster.empty() && HigherFeeRate(chunk.nModFees, chunk.nSize, cluster.back().nModFees, cluster.back().nSize)) {
+            Chunk& prev = cluster.back();
+            prev.vTx.insert(prev.vTx.end(), chunk.vTx.begin(), chunk.vTx.end());
+            prev.nModFees += chunk.nModFees;
+            prev.nSize += chunk.nSize;
+            prev.nSigOpCost += chunk.nSigOpCost;
+            chunk = std::move(prev);
+            cluster.pop_back();
+        }
+        cluster.push_back(std::move(chunk));
+    }
+}
+
+bool CTxMemPool::ClusterTail::operator<(const ClusterTail& other) const
+{
+    if (HigherFeeRate(other.nModFees, other.nSize, nModFees, nSize))
+        return true;
+    if (HigherFeeRate(nModFees, nSize, other.nModFees, other.nSize))
+        return false;
+    return nId < other.nId;
+}
+
+CTxMemPool::ClusterTail CTxMemPool::GetClusterTail(uint64_t nId, const Cluster& cluster)
+{
+    return ClusterTail{cluster.back().nModFees, cluster.back().nSize, nId};
+}
+
+size_t CTxMemPool::GetClusterUsage(const CachedCluster& cached)
+{
+    size_t nUsage = memusage::DynamicUsage(cached.chunks) + memusage::DynamicUsage(cached.vMembers);
+    for (const Chunk& chunk : cached.chunks)
+        nUsage += memusage::DynamicUsage(chunk.vTx);
+    return nUsage;
+}
+
+void CTxMemPool::MarkClusterDirty(const uint256& hash)
+{
+    if (!fClusterOrder)
+        return;
+    vClusterDirty.push_back(hash);
+    // The clusters are only brought up to date when they are used, which
+    // may not happen for a long time. Rather than keep track of more changes
+    // than there are transactions, drop them all to be rebuilt on next use.
+    if (vClusterDirty.size() > 2 * mapTx.size() + 100) {
+        ResetClusters();
+        for (const CTxMemPoolEntry& entry : mapTx)
+            vClusterDirty.push_back(entry.GetTx().GetHash());
+    }
+}
+
+void CTxMemPool::ResetClusters()
+{
+    mapClusters.clear();
+    mapClusterIds.clear();
+    setClusterTails.clear();
+    vClusterDirty.clear();
+    cachedClusterUsage = 0;
+}
+
+void CTxMemPool::UpdateClusters()
+{
+    AssertLockHeld(cs);
+    if (vClusterDirty.empty())
+        return;
+
+    // Drop every cached cluster that a dirty transaction is or was part of,
+    // and start the new clusters from whatever of them is still here.
+    std::vector<txiter> vSeeds;
+    auto drop = [&](const uint256& hash) {
+        auto itId = mapClusterIds.find(hash);
+        if (itId == mapClusterIds.end())
+            return;
+        auto itCluster = mapClusters.find(itId->second);
+        setClusterTails.erase(GetClusterTail(itCluster->first, itCluster->second.chunks));
+        for (const uint256& member : itCluster->second.vMembers) {
+            mapClusterIds.erase(member);
+            txiter it = mapTx.find(member);
+            if (it != mapTx.end())
+                vSeeds.push_back(it);
+        }
+        cachedClusterUsage -= GetClusterUsage(itCluster->second);
+        mapClusters.erase(itCluster);
+    };
+    for (const uint256& hash : vClusterDirty) {
+        drop(hash);
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end())
+            vSeeds.push_back(it);
+    }
+    vClusterDirty.clear();
+
+    // A new or changed cluster may have absorbed cached ones, which are
+    // dropped as the walk reaches them.
+    std::vector<vecEntries> vComponents;
+    {
+        EpochGuard guard(*this);
+        for (size_t s = 0; s < vSeeds.size(); s++) {
+            if (Visited(*vSeeds[s]))
+                continue;
+            vComponents.emplace_back(1, vSeeds[s]);
+            vecEntries& vCluster = vComponents.back();
+            for (size_t i = 0; i < vCluster.size(); i++) {
+                for (const CTxMemPoolEntry* parent : vCluster[i]->vMemPoolParents) {
+                    if (!Visited(*parent)) {
+                        vCluster.push_back(mapTx.iterator_to(*parent));
+                        drop(parent->GetTx().GetHash());
+                    }
+                }
+                for (const CTxMemPoolEntry* child : vCluster[i]->vMemPoolChildren) {
+                    if (!Visited(*child)) {
+                        vCluster.push_back(mapTx.iterator_to(*child));
+                        drop(child->GetTx().GetHash());
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<size_t> vLocalIdx(vTxHashes.size());
+    for (const vecEntries& vCluster : vComponents) {
+        const uint64_t nId = nNextClusterId++;
+        CachedCluster& cached = mapClusters[nId];
+        LinearizeCluster(vCluster, vLocalIdx, cached.chunks);
+        cached.vMembers.reserve(vCluster.size());
+        for (txiter it : vCluster) {
+            cached.vMembers.push_back(it->GetTx().GetHash());
+            mapClusterIds[it->GetTx().GetHash()] = nId;
+        }
+        cachedClusterUsage += GetClusterUsage(cached);
+        setClusterTails.insert(GetClusterTail(nId, cached.chunks));
+    }
+}
+
+void CTxMemPool::GetClusters(std::vector<Cluster>& clusters)
+{
+    LOCK(cs);
+    clusters.clear();
+
+    // Without cluster order nothing is kept up to date, so build them all
+    if (!fClusterOrder) {
+        for (const CTxMemPoolEntry& entry : mapTx)
+            vClusterDirty.push_back(entry.GetTx().GetHash());
+    }
+    UpdateClusters();
+    clusters.reserve(mapClusters.size());
+    for (const auto& cached : mapClusters)
+        clusters.push_back(cached.second.chunks);
+    if (!fClusterOrder)
+        ResetClusters();
+}
+
 void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining) {
     LOCK(cs);
 
     unsigned nTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
+
     while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
-        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+        setEntries stage;
+        CFeeRate removed;
+        if (fClusterOrder) {
+            // The worst chunk is the last one of some cluster; evicting it
+            // only changes that cluster, which is rebuilt on the next round.
+            // Nothing is rebuilt while the mempool is within its limit.
+            UpdateClusters();
+            const Chunk& chunk = mapClusters.at(setClusterTails.begin()->nId).chunks.back();
+            removed = CFeeRate(chunk.nModFees, chunk.nSize);
+            stage.insert(chunk.vTx.begin(), chunk.vTx.end());
+        } else {
+            indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+            removed = CFeeRate(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
+            CalculateDescendants(mapTx.project<0>(it), stage);
+        }
 
         // We set the new mempool min fee to the feerate of the removed set, plus the
         // "minimum reasonable fee rate" (ie some value under which we consider txn
         // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
         // equal to txn which were removed with no block in between.
-        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
         removed += incrementalRelayFee;
         trackPackageRemoved(removed);
         maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
 
-        setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
         nTxnRemoved += stage.size();
 
         std::vector<CTransaction> txn;
@@ -9,6 +9,8 @@
 #include <memory>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <utility>
 #include <string>
@@ -67,27 +69,30 @@ class CTxMemPoolEntry
 private:
     CTransactionRef tx;
     CAmount nFee;              //!< Cached to avoid expensive parent-transaction lookups
-    size_t nTxWeight;          //!< ... and avoid recomputing tx weight (also used for GetTxSize())
-    size_t nUsageSize;         //!< ... and total memory usage
+    uint32_t nTxWeight;        //!< ... and avoid recomputing tx weight (also used for GetTxSize())
+    uint32_t nUsageSize;       //!< ... and total memory usage
     int64_t nTime;             //!< Local time when entering the mempool
     unsigned int entryHeight;  //!< Chain height when entering the mempool
-    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
-    int64_t sigOpCost;         //!< Total sigop cost
+    int32_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
 
     // Information about descendants of this transaction that are in the
     // mempool; if we remove this transaction we must remove all of these
     // descendants as well.
-    uint64_t nCountWithDescendants;  //!< number of descendant transactions
-    uint64_t nSizeWithDescendants;   //!< ... and size
+    uint64_t nSizeWithDescendants;   //!< size of all descendant transactions
     CAmount nModFeesWithDescendants; //!< ... and total fees (all including us)
 
     // Analogous statistics for ancestor transactions
-    uint64_t nCountWithAncestors;
     uint64_t nSizeWithAncestors;
     CAmount nModFeesWithAncestors;
-    int64_t nSigOpCostWithAncestors;
+
+    // Counts and sigops are bounded far below 2^31 by the package and block
+    // limits, so they are kept narrow and packed next to each other.
+    uint32_t nCountWithDescendants;  //!< number of descendant transactions
+    uint32_t nCountWithAncestors;
+    int32_t nSigOpCostWithAncestors;
+    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
 
 public:
     CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
@@ -130,7 +135,13 @@ public:
     CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
-    mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint32_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint64_t nVisitedEpoch; //!< Last traversal of the mempool graph that reached this entry
+
+    //! In-mempool direct parents or children, in no particular order
+    typedef std::vector<const CTxMemPoolEntry*> Links;
+    mutable Links vMemPoolParents; //!< Maintained by CTxMemPool
+    mutable Links vMemPoolChildren; //!< Maintained by CTxMemPool
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -207,7 +218,7 @@ struct mempoolentry_txid
 class CompareTxMemPoolEntryByDescendantScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const /*COMPAT*/
     {
         bool fUseADescendants = UseDescendantScore(a);
         bool fUseBDescendants = UseDescendantScore(b);
@@ -229,7 +240,7 @@ public:
     }
 
     // Calculate which score to use for an entry (avoiding division).
-    bool UseDescendantScore(const CTxMemPoolEntry &a)
+    bool UseDescendantScore(const CTxMemPoolEntry &a) const /*COMPAT*/
     {
         double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
         double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
@@ -244,7 +255,7 @@ public:
 class CompareTxMemPoolEntryByScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const /*COMPAT*/
     {
         double f1 = (double)a.GetModifiedFee() * b.GetTxSize();
         double f2 = (double)b.GetModifiedFee() * a.GetTxSize();
@@ -258,7 +269,7 @@ public:
 class CompareTxMemPoolEntryByEntryTime
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const /*COMPAT*/
     {
         return a.GetTime() < b.GetTime();
     }
@@ -267,7 +278,7 @@ public:
 class CompareTxMemPoolEntryByAncestorFee
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const /*COMPAT*/
     {
         double aFees = a.GetModFeesWithAncestors();
         double aSize = a.GetSizeWithAncestors();
@@ -290,7 +301,6 @@ public:
 // Multi_index tag names
 struct descendant_score {};
 struct entry_time {};
-struct mining_score {};
 struct ancestor_score {};
 
 class CBlockPolicyEstimator;
@@ -367,7 +377,8 @@ public:
  *
  * In order for the feerate sort to remain correct, we must update transactions
  * in the mempool when new descendants arrive.  To facilitate this, we track
- * the set of in-mempool direct parents and direct children in mapLinks.  Within
+ * the set of in-mempool direct parents and direct children in each entry's
+ * vMemPoolParents and vMemPoolChildren.  Within
  * each CTxMemPoolEntry, we track the size and fees of all descendants.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
@@ -400,7 +411,7 @@ public:
  * state, to account for in-mempool, out-of-block descendants for all the
  * in-block transactions by calling UpdateTransactionsFromBlock().  Note that
  * until this is called, the mempool state is not consistent, and in particular
- * mapLinks may not be correct (and therefore functions like
+ * the parent and child links may not be correct (and therefore functions like
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely
  * on them to walk the mempool are not generally safe to use).
  *
@@ -416,6 +427,7 @@ class CTxMemPool
 {
 private:
     uint32_t nCheckFrequency; //!< Value n means that n times in 2^32 we check.
+    bool fClusterOrder; //!< Mine and evict by cluster chunks rather than by ancestor and descendant score
     unsigned int nTransactionsUpdated; //!< Used by getblocktemplate to trigger CreateNewBlock() invocation
     CBlockPolicyEstimator* minerPolicyEstimator;
 
@@ -449,12 +461,6 @@ public:
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByEntryTime
             >,
-            // sorted by score (for mining prioritization)
-            boost::multi_index::ordered_unique<
-                boost::multi_index::tag<mining_score>,
-                boost::multi_index::identity<CTxMemPoolEntry>,
-                CompareTxMemPoolEntryByScore
-            >,
             // sorted by fee rate with ancestors
             boost::multi_index::ordered_non_unique<
                 boost::multi_index::tag<ancestor_score>,
@@ -477,24 +483,90 @@ public:
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
-private:
-    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
+    /**
+     * Part of a linearized cluster that is mined or evicted as a unit: its
+     * transactions, parents first, and their totals.
+     */
+    struct Chunk {
+        std::vector<txiter> vTx;
+        CAmount nModFees;
+        uint64_t nSize;
+        int64_t nSigOpCost;
 
-    struct TxLinks {
-        setEntries parents;
-        setEntries children;
+        Chunk() : nModFees(0), nSize(0), nSigOpCost(0) {}
     };
+    //! The chunks of a cluster by nonincreasing feerate; a chunk only spends from chunks before it
+    typedef std::vector<Chunk> Cluster;
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
-    txlinksMap mapLinks;
+    const CTxMemPoolEntry::Links & GetMemPoolParents(txiter entry) const;
+    const CTxMemPoolEntry::Links & GetMemPoolChildren(txiter entry) const;
+private:
+    typedef std::vector<txiter> vecEntries;
+    typedef std::map<txiter, vecEntries, CompareIteratorByHash> cacheMap;
 
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
+    /**
+     * Walks of the parent and child links mark the entries they reach with the
+     * current epoch instead of collecting them in a set, so that each step
+     * is a field compare. Only one walk may be in progress at a time.
+     */
+    mutable uint64_t nEpoch;
+    mutable bool fEpochInUse;
+
+    class EpochGuard
+    {
+    public:
+        EpochGuard(const CTxMemPool& poolIn);
+        ~EpochGuard();
+    private:
+        const CTxMemPool& pool;
+    };
+
+    /** Mark entry as reached by the current walk; returns whether it already was. */
+    bool Visited(const CTxMemPoolEntry& entry) const
+    {
+        assert(fEpochInUse);
+        bool fVisited = entry.nVisitedEpoch == nEpoch;
+        entry.nVisitedEpoch = nEpoch;
+        return fVisited;
+    }
+
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
 
+    void LinearizeCluster(const vecEntries& vCluster, std::vector<size_t>& vLocalIdx, Cluster& cluster) const;
+
+    /**
+     * With fClusterOrder the linearized clusters are kept between uses. Only
+     * the clusters that transactions joined, left or were prioritised in
+     * since the last use are rebuilt.
+     */
+    struct CachedCluster {
+        Cluster chunks;
+        std::vector<uint256> vMembers;
+    };
+    //! A cluster ordered by the feerate of its last chunk, worst first
+    struct ClusterTail {
+        CAmount nModFees;
+        uint64_t nSize;
+        uint64_t nId;
+
+        bool operator<(const ClusterTail& other) const;
+    };
+    std::map<uint64_t, CachedCluster> mapClusters;
+    std::unordered_map<uint256, uint64_t, SaltedTxidHasher> mapClusterIds;
+    std::set<ClusterTail> setClusterTails;
+    std::vector<uint256> vClusterDirty; //!< Transactions whose cluster has to be rebuilt
+    uint64_t nNextClusterId;
+    size_t cachedClusterUsage; //!< Memory used by the contents of mapClusters
+
+    static ClusterTail GetClusterTail(uint64_t nId, const Cluster& cluster);
+    static size_t GetClusterUsage(const CachedCluster& cached);
+    void MarkClusterDirty(const uint256& hash);
+    void ResetClusters();
+    void UpdateClusters();
+
 public:
     indirectmap<COutPoint, const CTransaction*> mapNextTx;
     std::map<uint256, CAmount> mapDeltas;
@@ -511,6 +583,17 @@ public:
      */
     void check(const CCoinsViewCache *pcoins) const;
     void setSanityCheck(double dFrequency = 1.0) { nCheckFrequency = dFrequency * 4294967295.0; }
+    void setClusterOrder(bool fClusterOrderIn);
+    bool GetClusterOrder() const { LOCK(cs); return fClusterOrder; }
+
+    /**
+     * Split the mempool into clusters, the sets of transactions connected by
+     * spends, and linearize each into chunks. Within a cluster, the
+     * transaction with the best feerate including its not yet ordered
+     * ancestors goes next, and adjacent groups are merged until chunk
+     * feerates do not increase.
+     */
+    void GetClusters(std::vector<Cluster>& clusters);
 
     // addUnchecked must updated state for all ancestors of a given transaction,
     // to track size/count of descendant transactions.  First version of
@@ -571,10 +654,19 @@ public:
      *  limitDescendantSize = max size of descendants any ancestor can have
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
-     *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *    look up parents from the entry's links. Must be true for entries not in the mempool
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
+    /** With cluster order, check that a transaction with the in-mempool
+     *  ancestors setAncestors would not be part of a cluster of more than
+     *  limitClusterCount transactions, itself included.
+     *  setConflicting = the entries it replaces, which are left out together
+     *    with their descendants
+     *  errString = populated with error reason if the limit is hit
+     */
+    bool CheckClusterLimit(const setEntries &setAncestors, const setEntries &setConflicting, uint64_t limitClusterCount, std::string &errString) const;
+
     /** Populate setDescendants with all in-mempool descendants of hash.
      *  Assumes that setDescendants includes all in-mempool descendants of anything
      *  already in it.  */
@@ -643,14 +735,15 @@ private:
      */
     void UpdateForDescendants(txiter updateIt,
             cacheMap &cachedDescendants,
-            const std::set<uint256> &setExclude);
+            const std::unordered_set<uint256, SaltedTxidHasher> &setExclude);
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
     void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors);
     /** Set ancestor state for an entry */
     void UpdateEntryForAncestors(txiter it, const setEntries &setAncestors);
     /** For each transaction being removed, update ancestors and any direct children.
       * If updateDescendants is true, then also update in-mempool descendants'
-      * ancestor state. */
+      * ancestor state. Changes are summed per remaining entry and applied once;
+      * entries in entriesToRemove themselves are not updated. */
     void UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants);
     /** Sever link between specified transaction and direct children. */
     void UpdateChildrenForRemoval(txiter entry);
@@ -685,6 +778,7 @@ protected:
 public:
     CCoinsViewMemPool(CCoinsView* baseIn, const CTxMemPool& mempoolIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins) const override;
 };
 
 /**
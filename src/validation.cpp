@@ -68,6 +68,7 @@ CBlockIndex *pindexBestHeader = nullptr;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nMempoolScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 bool fReindex = false;
 bool fTxIndex = false;
@@ -182,6 +183,8 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewDB *pcoinsdbview = nullptr;
 CCoinsViewCache *pcoinsTip = nullptr;
+CCoinsCacheStats g_block_view_stats;
+CCoinsCacheStats g_mempool_view_stats;
 CBlockTreeDB *pblocktree = nullptr;
 
 enum FlushStateMode {
@@ -196,6 +199,7 @@ static bool FlushStateToDisk(const CChainParams& chainParams, CValidationState &
 static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight);
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
+static bool CheckInputScripts(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
 static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
@@ -422,24 +426,20 @@ void UpdateMempoolForReorg(DisconnectedBlockTransactions &disconnectpool, bool f
 }
 
 // Used to avoid mempool polluting consensus critical paths if CCoinsViewMempool
-// were somehow broken and returning the wrong scriptPubKeys
-static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, CTxMemPool& pool,
-                 unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata) {
+// were somehow broken and returning the wrong scriptPubKeys: the coins in view
+// are compared to the mempool and pcoinsTip before any script is checked
+// against them.
+static bool CheckCoinsFromMempoolAndCache(const CTransaction& tx, const CCoinsViewCache &view, CTxMemPool& pool) {
     AssertLockHeld(cs_main);
-
-    // pool.cs should be locked already, but go ahead and re-take the lock here
-    // to enforce that mempool doesn't change between when we check the view
-    // and when we actually call through to CheckInputs
-    LOCK(pool.cs);
+    AssertLockHeld(pool.cs);
 
     assert(!tx.IsCoinBase());
     for (const CTxIn& txin : tx.vin) {
         const Coin& coin = view.AccessCoin(txin.prevout);
 
-        // At this point we haven't actually checked if the coins are all
-        // available (or shouldn't assume we have, since CheckInputs does).
-        // So we just return failure if the inputs are not available here,
-        // and then only have to check equivalence for available inputs.
+        // The inputs were checked to be available by CheckTxInputs, but
+        // just return failure if they are not, and then only have to check
+        // equivalence for available inputs.
         if (coin.IsSpent()) return false;
 
         const CTransactionRef& txFrom = pool.get(txin.prevout.hash);
@@ -454,16 +454,89 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
         }
     }
 
-    return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, txdata);
+    return true;
 }
 
-static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
-                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+/**
+ * A transaction on its way into the mempool. MemPoolPreChecks fills in
+ * everything the later steps need, including a private view with the coins
+ * it spends, so that its scripts can also be checked without the locks. When
+ * that happens ahead of AcceptToMemoryPool (see PreVerifyTransactionScripts),
+ * the result of the script checks is kept here together with the chain tip
+ * and mempool state the other checks saw, so that the acceptance only has to
+ * re-check what may have changed in the meantime.
+ */
+struct MemPoolAccept
+{
+    explicit MemPoolAccept(const CTransactionRef& ptxIn) :
+        ptx(ptxIn), hash(ptxIn->GetHash()), view(&dummy, &g_mempool_view_stats),
+        nModifiedFees(0), nConflictingFees(0), nConflictingSize(0),
+        fReplacementTransaction(false), scriptVerifyFlags(0), nBlockScriptVerifyFlags(0),
+        fLimitFree(false), nAcceptTime(0), nAbsurdFee(0), nTransactionsUpdated(0),
+        fPreChecked(false), fScriptCheckFailed(false), fCacheScriptExecution(false),
+        fScriptsChecked(false), fScriptsValid(false) {}
+
+    const CTransactionRef ptx;
+    const uint256 hash;
+    CCoinsView dummy;
+    CCoinsViewCache view;
+    std::unique_ptr<CTxMemPoolEntry> entry;
+    std::set<uint256> setConflicts;
+    CTxMemPool::setEntries setAncestors;
+    CTxMemPool::setEntries setIterConflicting;
+    CTxMemPool::setEntries allConflicting;
+    CAmount nModifiedFees;
+    CAmount nConflictingFees;
+    size_t nConflictingSize;
+    bool fReplacementTransaction;
+    unsigned int scriptVerifyFlags;
+    unsigned int nBlockScriptVerifyFlags;
+
+    //! The arguments MemPoolPreChecks ran with
+    bool fLimitFree;
+    int64_t nAcceptTime;
+    CAmount nAbsurdFee;
+    //! The chain tip and GetTransactionsUpdated() of the mempool MemPoolPreChecks saw
+    uint256 hashTip;
+    unsigned int nTransactionsUpdated;
+    //! Whether MemPoolPreChecks passed
+    bool fPreChecked;
+
+    //! The inputs checked on the mempool script check threads share txdata;
+    //! fScriptCheckFailed is set by the first of them that fails.
+    std::unique_ptr<PrecomputedTransactionData> txdata;
+    std::atomic<bool> fScriptCheckFailed;
+    //! Whether the script execution cache is to get an entry once they all passed
+    bool fCacheScriptExecution;
+
+    //! The result of MemPoolScriptChecks, once it ran
+    bool fScriptsChecked;
+    bool fScriptsValid;
+    CValidationState stateScripts;
+
+    //! Coins pulled into pcoinsTip for this transaction, to be uncached if it is rejected
+    std::vector<COutPoint> coins_pulled_in;
+};
+
+/** Set the script verification flags the scripts of a transaction on its way into the mempool are checked with. Requires cs_main. */
+static void MemPoolSetScriptFlags(const CChainParams& chainparams, MemPoolAccept& ws)
 {
-    const CTransaction& tx = *ptx;
-    const uint256 hash = tx.GetHash();
     AssertLockHeld(cs_main);
+    ws.scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!chainparams.RequireStandard()) {
+        ws.scriptVerifyFlags = gArgs.GetArg("-promiscuousmempoolflags", ws.scriptVerifyFlags);
+    }
+    ws.nBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), chainparams.GetConsensus());
+}
+
+/** Run every check of AcceptToMemoryPool up to the script checks. Requires cs_main and pool.cs. */
+static bool MemPoolPreChecks(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, MemPoolAccept& ws, bool fLimitFree,
+                             bool* pfMissingInputs, int64_t nAcceptTime, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+{
+    const CTransaction& tx = *ws.ptx;
+    const uint256& hash = ws.hash;
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
@@ -497,9 +570,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     }
 
     // Check for conflicts with in-memory transactions
-    std::set<uint256> setConflicts;
-    {
-    LOCK(pool.cs); // protect pool.mapNextTx
+    std::set<uint256>& setConflicts = ws.setConflicts;
     for (const CTxIn &txin : tx.vin)
     {
         auto itConflicting = pool.mapNextTx.find(txin.prevout);
@@ -540,350 +611,542 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
             }
         }
     }
-    }
 
+    CCoinsViewCache& view = ws.view;
+    CAmount nValueIn = 0;
+    LockPoints lp;
     {
-        CCoinsView dummy;
-        CCoinsViewCache view(&dummy);
+    CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+    view.SetBackend(viewMemPool);
 
-        CAmount nValueIn = 0;
-        LockPoints lp;
-        {
-        LOCK(pool.cs);
-        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
-        view.SetBackend(viewMemPool);
-
-        // do all inputs exist?
-        for (const CTxIn txin : tx.vin) {
-            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
-                coins_to_uncache.push_back(txin.prevout);
-            }
-            if (!view.HaveCoin(txin.prevout)) {
-                // Are inputs missing because we already have the tx?
-                for (size_t out = 0; out < tx.vout.size(); out++) {
-                    // Optimistically just do efficient check of cache for outputs
-                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
-                        return state.Invalid(false, REJECT_DUPLICATE, "txn-already-known");
-                    }
-                }
-                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
-                if (pfMissingInputs) {
-                    *pfMissingInputs = true;
+    // do all inputs exist?
+    for (const CTxIn txin : tx.vin) {
+        if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+            coins_to_uncache.push_back(txin.prevout);
+        }
+        if (!view.HaveCoin(txin.prevout)) {
+            // Are inputs missing because we already have the tx?
+            for (size_t out = 0; out < tx.vout.size(); out++) {
+                // Optimistically just do efficient check of cache for outputs
+                if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+                    return state.Invalid(false, REJECT_DUPLICATE, "txn-already-known");
                 }
-                return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
+            // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
+            if (pfMissingInputs) {
+                *pfMissingInputs = true;
+            }
+            view.SetBackend(ws.dummy);
+            return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
         }
+    }
 
-        // Bring the best block into scope
-        view.GetBestBlock();
+    // Bring the best block into scope
+    view.GetBestBlock();
 
-        nValueIn = view.GetValueIn(tx);
+    nValueIn = view.GetValueIn(tx);
 
-        // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
-        view.SetBackend(dummy);
+    // we have all inputs cached now, so switch back to dummy, so the view
+    // can be used without the lock on mempool
+    view.SetBackend(ws.dummy);
 
-        // Only accept BIP68 sequence locked transactions that can be mined in the next
-        // block; we don't want our mempool filled up with transactions that can't
-        // be mined yet.
-        // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
-        // CoinsViewCache instead of create its own
-        if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
-            return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
+    // Only accept BIP68 sequence locked transactions that can be mined in the next
+    // block; we don't want our mempool filled up with transactions that can't
+    // be mined yet.
+    // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
+    // CoinsViewCache instead of create its own
+    if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
+        return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
+    }
+
+    // The inexpensive checks of the inputs, done by CheckInputs for blocks;
+    // the scripts are only checked once all other checks passed.
+    if (!Consensus::CheckTxInputs(tx, state, view, GetSpendHeight(view)))
+        return false; // state filled in by CheckTxInputs
+
+    // Check for non-standard pay-to-script-hash in inputs
+    if (fRequireStandard && !AreInputsStandard(tx, view))
+        return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
+
+    // Check for non-standard witness in P2WSH
+    if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
+
+    int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+
+    CAmount nValueOut = tx.GetValueOut();
+    CAmount nFees = nValueIn-nValueOut;
+    // nModifiedFees includes any fee deltas from PrioritiseTransaction
+    CAmount& nModifiedFees = ws.nModifiedFees;
+    nModifiedFees = nFees;
+    pool.ApplyDelta(hash, nModifiedFees);
+
+    // Keep track of transactions that spend a coinbase, which we re-scan
+    // during reorgs to ensure COINBASE_MATURITY is still met.
+    bool fSpendsCoinbase = false;
+    for (const CTxIn &txin : tx.vin) {
+        const Coin &coin = view.AccessCoin(txin.prevout);
+        if (coin.IsCoinBase()) {
+            fSpendsCoinbase = true;
+            break;
         }
+    }
 
-        // Check for non-standard pay-to-script-hash in inputs
-        if (fRequireStandard && !AreInputsStandard(tx, view))
-            return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
-
-        // Check for non-standard witness in P2WSH
-        if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
+    ws.entry.reset(new CTxMemPoolEntry(ws.ptx, nFees, nAcceptTime, chainActive.Height(),
+                                       fSpendsCoinbase, nSigOpsCost, lp));
+    const CTxMemPoolEntry& entry = *ws.entry;
+    unsigned int nSize = entry.GetTxSize();
 
-        int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+    // Check that the transaction doesn't have an excessive number of
+    // sigops, making it impossible to mine. Since the coinbase transaction
+    // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
+    // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
+    // merely non-standard transaction.
+    if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
+            strprintf("%d", nSigOpsCost));
 
-        CAmount nValueOut = tx.GetValueOut();
-        CAmount nFees = nValueIn-nValueOut;
-        // nModifiedFees includes any fee deltas from PrioritiseTransaction
-        CAmount nModifiedFees = nFees;
-        pool.ApplyDelta(hash, nModifiedFees);
+    CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+    if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
+    }
 
-        // Keep track of transactions that spend a coinbase, which we re-scan
-        // during reorgs to ensure COINBASE_MATURITY is still met.
-        bool fSpendsCoinbase = false;
-        for (const CTxIn &txin : tx.vin) {
-            const Coin &coin = view.AccessCoin(txin.prevout);
-            if (coin.IsCoinBase()) {
-                fSpendsCoinbase = true;
-                break;
-            }
-        }
+    // No transactions are allowed below minRelayTxFee except from disconnected blocks
+    if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
+    }
 
-        CTxMemPoolEntry entry(ptx, nFees, nAcceptTime, chainActive.Height(),
-                              fSpendsCoinbase, nSigOpsCost, lp);
-        unsigned int nSize = entry.GetTxSize();
+    if (nAbsurdFee && nFees > nAbsurdFee)
+        return state.Invalid(false,
+            REJECT_HIGHFEE, "absurdly-high-fee",
+            strprintf("%d > %d", nFees, nAbsurdFee));
 
-        // Check that the transaction doesn't have an excessive number of
-        // sigops, making it impossible to mine. Since the coinbase transaction
-        // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
-        // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
-        // merely non-standard transaction.
-        if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
-                strprintf("%d", nSigOpsCost));
+    // Calculate in-mempool ancestors, up to a limit.
+    CTxMemPool::setEntries& setAncestors = ws.setAncestors;
+    size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+    size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+    std::string errString;
+    if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+        return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
+    }
 
-        CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
-        if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
+    // A transaction that spends outputs that would be replaced by it is invalid. Now
+    // that we have the set of all ancestors we can detect this
+    // pathological case by making sure setConflicts and setAncestors don't
+    // intersect.
+    for (CTxMemPool::txiter ancestorIt : setAncestors)
+    {
+        const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
+        if (setConflicts.count(hashAncestor))
+        {
+            return state.DoS(10, false,
+                             REJECT_INVALID, "bad-txns-spends-conflicting-tx", false,
+                             strprintf("%s spends conflicting transaction %s",
+                                       hash.ToString(),
+                                       hashAncestor.ToString()));
         }
+    }
 
-        // No transactions are allowed below minRelayTxFee except from disconnected blocks
-        if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
-        }
+    // Check if it's economically rational to mine this transaction rather
+    // than the ones it replaces.
+    CAmount& nConflictingFees = ws.nConflictingFees;
+    size_t& nConflictingSize = ws.nConflictingSize;
+    uint64_t nConflictingCount = 0;
+    CTxMemPool::setEntries& setIterConflicting = ws.setIterConflicting;
+    CTxMemPool::setEntries& allConflicting = ws.allConflicting;
+
+    ws.fReplacementTransaction = setConflicts.size();
+    if (ws.fReplacementTransaction)
+    {
+        CFeeRate newFeeRate(nModifiedFees, nSize);
+        std::set<uint256> setConflictsParents;
+        const int maxDescendantsToVisit = 100;
+        for (const uint256 &hashConflicting : setConflicts)
+        {
+            CTxMemPool::txiter mi = pool.mapTx.find(hashConflicting);
+            if (mi == pool.mapTx.end())
+                continue;
 
-        if (nAbsurdFee && nFees > nAbsurdFee)
-            return state.Invalid(false,
-                REJECT_HIGHFEE, "absurdly-high-fee",
-                strprintf("%d > %d", nFees, nAbsurdFee));
+            // Save these to avoid repeated lookups
+            setIterConflicting.insert(mi);
+
+            // Don't allow the replacement to reduce the feerate of the
+            // mempool.
+            //
+            // We usually don't want to accept replacements with lower
+            // feerates than what they replaced as that would lower the
+            // feerate of the next block. Requiring that the feerate always
+            // be increased is also an easy-to-reason about way to prevent
+            // DoS attacks via replacements.
+            //
+            // The mining code doesn't (currently) take children into
+            // account (CPFP) so we only consider the feerates of
+            // transactions being directly replaced, not their indirect
+            // descendants. While that does mean high feerate children are
+            // ignored when deciding whether or not to replace, we do
+            // require the replacement to pay more overall fees too,
+            // mitigating most cases.
+            CFeeRate oldFeeRate(mi->GetModifiedFee(), mi->GetTxSize());
+            if (newFeeRate <= oldFeeRate)
+            {
+                return state.DoS(0, false,
+                        REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                        strprintf("rejecting replacement %s; new feerate %s <= old feerate %s",
+                              hash.ToString(),
+                              newFeeRate.ToString(),
+                              oldFeeRate.ToString()));
+            }
+
+            for (const CTxIn &txin : mi->GetTx().vin)
+            {
+                setConflictsParents.insert(txin.prevout.hash);
+            }
 
-        // Calculate in-mempool ancestors, up to a limit.
-        CTxMemPool::setEntries setAncestors;
-        size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
-        size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
-        size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
-        size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
-        std::string errString;
-        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
-            return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
+            nConflictingCount += mi->GetCountWithDescendants();
+        }
+        // This potentially overestimates the number of actual descendants
+        // but we just want to be conservative to avoid doing too much
+        // work.
+        if (nConflictingCount <= maxDescendantsToVisit && setIterConflicting.size() == 1) {
+            // A single conflict, as with a fee bump, evicts exactly the
+            // package its descendant state already sums up. The set of
+            // entries itself is only needed once all checks passed.
+            CTxMemPool::txiter it = *setIterConflicting.begin();
+            nConflictingFees = it->GetModFeesWithDescendants();
+            nConflictingSize = it->GetSizeWithDescendants();
+        } else if (nConflictingCount <= maxDescendantsToVisit) {
+            // If not too many to replace, then calculate the set of
+            // transactions that would have to be evicted; the conflicts
+            // may share descendants, so their packages can't just be added
+            for (CTxMemPool::txiter it : setIterConflicting) {
+                pool.CalculateDescendants(it, allConflicting);
+            }
+            for (CTxMemPool::txiter it : allConflicting) {
+                nConflictingFees += it->GetModifiedFee();
+                nConflictingSize += it->GetTxSize();
+            }
+        } else {
+            return state.DoS(0, false,
+                    REJECT_NONSTANDARD, "too many potential replacements", false,
+                    strprintf("rejecting replacement %s; too many potential replacements (%d > %d)\n",
+                        hash.ToString(),
+                        nConflictingCount,
+                        maxDescendantsToVisit));
         }
 
-        // A transaction that spends outputs that would be replaced by it is invalid. Now
-        // that we have the set of all ancestors we can detect this
-        // pathological case by making sure setConflicts and setAncestors don't
-        // intersect.
-        for (CTxMemPool::txiter ancestorIt : setAncestors)
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
         {
-            const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
-            if (setConflicts.count(hashAncestor))
+            // We don't want to accept replacements that require low
+            // feerate junk to be mined first. Ideally we'd keep track of
+            // the ancestor feerates and make the decision based on that,
+            // but for now requiring all new inputs to be confirmed works.
+            if (!setConflictsParents.count(tx.vin[j].prevout.hash))
             {
-                return state.DoS(10, false,
-                                 REJECT_INVALID, "bad-txns-spends-conflicting-tx", false,
-                                 strprintf("%s spends conflicting transaction %s",
-                                           hash.ToString(),
-                                           hashAncestor.ToString()));
+                // Rather than check the UTXO set - potentially expensive -
+                // it's cheaper to just check if the new input refers to a
+                // tx that's in the mempool.
+                if (pool.mapTx.find(tx.vin[j].prevout.hash) != pool.mapTx.end())
+                    return state.DoS(0, false,
+                                     REJECT_NONSTANDARD, "replacement-adds-unconfirmed", false,
+                                     strprintf("replacement %s adds unconfirmed input, idx %d",
+                                              hash.ToString(), j));
             }
         }
 
-        // Check if it's economically rational to mine this transaction rather
-        // than the ones it replaces.
-        CAmount nConflictingFees = 0;
-        size_t nConflictingSize = 0;
-        uint64_t nConflictingCount = 0;
-        CTxMemPool::setEntries allConflicting;
+        // The replacement must pay greater fees than the transactions it
+        // replaces - if we did the bandwidth used by those conflicting
+        // transactions would not be paid for.
+        if (nModifiedFees < nConflictingFees)
+        {
+            return state.DoS(0, false,
+                             REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                             strprintf("rejecting replacement %s, less fees than conflicting txs; %s < %s",
+                                      hash.ToString(), FormatMoney(nModifiedFees), FormatMoney(nConflictingFees)));
+        }
 
-        // If we don't hold the lock allConflicting might be incomplete; the
-        // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
-        // mempool consistency for us.
-        LOCK(pool.cs);
-        const bool fReplacementTransaction = setConflicts.size();
-        if (fReplacementTransaction)
+        // Finally in addition to paying more fees than the conflicts the
+        // new transaction must pay for its own bandwidth.
+        CAmount nDeltaFees = nModifiedFees - nConflictingFees;
+        if (nDeltaFees < ::incrementalRelayFee.GetFee(nSize))
         {
-            CFeeRate newFeeRate(nModifiedFees, nSize);
-            std::set<uint256> setConflictsParents;
-            const int maxDescendantsToVisit = 100;
-            CTxMemPool::setEntries setIterConflicting;
-            for (const uint256 &hashConflicting : setConflicts)
-            {
-                CTxMemPool::txiter mi = pool.mapTx.find(hashConflicting);
-                if (mi == pool.mapTx.end())
-                    continue;
+            return state.DoS(0, false,
+                    REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                    strprintf("rejecting replacement %s, not enough additional fees to relay; %s < %s",
+                          hash.ToString(),
+                          FormatMoney(nDeltaFees),
+                          FormatMoney(::incrementalRelayFee.GetFee(nSize))));
+        }
+    }
 
-                // Save these to avoid repeated lookups
-                setIterConflicting.insert(mi);
+    // The transactions a replacement evicts don't count towards the size of
+    // the cluster it joins.
+    if (!pool.CheckClusterLimit(setAncestors, setIterConflicting, gArgs.GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT), errString)) {
+        return state.DoS(0, false, REJECT_NONSTANDARD, "too-large-mempool-cluster", false, errString);
+    }
 
-                // Don't allow the replacement to reduce the feerate of the
-                // mempool.
-                //
-                // We usually don't want to accept replacements with lower
-                // feerates than what they replaced as that would lower the
-                // feerate of the next block. Requiring that the feerate always
-                // be increased is also an easy-to-reason about way to prevent
-                // DoS attacks via replacements.
-                //
-                // The mining code doesn't (currently) take children into
-                // account (CPFP) so we only consider the feerates of
-                // transactions being directly replaced, not their indirect
-                // descendants. While that does mean high feerate children are
-                // ignored when deciding whether or not to replace, we do
-                // require the replacement to pay more overall fees too,
-                // mitigating most cases.
-                CFeeRate oldFeeRate(mi->GetModifiedFee(), mi->GetTxSize());
-                if (newFeeRate <= oldFeeRate)
-                {
-                    return state.DoS(0, false,
-                            REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                            strprintf("rejecting replacement %s; new feerate %s <= old feerate %s",
-                                  hash.ToString(),
-                                  newFeeRate.ToString(),
-                                  oldFeeRate.ToString()));
-                }
+    if (!CheckCoinsFromMempoolAndCache(tx, view, pool))
+        return false;
 
-                for (const CTxIn &txin : mi->GetTx().vin)
-                {
-                    setConflictsParents.insert(txin.prevout.hash);
-                }
+    MemPoolSetScriptFlags(chainparams, ws);
+    ws.fLimitFree = fLimitFree;
+    ws.nAcceptTime = nAcceptTime;
+    ws.nAbsurdFee = nAbsurdFee;
+    ws.hashTip = chainActive.Tip()->GetBlockHash();
+    ws.nTransactionsUpdated = pool.GetTransactionsUpdated();
+    ws.fPreChecked = true;
 
-                nConflictingCount += mi->GetCountWithDescendants();
-            }
-            // This potentially overestimates the number of actual descendants
-            // but we just want to be conservative to avoid doing too much
-            // work.
-            if (nConflictingCount <= maxDescendantsToVisit) {
-                // If not too many to replace, then calculate the set of
-                // transactions that would have to be evicted
-                for (CTxMemPool::txiter it : setIterConflicting) {
-                    pool.CalculateDescendants(it, allConflicting);
-                }
-                for (CTxMemPool::txiter it : allConflicting) {
-                    nConflictingFees += it->GetModifiedFee();
-                    nConflictingSize += it->GetTxSize();
-                }
-            } else {
-                return state.DoS(0, false,
-                        REJECT_NONSTANDARD, "too many potential replacements", false,
-                        strprintf("rejecting replacement %s; too many potential replacements (%d > %d)\n",
-                            hash.ToString(),
-                            nConflictingCount,
-                            maxDescendantsToVisit));
-            }
+    return true;
+}
 
-            for (unsigned int j = 0; j < tx.vin.size(); j++)
-            {
-                // We don't want to accept replacements that require low
-                // feerate junk to be mined first. Ideally we'd keep track of
-                // the ancestor feerates and make the decision based on that,
-                // but for now requiring all new inputs to be confirmed works.
-                if (!setConflictsParents.count(tx.vin[j].prevout.hash))
-                {
-                    // Rather than check the UTXO set - potentially expensive -
-                    // it's cheaper to just check if the new input refers to a
-                    // tx that's in the mempool.
-                    if (pool.mapTx.find(tx.vin[j].prevout.hash) != pool.mapTx.end())
-                        return state.DoS(0, false,
-                                         REJECT_NONSTANDARD, "replacement-adds-unconfirmed", false,
-                                         strprintf("replacement %s adds unconfirmed input, idx %d",
-                                                  hash.ToString(), j));
-                }
-            }
+/**
+ * Fill the private view of a transaction for which MemPoolPreChecks found
+ * inputs missing, taking the coins that are not in the mempool or the UTXO
+ * set from earlier transactions of the batch being pre-verified with it.
+ * Returns false if some input is not found there either. Requires cs_main and
+ * pool.cs.
+ */
+static bool MemPoolLoadBatchCoins(CTxMemPool& pool, MemPoolAccept& ws, const std::map<uint256, CTransactionRef>& mapBatchTx)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
+    CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+    for (const CTxIn& txin : ws.ptx->vin) {
+        if (ws.view.HaveCoinInCache(txin.prevout))
+            continue;
+        auto it = mapBatchTx.find(txin.prevout.hash);
+        if (it != mapBatchTx.end()) {
+            if (txin.prevout.n >= it->second->vout.size())
+                return false;
+            ws.view.AddCoin(txin.prevout, Coin(it->second->vout[txin.prevout.n], MEMPOOL_HEIGHT, false), false);
+            continue;
+        }
+        if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+            ws.coins_pulled_in.push_back(txin.prevout);
+        Coin coin;
+        if (!viewMemPool.GetCoin(txin.prevout, coin))
+            return false;
+        ws.view.AddCoin(txin.prevout, std::move(coin), false);
+    }
+    return true;
+}
 
-            // The replacement must pay greater fees than the transactions it
-            // replaces - if we did the bandwidth used by those conflicting
-            // transactions would not be paid for.
-            if (nModifiedFees < nConflictingFees)
-            {
-                return state.DoS(0, false,
-                                 REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                                 strprintf("rejecting replacement %s, less fees than conflicting txs; %s < %s",
-                                          hash.ToString(), FormatMoney(nModifiedFees), FormatMoney(nConflictingFees)));
-            }
+/**
+ * Check whether what MemPoolPreChecks found for a transaction still holds:
+ * the chain tip is the same, so are the coins it spends that are not in the
+ * mempool, and none of them got spent by a mempool transaction. Its
+ * in-mempool ancestors are recalculated if the mempool changed. If this
+ * returns false, the transaction has to go through MemPoolPreChecks again.
+ * Requires cs_main and pool.cs.
+ */
+static bool MemPoolRecheck(CTxMemPool& pool, MemPoolAccept& ws, bool fLimitFree, int64_t nAcceptTime, const CAmount& nAbsurdFee)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
+    if (!ws.fPreChecked || ws.fLimitFree != fLimitFree || ws.nAcceptTime != nAcceptTime || ws.nAbsurdFee != nAbsurdFee)
+        return false;
+    if (ws.hashTip != chainActive.Tip()->GetBlockHash())
+        return false;
+    // PrioritiseTransaction only counts as a mempool update for transactions
+    // already in it, so a fee delta given in the meantime is looked up here.
+    CAmount nModifiedFees = ws.entry->GetFee();
+    pool.ApplyDelta(ws.hash, nModifiedFees);
+    if (nModifiedFees != ws.nModifiedFees)
+        return false;
+    if (ws.nTransactionsUpdated == pool.GetTransactionsUpdated())
+        return true;
 
-            // Finally in addition to paying more fees than the conflicts the
-            // new transaction must pay for its own bandwidth.
-            CAmount nDeltaFees = nModifiedFees - nConflictingFees;
-            if (nDeltaFees < ::incrementalRelayFee.GetFee(nSize))
-            {
-                return state.DoS(0, false,
-                        REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                        strprintf("rejecting replacement %s, not enough additional fees to relay; %s < %s",
-                              hash.ToString(),
-                              FormatMoney(nDeltaFees),
-                              FormatMoney(::incrementalRelayFee.GetFee(nSize))));
-            }
-        }
+    // Replacements depend on too much of the mempool to be worth re-checking
+    // piecemeal.
+    if (ws.fReplacementTransaction || pool.exists(ws.hash))
+        return false;
+    for (const CTxIn& txin : ws.ptx->vin) {
+        if (pool.mapNextTx.count(txin.prevout))
+            return false;
+        // Coins from the UTXO set can't have changed without the tip
+        // changing, but the mempool transaction a coin came from may be gone.
+        if (ws.view.AccessCoin(txin.prevout).nHeight == MEMPOOL_HEIGHT && !pool.exists(txin.prevout.hash))
+            return false;
+    }
 
-        unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
-        if (!chainparams.RequireStandard()) {
-            scriptVerifyFlags = gArgs.GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
-        }
+    CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(ws.entry->GetTxSize());
+    if (mempoolRejectFee > 0 && ws.nModifiedFees < mempoolRejectFee)
+        return false;
 
-        // Check against previous transactions
-        // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
-            // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
-            // need to turn both off, and compare against just turning off CLEANSTACK
-            // to see if the failure is specifically due to witness validation.
-            CValidationState stateDummy; // Want reported failures to be from first CheckInputs
-            if (!tx.HasWitness() && CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
-                !CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
-                // Only the witness is missing, so the transaction itself may be fine.
-                state.SetCorruptionPossible();
-            }
-            return false; // state filled in by CheckInputs
-        }
-
-        // Check again against the current block tip's script verification
-        // flags to cache our script execution flags. This is, of course,
-        // useless if the next block has different script flags from the
-        // previous one, but because the cache tracks script flags for us it
-        // will auto-invalidate and we'll just have a few blocks of extra
-        // misses on soft-fork activation.
-        //
-        // This is also useful in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
-        // CHECKSIG NOT scripts to pass, even though they were invalid.
-        //
-        // There is a similar check in CreateNewBlock() to prevent creating
-        // invalid blocks (using TestBlockValidity), however allowing such
-        // transactions into the mempool can be exploited as a DoS attack.
-        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
-        if (!CheckInputsFromMempoolAndCache(tx, state, view, pool, currentBlockScriptVerifyFlags, true, txdata))
-        {
-            // If we're using promiscuousmempoolflags, we may hit this normally
-            // Check if current block has some flags that scriptVerifyFlags
-            // does not before printing an ominous warning
-            if (!(~scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
-                return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against latest-block but not STANDARD flags %s, %s",
+    ws.setAncestors.clear();
+    size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+    size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+    std::string errString;
+    return pool.CalculateMemPoolAncestors(*ws.entry, ws.setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString) &&
+           pool.CheckClusterLimit(ws.setAncestors, CTxMemPool::setEntries(), gArgs.GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT), errString);
+}
+
+/**
+ * Check the scripts of a transaction that passed MemPoolPreChecks against the
+ * coins in its private view. Needs no locks, so that it can also run on the
+ * mempool script check threads.
+ */
+static bool MemPoolScriptChecks(CValidationState& state, const MemPoolAccept& ws)
+{
+    const CTransaction& tx = *ws.ptx;
+    const uint256& hash = ws.hash;
+    const unsigned int scriptVerifyFlags = ws.scriptVerifyFlags;
+    const CCoinsViewCache& view = ws.view;
+
+    // Check against previous transactions
+    // This is done last to help prevent CPU exhaustion denial-of-service attacks.
+    PrecomputedTransactionData txdata(tx);
+    if (!CheckInputScripts(tx, state, view, scriptVerifyFlags, true, false, txdata)) {
+        // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
+        // need to turn both off, and compare against just turning off CLEANSTACK
+        // to see if the failure is specifically due to witness validation.
+        CValidationState stateDummy; // Want reported failures to be from first CheckInputScripts
+        if (!tx.HasWitness() && CheckInputScripts(tx, stateDummy, view, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
+            !CheckInputScripts(tx, stateDummy, view, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
+            // Only the witness is missing, so the transaction itself may be fine.
+            state.SetCorruptionPossible();
+        }
+        return false; // state filled in by CheckInputScripts
+    }
+
+    // Check again against the current block tip's script verification
+    // flags to cache our script execution flags. This is, of course,
+    // useless if the next block has different script flags from the
+    // previous one, but because the cache tracks script flags for us it
+    // will auto-invalidate and we'll just have a few blocks of extra
+    // misses on soft-fork activation.
+    //
+    // This is also useful in case of bugs in the standard flags that cause
+    // transactions to pass as valid when they're actually invalid. For
+    // instance the STRICTENC flag was incorrectly allowing certain
+    // CHECKSIG NOT scripts to pass, even though they were invalid.
+    //
+    // There is a similar check in CreateNewBlock() to prevent creating
+    // invalid blocks (using TestBlockValidity), however allowing such
+    // transactions into the mempool can be exploited as a DoS attack.
+    //
+    // The coins in view were compared to the mempool and the UTXO set by
+    // CheckCoinsFromMempoolAndCache when they were loaded.
+    unsigned int currentBlockScriptVerifyFlags = ws.nBlockScriptVerifyFlags;
+    if (!CheckInputScripts(tx, state, view, currentBlockScriptVerifyFlags, true, true, txdata))
+    {
+        // If we're using promiscuousmempoolflags, we may hit this normally
+        // Check if current block has some flags that scriptVerifyFlags
+        // does not before printing an ominous warning
+        if (!(~scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
+            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against latest-block but not STANDARD flags %s, %s",
+                __func__, hash.ToString(), FormatStateMessage(state));
+        } else {
+            if (!CheckInputScripts(tx, state, view, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata)) {
+                return error("%s: ConnectInputs failed against MANDATORY but not STANDARD flags due to promiscuous mempool %s, %s",
                     __func__, hash.ToString(), FormatStateMessage(state));
             } else {
-                if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata)) {
-                    return error("%s: ConnectInputs failed against MANDATORY but not STANDARD flags due to promiscuous mempool %s, %s",
-                        __func__, hash.ToString(), FormatStateMessage(state));
-                } else {
-                    LogPrintf("Warning: -promiscuousmempool flags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
-                }
+                LogPrintf("Warning: -promiscuousmempool flags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
             }
         }
+    }
 
-        // Remove conflicting transactions from the mempool
-        for (const CTxMemPool::txiter it : allConflicting)
-        {
-            LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
-                    it->GetTx().GetHash().ToString(),
-                    hash.ToString(),
-                    FormatMoney(nModifiedFees - nConflictingFees),
-                    (int)nSize - (int)nConflictingSize);
-            if (plTxnReplaced)
-                plTxnReplaced->push_back(it->GetSharedTx());
+    return true;
+}
+
+/** Replace the conflicts of a transaction that passed its checks and add it to the mempool. Requires cs_main and pool.cs. */
+static bool MemPoolFinalize(CTxMemPool& pool, CValidationState& state, MemPoolAccept& ws, std::list<CTransactionRef>* plTxnReplaced, bool fOverrideMempoolLimit)
+{
+    const CTransaction& tx = *ws.ptx;
+    const uint256& hash = ws.hash;
+    const CAmount nModifiedFees = ws.nModifiedFees;
+    const CAmount nConflictingFees = ws.nConflictingFees;
+    const size_t nConflictingSize = ws.nConflictingSize;
+    const unsigned int nSize = ws.entry->GetTxSize();
+    CTxMemPool::setEntries& allConflicting = ws.allConflicting;
+
+    // Remove conflicting transactions from the mempool
+    if (allConflicting.empty()) {
+        for (CTxMemPool::txiter it : ws.setIterConflicting) {
+            pool.CalculateDescendants(it, allConflicting);
         }
-        pool.RemoveStaged(allConflicting, false, MemPoolRemovalReason::REPLACED);
+    }
+    for (const CTxMemPool::txiter it : allConflicting)
+    {
+        LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
+                it->GetTx().GetHash().ToString(),
+                hash.ToString(),
+                FormatMoney(nModifiedFees - nConflictingFees),
+                (int)nSize - (int)nConflictingSize);
+        if (plTxnReplaced)
+            plTxnReplaced->push_back(it->GetSharedTx());
+    }
+    pool.RemoveStaged(allConflicting, false, MemPoolRemovalReason::REPLACED);
+
+    // This transaction should only count for fee estimation if it isn't a
+    // BIP 125 replacement transaction (may not be widely supported), the
+    // node is not behind, and the transaction is not dependent on any other
+    // transactions in the mempool.
+    bool validForFeeEstimation = !ws.fReplacementTransaction && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
 
-        // This transaction should only count for fee estimation if it isn't a
-        // BIP 125 replacement transaction (may not be widely supported), the
-        // node is not behind, and the transaction is not dependent on any other
-        // transactions in the mempool.
-        bool validForFeeEstimation = !fReplacementTransaction && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
+    // Store transaction in memory
+    pool.addUnchecked(hash, *ws.entry, ws.setAncestors, validForFeeEstimation);
 
-        // Store transaction in memory
-        pool.addUnchecked(hash, entry, setAncestors, validForFeeEstimation);
+    // trim mempool and check if tx was trimmed
+    if (!fOverrideMempoolLimit) {
+        LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+    }
 
-        // trim mempool and check if tx was trimmed
-        if (!fOverrideMempoolLimit) {
-            LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
-            if (!pool.exists(hash))
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+    return true;
+}
+
+static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
+                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
+                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache, MemPoolAccept* pverified)
+{
+    AssertLockHeld(cs_main);
+    assert(!pverified || pverified->hash == ptx->GetHash());
+    if (pfMissingInputs)
+        *pfMissingInputs = false;
+    MemPoolAccept wsNew(ptx);
+    MemPoolAccept* pws = pverified;
+    {
+        // If we don't hold the lock throughout, the conflicts found by the
+        // checks might be incomplete; the subsequent RemoveStaged() and
+        // addUnchecked() calls don't guarantee mempool consistency for us.
+        LOCK(pool.cs);
+
+        // The scripts only depend on the transaction, the outputs it spends
+        // and the script verification flags, so ones that failed their
+        // pre-verification fail again as long as the tip is the same.
+        if (pverified && pverified->fScriptsChecked && !pverified->fScriptsValid && pverified->hashTip == chainActive.Tip()->GetBlockHash()) {
+            state = pverified->stateScripts;
+            return false;
         }
+
+        if (!pverified || !MemPoolRecheck(pool, *pverified, fLimitFree, nAcceptTime, nAbsurdFee)) {
+            pws = &wsNew;
+            if (!MemPoolPreChecks(chainparams, pool, state, wsNew, fLimitFree, pfMissingInputs, nAcceptTime, nAbsurdFee, coins_to_uncache))
+                return false;
+            if (pverified && pverified->fScriptsChecked && pverified->scriptVerifyFlags == wsNew.scriptVerifyFlags &&
+                pverified->nBlockScriptVerifyFlags == wsNew.nBlockScriptVerifyFlags) {
+                wsNew.fScriptsChecked = true;
+                wsNew.fScriptsValid = pverified->fScriptsValid;
+                wsNew.stateScripts = pverified->stateScripts;
+            }
+        }
+
+        MemPoolAccept& ws = *pws;
+        if (!ws.fScriptsChecked) {
+            ws.fScriptsValid = MemPoolScriptChecks(ws.stateScripts, ws);
+            ws.fScriptsChecked = true;
+        }
+        if (!ws.fScriptsValid) {
+            state = ws.stateScripts;
+            return false;
+        }
+        if (!MemPoolFinalize(pool, state, ws, plTxnReplaced, fOverrideMempoolLimit))
+            return false;
     }
 
     GetMainSignals().TransactionAddedToMempool(ptx);
@@ -894,10 +1157,12 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 static bool AcceptToMemoryPoolWithTime(const CChainParams& chainparams, CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                        bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+                        bool fOverrideMempoolLimit, const CAmount nAbsurdFee, MemPoolAccept* pverified = nullptr)
 {
     std::vector<COutPoint> coins_to_uncache;
-    bool res = AcceptToMemoryPoolWorker(chainparams, pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, coins_to_uncache);
+    if (pverified)
+        coins_to_uncache = pverified->coins_pulled_in;
+    bool res = AcceptToMemoryPoolWorker(chainparams, pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, coins_to_uncache, pverified);
     if (!res) {
         for (const COutPoint& hashTx : coins_to_uncache)
             pcoinsTip->Uncache(hashTx);
@@ -910,10 +1175,11 @@ static bool AcceptToMemoryPoolWithTime(const CChainParams& chainparams, CTxMemPo
 
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
-                        bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+                        bool fOverrideMempoolLimit, const CAmount nAbsurdFee, const MemPoolAcceptRef& preverified)
 {
     const CChainParams& chainparams = Params();
-    return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee);
+    int64_t nAcceptTime = preverified ? preverified->nAcceptTime : GetTime();
+    return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, preverified.get());
 }
 
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
@@ -1254,7 +1520,9 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     const CScriptWitness *witness = &ptxTo->vin[nIn].scriptWitness;
-    return VerifyScript(scriptSig, scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata), &error);
+    CachingTransactionSignatureChecker checker(ptxTo, nIn, amount, cacheStore, *txdata, cacheErase);
+    checker.SetProfile(profile);
+    return VerifyScript(scriptSig, scriptPubKey, witness, nFlags, checker, &error);
 }
 
 int GetSpendHeight(const CCoinsViewCache& inputs)
@@ -1265,7 +1533,7 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 }
 
 
-static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+static CuckooCache::sharded_cache<uint256, SignatureCacheHasher> scriptExecutionCache;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
 
 void InitScriptExecutionCache() {
@@ -1277,6 +1545,14 @@ void InitScriptExecutionCache() {
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+CuckooCache::cache_stats GetScriptExecutionCacheStats(bool fReset)
+{
+    CuckooCache::cache_stats stats = scriptExecutionCache.stats();
+    if (fReset)
+        scriptExecutionCache.reset_stats();
+    return stats;
+}
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set.
@@ -1298,9 +1574,6 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (!Consensus::CheckTxInputs(tx, state, inputs, GetSpendHeight(inputs)))
             return false;
 
-        if (pvChecks)
-            pvChecks->reserve(tx.vin.size());
-
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
@@ -1310,72 +1583,93 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // is safe because block merkle hashes are still computed and checked,
         // Of course, if an assumed valid block is invalid due to false scriptSigs
         // this optimization would allow an invalid chain to be accepted.
-        if (fScriptChecks) {
-            // First check if script executions have been cached with the same
-            // flags. Note that this assumes that the inputs provided are
-            // correct (ie that the transaction hash which is in tx's prevouts
-            // properly commits to the scriptPubKey in the inputs view of that
-            // transaction).
-            uint256 hashCacheEntry;
-            // We only use the first 19 bytes of nonce to avoid a second SHA
-            // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
-            static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
-            CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
-            AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
-            if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
-                return true;
-            }
+        if (fScriptChecks)
+            return CheckInputScripts(tx, state, inputs, flags, cacheSigStore, cacheFullScriptStore, txdata, pvChecks);
+    }
 
-            for (unsigned int i = 0; i < tx.vin.size(); i++) {
-                const COutPoint &prevout = tx.vin[i].prevout;
-                const Coin& coin = inputs.AccessCoin(prevout);
-                assert(!coin.IsSpent());
-
-                // We very carefully only pass in things to CScriptCheck which
-                // are clearly committed to by tx' witness hash. This provides
-                // a sanity check that our caching is not introducing consensus
-                // failures through additional data in, eg, the coins being
-                // spent being checked as a part of CScriptCheck.
-                const CScript& scriptPubKey = coin.out.scriptPubKey;
-                const CAmount amount = coin.out.nValue;
-
-                // Verify signature
-                CScriptCheck check(scriptPubKey, amount, tx, i, flags, cacheSigStore, &txdata);
-                if (pvChecks) {
-                    pvChecks->push_back(CScriptCheck());
-                    check.swap(pvChecks->back());
-                } else if (!check()) {
-                    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // non-standard DER encodings or non-null dummy
-                        // arguments; if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check2(scriptPubKey, amount, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
-                        if (check2())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after soft-fork
-                    // super-majority signaling has occurred.
-                    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
-                }
-            }
+    return true;
+}
 
-            if (cacheFullScriptStore && !pvChecks) {
-                // We executed all of the provided scripts, and were told to
-                // cache the result. Do so now.
-                scriptExecutionCache.insert(hashCacheEntry);
+/** The script execution cache entry of tx verified with flags. */
+static uint256 GetScriptExecutionCacheEntry(const CTransaction& tx, unsigned int flags)
+{
+    uint256 hashCacheEntry;
+    // We only use the first 19 bytes of nonce to avoid a second SHA
+    // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
+    static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
+    CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+    return hashCacheEntry;
+}
+
+/**
+ * The script part of CheckInputs, for a transaction that is not a coinbase
+ * and whose inputs passed Consensus::CheckTxInputs. Does not need cs_main.
+ */
+static bool CheckInputScripts(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+{
+    assert(!tx.IsCoinBase());
+
+    if (pvChecks)
+        pvChecks->reserve(tx.vin.size());
+
+    // First check if script executions have been cached with the same
+    // flags. Note that this assumes that the inputs provided are
+    // correct (ie that the transaction hash which is in tx's prevouts
+    // properly commits to the scriptPubKey in the inputs view of that
+    // transaction).
+    uint256 hashCacheEntry = GetScriptExecutionCacheEntry(tx, flags);
+    if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
+        return true;
+    }
+
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const COutPoint &prevout = tx.vin[i].prevout;
+        const Coin& coin = inputs.AccessCoin(prevout);
+        assert(!coin.IsSpent());
+
+        // We very carefully only pass in things to CScriptCheck which
+        // are clearly committed to by tx' witness hash. This provides
+        // a sanity check that our caching is not introducing consensus
+        // failures through additional data in, eg, the coins being
+        // spent being checked as a part of CScriptCheck.
+        const CScript& scriptPubKey = coin.out.scriptPubKey;
+        const CAmount amount = coin.out.nValue;
+
+        // Verify signature
+        CScriptCheck check(scriptPubKey, amount, tx, i, flags, cacheSigStore, &txdata);
+        if (pvChecks) {
+            pvChecks->push_back(CScriptCheck());
+            check.swap(pvChecks->back());
+        } else if (!check()) {
+            if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+                // Check whether the failure was caused by a
+                // non-mandatory script verification check, such as
+                // non-standard DER encodings or non-null dummy
+                // arguments; if so, don't trigger DoS protection to
+                // avoid splitting the network between upgraded and
+                // non-upgraded nodes.
+                CScriptCheck check2(scriptPubKey, amount, tx, i,
+                        flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
+                if (check2())
+                    return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
             }
+            // Failures of other flags indicate a transaction that is
+            // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
+            // such nodes as they are not following the protocol. That
+            // said during an upgrade careful thought should be taken
+            // as to the correct behavior - we may want to continue
+            // peering with non-upgraded nodes even after soft-fork
+            // super-majority signaling has occurred.
+            return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
         }
     }
 
+    if (cacheFullScriptStore && !pvChecks) {
+        // We executed all of the provided scripts, and were told to
+        // cache the result. Do so now.
+        scriptExecutionCache.insert(hashCacheEntry);
+    }
+
     return true;
 }
 
@@ -1592,6 +1886,173 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/**
+ * Closure representing the checks of one input of a transaction on its way
+ * into the mempool: against the standard script flags, and then against those
+ * of the current tip, either of which is left out if the script execution
+ * cache already has the transaction. A failure is recorded in the
+ * MemPoolAccept rather than returned, so that one invalid transaction does not
+ * stop the checks of the others; the inputs of a transaction that already
+ * failed are skipped.
+ */
+class CMemPoolScriptCheck
+{
+private:
+    CScriptCheck checkStandard;
+    CScriptCheck checkBlock;
+    bool fStandard;
+    bool fBlock;
+    MemPoolAccept* ws;
+
+public:
+    CMemPoolScriptCheck() : fStandard(false), fBlock(false), ws(nullptr) {}
+    CMemPoolScriptCheck(MemPoolAccept& wsIn, CScriptCheck* pcheckStandard, CScriptCheck* pcheckBlock) :
+        fStandard(pcheckStandard != nullptr), fBlock(pcheckBlock != nullptr), ws(&wsIn)
+    {
+        if (pcheckStandard)
+            checkStandard.swap(*pcheckStandard);
+        if (pcheckBlock)
+            checkBlock.swap(*pcheckBlock);
+    }
+
+    bool operator()()
+    {
+        if (ws->fScriptCheckFailed.load(std::memory_order_relaxed))
+            return true;
+        if ((fStandard && !checkStandard()) || (fBlock && !checkBlock()))
+            ws->fScriptCheckFailed = true;
+        return true;
+    }
+
+    void swap(CMemPoolScriptCheck& check)
+    {
+        checkStandard.swap(check.checkStandard);
+        checkBlock.swap(check.checkBlock);
+        std::swap(fStandard, check.fStandard);
+        std::swap(fBlock, check.fBlock);
+        std::swap(ws, check.ws);
+    }
+};
+
+/**
+ * Queue the checks MemPoolScriptChecks does for a transaction that passed
+ * MemPoolPreChecks onto vChecks, one per input, so that they can run on the
+ * mempool script check threads. Needs no locks.
+ */
+static void MemPoolQueueScriptChecks(MemPoolAccept& ws, std::vector<CMemPoolScriptCheck>& vChecks)
+{
+    const CTransaction& tx = *ws.ptx;
+    ws.txdata.reset(new PrecomputedTransactionData(tx));
+
+    // CheckInputScripts only fails when it runs the checks itself.
+    CValidationState stateDummy;
+    std::vector<CScriptCheck> vStandard, vBlock;
+    CheckInputScripts(tx, stateDummy, ws.view, ws.scriptVerifyFlags, true, false, *ws.txdata, &vStandard);
+    CheckInputScripts(tx, stateDummy, ws.view, ws.nBlockScriptVerifyFlags, true, true, *ws.txdata, &vBlock);
+    ws.fCacheScriptExecution = !vBlock.empty();
+    if (vStandard.empty() && vBlock.empty())
+        return;
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        vChecks.emplace_back(ws, vStandard.empty() ? nullptr : &vStandard[i], vBlock.empty() ? nullptr : &vBlock[i]);
+    }
+}
+
+/**
+ * Turn the results of the checks MemPoolQueueScriptChecks queued for a
+ * transaction into those of MemPoolScriptChecks, once they all ran.
+ */
+static void MemPoolFinishScriptChecks(MemPoolAccept& ws)
+{
+    if (ws.fScriptCheckFailed) {
+        // Run the checks again on this thread to tell how they failed. The
+        // signatures that were valid are found in the signature cache.
+        ws.fScriptsValid = MemPoolScriptChecks(ws.stateScripts, ws);
+    } else {
+        ws.fScriptsValid = true;
+        if (ws.fCacheScriptExecution)
+            scriptExecutionCache.insert(GetScriptExecutionCacheEntry(*ws.ptx, ws.nBlockScriptVerifyFlags));
+    }
+    ws.fScriptsChecked = true;
+    ws.txdata.reset();
+}
+
+/**
+ * The script checks of transactions on their way into the mempool run on a
+ * queue of their own, so that they never wait for, or hold up, the script
+ * checks of a block being connected. Each element checks one input.
+ */
+static CCheckQueue<CMemPoolScriptCheck> mempoolscriptcheckqueue(128);
+
+void ThreadMempoolScriptCheck() {
+    RenameThread("bitcoin-mempoolch");
+    mempoolscriptcheckqueue.Thread();
+}
+
+void PreVerifyTransactionScripts(const std::vector<CTransactionRef>& vtx, std::vector<MemPoolAcceptRef>& vAccept, const CAmount nAbsurdFee, const std::vector<int64_t>& vAcceptTime)
+{
+    assert(vAcceptTime.empty() || vAcceptTime.size() == vtx.size());
+    vAccept.assign(vtx.size(), nullptr);
+    if (vtx.empty())
+        return;
+
+    // Run the checks AcceptToMemoryPool does before the scripts while
+    // holding the locks, so that only transactions which would get that far
+    // cost any script verification. Their spent outputs end up in a private
+    // view each, so the scripts can run without the locks. Coins pulled into
+    // pcoinsTip for a transaction that fails are uncached again right away,
+    // like AcceptToMemoryPool does for rejected transactions.
+    //
+    // A transaction spending outputs of earlier transactions of the batch
+    // can't pass those checks before its parents are in the mempool. Its
+    // scripts are checked against their outputs all the same, and the other
+    // checks are left to AcceptToMemoryPool.
+    const CChainParams& chainparams = Params();
+    std::map<uint256, CTransactionRef> mapBatchTx;
+    {
+        LOCK2(cs_main, mempool.cs);
+        int64_t nNow = GetTime();
+        for (size_t i = 0; i < vtx.size(); i++) {
+            MemPoolAcceptRef ws = std::make_shared<MemPoolAccept>(vtx[i]);
+            const int64_t nAcceptTime = vAcceptTime.empty() ? nNow : vAcceptTime[i];
+            CValidationState state;
+            bool fMissingInputs = false;
+            if (!MemPoolPreChecks(chainparams, mempool, state, *ws, true, &fMissingInputs, nAcceptTime, nAbsurdFee, ws->coins_pulled_in)) {
+                if (!fMissingInputs || mapBatchTx.empty() || !MemPoolLoadBatchCoins(mempool, *ws, mapBatchTx)) {
+                    for (const COutPoint& outpoint : ws->coins_pulled_in)
+                        pcoinsTip->Uncache(outpoint);
+                    continue;
+                }
+                MemPoolSetScriptFlags(chainparams, *ws);
+                ws->fLimitFree = true;
+                ws->nAcceptTime = nAcceptTime;
+                ws->nAbsurdFee = nAbsurdFee;
+                ws->hashTip = chainActive.Tip()->GetBlockHash();
+            }
+            mapBatchTx.emplace(ws->hash, ws->ptx);
+            vAccept[i] = std::move(ws);
+        }
+    }
+
+    // The inputs of all transactions go onto the queue together, so that
+    // many small transactions spread over the threads as well as a few
+    // large ones. The results end up in vAccept, and AcceptToMemoryPool does
+    // not run the scripts again.
+    std::vector<CMemPoolScriptCheck> vChecks;
+    for (const MemPoolAcceptRef& ws : vAccept) {
+        if (ws)
+            MemPoolQueueScriptChecks(*ws, vChecks);
+    }
+    if (!vChecks.empty()) {
+        CCheckQueueControl<CMemPoolScriptCheck> control(&mempoolscriptcheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+    for (const MemPoolAcceptRef& ws : vAccept) {
+        if (ws)
+            MemPoolFinishScriptChecks(*ws);
+    }
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1686,14 +2147,65 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+/**
+ * Run the script checks of one transaction on this thread, recording each of
+ * them in profile. The spent coins must still be in view. Transactions found
+ * in the script execution cache are counted as cache hits and verified all
+ * the same, so that the profile covers every input. The signature and script
+ * execution caches are only read: nothing is added to them, and unlike block
+ * connection, the entries that are found are not removed either.
+ */
+static bool RunProfiledScriptChecks(const CTransaction& tx, const CCoinsViewCache& view, unsigned int flags, PrecomputedTransactionData& txdata, CValidationState& state, CBlockProfile& profile)
+{
+    if (scriptExecutionCache.contains(GetScriptExecutionCacheEntry(tx, flags), false))
+        profile.nScriptCacheHits++;
+    std::vector<CScriptCheck> vChecks;
+    vChecks.reserve(tx.vin.size());
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const Coin& coin = view.AccessCoin(tx.vin[i].prevout);
+        vChecks.emplace_back(coin.out.scriptPubKey, coin.out.nValue, tx, i, flags, false, &txdata, false);
+    }
+    std::vector<std::vector<unsigned char> > vSolutions;
+    for (size_t i = 0; i < vChecks.size(); i++) {
+        ScriptProfile script;
+        vChecks[i].SetProfile(&script);
+        int64_t nTimeStart = GetTimeMicros();
+        bool fOk = vChecks[i]();
+        int64_t nTime = GetTimeMicros() - nTimeStart;
+        if (!fOk)
+            return state.DoS(100, false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(vChecks[i].GetScriptError())));
+
+        CInputProfile input;
+        input.txid = tx.GetHash();
+        input.nIn = i;
+        if (!Solver(view.AccessCoin(tx.vin[i].prevout).out.scriptPubKey, input.type, vSolutions))
+            input.type = TX_NONSTANDARD;
+        input.nTimeMicros = nTime;
+        input.nSigChecks = script.nSigChecks;
+        input.nSigCacheHits = script.nSigCacheHits;
+        input.nSighashBytes = script.nSighashBytes;
+        input.fFastPath = script.fFastPath;
+        profile.vInputs.push_back(input);
+
+        for (int op = 0; op < 256; op++)
+            profile.total.nOpcodes[op] += script.nOpcodes[op];
+        profile.total.nSigChecks += script.nSigChecks;
+        profile.total.nSigCacheHits += script.nSigCacheHits;
+        profile.total.nSighashBytes += script.nSighashBytes;
+    }
+    return true;
+}
+
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  With pprofile, fJustCheck must be set. */
 static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, CBlockProfile* pprofile = nullptr)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
+    assert(!pprofile || fJustCheck);
     // pindex->phashBlock can be null if called by CreateNewBlock/TestBlockValidity
     assert((pindex->phashBlock == nullptr) ||
            (*pindex->phashBlock == block.GetHash()));
@@ -1716,7 +2228,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     }
 
     bool fScriptChecks = true;
-    if (!hashAssumeValid.IsNull()) {
+    if (!hashAssumeValid.IsNull() && !pprofile) {
         // We've been configured with the hash of a block which has been externally verified to have a valid history.
         // A suitable default value is included with the software and updated from time to time.  Because validity
         //  relative to a piece of software is an objective fact these defaults can be easily reviewed.
@@ -1795,7 +2307,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads && !pprofile ? &scriptcheckqueue : nullptr);
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
@@ -1807,6 +2319,22 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+
+    // Load all inputs that are not created by this block itself into the
+    // view up front, so that cache misses reach the database as one batch.
+    {
+        std::set<uint256> setBlockTxids;
+        std::vector<COutPoint> vPrevouts;
+        for (const auto& ptx : block.vtx) {
+            setBlockTxids.insert(ptx->GetHash());
+            if (ptx->IsCoinBase()) continue;
+            for (const CTxIn& txin : ptx->vin) {
+                if (!setBlockTxids.count(txin.prevout.hash)) vPrevouts.push_back(txin.prevout);
+            }
+        }
+        view.Prefetch(vPrevouts);
+    }
+
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
@@ -1849,9 +2377,15 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr))
+            // Profiling runs the scripts itself, with read-only cache lookups
+            if (!CheckInputs(tx, state, view, fScriptChecks && !pprofile, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
+            if (pprofile) {
+                if (!RunProfiledScriptChecks(tx, view, flags, txdata[i], state, *pprofile))
+                    return error("ConnectBlock(): script check on %s failed with %s",
+                        tx.GetHash().ToString(), FormatStateMessage(state));
+            }
             control.Add(vChecks);
         }
 
@@ -1879,6 +2413,11 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime4 - nTime2), nInputs <= 1 ? 0 : 0.001 * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * 0.000001);
 
+    if (pprofile) {
+        pprofile->nSigOpsCost = nSigOpsCost;
+        pprofile->nTimeConnect = nTime4 - nTimeStart;
+    }
+
     if (fJustCheck)
         return true;
 
@@ -2014,6 +2553,9 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // overwrite one. Still, use a conservative safety factor of 2.
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
+            // During initial sync flushes are large and mostly inserts; have
+            // the database write them in key order.
+            pcoinsdbview->SetBulkWriteMode(IsInitialBlockDownload());
             // Flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
@@ -2130,7 +2672,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
     {
-        CCoinsViewCache view(pcoinsTip);
+        CCoinsViewCache view(pcoinsTip, &g_block_view_stats);
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
         if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
@@ -2260,7 +2802,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
-        CCoinsViewCache view(pcoinsTip);
+        CCoinsViewCache view(pcoinsTip, &g_block_view_stats);
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
@@ -2280,6 +2822,9 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
     LogPrint(BCLog::BENCH, "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
+    LogPrint(BCLog::BENCH, "  - Coins cache: %u entries, %.2fMiB, hit rate %.2f%% (tip) %.2f%% (block views)\n",
+        pcoinsTip->GetCacheSize(), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)),
+        100.0 * pcoinsTip->GetStats().HitRate(), 100.0 * g_block_view_stats.HitRate());
     // Remove conflicting transactions from the mempool.;
     mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
     disconnectpool.removeForBlock(blockConnecting.vtx);
@@ -2841,7 +3386,7 @@ static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, const BlockMerkleRoots* pmerkleroots)
 {
     // These are checks that are independent of context.
 
@@ -2855,8 +3400,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Check the merkle root.
     if (fCheckMerkleRoot) {
-        bool mutated;
-        uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
+        bool mutated = pmerkleroots ? pmerkleroots->fMutated : false;
+        uint256 hashMerkleRoot2 = pmerkleroots ? pmerkleroots->hashMerkleRoot : BlockMerkleRoot(block, &mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, false, REJECT_INVALID, "bad-txnmrklroot", true, "hashMerkleRoot mismatch");
 
@@ -3016,7 +3561,7 @@ static bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationSta
     return true;
 }
 
-static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
+static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev, const BlockMerkleRoots* pmerkleroots = nullptr)
 {
     const int nHeight = pindexPrev == nullptr ? 0 : pindexPrev->nHeight + 1;
 
@@ -3098,7 +3643,7 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
         int commitpos = GetWitnessCommitmentIndex(block);
         if (commitpos != -1) {
             bool malleated = false;
-            uint256 hashWitness = BlockWitnessMerkleRoot(block, &malleated);
+            uint256 hashWitness = pmerkleroots ? pmerkleroots->hashWitnessMerkleRoot : BlockWitnessMerkleRoot(block, &malleated);
             // The malleation check is ignored; as the transaction tree itself
             // already does not permit it, it is impossible to trigger in the
             // witness tree.
@@ -3199,7 +3744,7 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidatio
 }
 
 /** Store block on disk. If dbp is non-nullptr, the file is known to already reside on disk */
-static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, const BlockMerkleRoots* pmerkleroots = nullptr)
 {
     const CBlock& block = *pblock;
 
@@ -3239,8 +3784,8 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     }
     if (fNewBlock) *fNewBlock = true;
 
-    if (!CheckBlock(block, state, chainparams.GetConsensus()) ||
-        !ContextualCheckBlock(block, state, chainparams.GetConsensus(), pindex->pprev)) {
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), true, true, pmerkleroots) ||
+        !ContextualCheckBlock(block, state, chainparams.GetConsensus(), pindex->pprev, pmerkleroots)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -3278,7 +3823,7 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     return true;
 }
 
-bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, bool *fNewBlock)
+bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, bool *fNewBlock, const BlockMerkleRoots* pmerkleroots)
 {
     {
         CBlockIndex *pindex = nullptr;
@@ -3286,13 +3831,13 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
         CValidationState state;
         // Ensure that CheckBlock() passes before calling AcceptBlock, as
         // belt-and-suspenders.
-        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
+        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus(), true, true, pmerkleroots);
 
         LOCK(cs_main);
 
         if (ret) {
             // Store to disk
-            ret = AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, nullptr, fNewBlock);
+            ret = AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, nullptr, fNewBlock, pmerkleroots);
         }
         CheckBlockIndex(chainparams.GetConsensus());
         if (!ret) {
@@ -3310,7 +3855,7 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
     return true;
 }
 
-bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
+bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot, CBlockProfile* pprofile)
 {
     AssertLockHeld(cs_main);
     assert(pindexPrev && pindexPrev == chainActive.Tip());
@@ -3326,13 +3871,39 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
     if (!ContextualCheckBlock(block, state, chainparams.GetConsensus(), pindexPrev))
         return error("%s: Consensus::ContextualCheckBlock: %s", __func__, FormatStateMessage(state));
-    if (!ConnectBlock(block, state, &indexDummy, viewNew, chainparams, true))
+    if (!ConnectBlock(block, state, &indexDummy, viewNew, chainparams, true, pprofile))
         return false;
     assert(state.IsValid());
 
     return true;
 }
 
+bool ProfileBlock(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindex, CBlockProfile& profile)
+{
+    AssertLockHeld(cs_main);
+    if (pindex->pprev && pindex->pprev == chainActive.Tip())
+        return TestBlockValidity(state, chainparams, block, pindex->pprev, true, true, &profile);
+    if (!pindex->pprev)
+        return state.Error("the genesis block has no scripts to validate");
+    if (!chainActive.Contains(pindex))
+        return state.Error("block is neither in the active chain nor a child of its tip");
+    if (chainActive.Height() - pindex->nHeight >= (int)MIN_BLOCKS_TO_KEEP)
+        return state.Error("block is too deep in the active chain");
+
+    // Rewind a copy of the UTXO set to the state the block was connected on.
+    // cs_main stays held while the blocks above it are read and disconnected,
+    // which the depth check above bounds to MIN_BLOCKS_TO_KEEP blocks.
+    CCoinsViewCache view(pcoinsTip);
+    for (CBlockIndex* pindexDisconnect = chainActive.Tip(); pindexDisconnect != pindex->pprev; pindexDisconnect = pindexDisconnect->pprev) {
+        CBlock blockDisconnect;
+        if (!ReadBlockFromDisk(blockDisconnect, pindexDisconnect, chainparams.GetConsensus()))
+            return state.Error(strprintf("failed to read block %s", pindexDisconnect->GetBlockHash().ToString()));
+        if (DisconnectBlock(blockDisconnect, pindexDisconnect, view) != DISCONNECT_OK)
+            return state.Error(strprintf("failed to disconnect block %s", pindexDisconnect->GetBlockHash().ToString()));
+    }
+    return ConnectBlock(block, state, pindex, view, chainparams, true, &profile);
+}
+
 /**
  * BLOCK PRUNING CODE
  */
@@ -4373,6 +4944,10 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
     return VersionBitsStateSinceHeight(chainActive.Tip(), params, pos, versionbitscache);
 }
 
+/**
+ * The dump ends in a hash of everything before it. Loaders that predate the
+ * hash stop reading before it, and dumps written by them are loaded unverified.
+ */
 static const uint64_t MEMPOOL_DUMP_VERSION = 1;
 
 bool LoadMempool(void)
@@ -4390,44 +4965,82 @@ bool LoadMempool(void)
     int64_t skipped = 0;
     int64_t failed = 0;
     int64_t nNow = GetTime();
+    int64_t nTimeStart = GetTimeMicros();
 
     try {
+        CHashVerifier<CAutoFile> verifier(&file);
         uint64_t version;
-        file >> version;
+        verifier >> version;
         if (version != MEMPOOL_DUMP_VERSION) {
             return false;
         }
+        // Read the whole dump and check its hash before accepting any of it.
         uint64_t num;
-        file >> num;
-        while (num--) {
+        verifier >> num;
+        std::vector<CTransactionRef> vtxAll;
+        std::vector<int64_t> vTimeAll;
+        std::vector<std::pair<uint256, CAmount>> vTxDeltas;
+        for (; num; num--) {
             CTransactionRef tx;
             int64_t nTime;
             int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
+            verifier >> tx;
+            verifier >> nTime;
+            verifier >> nFeeDelta;
 
             CAmount amountdelta = nFeeDelta;
             if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+                vTxDeltas.emplace_back(tx->GetHash(), amountdelta);
             }
-            CValidationState state;
             if (nTime + nExpiryTimeout > nNow) {
+                vtxAll.push_back(std::move(tx));
+                vTimeAll.push_back(nTime);
+            } else {
+                ++skipped;
+            }
+        }
+        std::map<uint256, CAmount> mapDeltas;
+        verifier >> mapDeltas;
+
+        uint256 hashFile;
+        size_t nHashRead = fread(hashFile.begin(), 1, sizeof(uint256), file.Get());
+        if (nHashRead != 0 || !feof(file.Get())) {
+            if (nHashRead != sizeof(uint256) || verifier.GetHash() != hashFile) {
+                LogPrintf("Mempool file on disk is corrupt. Continuing anyway.\n");
+                return false;
+            }
+        }
+
+        for (const auto& i : vTxDeltas) {
+            mempool.PrioritiseTransaction(i.first, i.second);
+        }
+
+        // Accept the transactions in batches, so that the scripts of each
+        // batch can be verified in parallel before they are accepted one by
+        // one. Transactions spending outputs of earlier ones of their batch
+        // are verified against those outputs, and their other checks are
+        // done when they are accepted after their parents.
+        static const size_t LOAD_BATCH_SIZE = 1000;
+        for (size_t nBatchStart = 0; nBatchStart < vtxAll.size(); nBatchStart += LOAD_BATCH_SIZE) {
+            size_t nBatchEnd = std::min(nBatchStart + LOAD_BATCH_SIZE, vtxAll.size());
+            std::vector<CTransactionRef> vtx(vtxAll.begin() + nBatchStart, vtxAll.begin() + nBatchEnd);
+            std::vector<int64_t> vTime(vTimeAll.begin() + nBatchStart, vTimeAll.begin() + nBatchEnd);
+
+            std::vector<MemPoolAcceptRef> vAccept;
+            PreVerifyTransactionScripts(vtx, vAccept, 0, vTime);
+            for (size_t i = 0; i < vtx.size(); i++) {
+                CValidationState state;
                 LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, true, nullptr, nTime, nullptr, false, 0);
+                AcceptToMemoryPoolWithTime(chainparams, mempool, state, vtx[i], true, nullptr, vTime[i], nullptr, false, 0, vAccept[i].get());
                 if (state.IsValid()) {
                     ++count;
                 } else {
                     ++failed;
                 }
-            } else {
-                ++skipped;
             }
             if (ShutdownRequested())
                 return false;
         }
-        std::map<uint256, CAmount> mapDeltas;
-        file >> mapDeltas;
 
         for (const auto& i : mapDeltas) {
             mempool.PrioritiseTransaction(i.first, i.second);
@@ -4437,7 +5050,8 @@ bool LoadMempool(void)
         return false;
     }
 
-    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", count, failed, skipped);
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired (%.2fs)\n", count, failed, skipped,
+              0.000001 * (GetTimeMicros() - nTimeStart));
     return true;
 }
 
@@ -4465,19 +5079,21 @@ void DumpMempool(void)
         }
 
         CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        CHashedWriter<CAutoFile> writer(&file);
 
         uint64_t version = MEMPOOL_DUMP_VERSION;
-        file << version;
+        writer << version;
 
-        file << (uint64_t)vinfo.size();
+        writer << (uint64_t)vinfo.size();
         for (const auto& i : vinfo) {
-            file << *(i.tx);
-            file << (int64_t)i.nTime;
-            file << (int64_t)i.nFeeDelta;
+            writer << *(i.tx);
+            writer << (int64_t)i.nTime;
+            writer << (int64_t)i.nFeeDelta;
             mapDeltas.erase(i.tx->GetHash());
         }
 
-        file << mapDeltas;
+        writer << mapDeltas;
+        file << writer.GetHash();
         FileCommit(file.Get());
         file.fclose();
         RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
@@ -16,12 +16,14 @@
 #include "protocol.h" // For CMessageHeader::MessageStartChars
 #include "policy/feerate.h"
 #include "script/script_error.h"
+#include "script/standard.h"
 #include "sync.h"
 #include "versionbits.h"
 
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -40,11 +42,16 @@ class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
+struct BlockMerkleRoots;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
 struct LockPoints;
 
+namespace CuckooCache {
+struct cache_stats;
+}
+
 /** Default for DEFAULT_WHITELISTRELAY. */
 static const bool DEFAULT_WHITELISTRELAY = true;
 /** Default for DEFAULT_WHITELISTFORCERELAY. */
@@ -65,6 +72,8 @@ static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
 static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -limitclustercount, max number of transactions in a mempool cluster with -clustermempool */
+static const unsigned int DEFAULT_CLUSTER_LIMIT = 64;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 336;
 /** Maximum kilobytes for transactions to store for processing during reorg */
@@ -80,6 +89,8 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** -parmempool default (number of threads checking the scripts of relayed transactions, 0 = none) */
+static const int DEFAULT_MEMPOOL_SCRIPTCHECK_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -133,6 +144,8 @@ static const bool DEFAULT_TXINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -clustermempool */
+static const bool DEFAULT_CLUSTER_MEMPOOL = false;
 /** Default for -mempoolreplacement */
 static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
@@ -169,6 +182,7 @@ extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nMempoolScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
@@ -234,7 +248,7 @@ static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
  * @param[out]  fNewBlock A boolean which is set to indicate if the block was first received via this call
  * @return True if state.IsValid()
  */
-bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, bool* fNewBlock);
+bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, bool* fNewBlock, const BlockMerkleRoots* pmerkleroots = nullptr);
 
 /**
  * Process incoming block headers.
@@ -267,6 +281,8 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread checking the scripts of transactions on their way into the mempool */
+void ThreadMempoolScriptCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -300,11 +316,36 @@ void PruneAndFlush();
 /** Prune block files up to a given height */
 void PruneBlockFilesManual(int nManualPruneHeight);
 
+/** The checks of a transaction done ahead of AcceptToMemoryPool by PreVerifyTransactionScripts */
+struct MemPoolAccept;
+typedef std::shared_ptr<MemPoolAccept> MemPoolAcceptRef;
+
+/**
+ * Run the checks of AcceptToMemoryPool for transactions that are about to be
+ * passed to it, verifying their scripts on the mempool script check threads
+ * without holding cs_main while they run. The checks before the scripts are
+ * done under cs_main first, and only transactions that pass them have their
+ * scripts verified. Transactions spending outputs of earlier ones in vtx
+ * have their scripts verified against those outputs, and the checks before
+ * the scripts are left to AcceptToMemoryPool. vAccept gets one entry per
+ * transaction, nullptr for those that failed the checks before the scripts
+ * (whose coins pulled into the tip cache are uncached right away); the others
+ * must be passed on to AcceptToMemoryPool, which then only re-checks what may
+ * have changed in the meantime, rejects the transaction right away if its
+ * scripts failed, and uncaches the coins pulled in for it if it is not
+ * accepted. vAcceptTime holds the acceptance time of each transaction, or is
+ * empty to use the current time. Must be called without cs_main held.
+ */
+void PreVerifyTransactionScripts(const std::vector<CTransactionRef>& vtx, std::vector<MemPoolAcceptRef>& vAccept, const CAmount nAbsurdFee=0,
+                                 const std::vector<int64_t>& vAcceptTime = std::vector<int64_t>());
+
 /** (try to) add transaction to memory pool
- * plTxnReplaced will be appended to with all transactions replaced from mempool **/
+ * plTxnReplaced will be appended to with all transactions replaced from mempool
+ * preverified is the result of PreVerifyTransactionScripts for the transaction, if any **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced = nullptr,
-                        bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
+                        bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0,
+                        const MemPoolAcceptRef& preverified = nullptr);
 
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
@@ -364,14 +405,17 @@ private:
     unsigned int nIn;
     unsigned int nFlags;
     bool cacheStore;
+    bool cacheErase;
     ScriptError error;
     PrecomputedTransactionData *txdata;
+    ScriptProfile *profile;
 
 public:
-    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CScript& scriptPubKeyIn, const CAmount amountIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), cacheErase(true), error(SCRIPT_ERR_UNKNOWN_ERROR), profile(nullptr) {}
+    //! cacheEraseIn = false looks signatures up without removing them when cacheIn is false.
+    CScriptCheck(const CScript& scriptPubKeyIn, const CAmount amountIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn, bool cacheEraseIn = true) :
         scriptPubKey(scriptPubKeyIn), amount(amountIn),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), cacheErase(cacheEraseIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn), profile(nullptr) { }
 
     bool operator()();
 
@@ -382,16 +426,60 @@ public:
         std::swap(nIn, check.nIn);
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
+        std::swap(cacheErase, check.cacheErase);
         std::swap(error, check.error);
         std::swap(txdata, check.txdata);
+        std::swap(profile, check.profile);
     }
 
     ScriptError GetScriptError() const { return error; }
+
+    //! Collect opcode and signature counters into profileIn when run.
+    void SetProfile(ScriptProfile* profileIn) { profile = profileIn; }
+};
+
+/** Script verification measurements for one input, see CBlockProfile. */
+struct CInputProfile
+{
+    uint256 txid;
+    unsigned int nIn;
+    //! Template of the spent output.
+    txnouttype type;
+    //! Time spent in VerifyScript, in microseconds.
+    int64_t nTimeMicros;
+    unsigned int nSigChecks;
+    unsigned int nSigCacheHits;
+    uint64_t nSighashBytes;
+    bool fFastPath;
+};
+
+/**
+ * Script validation profile of one block. Passing one to TestBlockValidity
+ * or ProfileBlock makes ConnectBlock run the script checks of the block one
+ * by one on the calling thread, timing each of them. The signature and script
+ * execution caches are only read: no entries are added or removed.
+ */
+struct CBlockProfile
+{
+    std::vector<CInputProfile> vInputs;
+    //! Counters summed over all inputs of the block.
+    ScriptProfile total;
+    //! Transactions found in the script execution cache. Their inputs are
+    //! verified and profiled anyway.
+    unsigned int nScriptCacheHits;
+    int64_t nSigOpsCost;
+    //! Time spent in ConnectBlock, in microseconds.
+    int64_t nTimeConnect;
+
+    CBlockProfile() : nScriptCacheHits(0), nSigOpsCost(0), nTimeConnect(0) {}
 };
 
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
 
+/** Return the script execution cache hit counters, and zero them if fReset is set. */
+CuckooCache::cache_stats GetScriptExecutionCacheStats(bool fReset = false);
+
 
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
@@ -399,11 +487,21 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 
 /** Functions for validating blocks and updating the block tree */
 
-/** Context-independent validity checks */
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/** Context-independent validity checks. pmerkleroots, if given, are the merkle roots computed while decoding the block. */
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true, const BlockMerkleRoots* pmerkleroots = nullptr);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
-bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true, CBlockProfile* pprofile = nullptr);
+
+/**
+ * Validate a block of the active chain, or a child of its tip, again while
+ * profiling its script checks. Blocks of the active chain are checked
+ * against a copy of the UTXO set with the blocks above them disconnected,
+ * so they may be at most MIN_BLOCKS_TO_KEEP blocks deep. Requires cs_main,
+ * which is held for the whole call, including reading and disconnecting up
+ * to MIN_BLOCKS_TO_KEEP blocks from disk.
+ */
+bool ProfileBlock(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindex, CBlockProfile& profile);
 
 /** Check whether witness commitments are required for block. */
 bool IsWitnessEnabled(const CBlockIndex* pindexPrev, const Consensus::Params& params);
@@ -449,6 +547,12 @@ extern CCoinsViewDB *pcoinsdbview;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Usage counters shared by the temporary caches used to connect/disconnect blocks */
+extern CCoinsCacheStats g_block_view_stats;
+
+/** Usage counters shared by the temporary caches used for mempool acceptance */
+extern CCoinsCacheStats g_mempool_view_stats;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -6,6 +6,9 @@
 
 Test the following RPCs:
     - gettxoutsetinfo
+    - getcoinscacheinfo
+    - getsigcacheinfo
+    - profileblock
     - getdifficulty
     - getbestblockhash
     - getblockhash
@@ -42,6 +45,9 @@ class BlockchainTest(BitcoinTestFramework):
     def run_test(self):
         self._test_getchaintxstats()
         self._test_gettxoutsetinfo()
+        self._test_getcoinscacheinfo()
+        self._test_getsigcacheinfo()
+        self._test_profileblock()
         self._test_getblockheader()
         self._test_getdifficulty()
         self._test_getnetworkhashps()
@@ -97,6 +103,79 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res['bestblock'], res3['bestblock'])
         assert_equal(res['hash_serialized_2'], res3['hash_serialized_2'])
 
+        self.log.info("Test that the rolling muhash agrees with a full parallel scan")
+        res4 = node.gettxoutsetinfo("muhash")
+        assert_equal(res4['height'], res['height'])
+        assert_equal(res4['txouts'], res['txouts'])
+        assert_equal(res4['bogosize'], res['bogosize'])
+        assert_equal(res4['total_amount'], res['total_amount'])
+        assert_equal(len(res4['muhash']), 64)
+        res5 = node.gettxoutsetinfo("muhash", True)
+        assert_equal(res4['muhash'], res5['muhash'])
+        assert_raises_jsonrpc(-8, "full_scan", node.gettxoutsetinfo, "hash_serialized_2", True)
+
+    def _test_getcoinscacheinfo(self):
+        node = self.nodes[0]
+        info = node.getcoinscacheinfo()
+        tip = info['tip']
+        assert tip['usage'] <= tip['maxusage']
+        assert tip['hits'] + tip['misses'] > 0
+        assert abs(tip['hitrate'] - Decimal(tip['hits']) / (tip['hits'] + tip['misses'])) < Decimal('0.0001')
+        assert info['blockviews']['added'] > 0
+
+        self.log.info("Test that getcoinscacheinfo(true) resets the counters")
+        node.getcoinscacheinfo(True)
+        info = node.getcoinscacheinfo()
+        assert_equal(info['blockviews']['added'], 0)
+        assert_equal(info['mempoolviews']['hits'], 0)
+
+    def _test_getsigcacheinfo(self):
+        node = self.nodes[0]
+        info = node.getsigcacheinfo()
+        for cache in ('signatures', 'scripts'):
+            stats = info[cache]
+            if stats['hits'] + stats['misses'] > 0:
+                assert abs(stats['hitrate'] - Decimal(stats['hits']) / (stats['hits'] + stats['misses'])) < Decimal('0.0001')
+
+        self.log.info("Test that getsigcacheinfo(true) resets the counters")
+        node.getsigcacheinfo(True)
+        info = node.getsigcacheinfo()
+        assert_equal(info['signatures']['hits'] + info['signatures']['misses'], 0)
+        assert_equal(info['scripts']['inserts'], 0)
+
+    def _test_profileblock(self):
+        node = self.nodes[0]
+        besthash = node.getbestblockhash()
+        profile = node.profileblock(besthash, True)
+        assert_equal(profile['hash'], besthash)
+        assert_equal(profile['height'], 200)
+        assert_equal(profile['txs'], 1)
+        # Only a coinbase, so no scripts to verify
+        assert_equal(profile['inputs'], 0)
+        assert_equal(profile['vin'], [])
+        assert 'vin' not in node.profileblock(node.getblockhash(150))
+        # Profiling never adds to the signature or script caches
+        node.getsigcacheinfo(True)
+        node.profileblock(node.getblockhash(190))
+        info = node.getsigcacheinfo()
+        assert_equal(info['signatures']['inserts'] + info['scripts']['inserts'], 0)
+
+        assert_raises_jsonrpc(-5, "Block not found", node.profileblock, "nonsense")
+        assert_raises_jsonrpc(-25, "genesis", node.profileblock, node.getblockhash(0))
+
+        # Profiling doesn't evict cache entries either. Invalidating a block
+        # returns its transaction to the mempool, which caches its scripts and
+        # signatures again, and leaves the block a child of the tip.
+        node.sendtoaddress(node.getnewaddress(), 1)
+        blockhash = node.generate(1)[0]
+        node.invalidateblock(blockhash)
+        assert_equal(node.getbestblockhash(), besthash)
+        for _ in range(2):
+            profile = node.profileblock(blockhash)
+            assert_equal(profile['scriptcachehits'], 1)
+            assert_equal(profile['sigcachehits'], profile['sigchecks'])
+            assert profile['sigchecks'] > 0
+
     def _test_getblockheader(self):
         node = self.nodes[0]
 